@@ -0,0 +1,105 @@
+/*
+ * Group Centric Networking
+ *
+ * Copyright (C) 2015 Massachusetts Institute of Technology
+ * All rights reserved.
+ *
+ * Authors:
+ *           Patricia Deutsch         <patricia.deutsch@ll.mit.edu>
+ *           Gregory Kuperman         <gkuperman@ll.mit.edu>
+ *           Leonid Veytser           <veytser@ll.mit.edu>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "BloomFilter.h"
+
+
+//************************************************************************
+// bit i of the k bits for gid. The two hashes are integer mixers so
+// neighboring group ids land far apart
+uint32_t BloomFilter::bitIndex(uint32_t gid, uint32_t i) const
+{
+	uint32_t h1 = gid * 0x9E3779B1;
+	h1 ^= h1 >> 16;
+	
+	uint32_t h2 = gid;
+	h2 = ((h2 >> 16) ^ h2) * 0x45D9F3B;
+	h2 = ((h2 >> 16) ^ h2) * 0x45D9F3B;
+	h2 = (h2 >> 16) ^ h2;
+	h2 |= 1;
+	
+	return( (h1 + i * h2) % (mBits.size() * 8) );
+}
+
+//************************************************************************
+void BloomFilter::insert(uint32_t gid)
+{
+	if (mBits.empty())
+	{
+		return;
+	}
+	for (uint32_t i = 0; i < mHashes; i++)
+	{
+		uint32_t bit = bitIndex(gid, i);
+		mBits[bit / 8] |= (1 << (bit % 8));
+	}
+}
+
+//************************************************************************
+bool BloomFilter::contains(uint32_t gid) const
+{
+	if (mBits.empty())
+	{
+		return(false);
+	}
+	for (uint32_t i = 0; i < mHashes; i++)
+	{
+		uint32_t bit = bitIndex(gid, i);
+		if ( !(mBits[bit / 8] & (1 << (bit % 8))) )
+		{
+			return(false);
+		}
+	}
+	return(true);
+}
+
+//************************************************************************
+void BloomFilter::merge(const BloomFilter & other)
+{
+	if (other.mBits.size() != mBits.size())
+	{
+		return;
+	}
+	for (size_t i = 0; i < mBits.size(); i++)
+	{
+		mBits[i] |= other.mBits[i];
+	}
+}
+
+//************************************************************************
+bool BloomFilter::load(const string & bits, uint32_t hashes)
+{
+	if ( (bits.size() != mBits.size()) || (hashes == 0) )
+	{
+		return(false);
+	}
+	mBits = bits;
+	mHashes = hashes;
+	return(true);
+}
@@ -0,0 +1,79 @@
+/*
+ * Group Centric Networking
+ *
+ * Copyright (C) 2015 Massachusetts Institute of Technology
+ * All rights reserved.
+ *
+ * Authors:
+ *           Patricia Deutsch         <patricia.deutsch@ll.mit.edu>
+ *           Gregory Kuperman         <gkuperman@ll.mit.edu>
+ *           Leonid Veytser           <veytser@ll.mit.edu>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef BLOOM_FILTER_H
+#define BLOOM_FILTER_H
+
+#include <stdint.h>
+#include <string>
+
+using std::string;
+
+// Bloom filter of group ids.
+//
+// Used for the group summary beacons. A node sends one filter of the
+// groups it sources or subscribes to, plus the filters of the groups
+// its neighbors reach, so a source can tell that nobody nearby cares
+// about a group without running discovery for it. A filter has no false
+// negatives, only false positives, which just mean discovery runs when
+// it did not have to.
+//
+// The bits are kept as the bytes sent over the air. Group ids are
+// mapped to bit positions by double hashing.
+
+class BloomFilter
+{
+	public:
+		BloomFilter() : mHashes(1) {}
+		BloomFilter(uint32_t bits, uint32_t hashes) : mBits((bits + 7) / 8, 0), mHashes(hashes ? hashes : 1) {}
+		
+		void insert(uint32_t gid);
+		bool contains(uint32_t gid) const;
+		
+		// Add everything in other (same size) to this filter
+		void merge(const BloomFilter & other);
+		
+		void clear() { mBits.assign(mBits.size(), 0); }
+		bool empty() const { return(mBits.find_first_not_of('\0') == string::npos); }
+		
+		// Bytes sent over the air
+		const string & bits() const { return(mBits); }
+		uint32_t hashes() const { return(mHashes); }
+		
+		// Returns false if the bytes are not a filter of the expected size
+		bool load(const string & bits, uint32_t hashes);
+		
+	private:
+		uint32_t bitIndex(uint32_t gid, uint32_t i) const;
+		
+		string		mBits;
+		uint32_t	mHashes;
+};
+
+#endif //BLOOM_FILTER_H
@@ -27,6 +27,7 @@
 */
 
 #include "Common.h"
+#include <sys/mman.h>
 
 mutex gLogMutex;
 
@@ -36,6 +37,11 @@ TimeDuration getTime()
 	return(system_clock::now().time_since_epoch()); 
 }
 
+double getTimeSec()
+{
+	return((double)duration_cast<microseconds>(getTime()).count() / 1000000.0);
+}
+
 
 void writelog(LogLevel level, LogLevel myLevel, NodeId mId, string file, int line, string funcName, const char * fmt, ...)
 {
@@ -78,11 +84,394 @@ void writelog(LogLevel level, LogLevel myLevel, NodeId mId, string file, int lin
 }
 
 
+//************************************************************************
+boost::asio::mutable_buffers_1 FrameReader::space()
+{
+	// Everything handed out is done with. Move what is left of a message
+	// to the front once there is no longer room for a whole one after it
+	if (mStart == mEnd)
+	{
+		mStart = mEnd = 0;
+	}
+	else if (mBuffer.size() - mEnd < MAX_BUFFER_SIZE)
+	{
+		memmove(mBuffer.data(), mBuffer.data() + mStart, mEnd - mStart);
+		mEnd -= mStart;
+		mStart = 0;
+	}
+	return(buffer(mBuffer.data() + mEnd, mBuffer.size() - mEnd));
+}
+
+//************************************************************************
+FrameStatus FrameReader::next(char* & pMessage, uint32_t & length)
+{
+	if (mEnd - mStart < sizeof(uint32_t))
+	{
+		return(FRAME_NONE);
+	}
+	
+	uint32_t size;
+	memcpy(&size, mBuffer.data() + mStart, sizeof(uint32_t));
+	length = ntohl(size);
+	if (length > MAX_BUFFER_SIZE - sizeof(uint32_t))
+	{
+		mStart += sizeof(uint32_t);
+		return(FRAME_BAD);
+	}
+	
+	if (mEnd - mStart < sizeof(uint32_t) + length)
+	{
+		return(FRAME_NONE);
+	}
+	pMessage = mBuffer.data() + mStart + sizeof(uint32_t);
+	mStart += sizeof(uint32_t) + length;
+	mFrames++;
+	return(FRAME_OK);
+}
+
+
+//************************************************************************
+BufferPool & BufferPool::instance()
+{
+	// Never destroyed so BufferPtrs held by other statics can still be released at exit.
+	// (Made in memory aligned for its cache line aligned members)
+	static BufferPool* pPool = []()
+	{
+		void* pMemory = NULL;
+		if (posix_memalign(&pMemory, 64, sizeof(BufferPool)) != 0)
+		{
+			throw std::bad_alloc();
+		}
+		return(new (pMemory) BufferPool);
+	}();
+	return(*pPool);
+}
+
+//************************************************************************
+// Registers a thread's counts with the pool for as long as the thread runs
+class BufferPool::ThreadCountsHolder
+{
+ public:
+	ThreadCountsHolder()
+	{
+		for (auto & count : counts.gets)
+		{
+			count.store(0, std::memory_order_relaxed);
+		}
+		for (auto & count : counts.puts)
+		{
+			count.store(0, std::memory_order_relaxed);
+		}
+		BufferPool & pool = instance();
+		lock_guard<mutex> lock(pool.mCountsMutex);
+		pool.mThreadCounts.insert(&counts);
+	}
+	
+	~ThreadCountsHolder()
+	{
+		BufferPool & pool = instance();
+		lock_guard<mutex> lock(pool.mCountsMutex);
+		for (int c = 0; c <= BUFFER_CLASS_MAX; c++)
+		{
+			pool.mExitedGets[c] += counts.gets[c].load(std::memory_order_relaxed);
+		}
+		for (int c = 0; c < BUFFER_CLASS_MAX; c++)
+		{
+			pool.mExitedPuts[c] += counts.puts[c].load(std::memory_order_relaxed);
+		}
+		pool.mThreadCounts.erase(&counts);
+	}
+	
+	ThreadCounts	counts;
+};
+
+//************************************************************************
+BufferPool::ThreadCounts & BufferPool::threadCounts()
+{
+	static thread_local ThreadCountsHolder holder;
+	return(holder.counts);
+}
+
+// Only the thread the count belongs to writes it
+static inline void countOne(std::atomic<uint64_t> & count)
+{
+	count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+//************************************************************************
+BufferPool::BufferPool() :
+	mHugePages(false),
+	mHugeFailures(0)
+{
+	memset(mExitedGets, 0, sizeof(mExitedGets));
+	memset(mExitedPuts, 0, sizeof(mExitedPuts));
+
+	for (int c = 0; c < BUFFER_CLASS_MAX; c++)
+	{
+		SizeClass & sizeClass = mClasses[c];
+		sizeClass.head = 0;
+		for (auto & slab : sizeClass.slabs)
+		{
+			slab = NULL;
+		}
+		sizeClass.slabCount = 0;
+		
+		// Each buffer starts on its own cache line
+		sizeClass.stride = (sizeof(Buffer) + BufferClassBytes[c] + 63) & ~(size_t)63;
+		sizeClass.perSlab = BUFFER_SLAB_BYTES / sizeClass.stride;
+		sizeClass.maxInUse = 0;
+	}
+}
+
+//************************************************************************
+BufferPtr BufferPool::get(size_t size)
+{
+	for (int c = 0; c < BUFFER_CLASS_MAX; c++)
+	{
+		if (size > BufferClassBytes[c])
+		{
+			continue;
+		}
+		
+		SizeClass & sizeClass = mClasses[c];
+		Buffer* pBuffer;
+		while ((pBuffer = pop(sizeClass)) == NULL)
+		{
+			if (!grow(sizeClass, (BufferClass)c))
+			{
+				break;
+			}
+		}
+		if (pBuffer == NULL)
+		{
+			break;
+		}
+		
+		pBuffer->mRefs.store(1, std::memory_order_relaxed);
+		countOne(threadCounts().gets[c]);
+		
+		// Only the first time a buffer is handed out (see SizeClass)
+		uint32_t maxInUse = sizeClass.maxInUse.load(std::memory_order_relaxed);
+		while ( (pBuffer->mIndex >= maxInUse) 
+		        && !sizeClass.maxInUse.compare_exchange_weak(maxInUse, pBuffer->mIndex + 1, std::memory_order_relaxed) )
+		{
+		}
+		return(BufferPtr(pBuffer));
+	}
+	
+	// Too large for any class or the class has no slabs left
+	countOne(threadCounts().gets[BUFFER_CLASS_MAX]);
+	Buffer* pBuffer = new (new char[sizeof(Buffer) + size]) Buffer;
+	pBuffer->mRefs.store(1, std::memory_order_relaxed);
+	pBuffer->mNext.store(0, std::memory_order_relaxed);
+	pBuffer->mIndex = 0;
+	pBuffer->mSize = size;
+	pBuffer->mClass = BUFFER_CLASS_MAX;
+	return(BufferPtr(pBuffer));
+}
+
+//************************************************************************
+void BufferPool::put(Buffer* pBuffer)
+{
+	if (pBuffer->mClass == BUFFER_CLASS_MAX)
+	{
+		pBuffer->~Buffer();
+		delete[] reinterpret_cast<char*>(pBuffer);
+		return;
+	}
+	
+	countOne(threadCounts().puts[pBuffer->mClass]);
+	push(mClasses[pBuffer->mClass], pBuffer);
+}
+
+//************************************************************************
+Buffer* BufferPool::at(SizeClass & sizeClass, uint32_t index)
+{
+	char* pSlab = sizeClass.slabs[index / sizeClass.perSlab].load(std::memory_order_acquire);
+	return(reinterpret_cast<Buffer*>(pSlab + (index % sizeClass.perSlab) * sizeClass.stride));
+}
+
+//************************************************************************
+// function to take the first buffer off the free list of a class. The tag
+// in the upper half of the head changes on every push and pop so a head
+// that was popped and pushed back in between does not fool the exchange.
+// Slabs are never freed so reading mNext of a buffer another thread has
+// just taken is harmless, the exchange then fails.
+Buffer* BufferPool::pop(SizeClass & sizeClass)
+{
+	uint64_t head = sizeClass.head.load(std::memory_order_acquire);
+	while ((uint32_t)head)
+	{
+		Buffer* pBuffer = at(sizeClass, (uint32_t)head - 1);
+		uint64_t next = (((head >> 32) + 1) << 32) | pBuffer->mNext.load(std::memory_order_relaxed);
+		if (sizeClass.head.compare_exchange_weak(head, next, std::memory_order_acquire, std::memory_order_acquire))
+		{
+			return(pBuffer);
+		}
+	}
+	return(NULL);
+}
+
+//************************************************************************
+void BufferPool::push(SizeClass & sizeClass, Buffer* pBuffer)
+{
+	uint64_t head = sizeClass.head.load(std::memory_order_relaxed);
+	uint64_t next;
+	do
+	{
+		pBuffer->mNext.store((uint32_t)head, std::memory_order_relaxed);
+		next = (((head >> 32) + 1) << 32) | (pBuffer->mIndex + 1);
+	} while (!sizeClass.head.compare_exchange_weak(head, next, std::memory_order_release, std::memory_order_relaxed));
+}
+
+//************************************************************************
+// function to add a slab (or a huge page worth of slabs) of buffers to a
+// class. Returns false when the class is out of slabs or memory.
+bool BufferPool::grow(SizeClass & sizeClass, BufferClass bufferClass)
+{
+	lock_guard<mutex> lock(mGrowMutex);
+	
+	// Another thread may have added buffers while we waited for the lock
+	if ((uint32_t)sizeClass.head.load(std::memory_order_acquire))
+	{
+		return(true);
+	}
+	
+	uint32_t count = sizeClass.slabCount.load(std::memory_order_relaxed);
+	if (count >= BUFFER_MAX_SLABS)
+	{
+		return(false);
+	}
+	
+	size_t bytes;
+	char* pMemory = allocSlab(bytes);
+	if (pMemory == NULL)
+	{
+		return(false);
+	}
+	uint32_t slabs = std::min(bytes / BUFFER_SLAB_BYTES, BUFFER_MAX_SLABS - count);
+	
+	for (uint32_t s = 0; s < slabs; s++)
+	{
+		char* pSlab = pMemory + s * BUFFER_SLAB_BYTES;
+		uint32_t first = (count + s) * sizeClass.perSlab;
+		for (uint32_t i = 0; i < sizeClass.perSlab; i++)
+		{
+			Buffer* pBuffer = new (pSlab + i * sizeClass.stride) Buffer;
+			pBuffer->mRefs.store(0, std::memory_order_relaxed);
+			pBuffer->mNext.store(0, std::memory_order_relaxed);
+			pBuffer->mIndex = first + i;
+			pBuffer->mSize = BufferClassBytes[bufferClass];
+			pBuffer->mClass = bufferClass;
+		}
+		sizeClass.slabs[count + s].store(pSlab, std::memory_order_release);
+	}
+	sizeClass.slabCount.store(count + slabs, std::memory_order_release);
+	
+	// Pushed last to first so the lowest index is handed out first
+	for (uint32_t s = slabs; s-- > 0;)
+	{
+		char* pSlab = pMemory + s * BUFFER_SLAB_BYTES;
+		for (uint32_t i = sizeClass.perSlab; i-- > 0;)
+		{
+			push(sizeClass, reinterpret_cast<Buffer*>(pSlab + i * sizeClass.stride));
+		}
+	}
+	return(true);
+}
+
+//************************************************************************
+char* BufferPool::allocSlab(size_t & bytes)
+{
+#if defined(MAP_HUGETLB) && !defined(NS3)
+	if (mHugePages)
+	{
+		void* pMemory = mmap(NULL, BUFFER_HUGE_SLAB_BYTES, PROT_READ | PROT_WRITE, 
+		                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (pMemory != MAP_FAILED)
+		{
+			bytes = BUFFER_HUGE_SLAB_BYTES;
+			return(static_cast<char*>(pMemory));
+		}
+		
+		// No huge pages reserved (see /proc/sys/vm/nr_hugepages). Counted in the stats
+		mHugeFailures.fetch_add(1, std::memory_order_relaxed);
+	}
+#endif
+	
+	void* pMemory = NULL;
+	if (posix_memalign(&pMemory, 4096, BUFFER_SLAB_BYTES) != 0)
+	{
+		return(NULL);
+	}
+	bytes = BUFFER_SLAB_BYTES;
+	return(static_cast<char*>(pMemory));
+}
+
+//************************************************************************
+void BufferPool::getStats(BufferClass bufferClass, BufferClassStats & stats) const
+{
+	const SizeClass & sizeClass = mClasses[bufferClass];
+	stats.slabs = sizeClass.slabCount.load(std::memory_order_relaxed);
+	stats.buffers = stats.slabs * sizeClass.perSlab;
+	stats.maxInUse = sizeClass.maxInUse.load(std::memory_order_relaxed);
+	
+	uint64_t gets[BUFFER_CLASS_MAX + 1];
+	uint64_t puts[BUFFER_CLASS_MAX];
+	sumCounts(gets, puts);
+	stats.gets = gets[bufferClass];
+	stats.inUse = gets[bufferClass] - puts[bufferClass];
+}
+
+//************************************************************************
+// function to add up the counts of every thread
+void BufferPool::sumCounts(uint64_t gets[BUFFER_CLASS_MAX + 1], uint64_t puts[BUFFER_CLASS_MAX]) const
+{
+	lock_guard<mutex> lock(mCountsMutex);
+	memcpy(gets, mExitedGets, sizeof(mExitedGets));
+	memcpy(puts, mExitedPuts, sizeof(mExitedPuts));
+	for (ThreadCounts* pCounts : mThreadCounts)
+	{
+		for (int c = 0; c <= BUFFER_CLASS_MAX; c++)
+		{
+			gets[c] += pCounts->gets[c].load(std::memory_order_relaxed);
+		}
+		for (int c = 0; c < BUFFER_CLASS_MAX; c++)
+		{
+			puts[c] += pCounts->puts[c].load(std::memory_order_relaxed);
+		}
+	}
+}
+
+//************************************************************************
+string BufferPool::statsString() const
+{
+	std::ostringstream out;
+	for (int c = 0; c < BUFFER_CLASS_MAX; c++)
+	{
+		BufferClassStats stats;
+		getStats((BufferClass)c, stats);
+		out << BufferClassStr[c] << ": buffers>" << stats.buffers << " inuse>" << stats.inUse
+		    << " maxinuse>" << stats.maxInUse << " gets>" << stats.gets << " ";
+	}
+	uint64_t gets[BUFFER_CLASS_MAX + 1];
+	uint64_t puts[BUFFER_CLASS_MAX];
+	sumCounts(gets, puts);
+	out << BufferClassStr[BUFFER_CLASS_MAX] << ">" << gets[BUFFER_CLASS_MAX];
+	if (mHugePages)
+	{
+		out << " hugefail>" << mHugeFailures.load(std::memory_order_relaxed);
+	}
+	return(out.str());
+}
+
 
 
 #ifdef NS3
 void OTASession::open(io_service & io, vector<string> & devices)
 {
+	mIo = &io;
+	
 	// Loop over all devices specified and open device
 	// For NS3, list of devices is a list of integers (stored as strings)
 	for (auto it = devices.begin(); it != devices.end(); ++it)
@@ -103,6 +492,7 @@ void OTASession::open(io_service & io, vector<string> & devices)
 			rawSocket.fd = fd;
 			rawSocket.mSocket = pSocket;
 			rawSocket.etherType = ETH_P_GCN_CTRL;
+			rawSocket.priority = 0;
 			mRawSockets.insert(pair<int, RawSocket>(atoi(it->c_str()), rawSocket));
 
 			printf("Opened socket 0x%x on device %s\n", rawSocket.etherType, it->c_str());
@@ -124,6 +514,7 @@ void OTASession::open(io_service & io, vector<string> & devices)
 			rawSocket.fd = fd;
 			rawSocket.mSocket = pSocket;
 			rawSocket.etherType = ETH_P_GCN_DATA;
+			rawSocket.priority = 0;
 			mRawSockets.insert(pair<int, RawSocket>(atoi(it->c_str()), rawSocket));
 
 			printf("Opened socket 0x%x on device %s\n", rawSocket.etherType, it->c_str());
@@ -131,7 +522,7 @@ void OTASession::open(io_service & io, vector<string> & devices)
 	}
 }
 
-void OTASession::read(function<void(char* buffer, int length)> & receiveHandler)
+void OTASession::read(function<void(char* buffer, int length, int device, const unsigned char* srcHwAddress)> & receiveHandler)
 {
 	for (auto it = mRawSockets.begin(); it != mRawSockets.end(); ++it)
 	{
@@ -153,7 +544,7 @@ void OTASession::handle_read(const error_code& ec,
 			     int device,
 			     int fd,
 			     shared_ptr<stream_descriptor> socket,
-			     function<void(char* buffer, int length)> & receiveHandler)
+			     function<void(char* buffer, int length, int device, const unsigned char* srcHwAddress)> & receiveHandler)
 {
 	if (ec)
 	{
@@ -161,7 +552,7 @@ void OTASession::handle_read(const error_code& ec,
 		return;
 	}
 
-	BufferPtr pMsgBuffer(new Buffer);
+	BufferPtr pMsgBuffer = newBuffer(ETH_FRAME_LEN);
 	struct sockaddr_ll from;
 	socklen_t l =  sizeof(from);
 
@@ -181,11 +572,11 @@ void OTASession::handle_read(const error_code& ec,
 	{
 		// Strip ethernet header
 		length -= sizeof(struct ether_header);
-		receiveHandler(pMsgBuffer->data() + sizeof(struct ether_header), length);
+		receiveHandler(pMsgBuffer->data() + sizeof(struct ether_header), length, device, from.sll_addr);
 	}
 	else
 	{
-		receiveHandler(pMsgBuffer->data(), length);
+		receiveHandler(pMsgBuffer->data(), length, device, from.sll_addr);
 	}
 	
 	// read again
@@ -201,12 +592,20 @@ void OTASession::handle_read(const error_code& ec,
 
 }
 
-void OTASession::write(GroupId gid, BufferPtr pBuffer, int length, bool ctrlPkt, const unsigned char* destHwAddress)
+bool OTASession::write(GroupId gid, BufferPtr pBuffer, int length, bool ctrlPkt, int priority, 
+                       const DeviceSet & devices, const unsigned char* destHwAddress)
 {
 	const unsigned char ether_broadcast_addr[]={0xff,0xff,0xff,0xff,0xff,0xff};
+	bool sent = false;
 
 	for (auto it = mRawSockets.begin(); it != mRawSockets.end(); ++it)
 	{
+		// only send on the devices asked for
+		if ( !devices.empty() && (devices.count(it->first) == 0) )
+		{
+			continue;
+		}
+		
 		// only send data to DATA and ctrl to CTRL
 		if (  (ctrlPkt && (it->second.etherType == ETH_P_GCN_DATA))
 				||
@@ -222,7 +621,7 @@ void OTASession::write(GroupId gid, BufferPtr pBuffer, int length, bool ctrlPkt,
 		
 		
 		if (USE_ETHERNET_HEADERS)
-			prependEthernetHeader(gid, it->second.hwAddress, pBuffer, ctrlPkt);
+			prependEthernetHeader(gid, it->second.hwAddress, pBuffer, ctrlPkt, destHwAddress);
 
 		struct sockaddr_ll addr={0};
 		addr.sll_family=AF_PACKET;
@@ -233,7 +632,12 @@ void OTASession::write(GroupId gid, BufferPtr pBuffer, int length, bool ctrlPkt,
 		else
 			addr.sll_protocol=htons(ETH_P_GCN_DATA);
 			
-		if ( mMcastEthernetHeader )
+		// The link layer destination comes from the address (DCE rewrites the Ethernet header)
+		if (destHwAddress)
+		{
+			memcpy(addr.sll_addr, destHwAddress, ETHER_ADDR_LEN);
+		}
+		else if ( mMcastEthernetHeader )
 		{
 			if ( gid > MAX_MCAST_HEADER_GROUP_ID )
 			{
@@ -264,6 +668,17 @@ void OTASession::write(GroupId gid, BufferPtr pBuffer, int length, bool ctrlPkt,
 		printf("\n");
 #endif
 
+		// sendto is synchronous so the priority only needs to be set on the socket
+		// when it changes
+		if (it->second.priority != priority)
+		{
+			if (setsockopt(it->second.fd, SOL_SOCKET, SO_PRIORITY, &priority, sizeof(priority)) == -1)
+			{
+				printf("ERROR: setsockopt SO_PRIORITY %d failed\n", priority);
+			}
+			it->second.priority = priority;
+		}
+
 		int send_result = 0;
 		send_result = sendto(it->second.fd, pBuffer->data(), length, 0,
 		      (struct sockaddr*)&addr, sizeof(addr));
@@ -271,7 +686,23 @@ void OTASession::write(GroupId gid, BufferPtr pBuffer, int length, bool ctrlPkt,
 		{
 			printf("ERROR: sendto failed\n");
 		}
+		sent = true;
+	}
+	
+	// sendto is synchronous so the frame is already out
+	if (sent && mWrittenHandler)
+	{
+		weak_ptr<int> alive(mAlive);
+		mIo->post([this, alive]()
+		          {
+			          if (!alive.expired())
+			          {
+				          mWrittenHandler();
+			          }
+		          });
+		return(true);
 	}
+	return(false);
 }
 
 void OTASession::close()
@@ -283,11 +714,22 @@ void OTASession::close()
 	mRawSockets.clear();
 }
 
+DeviceSet OTASession::getDevices()
+{
+	DeviceSet devices;
+	for (auto it = mRawSockets.begin(); it != mRawSockets.end(); ++it)
+	{
+		devices.insert(it->first);
+	}
+	return devices;
+}
+
 #else // other than NS3
 
 void OTASession::open(io_service & io, vector<string> & devices)
 {
 	char errbuf[PCAP_ERRBUF_SIZE];
+	mIo = &io;
 	
 	// If devices not specified, find a device (should be eth0)
 	if ( devices.empty() )
@@ -376,6 +818,7 @@ void OTASession::open(io_service & io, vector<string> & devices)
 
 				PcapSocket pcapSocket;
 				pcapSocket.mPcapHandle = pcapHandle;
+				pcapSocket.ifIndex = if_nametoindex(it->c_str());
 				pcapSocket.mSocket = pSocket;
 				char hwAddress[ETH_ALEN];
 				if (getEthernetAddress(*it, hwAddress))
@@ -395,7 +838,7 @@ void OTASession::open(io_service & io, vector<string> & devices)
 	}
 }
 
-void OTASession::read(function<void(char* buffer, int length)> & receiveHandler)
+void OTASession::read(function<void(char* buffer, int length, int device, const unsigned char* srcHwAddress)> & receiveHandler)
 {
 	for (auto it = mPcapSockets.begin(); it != mPcapSockets.end(); ++it)
 		{
@@ -405,6 +848,7 @@ void OTASession::read(function<void(char* buffer, int length)> & receiveHandler)
 								 boost::asio::placeholders::error,
 								 boost::asio::placeholders::bytes_transferred,
 								 it->second.mPcapHandle,
+								 it->second.ifIndex,
 								 it->second.mSocket,
 								 receiveHandler));
 		}
@@ -413,8 +857,9 @@ void OTASession::read(function<void(char* buffer, int length)> & receiveHandler)
 void OTASession::handle_read(const error_code& ec, 
 			     size_t, 
 			     pcap_t *pPcapHandle,
+			     int device,
 			     shared_ptr<stream_descriptor> socket,
-			     function<void(char* buffer, int length)> & receiveHandler)
+			     function<void(char* buffer, int length, int device, const unsigned char* srcHwAddress)> & receiveHandler)
 {
 	if (ec)
 	{
@@ -428,8 +873,14 @@ void OTASession::handle_read(const error_code& ec,
 	if (ret > 0)
 	{
 		size_t length = pktHeader->caplen;
+		const unsigned char* srcHwAddress = NULL;
 		if (USE_ETHERNET_HEADERS)
 		{
+			if (pktHeader->caplen >= sizeof(struct ether_header))
+			{
+				srcHwAddress = ((const struct ether_header*)packet)->ether_shost;
+			}
+
 			// Strip ethernet header
 			packet += sizeof(struct ether_header);
 			if (pktHeader->caplen < sizeof(struct ether_header))
@@ -440,7 +891,7 @@ void OTASession::handle_read(const error_code& ec,
 			
 		if (length > 0 )
 		{
-		 	receiveHandler((char*)packet, length);
+		 	receiveHandler((char*)packet, length, device, srcHwAddress);
 		}
 	}
 	else
@@ -454,24 +905,53 @@ void OTASession::handle_read(const error_code& ec,
 				     boost::asio::placeholders::error,
 				     boost::asio::placeholders::bytes_transferred,
 				     pPcapHandle,
+				     device,
 				     socket,
 				     receiveHandler));
 }
 
-void OTASession::write(GroupId gid, BufferPtr pBuffer, int length, bool ctrlPkt, const unsigned char* destHwAddress)
+bool OTASession::write(GroupId gid, BufferPtr pBuffer, int length, bool ctrlPkt, int priority, 
+                       const DeviceSet & devices, const unsigned char* destHwAddress)
 {
+	weak_ptr<int> alive(mAlive);
+	bool sent = false;
+	
 	for (auto it = mPcapSockets.begin(); it != mPcapSockets.end(); ++it)
 	{
+		// only send on the devices asked for
+		if ( !devices.empty() && (devices.count(it->second.ifIndex) == 0) )
+		{
+			continue;
+		}
+		
 		if (USE_ETHERNET_HEADERS)
 			prependEthernetHeader(gid, it->second.hwAddress, pBuffer, ctrlPkt, destHwAddress);
-			
-		async_write(*it->second.mSocket, buffer(pBuffer->data(), length),
-				[this, pBuffer](error_code ec, size_t write_size)
+		
+		// The write is asynchronous so we can't change the priority of the pcap
+		// socket per frame. Frames with a priority go out their own socket.
+		shared_ptr<stream_descriptor> pSocket = it->second.mSocket;
+		if (priority != OTA_PRIORITY_DEFAULT)
+		{
+			pSocket = getPrioritySocket(it->first, it->second, priority);
+		}
+		
+		mPendingWrites++;
+		sent = true;
+		async_write(*pSocket, buffer(pBuffer->data(), length),
+				[this, pBuffer, alive](error_code ec, size_t write_size)
 				{
 					if (ec)
 					{
 						fprintf(stderr, ">>>>> OTASession Write error!\n");
 					}
+					if (alive.expired())
+					{
+						return;
+					}
+					if ( (--mPendingWrites == 0) && mWrittenHandler )
+					{
+						mWrittenHandler();
+					}
 #if 0
 					else
 					{
@@ -485,6 +965,7 @@ void OTASession::write(GroupId gid, BufferPtr pBuffer, int length, bool ctrlPkt,
 #endif
 				});
 	}
+	return( sent && mWrittenHandler );
 }
 
 void OTASession::close()
@@ -493,10 +974,68 @@ void OTASession::close()
 	{
 		pcap_close(it->second.mPcapHandle);
 		it->second.mSocket->close();
+		for (auto iter = it->second.mPrioritySockets.begin(); iter != it->second.mPrioritySockets.end(); ++iter)
+		{
+			if (iter->second != it->second.mSocket)
+			{
+				iter->second->close();
+			}
+		}
 	}
 	mPcapSockets.clear();
 }
 
+DeviceSet OTASession::getDevices()
+{
+	DeviceSet devices;
+	for (auto it = mPcapSockets.begin(); it != mPcapSockets.end(); ++it)
+	{
+		devices.insert(it->second.ifIndex);
+	}
+	return devices;
+}
+
+// Returns the send socket for frames with the given priority on a device,
+// opening it the first time. If it can't be opened the pcap socket is used
+// (and the frames go out with the default priority).
+shared_ptr<stream_descriptor> OTASession::getPrioritySocket(const string & device, PcapSocket & pcapSocket, int priority)
+{
+	auto iter = pcapSocket.mPrioritySockets.find(priority);
+	if (iter != pcapSocket.mPrioritySockets.end())
+	{
+		return iter->second;
+	}
+	
+	// Protocol 0 means this socket never receives anything
+	struct sockaddr_ll addr={0};
+	addr.sll_family = AF_PACKET;
+	addr.sll_protocol = 0;
+	addr.sll_ifindex = if_nametoindex(device.c_str());
+	
+	shared_ptr<stream_descriptor> pSocket = pcapSocket.mSocket;
+	int fd = socket(AF_PACKET, SOCK_RAW, 0);
+	if ( (fd == -1)
+			|| (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1)
+			|| (setsockopt(fd, SOL_SOCKET, SO_PRIORITY, &priority, sizeof(priority)) == -1) )
+	{
+		printf("ERROR: Unable to open priority %d socket on device %s. Using default priority\n", priority, device.c_str());
+		if (fd != -1)
+		{
+			::close(fd);
+		}
+	}
+	else
+	{
+		pSocket = make_shared<stream_descriptor>(stream_descriptor(*mIo));
+		pSocket->assign(fd);
+		printf("Opened priority %d socket on device %s\n", priority, device.c_str());
+	}
+	
+	// Remember failures too so we only try once
+	pcapSocket.mPrioritySockets[priority] = pSocket;
+	return pSocket;
+}
+
 bool OTASession::getEthernetAddress(string ifname, char* hwAddress)
 {
 	struct ifreq ifr;
@@ -546,7 +1085,12 @@ void OTASession::prependEthernetHeader(GroupId gid, const char* hwAddress, Buffe
 
 	memcpy(header.ether_shost, hwAddress, sizeof(header.ether_shost));
 
-	if ( mMcastEthernetHeader )
+	if (destHwAddress)
+	{
+		// frame directed to one neighbor
+		memcpy(header.ether_dhost, destHwAddress, sizeof(header.ether_dhost));
+	}
+	else if ( mMcastEthernetHeader )
 	{
 		if ( gid > MAX_MCAST_HEADER_GROUP_ID )
 		{
@@ -562,10 +1106,6 @@ void OTASession::prependEthernetHeader(GroupId gid, const char* hwAddress, Buffe
 		// destination address of 01:00:05:01:00:00
 		memcpy(&header.ether_dhost[3], &gid, sizeof(header.ether_shost)/2);
 	}
-	else if (destHwAddress)
-	{
-		memcpy(header.ether_dhost, destHwAddress, sizeof(header.ether_dhost));
-	}
 	else
 	{
 		// (Destination set to broadcast address, FF:FF:FF:FF:FF:FF.)
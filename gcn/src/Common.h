@@ -42,6 +42,9 @@
 #include <unordered_map>
 #include <unordered_set>
 #include <array>
+#include <atomic>
+#include <type_traits>
+#include <algorithm>
 #include <assert.h>
 #include <math.h>
 #include <stdio.h>
@@ -59,6 +62,7 @@
 #include <netpacket/packet.h>
 #include <arpa/inet.h>
 #include <net/if_arp.h>
+#include <net/if.h>
 #include <unistd.h>
 #include <pcap.h>
 #include <sys/socket.h>
@@ -74,10 +78,12 @@ using std::bind;
 using std::cerr;
 using std::cout;
 using std::endl;
+using std::equal_to;
 using std::exception;
 using std::fixed;
 using std::function;
 using std::hash;
+using std::less;
 using std::lock_guard;
 using std::make_shared;
 using std::map;
@@ -93,6 +99,7 @@ using std::unordered_map;
 using std::unordered_set;
 using std::set;
 using std::vector;
+using std::weak_ptr;
 using std::static_pointer_cast;
 using namespace std::chrono;
 
@@ -117,6 +124,17 @@ using boost::asio::async_read;
 static constexpr uint32_t ETH_P_GCN_CTRL = 0x88b5; // custom GCN EtherType for control packets
 static constexpr uint32_t ETH_P_GCN_DATA = 0x88b6; // custom GCN EtherType for data packets
 
+// Socket priorities (SO_PRIORITY) for OTA frames. Linux qdiscs and WMM
+// capable drivers map these to access categories:
+//   1,2 = background  0,3 = best effort  4,5 = video  6,7 = voice
+static constexpr int OTA_PRIORITY_DEFAULT = 0;  // DATA of groups that did not ask for a priority
+static constexpr int OTA_PRIORITY_CTRL = 6;     // control messages ride the voice access category
+static constexpr int OTA_PRIORITY_MAX = 7;
+
+// The set of OTA devices a frame is sent on. Empty means every device.
+// Devices are identified by their interface index (device number for NS3)
+typedef set<int> DeviceSet;
+
 typedef boost::posix_time::seconds Seconds;
 typedef boost::posix_time::milliseconds Milliseconds;
 typedef boost::posix_time::microseconds Microseconds;
@@ -175,17 +193,436 @@ static const char __attribute__ ((used)) *LogLevelStr[] = { "", "FATAL", "FORCE"
 static const unsigned int	MAX_BUFFER_SIZE = 8192;
 static const LogLevel		DEFAULT_LOG_LEVEL = LOG_ERROR;
 
-// buffer typedefs
-typedef array<char, MAX_BUFFER_SIZE> Buffer;
-typedef shared_ptr<Buffer> BufferPtr;
+// Packet buffers.
+//
+// Every message the GCN and the apps send (and every frame read in NS3)
+// goes in a Buffer. Buffers come from a pool with a few size classes so a
+// small control message does not take a MAX_BUFFER_SIZE buffer, and go
+// back to the pool when the last BufferPtr to them goes away. The free
+// lists are lock free so any thread may take and release buffers.
+// Buffers are carved out of slabs that are never freed, optionally
+// backed by huge pages.
+enum BufferClass
+{
+	BUFFER_CLASS_SMALL = 0,  // control messages
+	BUFFER_CLASS_MTU,        // anything that fits in an Ethernet frame
+	BUFFER_CLASS_JUMBO,      // up to MAX_BUFFER_SIZE
+	BUFFER_CLASS_MAX         // (too large for the pool, from the heap)
+};
+static const size_t BufferClassBytes[BUFFER_CLASS_MAX] = { 256, 2048, MAX_BUFFER_SIZE };
+static const char __attribute__ ((used)) *BufferClassStr[] = { "small", "mtu", "jumbo", "heap"};
+
+static const size_t		BUFFER_SLAB_BYTES = 262144;        // buffers are made this many bytes at a time
+static const size_t		BUFFER_HUGE_SLAB_BYTES = 2097152;  // or a huge page at a time
+static const size_t		BUFFER_MAX_SLABS = 4096;           // per class. Past that they come from the heap
+
+// The header of a buffer. Its bytes follow it
+class alignas(16) Buffer
+{
+ public:
+	char* data() { return(reinterpret_cast<char*>(this + 1)); }
+	const char* data() const { return(reinterpret_cast<const char*>(this + 1)); }
+	size_t size() const { return(mSize); }
+	
+ private:
+	friend class BufferPtr;
+	friend class BufferPool;
+	
+	std::atomic<uint32_t>	mRefs;
+	std::atomic<uint32_t>	mNext;   // index + 1 of the next free buffer of the class
+	uint32_t				mIndex;
+	uint32_t				mSize;
+	BufferClass				mClass;
+};
+
+// Counted reference to a Buffer, used like a shared_ptr
+class BufferPtr
+{
+ public:
+	BufferPtr() : mBuffer(NULL) {}
+	BufferPtr(std::nullptr_t) : mBuffer(NULL) {}
+	BufferPtr(const BufferPtr & other) : mBuffer(other.mBuffer)
+	{
+		if (mBuffer)
+		{
+			mBuffer->mRefs.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+	BufferPtr(BufferPtr && other) : mBuffer(other.mBuffer) { other.mBuffer = NULL; }
+	~BufferPtr() { release(); }
+	
+	BufferPtr & operator=(BufferPtr other)
+	{
+		std::swap(mBuffer, other.mBuffer);
+		return(*this);
+	}
+	
+	Buffer* operator->() const { return(mBuffer); }
+	Buffer & operator*() const { return(*mBuffer); }
+	Buffer* get() const { return(mBuffer); }
+	explicit operator bool() const { return(mBuffer != NULL); }
+	void reset() { release(); mBuffer = NULL; }
+	
+ private:
+	friend class BufferPool;
+	explicit BufferPtr(Buffer* pBuffer) : mBuffer(pBuffer) {}
+	void release();
+	
+	Buffer*	mBuffer;
+};
+
+struct BufferClassStats
+{
+	unsigned int	slabs;
+	unsigned int	buffers;    // made so far
+	unsigned int	inUse;
+	unsigned int	maxInUse;
+	uint64_t		gets;
+};
+
+class BufferPool
+{
+ public:
+	// the one pool of the process
+	static BufferPool & instance();
+	
+	// a buffer of at least size bytes from the smallest class it fits in
+	BufferPtr get(size_t size);
+	
+	// Back the slabs made from now on with huge pages (if the system has
+	// them reserved, otherwise normal pages are used)
+	void useHugePages(bool enable) { mHugePages = enable; }
+	
+	void getStats(BufferClass bufferClass, BufferClassStats & stats) const;
+	string statsString() const;
+	
+ private:
+	// The free list head is on its own cache line. The rest is only
+	// written when a slab is added or a buffer is handed out the first time.
+	//
+	// The free list is a stack and new buffers go on it lowest index on
+	// top, so a buffer is handed out for the first time only when all the
+	// buffers before it are in use. The highest index handed out is then
+	// the most buffers ever in use at once (a little more if threads race
+	// adding a slab).
+	struct SizeClass
+	{
+		alignas(64) std::atomic<uint64_t>	head;     // tag << 32 | index + 1 of the first free buffer
+		alignas(64) uint32_t				perSlab;
+		size_t								stride;
+		std::atomic<uint32_t>				maxInUse; // highest index handed out + 1
+		std::atomic<uint32_t>				slabCount;
+		std::atomic<char*>					slabs[BUFFER_MAX_SLABS];
+	};
+	
+	// Buffers taken and given back by one thread. Only that thread writes
+	// them so counting needs no locked instructions. getStats adds up every
+	// thread's counts (and those of the threads that have exited)
+	struct ThreadCounts
+	{
+		std::atomic<uint64_t>	gets[BUFFER_CLASS_MAX + 1];   // the last is gets from the heap
+		std::atomic<uint64_t>	puts[BUFFER_CLASS_MAX];
+	};
+	class ThreadCountsHolder;
+	
+	BufferPool();
+	BufferPool(const BufferPool &);
+	BufferPool & operator=(const BufferPool &);
+	
+	friend class BufferPtr;
+	static ThreadCounts & threadCounts();
+	void sumCounts(uint64_t gets[BUFFER_CLASS_MAX + 1], uint64_t puts[BUFFER_CLASS_MAX]) const;
+	Buffer* at(SizeClass & sizeClass, uint32_t index);
+	Buffer* pop(SizeClass & sizeClass);
+	void push(SizeClass & sizeClass, Buffer* pBuffer);
+	bool grow(SizeClass & sizeClass, BufferClass bufferClass);
+	char* allocSlab(size_t & bytes);
+	void put(Buffer* pBuffer);
+	
+	SizeClass				mClasses[BUFFER_CLASS_MAX];
+	mutex					mGrowMutex;   // only taken to add a slab
+	bool					mHugePages;
+	std::atomic<uint32_t>	mHugeFailures;
+	
+	mutable mutex			mCountsMutex;   // for the three below
+	set<ThreadCounts*>		mThreadCounts;
+	uint64_t				mExitedGets[BUFFER_CLASS_MAX + 1];
+	uint64_t				mExitedPuts[BUFFER_CLASS_MAX];
+};
+
+// a buffer of at least size bytes from the pool
+inline BufferPtr newBuffer(size_t size = MAX_BUFFER_SIZE)
+{
+	return(BufferPool::instance().get(size));
+}
+
+inline void BufferPtr::release()
+{
+	// The only reference can not be copied by anyone else meanwhile so it
+	// needs no atomic decrement
+	if ( mBuffer && ( (mBuffer->mRefs.load(std::memory_order_acquire) == 1) 
+	                  || (mBuffer->mRefs.fetch_sub(1, std::memory_order_acq_rel) == 1) ) )
+	{
+		BufferPool::instance().put(mBuffer);
+	}
+}
 
 // Miscellaneous utility functions
 TimeDuration getTime(); // returns current time as a duration
+double getTimeSec();     // returns current time in seconds (microsecond resolution)
 
 // Logging function
 void writelog(LogLevel level, LogLevel myLevel, NodeId mId, string file, int line, string func, const char * fmt, ...);
 
 
+// Reader for the length prefixed messages between the apps and the GCN.
+//
+// Each read takes as much as the socket has into one reusable buffer and
+// every complete message in it is handed out in place, so a busy stream
+// costs much less than a read per message. A message cut off at the end
+// of a read is kept for the next one.
+static const unsigned int	FRAME_READER_BYTES = 8 * MAX_BUFFER_SIZE;
+
+enum FrameStatus
+{
+	FRAME_NONE = 0,  // no complete message left
+	FRAME_OK,        // a message (length 0 is a doorbell)
+	FRAME_BAD        // the size was too large. Its 4 bytes were skipped
+};
+
+class FrameReader
+{
+ public:
+	FrameReader() : mBuffer(FRAME_READER_BYTES), mStart(0), mEnd(0), mReads(0), mFrames(0) {}
+	
+	// where the next read goes. Must not be called while messages
+	// handed out by next() are still being used
+	boost::asio::mutable_buffers_1 space();
+	
+	// length bytes were read into space()
+	void commit(size_t length) { mEnd += length; mReads++; }
+	
+	FrameStatus next(char* & pMessage, uint32_t & length);
+	
+	// drop whatever is left of the last stream before reading a new one
+	void reset() { mStart = mEnd = 0; }
+	
+	unsigned int reads() const { return mReads; }
+	unsigned int frames() const { return mFrames; }
+	
+ private:
+	vector<char>	mBuffer;
+	size_t			mStart;   // first byte not handed out yet
+	size_t			mEnd;     // end of the bytes read
+	unsigned int	mReads;
+	unsigned int	mFrames;
+};
+
+
+// Allocator for the nodes of tables that gain and lose an entry for every
+// packet (like the hash). A node that is freed is kept for the next insert
+// instead of going back to the heap, so once a table has grown to its
+// steady size inserting does not allocate. Anything bigger than one node
+// (like the buckets of an unordered_map) comes from the heap as usual.
+// Each thread keeps its own free nodes.
+template <typename T>
+class NodeAllocator
+{
+ public:
+	typedef T value_type;
+	
+	NodeAllocator() {}
+	template <typename U> NodeAllocator(const NodeAllocator<U> &) {}
+	
+	T* allocate(size_t n)
+	{
+		FreeNode* & pFree = freeNodes();
+		if ( (n == 1) && pFree )
+		{
+			FreeNode* pNode = pFree;
+			pFree = pNode->pNext;
+			return(reinterpret_cast<T*>(pNode));
+		}
+		return(static_cast<T*>(::operator new(n * sizeof(T))));
+	}
+	
+	void deallocate(T* p, size_t n)
+	{
+		if (n != 1)
+		{
+			::operator delete(p);
+			return;
+		}
+		FreeNode* & pFree = freeNodes();
+		FreeNode* pNode = reinterpret_cast<FreeNode*>(p);
+		pNode->pNext = pFree;
+		pFree = pNode;
+	}
+	
+ private:
+	struct FreeNode
+	{
+		FreeNode*	pNext;
+	};
+	static_assert(sizeof(T) >= sizeof(FreeNode), "NodeAllocator nodes must hold a pointer");
+	
+	static FreeNode* & freeNodes()
+	{
+		static thread_local FreeNode* pFree = NULL;
+		return(pFree);
+	}
+};
+
+template <typename T, typename U>
+inline bool operator==(const NodeAllocator<T> &, const NodeAllocator<U> &) { return(true); }
+template <typename T, typename U>
+inline bool operator!=(const NodeAllocator<T> &, const NodeAllocator<U> &) { return(false); }
+
+
+// Memory for the operation of a timer that is waited on again and again.
+// asio keeps only one operation's memory per thread for reuse, so a
+// handler made with makeAllocHandler gets it from here instead. One
+// operation at a time is held here, any more come from the heap. The
+// handler keeps the memory alive as it may outlive its owner.
+class HandlerMemory
+{
+ public:
+	HandlerMemory() : mInUse(false) {}
+	
+	void* allocate(size_t size)
+	{
+		if ( !mInUse && (size <= sizeof(mStorage)) )
+		{
+			mInUse = true;
+			return(&mStorage);
+		}
+		return(::operator new(size));
+	}
+	
+	void deallocate(void* p)
+	{
+		if (p == &mStorage)
+		{
+			mInUse = false;
+			return;
+		}
+		::operator delete(p);
+	}
+	
+ private:
+	HandlerMemory(const HandlerMemory &);
+	HandlerMemory & operator=(const HandlerMemory &);
+	
+	std::aligned_storage<256>::type	mStorage;
+	bool							mInUse;
+};
+
+template <typename T>
+class HandlerAllocator
+{
+ public:
+	typedef T value_type;
+	
+	explicit HandlerAllocator(const shared_ptr<HandlerMemory> & pMemory) : mMemory(pMemory.get()) {}
+	template <typename U> HandlerAllocator(const HandlerAllocator<U> & other) : mMemory(other.mMemory) {}
+	
+	T* allocate(size_t n) { return(static_cast<T*>(mMemory->allocate(n * sizeof(T)))); }
+	void deallocate(T* p, size_t /*n*/) { mMemory->deallocate(p); }
+	
+	template <typename U> bool operator==(const HandlerAllocator<U> & other) const { return(mMemory == other.mMemory); }
+	template <typename U> bool operator!=(const HandlerAllocator<U> & other) const { return(mMemory != other.mMemory); }
+	
+	HandlerMemory*	mMemory;
+};
+
+template <typename Handler>
+class AllocHandler
+{
+ public:
+	typedef HandlerAllocator<Handler> allocator_type;
+	
+	AllocHandler(const shared_ptr<HandlerMemory> & pMemory, Handler handler) : mMemory(pMemory), mHandler(handler) {}
+	
+	allocator_type get_allocator() const { return(allocator_type(mMemory)); }
+	
+	template <typename... Args>
+	void operator()(Args&&... args) { mHandler(std::forward<Args>(args)...); }
+	
+ private:
+	shared_ptr<HandlerMemory>	mMemory;
+	Handler						mHandler;
+};
+
+template <typename Handler>
+inline AllocHandler<Handler> makeAllocHandler(const shared_ptr<HandlerMemory> & pMemory, Handler handler)
+{
+	return(AllocHandler<Handler>(pMemory, handler));
+}
+
+
+// Pool of protobuf messages that are used again rather than freed.
+//
+// A message's Clear() keeps the memory it grew (the strings, repeated
+// fields and sub-messages in it) so parsing into, or copying into, a
+// message taken from the pool does not allocate once the pool's messages
+// have grown to fit the traffic. Handlers that run inside one another
+// each take their own message. Not thread safe.
+template <typename T>
+class MessagePool
+{
+ public:
+	// A message taken from the pool. It goes back, cleared, when the
+	// handle goes away
+	class Handle
+	{
+	 public:
+		explicit Handle(MessagePool & pool) : mPool(pool), mMessage(pool.take()) {}
+		~Handle() { mPool.give(mMessage); }
+		T & operator*() const { return *mMessage; }
+		T * operator->() const { return mMessage; }
+		
+	 private:
+		Handle(const Handle &);
+		Handle & operator=(const Handle &);
+		MessagePool &	mPool;
+		T*				mMessage;
+	};
+	
+	MessagePool() : mCreated(0) {}
+	~MessagePool() { for (T* pMessage : mFree) delete pMessage; }
+	
+	// messages made since the pool was. Stays put in steady state
+	unsigned int created() const { return mCreated; }
+	
+	// For a message kept in a table past the handler: take one and give
+	// it back when done with it
+	T* take()
+	{
+		if (mFree.empty())
+		{
+			mCreated++;
+			return(new T);
+		}
+		T* pMessage = mFree.back();
+		mFree.pop_back();
+		return(pMessage);
+	}
+	
+	void give(T* pMessage)
+	{
+		pMessage->Clear();
+		mFree.push_back(pMessage);
+	}
+	
+ private:
+	MessagePool(const MessagePool &);
+	MessagePool & operator=(const MessagePool &);
+	
+	vector<T*>		mFree;
+	unsigned int	mCreated;
+};
+
+
 #define MAX_MCAST_HEADER_GROUP_ID 16777216
 
 // Whether Ethernet headers are to be used OTA
@@ -203,14 +640,24 @@ static const bool USE_ETHERNET_HEADERS = true;
 class OTASession
 {
  public:
- OTASession(bool mcastEthernetHeader) : mMcastEthernetHeader(mcastEthernetHeader){}
+ OTASession(bool mcastEthernetHeader) : mMcastEthernetHeader(mcastEthernetHeader), mIo(NULL), mPendingWrites(0), mAlive(make_shared<int>(0)) {}
 	void open(io_service & io, vector<string> & devices);
-	void read(function<void(char* buffer, int length)> & receiveHandler);
-	void write(GroupId gid, BufferPtr pBuffer, int length, bool ctrlPkt, const unsigned char* destHwAddress = NULL);
+	void read(function<void(char* buffer, int length, int device, const unsigned char* srcHwAddress)> & receiveHandler);
+	// written (if set) is called from the io_service once the frames written
+	// are out on every device. It is set once so a write does not allocate
+	void setWrittenHandler(function<void()> written) { mWrittenHandler = written; }
+	// Returns false if nothing was sent (and written will not be called for it)
+	bool write(GroupId gid, BufferPtr pBuffer, int length, bool ctrlPkt, int priority = OTA_PRIORITY_DEFAULT, 
+	           const DeviceSet & devices = DeviceSet(), const unsigned char* destHwAddress = NULL);
 	void close();
+	DeviceSet getDevices();
  private:
 
 	bool mMcastEthernetHeader;
+	io_service* mIo;
+	function<void()> mWrittenHandler;
+	int mPendingWrites;        // device writes not done yet
+	shared_ptr<int> mAlive;    // completion handlers do nothing once we are gone
 
 #ifdef NS3
 	struct RawSocket
@@ -219,6 +666,7 @@ class OTASession
 		shared_ptr<stream_descriptor> mSocket;
 		char hwAddress[ETH_ALEN];
 		uint32_t etherType;
+		int priority;  // SO_PRIORITY currently set on the socket
 	};
 	multimap<int, RawSocket> mRawSockets;
 
@@ -227,21 +675,26 @@ class OTASession
 				int device,
 				int fd,
 				shared_ptr<stream_descriptor> socket,
-				function<void(char* buffer, int length)> & receiveHandler);
+				function<void(char* buffer, int length, int device, const unsigned char* srcHwAddress)> & receiveHandler);
 #else
 	struct PcapSocket
 	{
 		pcap_t* mPcapHandle;
+		int ifIndex;
 		shared_ptr<stream_descriptor> mSocket;
 		char hwAddress[ETH_ALEN];
+		map<int, shared_ptr<stream_descriptor>> mPrioritySockets;  // send only sockets for frames with a non default priority
 	};
 	map<string, PcapSocket> mPcapSockets;
 
+	shared_ptr<stream_descriptor> getPrioritySocket(const string & device, PcapSocket & pcapSocket, int priority);
+
 	void handle_read(const error_code& error, 
 			 size_t, 
 			 pcap_t *pPcapHandle,
+			 int device,
 			 shared_ptr<stream_descriptor> socket,
-			 function<void(char* buffer, int length)> & receiveHandler);
+			 function<void(char* buffer, int length, int device, const unsigned char* srcHwAddress)> & receiveHandler);
 
 	bool getEthernetAddress(string ifname, char* hwAddress);
 #endif
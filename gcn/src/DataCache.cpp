@@ -0,0 +1,121 @@
+/*
+ * Group Centric Networking
+ *
+ * Copyright (C) 2015 Massachusetts Institute of Technology
+ * All rights reserved.
+ *
+ * Authors:
+ *           Patricia Deutsch         <patricia.deutsch@ll.mit.edu>
+ *           Gregory Kuperman         <gkuperman@ll.mit.edu>
+ *           Leonid Veytser           <veytser@ll.mit.edu>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "DataCache.h"
+#include <string.h>
+
+
+//************************************************************************
+DataCache::DataCache(size_t maxBytes, size_t maxItems, double window) :
+	mArena(maxBytes),
+	mTail(0),
+	mUsed(0),
+	mMaxItems(maxItems ? maxItems : 1),
+	mWindow(window)
+{
+}
+
+//************************************************************************
+// function to copy a record into the arena.
+// The records sit in the arena in the order they were added, wrapping
+// back to the start when the end is reached, so the records in the way
+// of the new one are always the oldest ones.
+bool DataCache::add(const string & record, double now)
+{
+	size_t length = record.size();
+	if ( (length == 0) || (length > mArena.size()) )
+	{
+		return(false);
+	}
+	
+	while (mRecords.size() >= mMaxItems)
+	{
+		evictFront();
+	}
+	
+	if (mRecords.empty())
+	{
+		mTail = 0;
+	}
+	
+	// Not enough room before the end. Everything from the previous lap
+	// between here and the end goes, then start over at the front
+	if (mTail + length > mArena.size())
+	{
+		while ( !mRecords.empty() && (mRecords.front().offset >= mTail) )
+		{
+			evictFront();
+		}
+		mTail = 0;
+	}
+	
+	// Evict the records of the previous lap that the new one overlaps
+	while ( !mRecords.empty() && (mRecords.front().offset >= mTail) && (mRecords.front().offset < mTail + length) )
+	{
+		evictFront();
+	}
+	
+	memcpy(&mArena[mTail], record.data(), length);
+	Record entry = {mTail, (uint32_t)length, now};
+	mRecords.push_back(entry);
+	mTail += length;
+	mUsed += length;
+	return(true);
+}
+
+//************************************************************************
+void DataCache::get(vector<string> & records, double now)
+{
+	expire(now);
+	records.reserve(records.size() + mRecords.size());
+	for (auto & entry : mRecords)
+	{
+		records.push_back(string(&mArena[entry.offset], entry.length));
+	}
+}
+
+//************************************************************************
+void DataCache::evictFront()
+{
+	mUsed -= mRecords.front().length;
+	mRecords.pop_front();
+}
+
+//************************************************************************
+void DataCache::expire(double now)
+{
+	if (mWindow <= 0)
+	{
+		return;
+	}
+	while ( !mRecords.empty() && ((now - mRecords.front().time) > mWindow) )
+	{
+		evictFront();
+	}
+}
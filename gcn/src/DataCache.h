@@ -0,0 +1,85 @@
+/*
+ * Group Centric Networking
+ *
+ * Copyright (C) 2015 Massachusetts Institute of Technology
+ * All rights reserved.
+ *
+ * Authors:
+ *           Patricia Deutsch         <patricia.deutsch@ll.mit.edu>
+ *           Gregory Kuperman         <gkuperman@ll.mit.edu>
+ *           Leonid Veytser           <veytser@ll.mit.edu>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef DATA_CACHE_H
+#define DATA_CACHE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+
+using std::string;
+using std::vector;
+using std::deque;
+
+// Cache of the most recent DATA of one group, used to prime subscribers
+// that join late.
+//
+// The records (serialized DATA) are copied into one fixed size arena
+// that is written as a ring, so a group never holds more than its byte
+// limit and there is no allocation per record once the arena exists.
+// The oldest records are evicted when the arena is full, when there are
+// more than maxItems of them, or when they are older than the window.
+
+class DataCache
+{
+	public:
+		// maxBytes is the arena size, window in seconds (0 = no time limit)
+		DataCache(size_t maxBytes, size_t maxItems, double window);
+		
+		// Returns false if the record can never fit
+		bool add(const string & record, double now);
+		
+		// Get the records still in the window, oldest first
+		void get(vector<string> & records, double now);
+		
+		size_t size() const { return(mRecords.size()); }
+		size_t bytes() const { return(mUsed); }
+		
+	private:
+		struct Record
+		{
+			size_t		offset;
+			uint32_t	length;
+			double		time;
+		};
+		
+		void evictFront();
+		void expire(double now);
+		
+		vector<char>		mArena;
+		deque<Record>		mRecords;     // oldest first
+		size_t			mTail;        // where the next record is written
+		size_t			mUsed;        // bytes held by records
+		size_t			mMaxItems;
+		double			mWindow;
+};
+
+#endif //DATA_CACHE_H
@@ -0,0 +1,243 @@
+/*
+ * Group Centric Networking
+ *
+ * Copyright (C) 2015 Massachusetts Institute of Technology
+ * All rights reserved.
+ *
+ * Authors:
+ *           Patricia Deutsch         <patricia.deutsch@ll.mit.edu>
+ *           Gregory Kuperman         <gkuperman@ll.mit.edu>
+ *           Leonid Veytser           <veytser@ll.mit.edu>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "Fec.h"
+#include "GaloisField.h"
+#include <algorithm>
+#include <string.h>
+
+
+//************************************************************************
+string Fec::toSymbol(uint64_t seq, const string & data)
+{
+	string symbol(FEC_SYMBOL_HEADER + data.size(), '\0');
+	for (int i = 0; i < 8; i++)
+	{
+		symbol[i] = (char)((seq >> (8 * i)) & 0xff);
+	}
+	symbol[8] = (char)(data.size() & 0xff);
+	symbol[9] = (char)((data.size() >> 8) & 0xff);
+	memcpy(&symbol[FEC_SYMBOL_HEADER], data.data(), data.size());
+	return(symbol);
+}
+
+//************************************************************************
+bool Fec::fromSymbol(const string & symbol, uint64_t & seq, string & data)
+{
+	if (symbol.size() < FEC_SYMBOL_HEADER)
+	{
+		return(false);
+	}
+	
+	const uint8_t* p = (const uint8_t*)symbol.data();
+	seq = 0;
+	for (int i = 0; i < 8; i++)
+	{
+		seq |= ((uint64_t)p[i]) << (8 * i);
+	}
+	size_t len = p[8] | (p[9] << 8);
+	if (FEC_SYMBOL_HEADER + len > symbol.size())
+	{
+		return(false);
+	}
+	data.assign(symbol, FEC_SYMBOL_HEADER, len);
+	return(true);
+}
+
+//************************************************************************
+// Cauchy element 1 / (x_row + y_col) with x_row = k + row and y_col = col,
+// divided by the row 0 element of the same column so row 0 is all ones
+uint8_t Fec::coefficient(uint32_t k, uint32_t row, uint32_t col)
+{
+	if (row == 0)
+	{
+		return(1);
+	}
+	return(GaloisField::div((uint8_t)(k ^ col), (uint8_t)((k + row) ^ col)));
+}
+
+//************************************************************************
+bool Fec::encode(const vector<string> & source, uint32_t r, vector<string> & repair)
+{
+	uint32_t k = source.size();
+	if ( (k == 0) || (k + r > FEC_MAX_SYMBOLS) )
+	{
+		return(false);
+	}
+	
+	size_t len = 0;
+	for (auto & symbol : source)
+	{
+		len = std::max(len, symbol.size());
+	}
+	
+	repair.assign(r, string(len, '\0'));
+	for (uint32_t i = 0; i < r; i++)
+	{
+		uint8_t* out = (uint8_t*)&repair[i][0];
+		for (uint32_t j = 0; j < k; j++)
+		{
+			// the padding is zero so only the actual symbol bytes count
+			GaloisField::mulAddRegion(out, (const uint8_t*)source[j].data(), coefficient(k, i, j), source[j].size());
+		}
+	}
+	return(true);
+}
+
+//************************************************************************
+bool Fec::decode(uint32_t k, uint32_t r, map<uint32_t, string> & symbols)
+{
+	if ( (k == 0) || (k + r > FEC_MAX_SYMBOLS) )
+	{
+		return(false);
+	}
+	
+	vector<uint32_t> missing;
+	for (uint32_t j = 0; j < k; j++)
+	{
+		if (symbols.count(j) == 0)
+		{
+			missing.push_back(j);
+		}
+	}
+	if (missing.empty())
+	{
+		return(true);
+	}
+	
+	// Use one repair symbol for each missing source symbol
+	vector<uint32_t> rows;
+	for (auto it = symbols.lower_bound(k); (it != symbols.end()) && (rows.size() < missing.size()); ++it)
+	{
+		if (it->first < k + r)
+		{
+			rows.push_back(it->first - k);
+		}
+	}
+	if (rows.size() < missing.size())
+	{
+		return(false);
+	}
+	
+	size_t len = 0;
+	for (auto & symbol : symbols)
+	{
+		len = std::max(len, symbol.second.size());
+	}
+	
+	// Take the source symbols we have out of each repair symbol. What is
+	// left only depends on the missing source symbols
+	uint32_t m = missing.size();
+	vector<string> partial(m);
+	for (uint32_t a = 0; a < m; a++)
+	{
+		partial[a] = symbols[k + rows[a]];
+		partial[a].resize(len, '\0');
+		uint8_t* out = (uint8_t*)&partial[a][0];
+		for (auto it = symbols.begin(); (it != symbols.end()) && (it->first < k); ++it)
+		{
+			GaloisField::mulAddRegion(out, (const uint8_t*)it->second.data(), coefficient(k, rows[a], it->first), it->second.size());
+		}
+	}
+	
+	// Solve for the missing symbols. Any square part of a Cauchy matrix
+	// (and so of ours) can be inverted
+	vector<uint8_t> matrix(m * m);
+	for (uint32_t a = 0; a < m; a++)
+	{
+		for (uint32_t b = 0; b < m; b++)
+		{
+			matrix[a * m + b] = coefficient(k, rows[a], missing[b]);
+		}
+	}
+	if (!invert(matrix, m))
+	{
+		return(false);
+	}
+	
+	for (uint32_t b = 0; b < m; b++)
+	{
+		string recovered(len, '\0');
+		uint8_t* out = (uint8_t*)&recovered[0];
+		for (uint32_t a = 0; a < m; a++)
+		{
+			GaloisField::mulAddRegion(out, (const uint8_t*)partial[a].data(), matrix[b * m + a], len);
+		}
+		symbols[missing[b]] = recovered;
+	}
+	return(true);
+}
+
+//************************************************************************
+// Gauss-Jordan elimination. matrix is n x n stored by rows
+bool Fec::invert(vector<uint8_t> & matrix, uint32_t n)
+{
+	vector<uint8_t> result(n * n, 0);
+	for (uint32_t i = 0; i < n; i++)
+	{
+		result[i * n + i] = 1;
+	}
+	
+	for (uint32_t col = 0; col < n; col++)
+	{
+		// find a pivot
+		uint32_t pivot = col;
+		while ( (pivot < n) && (matrix[pivot * n + col] == 0) )
+		{
+			pivot++;
+		}
+		if (pivot == n)
+		{
+			return(false);
+		}
+		if (pivot != col)
+		{
+			std::swap_ranges(matrix.begin() + pivot * n, matrix.begin() + (pivot + 1) * n, matrix.begin() + col * n);
+			std::swap_ranges(result.begin() + pivot * n, result.begin() + (pivot + 1) * n, result.begin() + col * n);
+		}
+		
+		// scale the pivot row so the pivot is 1
+		uint8_t scale = GaloisField::inv(matrix[col * n + col]);
+		GaloisField::mulRegion(&matrix[col * n], scale, n);
+		GaloisField::mulRegion(&result[col * n], scale, n);
+		
+		// clear the column in every other row
+		for (uint32_t row = 0; row < n; row++)
+		{
+			uint8_t factor = matrix[row * n + col];
+			if ( (row != col) && factor )
+			{
+				GaloisField::mulAddRegion(&matrix[row * n], &matrix[col * n], factor, n);
+				GaloisField::mulAddRegion(&result[row * n], &result[col * n], factor, n);
+			}
+		}
+	}
+	
+	matrix.swap(result);
+	return(true);
+}
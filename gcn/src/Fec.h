@@ -0,0 +1,81 @@
+/*
+ * Group Centric Networking
+ *
+ * Copyright (C) 2015 Massachusetts Institute of Technology
+ * All rights reserved.
+ *
+ * Authors:
+ *           Patricia Deutsch         <patricia.deutsch@ll.mit.edu>
+ *           Gregory Kuperman         <gkuperman@ll.mit.edu>
+ *           Leonid Veytser           <veytser@ll.mit.edu>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef FEC_H
+#define FEC_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+
+using std::string;
+using std::vector;
+using std::map;
+
+// Systematic block FEC for the DATA messages of a group.
+//
+// A block is K source DATA messages followed by R repair DATA messages.
+// Source DATA are sent unchanged so subscribers that miss nothing never
+// decode. For coding, each source payload is turned into a symbol:
+//    sequence (8 bytes) | length (2 bytes) | data
+// zero padded to the longest symbol of the block. Repair symbol i is
+//    sum over j of C(i,j) * source symbol j
+// where C is a Cauchy matrix with its columns scaled so that the first
+// repair row is all ones. With R = 1 the code is plain XOR parity, with
+// R > 1 it is a Reed-Solomon (MDS) code: ANY K of the K+R symbols of a
+// block recover all the source symbols. K + R must not exceed 256.
+
+static const uint32_t FEC_MAX_SYMBOLS = 256;
+static const size_t FEC_SYMBOL_HEADER = 10;
+
+class Fec
+{
+	public:
+		// Convert between a source DATA payload and a symbol
+		static string toSymbol(uint64_t seq, const string & data);
+		static bool fromSymbol(const string & symbol, uint64_t & seq, string & data);
+		
+		// Coding coefficient for repair row "row" and source symbol "col"
+		static uint8_t coefficient(uint32_t k, uint32_t row, uint32_t col);
+		
+		// Compute the r repair symbols for the source symbols of a block
+		static bool encode(const vector<string> & source, uint32_t r, vector<string> & repair);
+		
+		// Recover the missing source symbols of a block.
+		// symbols holds what was received keyed by index in the block
+		// (0..k-1 source, k..k+r-1 repair). On success the missing source
+		// symbols are added to the map.
+		static bool decode(uint32_t k, uint32_t r, map<uint32_t, string> & symbols);
+		
+		// Invert a square matrix over GF(256) in place. Returns false if singular
+		static bool invert(vector<uint8_t> & matrix, uint32_t n);
+};
+
+#endif // FEC_H
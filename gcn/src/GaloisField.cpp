@@ -0,0 +1,361 @@
+/*
+ * Group Centric Networking
+ *
+ * Copyright (C) 2015 Massachusetts Institute of Technology
+ * All rights reserved.
+ *
+ * Authors:
+ *           Patricia Deutsch         <patricia.deutsch@ll.mit.edu>
+ *           Gregory Kuperman         <gkuperman@ll.mit.edu>
+ *           Leonid Veytser           <veytser@ll.mit.edu>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "GaloisField.h"
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GF_HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+static const unsigned int GF_POLYNOMIAL = 0x11d;
+
+// Lookup tables. Built once on first use
+struct GfTables
+{
+	uint8_t		exp[512];        // doubled so exp[log a + log b] needs no modulo
+	uint8_t		log[256];
+	uint8_t		mul[256][256];   // full multiply table used by the scalar kernel
+	uint8_t		lo[256][16];     // lo[c][n] = c * n        (low 4 bits of a byte)
+	uint8_t		hi[256][16];     // hi[c][n] = c * (n << 4) (high 4 bits of a byte)
+	
+	GfTables()
+	{
+		unsigned int x = 1;
+		for (int i = 0; i < 255; i++)
+		{
+			exp[i] = (uint8_t)x;
+			log[x] = (uint8_t)i;
+			x <<= 1;
+			if (x & 0x100)
+			{
+				x ^= GF_POLYNOMIAL;
+			}
+		}
+		for (int i = 255; i < 512; i++)
+		{
+			exp[i] = exp[i - 255];
+		}
+		log[0] = 0;
+		
+		for (int a = 0; a < 256; a++)
+		{
+			for (int b = 0; b < 256; b++)
+			{
+				mul[a][b] = (a && b) ? exp[log[a] + log[b]] : 0;
+			}
+			for (int n = 0; n < 16; n++)
+			{
+				lo[a][n] = mul[a][n];
+				hi[a][n] = mul[a][n << 4];
+			}
+		}
+	}
+};
+
+static const GfTables & tables()
+{
+	static GfTables t;
+	return(t);
+}
+
+typedef void (*MulAddFunc)(uint8_t* dst, const uint8_t* src, uint8_t c, size_t len);
+typedef void (*MulFunc)(uint8_t* dst, uint8_t c, size_t len);
+
+
+//************************************************************************
+// Scalar kernels
+static void mulAddScalar(uint8_t* dst, const uint8_t* src, uint8_t c, size_t len)
+{
+	const uint8_t* row = tables().mul[c];
+	for (size_t i = 0; i < len; i++)
+	{
+		dst[i] ^= row[src[i]];
+	}
+}
+
+static void mulScalar(uint8_t* dst, uint8_t c, size_t len)
+{
+	const uint8_t* row = tables().mul[c];
+	for (size_t i = 0; i < len; i++)
+	{
+		dst[i] = row[dst[i]];
+	}
+}
+
+
+#ifdef GF_HAVE_X86
+//************************************************************************
+// SSSE3 kernels. 16 bytes per step
+__attribute__ ((target("ssse3")))
+static void mulAddSsse3(uint8_t* dst, const uint8_t* src, uint8_t c, size_t len)
+{
+	const GfTables & t = tables();
+	const __m128i lo = _mm_loadu_si128((const __m128i*)t.lo[c]);
+	const __m128i hi = _mm_loadu_si128((const __m128i*)t.hi[c]);
+	const __m128i mask = _mm_set1_epi8(0x0f);
+	
+	size_t i = 0;
+	for (; i + 16 <= len; i += 16)
+	{
+		__m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+		__m128i l = _mm_shuffle_epi8(lo, _mm_and_si128(s, mask));
+		__m128i h = _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi64(s, 4), mask));
+		__m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_xor_si128(d, _mm_xor_si128(l, h)));
+	}
+	mulAddScalar(dst + i, src + i, c, len - i);
+}
+
+__attribute__ ((target("ssse3")))
+static void mulSsse3(uint8_t* dst, uint8_t c, size_t len)
+{
+	const GfTables & t = tables();
+	const __m128i lo = _mm_loadu_si128((const __m128i*)t.lo[c]);
+	const __m128i hi = _mm_loadu_si128((const __m128i*)t.hi[c]);
+	const __m128i mask = _mm_set1_epi8(0x0f);
+	
+	size_t i = 0;
+	for (; i + 16 <= len; i += 16)
+	{
+		__m128i s = _mm_loadu_si128((const __m128i*)(dst + i));
+		__m128i l = _mm_shuffle_epi8(lo, _mm_and_si128(s, mask));
+		__m128i h = _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi64(s, 4), mask));
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_xor_si128(l, h));
+	}
+	mulScalar(dst + i, c, len - i);
+}
+
+//************************************************************************
+// AVX2 kernels. 32 bytes per step. The 16 entry tables are copied into
+// both 128 bit lanes since the shuffle works within each lane
+__attribute__ ((target("avx2")))
+static void mulAddAvx2(uint8_t* dst, const uint8_t* src, uint8_t c, size_t len)
+{
+	const GfTables & t = tables();
+	const __m256i lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)t.lo[c]));
+	const __m256i hi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)t.hi[c]));
+	const __m256i mask = _mm256_set1_epi8(0x0f);
+	
+	size_t i = 0;
+	for (; i + 32 <= len; i += 32)
+	{
+		__m256i s = _mm256_loadu_si256((const __m256i*)(src + i));
+		__m256i l = _mm256_shuffle_epi8(lo, _mm256_and_si256(s, mask));
+		__m256i h = _mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi64(s, 4), mask));
+		__m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+		_mm256_storeu_si256((__m256i*)(dst + i), _mm256_xor_si256(d, _mm256_xor_si256(l, h)));
+	}
+	mulAddScalar(dst + i, src + i, c, len - i);
+}
+
+__attribute__ ((target("avx2")))
+static void mulAvx2(uint8_t* dst, uint8_t c, size_t len)
+{
+	const GfTables & t = tables();
+	const __m256i lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)t.lo[c]));
+	const __m256i hi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)t.hi[c]));
+	const __m256i mask = _mm256_set1_epi8(0x0f);
+	
+	size_t i = 0;
+	for (; i + 32 <= len; i += 32)
+	{
+		__m256i s = _mm256_loadu_si256((const __m256i*)(dst + i));
+		__m256i l = _mm256_shuffle_epi8(lo, _mm256_and_si256(s, mask));
+		__m256i h = _mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi64(s, 4), mask));
+		_mm256_storeu_si256((__m256i*)(dst + i), _mm256_xor_si256(l, h));
+	}
+	mulScalar(dst + i, c, len - i);
+}
+#endif // GF_HAVE_X86
+
+
+//************************************************************************
+// Kernel dispatch. Picks the best kernel the first time it is used
+struct GfDispatch
+{
+	GfKernel	kernel;
+	MulAddFunc	mulAdd;
+	MulFunc		mul;
+	
+	GfDispatch()
+	{
+		kernel = GF_KERNEL_SCALAR;
+		if (GaloisField::kernelSupported(GF_KERNEL_AVX2))
+		{
+			kernel = GF_KERNEL_AVX2;
+		}
+		else if (GaloisField::kernelSupported(GF_KERNEL_SSSE3))
+		{
+			kernel = GF_KERNEL_SSSE3;
+		}
+		set(kernel);
+	}
+	
+	void set(GfKernel k)
+	{
+		kernel = k;
+		switch (k)
+		{
+#ifdef GF_HAVE_X86
+			case GF_KERNEL_AVX2:
+				mulAdd = mulAddAvx2;
+				mul = mulAvx2;
+				break;
+			case GF_KERNEL_SSSE3:
+				mulAdd = mulAddSsse3;
+				mul = mulSsse3;
+				break;
+#endif
+			default:
+				kernel = GF_KERNEL_SCALAR;
+				mulAdd = mulAddScalar;
+				mul = mulScalar;
+				break;
+		}
+	}
+};
+
+static GfDispatch & dispatch()
+{
+	static GfDispatch d;
+	return(d);
+}
+
+
+//************************************************************************
+uint8_t GaloisField::mul(uint8_t a, uint8_t b)
+{
+	return(tables().mul[a][b]);
+}
+
+//************************************************************************
+// NOTE: division by 0 returns 0. Callers never divide by 0
+uint8_t GaloisField::div(uint8_t a, uint8_t b)
+{
+	if ( (a == 0) || (b == 0) )
+	{
+		return(0);
+	}
+	const GfTables & t = tables();
+	return(t.exp[t.log[a] + 255 - t.log[b]]);
+}
+
+//************************************************************************
+uint8_t GaloisField::inv(uint8_t a)
+{
+	return(div(1, a));
+}
+
+//************************************************************************
+void GaloisField::mulAddRegion(uint8_t* dst, const uint8_t* src, uint8_t c, size_t len)
+{
+	if (c == 0)
+	{
+		return;
+	}
+	if (c == 1)
+	{
+		addRegion(dst, src, len);
+		return;
+	}
+	dispatch().mulAdd(dst, src, c, len);
+}
+
+//************************************************************************
+void GaloisField::mulRegion(uint8_t* dst, uint8_t c, size_t len)
+{
+	if (c == 0)
+	{
+		memset(dst, 0, len);
+		return;
+	}
+	if (c == 1)
+	{
+		return;
+	}
+	dispatch().mul(dst, c, len);
+}
+
+//************************************************************************
+// Plain XOR, 8 bytes at a time so it is not byte by byte in a build
+// without optimization (an optimized build vectorizes it further)
+void GaloisField::addRegion(uint8_t* dst, const uint8_t* src, size_t len)
+{
+	size_t i = 0;
+	for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t))
+	{
+		uint64_t a, b;
+		memcpy(&a, dst + i, sizeof(a));
+		memcpy(&b, src + i, sizeof(b));
+		a ^= b;
+		memcpy(dst + i, &a, sizeof(a));
+	}
+	for (; i < len; i++)
+	{
+		dst[i] ^= src[i];
+	}
+}
+
+//************************************************************************
+bool GaloisField::kernelSupported(GfKernel kernel)
+{
+	switch (kernel)
+	{
+		case GF_KERNEL_SCALAR:
+			return(true);
+#ifdef GF_HAVE_X86
+		case GF_KERNEL_SSSE3:
+			__builtin_cpu_init();
+			return(__builtin_cpu_supports("ssse3"));
+		case GF_KERNEL_AVX2:
+			__builtin_cpu_init();
+			return(__builtin_cpu_supports("avx2"));
+#endif
+		default:
+			return(false);
+	}
+}
+
+//************************************************************************
+bool GaloisField::setKernel(GfKernel kernel)
+{
+	if (!kernelSupported(kernel))
+	{
+		return(false);
+	}
+	dispatch().set(kernel);
+	return(true);
+}
+
+//************************************************************************
+GfKernel GaloisField::getKernel()
+{
+	return(dispatch().kernel);
+}
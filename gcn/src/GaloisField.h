@@ -0,0 +1,81 @@
+/*
+ * Group Centric Networking
+ *
+ * Copyright (C) 2015 Massachusetts Institute of Technology
+ * All rights reserved.
+ *
+ * Authors:
+ *           Patricia Deutsch         <patricia.deutsch@ll.mit.edu>
+ *           Gregory Kuperman         <gkuperman@ll.mit.edu>
+ *           Leonid Veytser           <veytser@ll.mit.edu>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef GALOIS_FIELD_H
+#define GALOIS_FIELD_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Arithmetic over GF(2^8) with the primitive polynomial x^8+x^4+x^3+x^2+1 (0x11d).
+//
+// Addition is XOR. Multiplication of single values uses log/exp tables.
+// The region functions work on whole packet payloads and are what the
+// FEC and network coding code spends its time in. They use the fastest
+// kernel the CPU supports:
+//   - AVX2 and SSSE3 kernels split each byte into two 4-bit halves and use
+//     shuffle instructions as 16 entry lookup tables (one for each half)
+//   - the scalar kernel uses one row of a full 256x256 multiply table
+// The kernel is picked at run time so the same binary runs on any x86 CPU
+// (and on non x86 builds only the scalar kernel exists).
+
+enum GfKernel
+{
+	GF_KERNEL_SCALAR = 0,
+	GF_KERNEL_SSSE3,
+	GF_KERNEL_AVX2,
+	GF_KERNEL_MAX
+};
+
+static const char __attribute__ ((used)) *GfKernelStr[] = { "scalar", "ssse3", "avx2" };
+
+class GaloisField
+{
+	public:
+		static uint8_t add(uint8_t a, uint8_t b) { return(a ^ b); }
+		static uint8_t mul(uint8_t a, uint8_t b);
+		static uint8_t div(uint8_t a, uint8_t b);
+		static uint8_t inv(uint8_t a);
+		
+		// dst[i] ^= c * src[i]
+		static void mulAddRegion(uint8_t* dst, const uint8_t* src, uint8_t c, size_t len);
+		// dst[i] = c * dst[i]
+		static void mulRegion(uint8_t* dst, uint8_t c, size_t len);
+		// dst[i] ^= src[i]
+		static void addRegion(uint8_t* dst, const uint8_t* src, size_t len);
+		
+		// Kernel selection. The best supported kernel is used by default.
+		// setKernel is for benchmarking and returns false if the CPU does
+		// not support the kernel.
+		static bool kernelSupported(GfKernel kernel);
+		static bool setKernel(GfKernel kernel);
+		static GfKernel getKernel();
+};
+
+#endif // GALOIS_FIELD_H
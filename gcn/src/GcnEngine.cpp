@@ -0,0 +1,128 @@
+/*
+ * Group Centric Networking
+ *
+ * Copyright (C) 2015 Massachusetts Institute of Technology
+ * All rights reserved.
+ *
+ * Authors:
+ *           Patricia Deutsch         <patricia.deutsch@ll.mit.edu>
+ *           Gregory Kuperman         <gkuperman@ll.mit.edu>
+ *           Leonid Veytser           <veytser@ll.mit.edu>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "GcnEngine.h"
+
+
+//************************************************************************
+GcnEngine::GcnEngine(const GcnServiceConfig & config, io_service * io_serv)
+: mService(config, io_serv),
+  mStarted(false)
+{
+}
+
+//************************************************************************
+GcnEngine::~GcnEngine()
+{
+	Stop();
+}
+
+//************************************************************************
+void GcnEngine::Start()
+{
+	if (!mStarted)
+	{
+		mService.Start();
+		mStarted = true;
+	}
+}
+
+//************************************************************************
+// The io_service is left running. It returns from run() once nothing
+// else the app gave it is pending
+void GcnEngine::Stop()
+{
+	if (mStarted)
+	{
+		mService.Stop();
+		mStarted = false;
+	}
+}
+
+//************************************************************************
+GcnApp GcnEngine::attach(function<void(const AppMessage & message)> handler)
+{
+	return(mService.attachLocalApp(handler));
+}
+
+//************************************************************************
+void GcnEngine::detach(GcnApp app)
+{
+	mService.closeClientConnection(app);
+}
+
+//************************************************************************
+void GcnEngine::send(GcnApp app, AppMessage & message)
+{
+	mService.processAppMessage(app, message);
+}
+
+//************************************************************************
+void GcnEngine::subscribe(GcnApp app, GroupId gid)
+{
+	AppMessage message;
+	message.add_pull()->set_gid(gid);
+	send(app, message);
+}
+
+//************************************************************************
+void GcnEngine::unsubscribe(GcnApp app, GroupId gid)
+{
+	AppMessage message;
+	message.add_unpull()->set_gid(gid);
+	send(app, message);
+}
+
+//************************************************************************
+void GcnEngine::advertise(GcnApp app, GroupId gid, uint32_t srcttl)
+{
+	AppMessage message;
+	auto pAdvertise = message.add_advertise();
+	pAdvertise->set_gid(gid);
+	pAdvertise->set_srcttl(srcttl);
+	pAdvertise->set_type(REGISTER);
+	send(app, message);
+}
+
+//************************************************************************
+void GcnEngine::publish(GcnApp app, GroupId gid, const char* payload, size_t length, uint32_t srcttl)
+{
+	AppMessage message;
+	auto pData = message.add_data();
+	pData->set_gid(gid);
+	pData->set_srcttl(srcttl);
+	pData->set_data(payload, length);
+	send(app, message);
+}
+
+//************************************************************************
+void GcnEngine::setDataReducer(GroupId gid, DataReducer reducer)
+{
+	mService.setDataReducer(gid, reducer);
+}
@@ -0,0 +1,87 @@
+/*
+ * Group Centric Networking
+ *
+ * Copyright (C) 2015 Massachusetts Institute of Technology
+ * All rights reserved.
+ *
+ * Authors:
+ *           Patricia Deutsch         <patricia.deutsch@ll.mit.edu>
+ *           Gregory Kuperman         <gkuperman@ll.mit.edu>
+ *           Leonid Veytser           <veytser@ll.mit.edu>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef GCN_ENGINE_H
+#define GCN_ENGINE_H
+
+#include "gcnService.h"
+
+// In-process GCN.
+//
+// This is the GCN the gcn daemon runs, on the app's own io_service. Apps
+// in the same process attach to it and exchange AppMessages with it
+// through callbacks, so nothing goes through a socket or is serialized on
+// the way. Apps in other processes can still connect on config.appPort
+// unless it is 0.
+//
+// Several engines may run in one process (on one io_service or several),
+// for example to test a handful of nodes together. Everything must be
+// called from the thread running the engine's io_service, and the engine
+// must not be destroyed while that io_service may still run its handlers.
+
+typedef shared_ptr<ClientSession> GcnApp;
+
+class GcnEngine
+{
+	public:
+		GcnEngine(const GcnServiceConfig & config, io_service * io_serv);
+		~GcnEngine();
+		void Start();
+		void Stop();
+		
+		// handler gets every AppMessage the GCN has for the app: DATA for the
+		// groups it pulled, PULL/UNPULL and RATECONTROL for the groups it
+		// advertised
+		GcnApp attach(function<void(const AppMessage & message)> handler);
+		// the GCN forgets the app's groups as if its socket had closed
+		void detach(GcnApp app);
+		
+		// gives the GCN a message from the app, as if it came on the socket
+		void send(GcnApp app, AppMessage & message);
+		
+		// shortcuts for the usual messages
+		void subscribe(GcnApp app, GroupId gid);
+		void unsubscribe(GcnApp app, GroupId gid);
+		// register as a source of gid that floods its DATA srcttl hops
+		// (no ADVERTISE/ACK)
+		void advertise(GcnApp app, GroupId gid, uint32_t srcttl);
+		void publish(GcnApp app, GroupId gid, const char* payload, size_t length, uint32_t srcttl);
+		
+		// combines the unicast DATA a relay holds for gid (see -A) into one
+		// payload before it is sent on. An empty reducer removes it.
+		void setDataReducer(GroupId gid, DataReducer reducer);
+		
+		GcnService & service() { return mService; }
+		
+	private:
+		GcnService mService;
+		bool mStarted;
+};
+
+#endif // GCN_ENGINE_H
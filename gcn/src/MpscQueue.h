@@ -0,0 +1,108 @@
+/*
+ * Group Centric Networking
+ *
+ * Copyright (C) 2015 Massachusetts Institute of Technology
+ * All rights reserved.
+ *
+ * Authors:
+ *           Patricia Deutsch         <patricia.deutsch@ll.mit.edu>
+ *           Gregory Kuperman         <gkuperman@ll.mit.edu>
+ *           Leonid Veytser           <veytser@ll.mit.edu>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef MPSC_QUEUE_H
+#define MPSC_QUEUE_H
+
+#include <atomic>
+#include <utility>
+
+using std::atomic;
+
+// Unbounded lock-free queue with many producers and one consumer.
+//
+// Any thread may push. Only one thread may pop. A push is one atomic
+// exchange on the head followed by linking the old head to the new node,
+// so producers never wait on each other or on the consumer. Between those
+// two steps the node is not reachable yet and pop reports the queue empty;
+// whoever pushed it is still responsible for telling the consumer.
+//
+// The consumer owns a dummy node at the tail. Popping moves the value out
+// of the node after the dummy, which then becomes the new dummy.
+
+template <typename T>
+class MpscQueue
+{
+	public:
+		MpscQueue()
+		{
+			Node* stub = new Node;
+			mHead.store(stub, std::memory_order_relaxed);
+			mTail = stub;
+		}
+		
+		~MpscQueue()
+		{
+			while (mTail)
+			{
+				Node* next = mTail->next.load(std::memory_order_relaxed);
+				delete mTail;
+				mTail = next;
+			}
+		}
+		
+		// any thread
+		void push(T && value)
+		{
+			Node* node = new Node;
+			node->value = std::move(value);
+			Node* prev = mHead.exchange(node, std::memory_order_acq_rel);
+			prev->next.store(node, std::memory_order_release);
+		}
+		
+		// consumer thread only. Returns false if there is nothing to pop
+		bool pop(T & value)
+		{
+			Node* next = mTail->next.load(std::memory_order_acquire);
+			if (!next)
+			{
+				return(false);
+			}
+			value = std::move(next->value);
+			delete mTail;
+			mTail = next;
+			return(true);
+		}
+		
+	private:
+		struct Node
+		{
+			Node() : next(nullptr) {}
+			atomic<Node*>	next;
+			T				value;
+		};
+		
+		MpscQueue(const MpscQueue &);
+		MpscQueue & operator=(const MpscQueue &);
+		
+		atomic<Node*>	mHead;   // last node pushed
+		Node*			mTail;   // dummy in front of the next node to pop
+};
+
+#endif // MPSC_QUEUE_H
@@ -0,0 +1,164 @@
+/*
+ * Group Centric Networking
+ *
+ * Copyright (C) 2015 Massachusetts Institute of Technology
+ * All rights reserved.
+ *
+ * Authors:
+ *           Patricia Deutsch         <patricia.deutsch@ll.mit.edu>
+ *           Gregory Kuperman         <gkuperman@ll.mit.edu>
+ *           Leonid Veytser           <veytser@ll.mit.edu>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "NetworkCoding.h"
+#include "GaloisField.h"
+#include <stdlib.h>
+
+
+//************************************************************************
+void RlncGeneration::init(uint32_t size)
+{
+	mSize = size;
+	mLength = 0;
+	mCoefficients.clear();
+	mPayloads.clear();
+	mPivots.clear();
+}
+
+//************************************************************************
+bool RlncGeneration::add(const string & coefficients, const string & payload)
+{
+	if ( (mSize == 0) || (coefficients.size() != mSize) || complete() )
+	{
+		return(false);
+	}
+	
+	// Make all the payloads the same length
+	if (payload.size() > mLength)
+	{
+		mLength = payload.size();
+		for (auto & row : mPayloads)
+		{
+			row.resize(mLength, '\0');
+		}
+	}
+	string coef(coefficients);
+	string data(payload);
+	data.resize(mLength, '\0');
+	uint8_t* c = (uint8_t*)&coef[0];
+	uint8_t* d = (uint8_t*)&data[0];
+	
+	// Eliminate the pivot columns we already have
+	for (uint32_t row = 0; row < mPivots.size(); row++)
+	{
+		uint8_t factor = c[mPivots[row]];
+		if (factor)
+		{
+			GaloisField::mulAddRegion(c, (const uint8_t*)mCoefficients[row].data(), factor, mSize);
+			GaloisField::mulAddRegion(d, (const uint8_t*)mPayloads[row].data(), factor, mLength);
+		}
+	}
+	
+	// Anything left?
+	uint32_t pivot = 0;
+	while ( (pivot < mSize) && (c[pivot] == 0) )
+	{
+		pivot++;
+	}
+	if (pivot == mSize)
+	{
+		return(false);
+	}
+	
+	// Normalize so the pivot is 1 then clear the pivot column from the
+	// other rows to keep the reduced row echelon form
+	uint8_t scale = GaloisField::inv(c[pivot]);
+	GaloisField::mulRegion(c, scale, mSize);
+	GaloisField::mulRegion(d, scale, mLength);
+	for (uint32_t row = 0; row < mPivots.size(); row++)
+	{
+		uint8_t factor = (uint8_t)mCoefficients[row][pivot];
+		if (factor)
+		{
+			GaloisField::mulAddRegion((uint8_t*)&mCoefficients[row][0], c, factor, mSize);
+			GaloisField::mulAddRegion((uint8_t*)&mPayloads[row][0], d, factor, mLength);
+		}
+	}
+	
+	mCoefficients.push_back(coef);
+	mPayloads.push_back(data);
+	mPivots.push_back(pivot);
+	return(true);
+}
+
+//************************************************************************
+bool RlncGeneration::getDecoded(uint32_t index, string & symbol) const
+{
+	for (uint32_t row = 0; row < mPivots.size(); row++)
+	{
+		if (mPivots[row] != index)
+		{
+			continue;
+		}
+		
+		// Decoded if the pivot is the only non-zero coefficient
+		const string & coef = mCoefficients[row];
+		for (uint32_t col = 0; col < mSize; col++)
+		{
+			if ( (col != index) && coef[col] )
+			{
+				return(false);
+			}
+		}
+		symbol = mPayloads[row];
+		return(true);
+	}
+	return(false);
+}
+
+//************************************************************************
+bool RlncGeneration::recode(string & coefficients, string & payload) const
+{
+	if (mPivots.empty())
+	{
+		return(false);
+	}
+	
+	coefficients.assign(mSize, '\0');
+	payload.assign(mLength, '\0');
+	for (uint32_t row = 0; row < mPivots.size(); row++)
+	{
+		// random non-zero coefficient
+		uint8_t factor = (uint8_t)((rand() % 255) + 1);
+		GaloisField::mulAddRegion((uint8_t*)&coefficients[0], (const uint8_t*)mCoefficients[row].data(), factor, mSize);
+		GaloisField::mulAddRegion((uint8_t*)&payload[0], (const uint8_t*)mPayloads[row].data(), factor, mLength);
+	}
+	return(true);
+}
+
+//************************************************************************
+string RlncGeneration::unitVector(uint32_t size, uint32_t index)
+{
+	string coefficients(size, '\0');
+	if (index < size)
+	{
+		coefficients[index] = 1;
+	}
+	return(coefficients);
+}
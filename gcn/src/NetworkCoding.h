@@ -0,0 +1,88 @@
+/*
+ * Group Centric Networking
+ *
+ * Copyright (C) 2015 Massachusetts Institute of Technology
+ * All rights reserved.
+ *
+ * Authors:
+ *           Patricia Deutsch         <patricia.deutsch@ll.mit.edu>
+ *           Gregory Kuperman         <gkuperman@ll.mit.edu>
+ *           Leonid Veytser           <veytser@ll.mit.edu>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef NETWORK_CODING_H
+#define NETWORK_CODING_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+// Random linear network coding (RLNC) over GF(256).
+//
+// A generation is N source symbols (see Fec.h for the symbol format). A
+// coded packet carries N coefficients and the matching linear combination
+// of the source symbols. Every node that handles a coded flow keeps, for
+// each recent generation, the coded packets it received in reduced row
+// echelon form:
+//   - a packet is innovative when it increases the rank. Packets that are
+//     not innovative carry nothing new and are dropped, which replaces the
+//     hash check used for uncoded DATA
+//   - once a row has a single non-zero coefficient that source symbol is
+//     decoded, so subscribers can deliver DATA before the whole generation
+//     is in
+//   - relays send a random combination of all their rows instead of a copy
+//     of the packet they just received (recoding)
+// The row operations run on the GaloisField region kernels.
+
+class RlncGeneration
+{
+	public:
+		RlncGeneration() : mSize(0), mLength(0) {}
+		
+		void init(uint32_t size);
+		uint32_t size() const { return(mSize); }
+		uint32_t rank() const { return(mPivots.size()); }
+		bool complete() const { return( (mSize > 0) && (rank() == mSize) ); }
+		
+		// Add a coded packet. Returns true if it was innovative
+		bool add(const string & coefficients, const string & payload);
+		
+		// Get source symbol "index" if it has been decoded
+		bool getDecoded(uint32_t index, string & symbol) const;
+		
+		// Make a new random combination of everything we have.
+		// Returns false if we have nothing yet
+		bool recode(string & coefficients, string & payload) const;
+		
+		// Coefficient vector of a source symbol sent as is
+		static string unitVector(uint32_t size, uint32_t index);
+		
+	private:
+		uint32_t				mSize;
+		size_t				mLength;        // longest payload seen. Shorter ones are zero padded
+		vector<string>		mCoefficients;  // one row per innovative packet
+		vector<string>		mPayloads;
+		vector<uint32_t>	mPivots;        // pivot column of each row
+};
+
+#endif // NETWORK_CODING_H
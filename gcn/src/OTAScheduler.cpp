@@ -0,0 +1,283 @@
+/*
+ * Group Centric Networking
+ *
+ * Copyright (C) 2015 Massachusetts Institute of Technology
+ * All rights reserved.
+ *
+ * Authors:
+ *           Patricia Deutsch         <patricia.deutsch@ll.mit.edu>
+ *           Gregory Kuperman         <gkuperman@ll.mit.edu>
+ *           Leonid Veytser           <veytser@ll.mit.edu>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "OTAScheduler.h"
+
+
+//************************************************************************
+OTAScheduler::OTAScheduler(io_service & io, OTASession & session) :
+	mOTASession(session),
+	mPaceTimer(io),
+	mTimerSet(false),
+	mInFlight(false),
+	mAlive(make_shared<int>(0)),
+	mRate(0),
+	mBucket(MAX_BUFFER_SIZE),
+	mTokens(MAX_BUFFER_SIZE),
+	mLastRefill(0),
+	mQuantum(MAX_BUFFER_SIZE),
+	mMaxQueue(1),
+	mTurnStarted(false)
+{
+	memset(mStats, 0, sizeof(mStats));
+	
+	weak_ptr<int> alive(mAlive);
+	mOTASession.setWrittenHandler([this, alive]()
+	                              {
+		                              if (!alive.expired())
+		                              {
+			                              OnWritten();
+		                              }
+	                              });
+}
+
+//************************************************************************
+void OTAScheduler::configure(double rate, uint32_t bucket, uint32_t quantum, size_t maxQueue)
+{
+	mRate = rate / 8;
+
+	// The bucket must hold the largest frame or that frame would never go out
+	mBucket = (bucket > MAX_BUFFER_SIZE) ? bucket : MAX_BUFFER_SIZE;
+	mTokens = mBucket;
+	mLastRefill = getTimeSec();
+	mQuantum = quantum ? quantum : 1;
+	mMaxQueue = maxQueue ? maxQueue : 1;
+}
+
+//************************************************************************
+void OTAScheduler::enqueue(GroupId gid, BufferPtr pBuffer, int length, bool ctrlPkt, int priority, const DeviceSet & devices, 
+                           double deadline, const unsigned char* destHwAddress)
+{
+	OTAClassStats & stats = mStats[ctrlPkt ? OTA_CLASS_CTRL : OTA_CLASS_DATA];
+	
+	// With nothing queued and the last frame out this one is next anyway,
+	// so it goes straight out without a trip through the queues
+	if ( !mInFlight && !mTimerSet && mCtrlQueue.empty() && mActive.empty() && takeTokens(length) )
+	{
+		mInFlight = mOTASession.write(gid, pBuffer, length, ctrlPkt, priority, devices, destHwAddress);
+		stats.sent++;
+		return;
+	}
+	
+	Frame frame;
+	frame.gid = gid;
+	frame.pBuffer = pBuffer;
+	frame.length = length;
+	frame.priority = priority;
+	frame.devices = devices;
+	frame.deadline = deadline;
+	frame.directed = (destHwAddress != NULL);
+	if (frame.directed)
+	{
+		memcpy(frame.destHwAddress, destHwAddress, ETH_ALEN);
+	}
+
+	if (ctrlPkt)
+	{
+		if (mCtrlQueue.size() >= mMaxQueue)
+		{
+			stats.dropOverflow++;
+			return;
+		}
+		mCtrlQueue.push_back(frame);
+	}
+	else
+	{
+		GroupQueue & queue = mDataQueues[gid];
+		if (queue.frames.size() >= mMaxQueue)
+		{
+			stats.dropOverflow++;
+			return;
+		}
+
+		// A group that had nothing queued joins the end of the round
+		if (queue.frames.empty())
+		{
+			queue.deficit = 0;
+			mActive.push_back(gid);
+		}
+		queue.frames.push_back(frame);
+	}
+
+	stats.depth++;
+	if (stats.depth > stats.maxDepth)
+	{
+		stats.maxDepth = stats.depth;
+	}
+
+	// If we are waiting on the pacing timer (or the last frame) the frame
+	// goes out when it fires
+	if (!mTimerSet)
+	{
+		service();
+	}
+}
+
+//************************************************************************
+void OTAScheduler::stop()
+{
+	mPaceTimer.cancel();
+	mTimerSet = false;
+	mInFlight = false;
+	mCtrlQueue.clear();
+	mDataQueues.clear();
+	mActive.clear();
+	mStats[OTA_CLASS_CTRL].depth = 0;
+	mStats[OTA_CLASS_DATA].depth = 0;
+}
+
+//************************************************************************
+// function to send the next frame if the last one is out and the token
+// bucket allows. Control frames first, then DATA deficit round robin
+// across groups.
+void OTAScheduler::service()
+{
+	while (!mCtrlQueue.empty())
+	{
+		if ( mInFlight || !takeTokens(mCtrlQueue.front().length) )
+		{
+			return;
+		}
+		send(mCtrlQueue.front(), OTA_CLASS_CTRL);
+		mCtrlQueue.pop_front();
+	}
+
+	double now = getTimeSec();
+	while (!mActive.empty())
+	{
+		GroupId gid = mActive.front();
+		GroupQueue & queue = mDataQueues[gid];
+
+		// Drop DATA that would be sent too late to be of use
+		while ( !queue.frames.empty() && queue.frames.front().deadline && (queue.frames.front().deadline < now) )
+		{
+			queue.frames.pop_front();
+			mStats[OTA_CLASS_DATA].depth--;
+			mStats[OTA_CLASS_DATA].dropDeadline++;
+		}
+
+		// A group with nothing left leaves the round and loses its deficit.
+		// Its (empty) queue is kept so the next burst does not allocate one
+		if (queue.frames.empty())
+		{
+			mActive.pop_front();
+			mTurnStarted = false;
+			continue;
+		}
+
+		if (!mTurnStarted)
+		{
+			queue.deficit += mQuantum;
+			mTurnStarted = true;
+		}
+
+		// Not enough deficit for the next frame so it is the next group's turn
+		Frame & frame = queue.frames.front();
+		if ((uint32_t)frame.length > queue.deficit)
+		{
+			mActive.pop_front();
+			mActive.push_back(gid);
+			mTurnStarted = false;
+			continue;
+		}
+
+		if ( mInFlight || !takeTokens(frame.length) )
+		{
+			return;
+		}
+		queue.deficit -= frame.length;
+		send(frame, OTA_CLASS_DATA);
+		queue.frames.pop_front();
+	}
+}
+
+//************************************************************************
+// function to take length bytes worth of tokens. If there are not enough
+// the pacing timer is set for when there will be.
+bool OTAScheduler::takeTokens(int length)
+{
+	if (mRate <= 0)
+	{
+		return(true);
+	}
+
+	double now = getTimeSec();
+	mTokens += (now - mLastRefill) * mRate;
+	if (mTokens > mBucket)
+	{
+		mTokens = mBucket;
+	}
+	mLastRefill = now;
+
+	if (mTokens >= length)
+	{
+		mTokens -= length;
+		return(true);
+	}
+
+	if (!mTimerSet)
+	{
+		double wait = (length - mTokens) / mRate;
+		mPaceTimer.expires_from_now(Microseconds((long)(wait * 1000000) + 1));
+		mPaceTimer.async_wait(boost::bind(&OTAScheduler::OnPaceTimeout, this, boost::asio::placeholders::error));
+		mTimerSet = true;
+	}
+	return(false);
+}
+
+//************************************************************************
+void OTAScheduler::send(Frame & frame, OTAClass otaClass)
+{
+	mInFlight = mOTASession.write(frame.gid, frame.pBuffer, frame.length, (otaClass == OTA_CLASS_CTRL), frame.priority, frame.devices,
+	                              (frame.directed ? frame.destHwAddress : NULL));
+	mStats[otaClass].sent++;
+	mStats[otaClass].depth--;
+}
+
+//************************************************************************
+void OTAScheduler::OnWritten()
+{
+	mInFlight = false;
+	if (!mTimerSet)
+	{
+		service();
+	}
+}
+
+//************************************************************************
+void OTAScheduler::OnPaceTimeout(const error_code & ec)
+{
+	// cancelled by stop(), which may be on the way to destroying us
+	if (ec == operation_aborted)
+	{
+		return;
+	}
+	mTimerSet = false;
+	service();
+}
@@ -0,0 +1,139 @@
+/*
+ * Group Centric Networking
+ *
+ * Copyright (C) 2015 Massachusetts Institute of Technology
+ * All rights reserved.
+ *
+ * Authors:
+ *           Patricia Deutsch         <patricia.deutsch@ll.mit.edu>
+ *           Gregory Kuperman         <gkuperman@ll.mit.edu>
+ *           Leonid Veytser           <veytser@ll.mit.edu>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef OTA_SCHEDULER_H
+#define OTA_SCHEDULER_H
+
+#include "Common.h"
+#include <deque>
+
+using std::deque;
+
+// Transmit scheduler in front of the OTA session.
+//
+// Control frames (ADVERTISE, ACK, REPAIR, NACK) have strict priority over
+// DATA. DATA frames are queued per group and served deficit round robin
+// so one busy group can not starve the others. Each DATA frame may have
+// a deadline after which it is dropped instead of sent late.
+//
+// Frames are written one at a time: the next one is picked when the OTA
+// session says the last one is out, so a burst queues up here (and is
+// sent in priority and round robin order) instead of in the device. With
+// a pacing rate the frames also leave through a token bucket.
+//
+// NOTE: the written handler the session is given only holds a weak_ptr
+// to the scheduler so it does nothing if the scheduler is gone.
+
+enum OTAClass
+{
+	OTA_CLASS_CTRL = 0,
+	OTA_CLASS_DATA,
+	OTA_CLASS_MAX
+};
+static const char __attribute__ ((used)) *OTAClassStr[] = { "ctrl", "data" };
+
+// Queue and drop counters per class
+struct OTAClassStats
+{
+	size_t			depth;         // frames queued now
+	size_t			maxDepth;      // most frames ever queued
+	unsigned int	sent;
+	unsigned int	dropDeadline;  // frames dropped because their deadline passed
+	unsigned int	dropOverflow;  // frames dropped because their queue was full
+};
+
+class OTAScheduler
+{
+	public:
+		OTAScheduler(io_service & io, OTASession & session);
+
+		// rate is in bits per second (0 = no pacing), bucket and quantum in bytes,
+		// maxQueue is the max frames queued per group (and for control)
+		void configure(double rate, uint32_t bucket, uint32_t quantum, size_t maxQueue);
+
+		// deadline is an absolute time from getTimeSec() (0 = never stale)
+		// devices are the OTA devices to send on (empty = all),
+		// destHwAddress the neighbor to send to (NULL = broadcast)
+		void enqueue(GroupId gid, BufferPtr pBuffer, int length, bool ctrlPkt, int priority, const DeviceSet & devices, 
+		             double deadline, const unsigned char* destHwAddress = NULL);
+
+		// drop everything queued
+		void stop();
+
+		const OTAClassStats & getStats(OTAClass otaClass) const { return mStats[otaClass]; }
+		size_t activeGroups() const { return mActive.size(); }
+
+	private:
+		struct Frame
+		{
+			GroupId		gid;
+			BufferPtr	pBuffer;
+			int			length;
+			int			priority;
+			DeviceSet	devices;
+			double		deadline;
+			bool		directed;
+			unsigned char	destHwAddress[ETH_ALEN];
+		};
+
+		// DATA queue for one group and its deficit counter
+		struct GroupQueue
+		{
+			deque<Frame>	frames;
+			uint32_t		deficit;
+		};
+
+		void service();
+		bool takeTokens(int length);
+		void send(Frame & frame, OTAClass otaClass);
+		void OnPaceTimeout(const error_code & ec);
+		void OnWritten();
+
+		OTASession &			mOTASession;
+		deadline_timer			mPaceTimer;
+		bool					mTimerSet;
+		bool					mInFlight;   // a frame was written and is not out yet
+		shared_ptr<int>			mAlive;      // see NOTE above
+
+		double					mRate;       // bytes per second
+		double					mBucket;     // bytes
+		double					mTokens;
+		double					mLastRefill;
+		uint32_t				mQuantum;
+		size_t					mMaxQueue;
+
+		deque<Frame>				mCtrlQueue;
+		map<GroupId, GroupQueue>	mDataQueues;
+		deque<GroupId>			mActive;     // groups with queued DATA in round robin order
+		bool					mTurnStarted; // front of mActive already got its quantum this round
+
+		OTAClassStats			mStats[OTA_CLASS_MAX];
+};
+
+#endif //OTA_SCHEDULER_H
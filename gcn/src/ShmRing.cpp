@@ -0,0 +1,344 @@
+/*
+ * Group Centric Networking
+ *
+ * Copyright (C) 2015 Massachusetts Institute of Technology
+ * All rights reserved.
+ *
+ * Authors:
+ *           Patricia Deutsch         <patricia.deutsch@ll.mit.edu>
+ *           Gregory Kuperman         <gkuperman@ll.mit.edu>
+ *           Leonid Veytser           <veytser@ll.mit.edu>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "ShmRing.h"
+#include <new>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Each message is its length followed by the bytes, padded so the next
+// length is aligned. A message that does not fit before the end of the
+// ring starts over at the front and leaves this marker behind.
+static const uint32_t SHM_WRAP = 0xFFFFFFFF;
+static const uint32_t SHM_ALIGN = 8;
+static const uint32_t SHM_MIN_RING_BYTES = 4096;
+
+static inline uint32_t recordSize(uint32_t length)
+{
+	return( (sizeof(uint32_t) + length + SHM_ALIGN - 1) & ~(SHM_ALIGN - 1) );
+}
+
+static inline size_t headerSize(size_t size)
+{
+	return( (size + 63) & ~(size_t)63 );
+}
+
+//************************************************************************
+size_t ShmRing::footprint(uint32_t size)
+{
+	return(headerSize(sizeof(Header)) + size);
+}
+
+//************************************************************************
+bool ShmRing::attach(void* base, uint32_t size, bool init)
+{
+	mHeader = static_cast<Header*>(base);
+	mData = static_cast<char*>(base) + headerSize(sizeof(Header));
+	mSize = size;
+	mBroken = false;
+	if (init)
+	{
+		new (mHeader) Header;
+		mHeader->head.store(0);
+		mHeader->tail.store(0);
+		mHeader->waiting.store(1);
+		mHeader->size = size;
+	}
+	return(mHeader->size == size);
+}
+
+//************************************************************************
+char* ShmRing::reserve(uint32_t length)
+{
+	uint32_t size = mSize;
+	uint32_t need = recordSize(length);
+	
+	// Anything bigger could never wrap into the space left behind it
+	if (need > size / 2)
+	{
+		return(NULL);
+	}
+	
+	uint32_t head = mHeader->head.load(std::memory_order_relaxed);
+	uint32_t tail = mHeader->tail.load(std::memory_order_acquire);
+	uint32_t free = size - (head - tail);
+	uint32_t pos = head & (size - 1);
+	uint32_t contiguous = size - pos;
+	
+	mSkip = 0;
+	if (contiguous < need)
+	{
+		if (free < contiguous + need)
+		{
+			return(NULL);
+		}
+		mSkip = contiguous;
+		pos = 0;
+	}
+	else if (free < need)
+	{
+		return(NULL);
+	}
+	return(mData + pos + sizeof(uint32_t));
+}
+
+//************************************************************************
+bool ShmRing::commit(uint32_t length)
+{
+	uint32_t head = mHeader->head.load(std::memory_order_relaxed);
+	uint32_t pos = head & (mSize - 1);
+	if (mSkip)
+	{
+		memcpy(mData + pos, &SHM_WRAP, sizeof(uint32_t));
+		pos = 0;
+	}
+	memcpy(mData + pos, &length, sizeof(uint32_t));
+	mHeader->head.store(head + mSkip + recordSize(length), std::memory_order_release);
+	mSkip = 0;
+	
+	// Pairs with the fence in sleep() so either the consumer sees this
+	// message or we see it waiting
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	return( mHeader->waiting.load(std::memory_order_relaxed) && mHeader->waiting.exchange(0) );
+}
+
+//************************************************************************
+bool ShmRing::write(const char* buffer, uint32_t length, bool & doorbell)
+{
+	char* pDest = reserve(length);
+	if (!pDest)
+	{
+		return(false);
+	}
+	memcpy(pDest, buffer, length);
+	doorbell = commit(length);
+	return(true);
+}
+
+//************************************************************************
+char* ShmRing::peek(uint32_t & length)
+{
+	uint32_t tail = mHeader->tail.load(std::memory_order_relaxed);
+	uint32_t head = mHeader->head.load(std::memory_order_acquire);
+	if ( (tail == head) || mBroken )
+	{
+		return(NULL);
+	}
+	
+	// The producer can not have written more than the ring holds, nor
+	// anywhere but on a record boundary
+	uint32_t used = head - tail;
+	uint32_t pos = tail & (mSize - 1);
+	if ( (used > mSize) || (used % SHM_ALIGN) || (pos % SHM_ALIGN) )
+	{
+		mBroken = true;
+		return(NULL);
+	}
+	
+	memcpy(&length, mData + pos, sizeof(uint32_t));
+	if (length == SHM_WRAP)
+	{
+		uint32_t skip = mSize - pos;
+		if (used <= skip)
+		{
+			mBroken = true;
+			return(NULL);
+		}
+		tail += skip;
+		used -= skip;
+		pos = 0;
+		memcpy(&length, mData, sizeof(uint32_t));
+	}
+	
+	// The message has to be all there and must not run off the end
+	if ( (length > mSize / 2) || (recordSize(length) > used) || (recordSize(length) > mSize - pos) )
+	{
+		mBroken = true;
+		return(NULL);
+	}
+	mNextTail = tail + recordSize(length);
+	return(mData + pos + sizeof(uint32_t));
+}
+
+//************************************************************************
+void ShmRing::release()
+{
+	mHeader->tail.store(mNextTail, std::memory_order_release);
+}
+
+//************************************************************************
+uint32_t ShmRing::used() const
+{
+	return(mHeader->head.load(std::memory_order_relaxed) - mHeader->tail.load(std::memory_order_relaxed));
+}
+
+//************************************************************************
+bool ShmRing::sleep()
+{
+	// Nothing more will be read from a broken ring
+	if (mBroken)
+	{
+		return(true);
+	}
+	
+	mHeader->waiting.store(1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (mHeader->head.load(std::memory_order_relaxed) != mHeader->tail.load(std::memory_order_relaxed))
+	{
+		mHeader->waiting.store(0, std::memory_order_relaxed);
+		return(false);
+	}
+	return(true);
+}
+
+
+//************************************************************************
+bool ShmChannel::create(uint32_t ringBytes)
+{
+#ifdef NS3
+	// DCE does not share memory between nodes' processes
+	return(false);
+#else
+	mRingBytes = SHM_MIN_RING_BYTES;
+	while (mRingBytes < ringBytes)
+	{
+		mRingBytes <<= 1;
+	}
+	
+	static unsigned int count = 0;
+	char name[64];
+	snprintf(name, sizeof(name), "/gcn-%d-%u", (int)getpid(), count++);
+	
+	int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+	if (fd < 0)
+	{
+		return(false);
+	}
+	mName = name;
+	mLength = headerSize(sizeof(Header)) + 2 * ShmRing::footprint(mRingBytes);
+	if ( (ftruncate(fd, mLength) < 0) || !map(fd, true) )
+	{
+		::close(fd);
+		unlink();
+		return(false);
+	}
+	::close(fd);
+	return(true);
+#endif
+}
+
+//************************************************************************
+bool ShmChannel::open(const string & name, uint32_t ringBytes)
+{
+#ifdef NS3
+	return(false);
+#else
+	// the ring offsets are masked so the size must be a power of 2
+	if ( (ringBytes < SHM_MIN_RING_BYTES) || (ringBytes & (ringBytes - 1)) )
+	{
+		return(false);
+	}
+	
+	int fd = shm_open(name.c_str(), O_RDWR, 0);
+	if (fd < 0)
+	{
+		return(false);
+	}
+	
+	mRingBytes = ringBytes;
+	mLength = headerSize(sizeof(Header)) + 2 * ShmRing::footprint(mRingBytes);
+	struct stat info;
+	if ( (fstat(fd, &info) < 0) || ((size_t)info.st_size != mLength) || !map(fd, false) )
+	{
+		::close(fd);
+		return(false);
+	}
+	::close(fd);
+	
+	Header* pHeader = static_cast<Header*>(mBase);
+	if ( (pHeader->magic != SHM_MAGIC) || (pHeader->ringBytes != mRingBytes) )
+	{
+		close();
+		return(false);
+	}
+	return(true);
+#endif
+}
+
+//************************************************************************
+bool ShmChannel::map(int fd, bool init)
+{
+	mBase = mmap(NULL, mLength, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (mBase == MAP_FAILED)
+	{
+		mBase = NULL;
+		return(false);
+	}
+	
+	// The GCN only trusts the rings if they are the size it mapped
+	char* pRings = static_cast<char*>(mBase) + headerSize(sizeof(Header));
+	if ( !mToGcn.attach(pRings, mRingBytes, init) || !mFromGcn.attach(pRings + ShmRing::footprint(mRingBytes), mRingBytes, init) )
+	{
+		close();
+		return(false);
+	}
+	if (init)
+	{
+		Header* pHeader = static_cast<Header*>(mBase);
+		pHeader->magic = SHM_MAGIC;
+		pHeader->ringBytes = mRingBytes;
+	}
+	return(true);
+}
+
+//************************************************************************
+void ShmChannel::unlink()
+{
+#ifndef NS3
+	if (!mName.empty())
+	{
+		shm_unlink(mName.c_str());
+		mName.clear();
+	}
+#endif
+}
+
+//************************************************************************
+void ShmChannel::close()
+{
+	if (mBase)
+	{
+		munmap(mBase, mLength);
+		mBase = NULL;
+	}
+}
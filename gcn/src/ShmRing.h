@@ -0,0 +1,153 @@
+/*
+ * Group Centric Networking
+ *
+ * Copyright (C) 2015 Massachusetts Institute of Technology
+ * All rights reserved.
+ *
+ * Authors:
+ *           Patricia Deutsch         <patricia.deutsch@ll.mit.edu>
+ *           Gregory Kuperman         <gkuperman@ll.mit.edu>
+ *           Leonid Veytser           <veytser@ll.mit.edu>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <stdint.h>
+#include <string>
+#include <atomic>
+
+using std::string;
+using std::atomic;
+
+// Shared memory transport between an app and the GCN.
+//
+// The app creates a segment holding two single producer single consumer
+// rings, one in each direction, and offers it to the GCN over the TCP
+// socket. Once the GCN accepts, AppMessages are serialized straight into
+// the ring and parsed straight out of it, so there is no copy through a
+// socket buffer and no system call while both sides keep up.
+//
+// A consumer that has emptied its ring sets the waiting flag before it
+// goes back to its event loop. The producer only rings the doorbell (a
+// zero length frame on the TCP socket) when it sees that flag, so a busy
+// consumer is never woken through the kernel. A new ring starts with its
+// consumer waiting, so the first message always rings.
+//
+// The other side may be buggy or hostile, so the size of each ring is the
+// one it was mapped with, not the one in the segment, and a consumer
+// checks each record against what the producer has published. A ring
+// with a bad record is broken for good.
+
+static const uint32_t SHM_MAGIC = 0x47434E52;        // "GCNR"
+static const uint32_t SHM_DEFAULT_RING_BYTES = 1 << 20;
+
+class ShmRing
+{
+	public:
+		ShmRing() : mHeader(NULL), mData(NULL), mSize(0), mSkip(0), mNextTail(0), mBroken(false) {}
+		
+		// base is where the ring lives in the segment. size must be a power of 2.
+		// Returns false if the ring someone else set up is not that size
+		bool attach(void* base, uint32_t size, bool init);
+		
+		// bytes the ring takes in the segment
+		static size_t footprint(uint32_t size);
+		
+		// producer side. reserve returns where to write length bytes or NULL
+		// if the ring is full. commit publishes them and returns true if the
+		// consumer is waiting and needs the doorbell
+		char* reserve(uint32_t length);
+		bool commit(uint32_t length);
+		
+		// copies the message in. Returns false if the ring is full
+		bool write(const char* buffer, uint32_t length, bool & doorbell);
+		
+		// consumer side. peek returns the oldest message or NULL if the ring
+		// is empty or broken. release frees it. sleep sets the waiting flag
+		// and returns false if a message slipped in, in which case keep reading
+		char* peek(uint32_t & length);
+		void release();
+		bool sleep();
+		
+		// the producer wrote something that is not a message
+		bool broken() const { return mBroken; }
+		
+		// bytes not read yet
+		uint32_t used() const;
+		
+	private:
+		struct Header
+		{
+			alignas(64) atomic<uint32_t>	head;     // bytes ever written
+			alignas(64) atomic<uint32_t>	tail;     // bytes ever read
+			alignas(64) atomic<uint32_t>	waiting;  // consumer wants the doorbell
+			uint32_t					size;
+		};
+		
+		Header*		mHeader;
+		char*		mData;
+		uint32_t	mSize;
+		uint32_t	mSkip;      // bytes the reserved message wrapped past
+		uint32_t	mNextTail;  // tail after the peeked message
+		bool		mBroken;
+};
+
+// The shared memory segment with the ring in each direction
+class ShmChannel
+{
+	public:
+		ShmChannel() : mRingBytes(0), mBase(NULL), mLength(0) {}
+		~ShmChannel() { close(); }
+		
+		// app side. Creates the segment under a new name
+		bool create(uint32_t ringBytes);
+		
+		// GCN side. Maps the segment the app offered
+		bool open(const string & name, uint32_t ringBytes);
+		
+		// remove the name once both sides have the segment mapped
+		void unlink();
+		void close();
+		
+		const string & name() const { return(mName); }
+		uint32_t ringBytes() const { return(mRingBytes); }
+		
+		ShmRing &	toGcn() { return(mToGcn); }
+		ShmRing &	fromGcn() { return(mFromGcn); }
+		
+	private:
+		struct Header
+		{
+			uint32_t	magic;
+			uint32_t	ringBytes;
+		};
+		
+		bool map(int fd, bool init);
+		
+		string		mName;
+		uint32_t	mRingBytes;
+		void*		mBase;
+		size_t		mLength;
+		ShmRing		mToGcn;
+		ShmRing		mFromGcn;
+};
+
+#endif //SHM_RING_H
@@ -84,6 +84,98 @@ void usage(const string & sAppName)
 	cout<<"                                seen yet even if we do not have an entry in Remote Pull table. This is also called robust mode." <<endl;
 	cout<<"                                Default behavior is to only re-broadcast if we have an entry in Remote Pull table (downstream subscriber)"<<endl;
 	cout<<endl;
+	cout<<"  -R, --localrepair             When running GCN with acknowledgements, group nodes watch each flow for sequence gaps,"<<endl;
+	cout<<"                                silence or a lost upstream neighbor and send a REPAIR to nearby nodes to patch the tree"<<endl;
+	cout<<"                                instead of waiting for the next ADVERTISE flood."<<endl;
+	cout<<endl;
+	cout<<"  -T, --repairttl REPAIRTTL     Set the number of hops a REPAIR message may travel."<<endl;
+	cout<<"                                Default is "<< DEFAULT_REPAIRTTL << " hop(s)"<<endl;
+	cout<<endl;
+	cout<<"  -N, --neighborexpire NBREXPIRE  Set the amount of time in seconds without hearing a neighbor before it is considered"<<endl;
+	cout<<"                                lost by local repair."<<endl;
+	cout<<"                                Default is "<< DEFAULT_NEIGHBOREXPIRE << " seconds"<<endl;
+	cout<<endl;
+	cout<<"  -C, --retxcache SIZE          Set the number of recent DATA messages kept for each flow to answer NACKs from"<<endl;
+	cout<<"                                subscribers of reliable groups. 0 disables the retransmission cache."<<endl;
+	cout<<"                                Default is "<< DEFAULT_RETXCACHESIZE << endl;
+	cout<<endl;
+	cout<<"  -K, --nackttl NACKTTL         Set the number of hops a NACK message may travel to find a cached copy."<<endl;
+	cout<<"                                Default is "<< DEFAULT_NACKTTL << " hop(s)"<<endl;
+	cout<<endl;
+	cout<<"  -P, --otarate RATE            Pace OTA transmissions to RATE kbit/s. Control messages are always sent before DATA and"<<endl;
+	cout<<"                                groups share the device round robin. 0 sends as fast as the device takes them."<<endl;
+	cout<<"                                Default is "<< DEFAULT_OTARATE << endl;
+	cout<<endl;
+	cout<<"  -Q, --drrquantum BYTES        Set the number of bytes each group may send per round when OTA pacing is on."<<endl;
+	cout<<"                                Default is "<< DEFAULT_DRRQUANTUM << " bytes"<<endl;
+	cout<<endl;
+	cout<<"  -D, --datadeadline DEADLINE   Set the time in ms a DATA message may wait to be sent OTA before it is dropped."<<endl;
+	cout<<"                                0 means DATA messages are never dropped for being late."<<endl;
+	cout<<"                                Default is "<< DEFAULT_DATADEADLINE << " ms"<<endl;
+	cout<<endl;
+	cout<<"  -F, --flowcontrol CAPACITY    Tell source apps to slow down when the OTA transmit queue, the socket from the app"<<endl;
+	cout<<"                                or the channel is congested. CAPACITY is the channel rate in kbit/s used to decide"<<endl;
+	cout<<"                                the channel is busy. 0 only uses the transmit queue and the app socket."<<endl;
+	cout<<"                                Default is no rate feedback to source apps."<<endl;
+	cout<<endl;
+	cout<<"  -I, --ifmode MODE             How DATA messages are sent when there is more than one device. Control messages"<<endl;
+	cout<<"                                are always sent on every device."<<endl;
+	cout<<"                                  all    = every DATA message on every device"<<endl;
+	cout<<"                                  select = on the device(s) the downstream neighbors of the group are heard on"<<endl;
+	cout<<"                                  stripe = on one device at a time, round robin over the devices that reach"<<endl;
+	cout<<"                                           every downstream neighbor of the group"<<endl;
+	cout<<"                                Default is "<< IfModeStr[IF_MODE_ALL] << endl;
+	cout<<endl;
+	cout<<"  -U, --l2unicast               Send ACKs and unicast DATA as link layer unicast to their next hop when its"<<endl;
+	cout<<"                                address is known so the MAC retransmits lost frames. Otherwise they are broadcast."<<endl;
+	cout<<"                                Default is to broadcast every message."<<endl;
+	cout<<endl;
+	cout<<"  -A, --aggregate HOLD          Hold relayed unicast DATA for HOLD ms and send the ones going to the same"<<endl;
+	cout<<"                                destination together in one OTA message. 0 relays each unicast DATA on its own."<<endl;
+	cout<<"                                Default is "<< DEFAULT_AGGREGATEHOLD << endl;
+	cout<<endl;
+	cout<<"  -W, --adaptivecorridor        Adapt the relay corridor of our unicast DATA to each destination from the"<<endl;
+	cout<<"                                feedback the destination sends. Starts from the resilience the app asked for."<<endl;
+	cout<<"                                Default is a fixed corridor set by the resilience."<<endl;
+	cout<<endl;
+	cout<<"  -a, --autottl MARGIN          Sources use the distance of their farthest group member plus MARGIN hops as the"<<endl;
+	cout<<"                                source ttl instead of the ttl from the app. Every "<< AUTOTTL_PROBE_EVERY <<"th message still goes as far"<<endl;
+	cout<<"                                as the app's ttl so new members can find the group."<<endl;
+	cout<<"                                Default is to use the ttl from the app."<<endl;
+	cout<<endl;
+	cout<<"  -k, --catchup ITEMS           Group nodes and relays keep the last ITEMS DATA of each group and give them to"<<endl;
+	cout<<"                                subscribers that join late, locally or when a neighbor asks. 0 keeps nothing."<<endl;
+	cout<<"                                Default is "<< DEFAULT_CATCHUPITEMS << endl;
+	cout<<endl;
+	cout<<"  -w, --catchupwindow WINDOW    Set the time in seconds a cached DATA may be given to a late subscriber."<<endl;
+	cout<<"                                0 means cached DATA are only replaced by newer ones."<<endl;
+	cout<<"                                Default is "<< DEFAULT_CATCHUPWINDOW << endl;
+	cout<<endl;
+	cout<<"  -j, --catchupbytes BYTES      Set the memory in bytes each group's catch-up cache may use."<<endl;
+	cout<<"                                Default is "<< DEFAULT_CATCHUPBYTES << " bytes"<<endl;
+	cout<<endl;
+	cout<<"  -B, --summary INTERVAL        Send a summary of the groups subscribed to near this node to the neighbors"<<endl;
+	cout<<"                                every INTERVAL seconds. Periodic ADVERTISE are then sent with the summary"<<endl;
+	cout<<"                                and only for groups a neighbor's summary reaches. 0 means no summaries."<<endl;
+	cout<<"                                Default is "<< DEFAULT_SUMMARYINTERVAL << endl;
+	cout<<endl;
+	cout<<"  -H, --sessionhigh BYTES       Set the bytes queued to an app before its DATA are dropped."<<endl;
+	cout<<"                                Default is "<< DEFAULT_SESSIONHIGHWATER << " bytes"<<endl;
+	cout<<endl;
+	cout<<"  -L, --sessionlow BYTES        Set the bytes queued to an app below which we stop dropping its DATA."<<endl;
+	cout<<"                                Default is "<< DEFAULT_SESSIONLOWWATER << " bytes"<<endl;
+	cout<<endl;
+	cout<<"  -O, --sessiondrop POLICY      Set which DATA are dropped when an app falls behind. Control messages are never dropped."<<endl;
+	cout<<"                                " << SessionDropPolicyStr[SESSION_DROP_OLDEST] << " = the oldest queued DATA, " 
+	                                          << SessionDropPolicyStr[SESSION_DROP_NEWEST] << " = the new DATA."<<endl;
+	cout<<"                                Default is "<< SessionDropPolicyStr[SESSION_DROP_OLDEST] << endl;
+	cout<<endl;
+	cout<<"  -E, --appport PORT            Set the TCP port apps connect to."<<endl;
+	cout<<"                                Default is "<< DEFAULT_APPPORT << endl;
+	cout<<endl;
+	cout<<"  -G, --hugepages               Back the packet buffer pool with huge pages (reserve them in /proc/sys/vm/nr_hugepages)."<<endl;
+	cout<<"                                Falls back to normal pages if none are free."<<endl;
+	cout<<endl;
 }
 
 
@@ -113,6 +205,11 @@ class Gcn
 			
 				delete pGcnService;
 			}
+			pIoService->stop();
+			
+			// Delete all global objects allocated by libprotobuf.
+			google::protobuf::ShutdownProtobufLibrary();
+			printf(" ... google buffer shutdown\n");
 			exit (1);
 		}
 		
@@ -142,27 +239,40 @@ bool Gcn::Start(int argc, char* argv[])
 		{"pathclean",   1, nullptr, 'x'},
 		{"mcastethernetheader", 0, nullptr, 'm'},
 		{"alwaysrebroadcast",   0, nullptr, 'b'},
+		{"localrepair",         0, nullptr, 'R'},
+		{"repairttl",           1, nullptr, 'T'},
+		{"neighborexpire",      1, nullptr, 'N'},
+		{"retxcache",           1, nullptr, 'C'},
+		{"nackttl",             1, nullptr, 'K'},
+		{"otarate",             1, nullptr, 'P'},
+		{"drrquantum",          1, nullptr, 'Q'},
+		{"datadeadline",        1, nullptr, 'D'},
+		{"flowcontrol",         1, nullptr, 'F'},
+		{"ifmode",              1, nullptr, 'I'},
+		{"l2unicast",           0, nullptr, 'U'},
+		{"aggregate",           1, nullptr, 'A'},
+		{"adaptivecorridor",    0, nullptr, 'W'},
+		{"autottl",             1, nullptr, 'a'},
+		{"catchup",             1, nullptr, 'k'},
+		{"catchupwindow",       1, nullptr, 'w'},
+		{"catchupbytes",        1, nullptr, 'j'},
+		{"summary",             1, nullptr, 'B'},
+		{"sessionhigh",         1, nullptr, 'H'},
+		{"sessionlow",          1, nullptr, 'L'},
+		{"sessiondrop",         1, nullptr, 'O'},
+		{"appport",             1, nullptr, 'E'},
+		{"hugepages",           0, nullptr, 'G'},
 		{0,            0, nullptr,  0 }
 	};
 
-	string sOptString{"hl:f:i:d:e:c:p:t:r:x:mbo"};
+	string sOptString{"hl:f:i:d:e:c:p:t:r:x:mboRT:N:C:K:P:Q:D:F:I:UA:Wa:k:w:j:B:H:L:O:E:G"};
 
 	int iOption{};
 	int iOptionIndex{};
 	
 	// create and fill in config structure with default values
 	GcnServiceConfig gcnConfig;
-	gcnConfig.logLevel = DEFAULT_LOG_LEVEL;
-	gcnConfig.nodeId = 0;
-	gcnConfig.hashExpire   = DEFAULT_HASHEXPIRE;
-	gcnConfig.hashInterval = DEFAULT_HASHINTERVAL;
-	gcnConfig.pullExpire   = DEFAULT_PULLEXPIRE;
-	gcnConfig.pullInterval = DEFAULT_PULLINTERVAL;
-	gcnConfig.pathExpire   = DEFAULT_REVPATHEXPIRE;
-	gcnConfig.pathInterval = DEFAULT_REVPATHINTERVAL;
-	gcnConfig.mcastEthernetHeader = false;
-	gcnConfig.alwaysRebroadcast = false;
-	gcnConfig.dataFile = "";
+	initGcnServiceConfig(gcnConfig);
 
 	while((iOption = getopt_long(argc,argv,sOptString.c_str(), &options[0], &iOptionIndex)) != -1)
 	{
@@ -208,6 +318,101 @@ bool Gcn::Start(int argc, char* argv[])
 		case 'b':
 			gcnConfig.alwaysRebroadcast = true;
 			break;
+		case 'R':
+			gcnConfig.localRepair = true;
+			break;
+		case 'T':
+			gcnConfig.repairTtl = atoi(optarg);
+			break;
+		case 'N':
+			gcnConfig.neighborExpire = atof(optarg);
+			break;
+		case 'C':
+			gcnConfig.retxCacheSize = atoi(optarg);
+			break;
+		case 'K':
+			gcnConfig.nackTtl = atoi(optarg);
+			break;
+		case 'P':
+			gcnConfig.otaRate = atof(optarg);
+			break;
+		case 'Q':
+			gcnConfig.drrQuantum = atoi(optarg);
+			break;
+		case 'D':
+			gcnConfig.dataDeadline = atof(optarg);
+			break;
+		case 'F':
+			gcnConfig.flowCapacity = atof(optarg);
+			break;
+		case 'I':
+			gcnConfig.ifMode = IF_MODE_MAX;
+			for (int mode = IF_MODE_ALL; mode < IF_MODE_MAX; mode++)
+			{
+				if (string(optarg) == IfModeStr[mode])
+				{
+					gcnConfig.ifMode = (IfMode)mode;
+				}
+			}
+			if (gcnConfig.ifMode == IF_MODE_MAX)
+			{
+				cout <<"\n************** ERROR: Invalid interface mode: "<< optarg <<" **************\n"<<endl;
+				usage(argv[0]);
+				return false;
+			}
+			break;
+		case 'U':
+			gcnConfig.l2Unicast = true;
+			break;
+		case 'A':
+			gcnConfig.aggregateHold = atof(optarg);
+			break;
+		case 'W':
+			gcnConfig.adaptiveCorridor = true;
+			break;
+		case 'a':
+			gcnConfig.autoTtlMargin = atoi(optarg);
+			break;
+		case 'k':
+			gcnConfig.catchupItems = atoi(optarg);
+			break;
+		case 'w':
+			gcnConfig.catchupWindow = atof(optarg);
+			break;
+		case 'j':
+			gcnConfig.catchupBytes = atoi(optarg);
+			break;
+		case 'B':
+			gcnConfig.summaryInterval = atof(optarg);
+			break;
+		case 'H':
+			gcnConfig.sessionQueue.highWater = atoi(optarg);
+			break;
+		case 'L':
+			gcnConfig.sessionQueue.lowWater = atoi(optarg);
+			break;
+		case 'E':
+			gcnConfig.appPort = atoi(optarg);
+			break;
+		case 'G':
+			gcnConfig.hugePages = true;
+			break;
+		case 'O':
+			gcnConfig.sessionQueue.dropPolicy = SESSION_DROP_MAX;
+			for (int policy = SESSION_DROP_OLDEST; policy < SESSION_DROP_MAX; policy++)
+			{
+				if (string(optarg) == SessionDropPolicyStr[policy])
+				{
+					gcnConfig.sessionQueue.dropPolicy = (SessionDropPolicy)policy;
+				}
+			}
+			if (gcnConfig.sessionQueue.dropPolicy == SESSION_DROP_MAX)
+			{
+				cout <<"\n************** ERROR: Invalid session drop policy: "<< optarg <<" **************\n"<<endl;
+				usage(argv[0]);
+				return false;
+			}
+			break;
 		default:
 			return false; 
 		}
@@ -228,6 +433,14 @@ bool Gcn::Start(int argc, char* argv[])
 		usage(argv[0]);
 		return false;
 	}
+	
+	// Make sure the app queue water marks make sense
+	if (gcnConfig.sessionQueue.lowWater > gcnConfig.sessionQueue.highWater)
+	{
+		cout <<"\n************** ERROR: Session low water mark "<< gcnConfig.sessionQueue.lowWater <<" is above the high water mark **************\n"<<endl;
+		usage(argv[0]);
+		return false;
+	}
 
 	// spawn the GCN
 	pGcnService = new GcnService(gcnConfig, pIoService);
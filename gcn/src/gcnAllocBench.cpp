@@ -0,0 +1,407 @@
+/*
+ * Group Centric Networking
+ *
+ * Copyright (C) 2015 Massachusetts Institute of Technology
+ * All rights reserved.
+ *
+ * Authors:
+ *           Patricia Deutsch         <patricia.deutsch@ll.mit.edu>
+ *           Gregory Kuperman         <gkuperman@ll.mit.edu>
+ *           Leonid Veytser           <veytser@ll.mit.edu>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Heap allocation benchmark for the packet paths of the GcnService.
+//
+// A GcnService is made (but not started, so no devices are opened) and
+// fed the way the daemon feeds it, from handlers run by the io_service.
+// Its hash entries expire after a second and the hash cleanup timer runs
+// every 100 ms, as it does in the daemon (see -e and -c). The calls to
+// operator new per packet are counted once the service has warmed up:
+//   - receive:   OnNetworkReceive of new DATA for a group we do not relay
+//   - duplicate: OnNetworkReceive of DATA already in the hash
+//   - relay:     OnNetworkReceive of new DATA we relay (the relay timer
+//                fires and the DATA goes through forwardToOTA and the
+//                transmit scheduler)
+//   - forward:   forwardToOTA of a DATA
+//   - hash:      addToHash of new DATA
+//   - buffer:    a frame copied into a buffer from the BufferPool
+// The paths that add to the hash (receive, relay and hash) get their
+// packets at a steady rate (see -r), a burst every millisecond, so the
+// hash holds as many entries while they are counted as it did while
+// warming up. Their time is what handling the packets took, not counting
+// the relay timer. The others run one packet per handler, back to back.
+// All of these should be 0. The program exits 1 if one is not. For
+// comparison, "new buffer" is a frame copied into a new 8 KB shared_ptr
+// buffer the way the GCN used to do it.
+// Build with -DBENCHMARKS=ON (and -DRELEASE=ON for meaningful times).
+
+#include "gcnService.h"
+#include <chrono>
+#include <iomanip>
+#include <new>
+
+using namespace std;
+using namespace std::chrono;
+using namespace GCNMessage;
+
+static uint64_t gAllocations = 0;
+
+void* operator new(size_t size)
+{
+	gAllocations++;
+	void* p = malloc(size ? size : 1);
+	if (!p)
+	{
+		throw std::bad_alloc();
+	}
+	return(p);
+}
+
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void* p, size_t /*size*/) noexcept
+{
+	free(p);
+}
+
+static void usage(const char* sAppName)
+{
+	cout<<"usage: "<<sAppName <<" [OPTIONS]"<<endl;
+	cout<<endl;
+	cout<<"options:"<<endl;
+	cout<<"  -h, --help               Print this message and exit."<<endl;
+	cout<<"  -s, --size SIZE          Payload size in bytes. Default is 1000"<<endl;
+	cout<<"  -n, --iterations N       Number of packets counted for each path. Default is 50000"<<endl;
+	cout<<"  -r, --rate RATE          Packets per second for the paths that add to the hash. Default is 20000"<<endl;
+	cout<<"  -e, --hashexpire SECS    Seconds before a hash entry expires. Default is 1"<<endl;
+	cout<<"  -c, --hashinterval MS    Milliseconds between hash cleanups. Default is 100"<<endl;
+	cout<<endl;
+}
+
+struct Result
+{
+	double allocs;   // per packet
+	double ns;       // per packet
+};
+
+// Runs f for 2 * iterations packets, each from its own handler on the
+// io_service, and counts the second half
+class ServiceRun
+{
+ public:
+	ServiceRun(io_service & io, uint32_t iterations, function<void()> f) 
+		: mIo(io), mIterations(iterations), mCount(0), mBefore(0), mF(f) {}
+	
+	// (the service's timers are left waiting for the next run)
+	Result run()
+	{
+		mIo.reset();
+		mIo.post(Step{this});
+		mIo.run();
+		return(mResult);
+	}
+	
+ private:
+	struct Step
+	{
+		ServiceRun* pRun;
+		void operator()() const { pRun->step(); }
+	};
+	
+	void step()
+	{
+		if (mCount == mIterations)
+		{
+			mBefore = gAllocations;
+			mStart = steady_clock::now();
+		}
+		else if (mCount == 2 * mIterations)
+		{
+			double ns = (double)duration_cast<nanoseconds>(steady_clock::now() - mStart).count();
+			mResult.allocs = (double)(gAllocations - mBefore) / mIterations;
+			mResult.ns = ns / mIterations;
+			mIo.stop();
+			return;
+		}
+		mF();
+		mCount++;
+		mIo.post(Step{this});
+	}
+	
+	io_service &				mIo;
+	uint32_t					mIterations;
+	uint32_t					mCount;
+	uint64_t					mBefore;
+	steady_clock::time_point	mStart;
+	function<void()>			mF;
+	Result						mResult;
+};
+
+// Runs f rate times a second, in a burst every millisecond from a timer on
+// the io_service, for warmup seconds and then counts the next iterations
+// packets. The service's timers run in between, as they do in the daemon.
+// The warm up is 10% faster so the tables grow a little past what the
+// counted packets need (when a cleanup runs shifts with the load)
+class PacedRun
+{
+ public:
+	PacedRun(io_service & io, uint32_t rate, double warmup, uint32_t iterations, function<void()> f) 
+		: mIo(io), mTimer(io), mBurst(std::max(rate / 1000, 1u)), mWarmBurst(mBurst + std::max(mBurst / 10, 1u)), mWarmup(warmup), mIterations(iterations), 
+		  mCount(0), mBefore(0), mBusy(0), mCounting(false), mF(f) {}
+	
+	// (the service's timers are left waiting for the next run)
+	Result run()
+	{
+		mIo.reset();
+		mStart = steady_clock::now();
+		mTimer.expires_from_now(Milliseconds(1));
+		mTimer.async_wait(Tick{this});
+		mIo.run();
+		return(mResult);
+	}
+	
+ private:
+	struct Tick
+	{
+		PacedRun* pRun;
+		void operator()(const boost::system::error_code &) const { pRun->tick(); }
+	};
+	
+	void tick()
+	{
+		steady_clock::time_point now = steady_clock::now();
+		if ( !mCounting && (duration_cast<milliseconds>(now - mStart).count() >= mWarmup * 1000) )
+		{
+			mCounting = true;
+			mBefore = gAllocations;
+		}
+		
+		uint32_t burst = mCounting ? mBurst : mWarmBurst;
+		for (uint32_t n = 0; n < burst; n++)
+		{
+			mF();
+		}
+		
+		if (mCounting)
+		{
+			mBusy += duration_cast<nanoseconds>(steady_clock::now() - now).count();
+			mCount += mBurst;
+			if (mCount >= mIterations)
+			{
+				mResult.allocs = (double)(gAllocations - mBefore) / mCount;
+				mResult.ns = (double)mBusy / mCount;
+				mIo.stop();
+				return;
+			}
+		}
+		
+		// A late tick is made up by the next ones so the rate stays the same
+		mTimer.expires_at(mTimer.expires_at() + Milliseconds(1));
+		mTimer.async_wait(Tick{this});
+	}
+	
+	io_service &				mIo;
+	deadline_timer				mTimer;
+	uint32_t					mBurst;
+	uint32_t					mWarmBurst;
+	double						mWarmup;
+	uint32_t					mIterations;
+	uint32_t					mCount;
+	uint64_t					mBefore;
+	uint64_t					mBusy;      // ns spent in f while counting
+	bool						mCounting;
+	steady_clock::time_point	mStart;
+	function<void()>			mF;
+	Result						mResult;
+};
+
+// runs f once to warm up and then iterations times
+template <typename F>
+static Result measure(uint32_t iterations, F f)
+{
+	f();
+	uint64_t before = gAllocations;
+	steady_clock::time_point start = steady_clock::now();
+	for (uint32_t n = 0; n < iterations; n++)
+	{
+		f();
+	}
+	double ns = (double)duration_cast<nanoseconds>(steady_clock::now() - start).count();
+	Result result;
+	result.allocs = (double)(gAllocations - before) / iterations;
+	result.ns = ns / iterations;
+	return(result);
+}
+
+// returns false if the path allocated
+static bool report(const char* path, const Result & result, bool mustBeZero = true)
+{
+	bool ok = !mustBeZero || (result.allocs == 0);
+	cout << setw(12) << path << fixed << setprecision(2) << setw(10) << result.allocs 
+	     << setprecision(0) << setw(10) << result.ns << (ok ? "" : "   ALLOCATES") << endl;
+	return(ok);
+}
+
+static void fillData(Data & data, size_t size, uint64_t seq, uint32_t ttl)
+{
+	data.set_gid(5);
+	data.set_srcnode(2);
+	data.set_sequence(seq);
+	data.set_srcttl(3);
+	data.set_ttl(ttl);
+	data.set_distance(1);
+	data.set_data(string(size, 'x'));
+}
+
+int main(int argc, char* argv[])
+{
+	size_t size = 1000;
+	uint32_t iterations = 50000;
+	uint32_t rate = 20000;
+	double hashExpire = 1.0;
+	double hashInterval = 100.0;
+	
+	option options[] =
+	{
+		{"help",         0, nullptr, 'h'},
+		{"size",         1, nullptr, 's'},
+		{"iterations",   1, nullptr, 'n'},
+		{"rate",         1, nullptr, 'r'},
+		{"hashexpire",   1, nullptr, 'e'},
+		{"hashinterval", 1, nullptr, 'c'},
+		{0,              0, nullptr,  0 }
+	};
+	int iOption;
+	while((iOption = getopt_long(argc, argv, "hs:n:r:e:c:", options, nullptr)) != -1)
+	{
+		switch(iOption)
+		{
+		case 's':
+			size = atoi(optarg);
+			break;
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		case 'r':
+			rate = atoi(optarg);
+			break;
+		case 'e':
+			hashExpire = atof(optarg);
+			break;
+		case 'c':
+			hashInterval = atof(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if ( (size == 0) || (size > MAX_BUFFER_SIZE / 2) || (iterations == 0) || (rate == 0) || (hashExpire < 0) || (hashInterval <= 0) )
+	{
+		cout << "Invalid parameters. Need 0 < SIZE <= " << MAX_BUFFER_SIZE / 2 << ", RATE > 0, SECS >= 0 and MS > 0" << endl;
+		return 1;
+	}
+	
+	// A node that is not in group 5. Its log is off (even LOG_FORCE) so
+	// it does not get in the way of the results
+	io_service io;
+	GcnServiceConfig config;
+	initGcnServiceConfig(config);
+	config.nodeId = 1;
+	config.logLevel = LOG_FATAL;
+	config.hashExpire = hashExpire;
+	config.hashInterval = hashInterval;
+	GcnService service(config, &io);
+	service.mStatTimer.cancel();
+	
+	// The hash is cleaned as in the daemon (Start is not called so as not
+	// to open devices)
+	service.mHashCleanupTimer.expires_from_now(Milliseconds((long)hashInterval));
+	service.mHashCleanupTimer.async_wait(boost::bind(&GcnService::hashCleanup, &service, _1));
+	
+	// Entries live up to a second longer than hashExpire (their time is
+	// kept in whole seconds) and until the next cleanup. Warming up over
+	// two of those lifetimes lets the hash reach its steady size
+	double warmup = 2 * (hashExpire + 1 + hashInterval / 1000);
+	
+	// What arrives over the air from node 2. The sequence number is
+	// changed for each packet so it is new to the hash
+	OTAMessage otaMsg;
+	otaMsg.mutable_header()->set_src(2);
+	Data* pData = otaMsg.add_data();
+	vector<char> frame(MAX_BUFFER_SIZE);
+	uint64_t seq = 0;
+	auto receive = [&]() {
+		pData->set_sequence(++seq);
+		int length = otaMsg.ByteSizeLong();
+		otaMsg.SerializeToArray(frame.data(), length);
+		service.OnNetworkReceive(frame.data(), length, 1, NULL);
+	};
+	
+	Data data;
+	HashValue hashValue;
+	bool ok = true;
+	
+	cout << "Payload " << size << " bytes, " << iterations << " packets, " << rate << " packets/s to the hash"
+	     << " (hash expire " << hashExpire << " s, cleanup every " << hashInterval << " ms, warm up " << warmup << " s)" << endl;
+	cout << setw(12) << "path" << setw(10) << "allocs" << setw(10) << "ns" << endl;
+	
+	fillData(*pData, size, 0, 0);
+	ok = report("receive", PacedRun(io, rate, warmup, iterations, receive).run()) && ok;
+	
+	ok = report("duplicate", ServiceRun(io, iterations, [&]() {
+		int length = otaMsg.ByteSizeLong();
+		otaMsg.SerializeToArray(frame.data(), length);
+		service.OnNetworkReceive(frame.data(), length, 1, NULL);
+	}).run()) && ok;
+	
+	pData->set_ttl(2);
+	ok = report("relay", PacedRun(io, rate, warmup, iterations, receive).run()) && ok;
+	
+	fillData(data, size, 1, 2);
+	ok = report("forward", ServiceRun(io, iterations, [&]() {
+		service.forwardToOTA(data, 2);
+	}).run()) && ok;
+	
+	ok = report("hash", PacedRun(io, rate, warmup, iterations, [&]() {
+		data.set_sequence(++seq);
+		service.addToHash(data, hashValue);
+	}).run()) && ok;
+	
+	string otaBytes = otaMsg.SerializeAsString();
+	report("new buffer", measure(iterations, [&]() {
+		shared_ptr<array<char, MAX_BUFFER_SIZE>> pBuffer(new array<char, MAX_BUFFER_SIZE>);
+		memcpy(pBuffer->data(), otaBytes.data(), otaBytes.size());
+	}), false);
+	ok = report("buffer", measure(iterations, [&]() {
+		BufferPtr pBuffer = newBuffer(otaBytes.size());
+		memcpy(pBuffer->data(), otaBytes.data(), otaBytes.size());
+	})) && ok;
+	cout << BufferPool::instance().statsString() << endl;
+	
+	if (!ok)
+	{
+		cout << "FAILED: a packet path allocates in steady state" << endl;
+		return 1;
+	}
+	return 0;
+}
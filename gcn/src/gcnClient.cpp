@@ -28,13 +28,74 @@
 
 #include "gcnClient.h"
 
+// The data field of AppMessage and the content field of Data are both
+// length delimited (wire type 2)
+static const uint32_t DATA_TAG = (AppMessage::kDataFieldNumber << 3) | 2;
+static const uint32_t CONTENT_TAG = (Data::kDataFieldNumber << 3) | 2;
 
+// bytes in a Data with length bytes of content
+static uint32_t dataSize(uint32_t headerSize, uint32_t length)
+{
+	return(headerSize + CodedOutputStream::VarintSize32(CONTENT_TAG) + CodedOutputStream::VarintSize32(length) + length);
+}
+
+// bytes that Data takes up in an AppMessage
+static uint32_t dataFieldSize(uint32_t headerSize, uint32_t length)
+{
+	uint32_t size = dataSize(headerSize, length);
+	return(CodedOutputStream::VarintSize32(DATA_TAG) + CodedOutputStream::VarintSize32(size) + size);
+}
+
+// writes the Data field for the content that fill puts in and returns
+// where it ends
+static uint8_t* writeData(uint8_t* pDest, const string & header, uint32_t length, size_t index, 
+                          const function<void(size_t index, char* pDest)> & fill)
+{
+	pDest = CodedOutputStream::WriteVarint32ToArray(DATA_TAG, pDest);
+	pDest = CodedOutputStream::WriteVarint32ToArray(dataSize(header.size(), length), pDest);
+	memcpy(pDest, header.data(), header.size());
+	pDest += header.size();
+	pDest = CodedOutputStream::WriteVarint32ToArray(CONTENT_TAG, pDest);
+	pDest = CodedOutputStream::WriteVarint32ToArray(length, pDest);
+	if (length)
+	{
+		fill(index, (char*)pDest);
+	}
+	return(pDest + length);
+}
 
 //************************************************************************
 gcnClient::gcnClient(io_service * io_serv)
- : mResolver(*io_serv),
+ : pIoService(io_serv),
    mSocket(*io_serv),
    mSocketConnected(false),
+   mWritesInFlight(0),
+   mStarted(false),
+   mStopped(false),
+   mReconnectTimer(*io_serv),
+   mReconnectDelay(RECONNECT_MIN_DELAY),
+   mReconnects(0),
+   mOutageTime(DEFAULT_OUTAGE_TIME),
+   mOutageBytes(0),
+   mOutageHeld(0),
+   mOutageDrops(0),
+   mShmBytes(0),
+   mShmActive(false),
+   mShmWrite(false),
+   mDrainPosted(false),
+   mSubmitDepth(0),
+   mSubmitCount(0),
+   mSubmitDrops(0),
+   mSubmitBatches(0),
+   mBatchDelay(0),
+   mBatchCount(0),
+   mBatchBytes(0),
+   mBatchSize(0),
+   mBatchItems(0),
+   mBatchTimer(*io_serv),
+   mBatchTimerSet(false),
+   mBatchFlushes(0),
+   mBatchedItems(0),
    mStatTimer(*io_serv, Seconds(1)),
    mStatInterval(1.0),
    mDataProdDI(0),
@@ -55,11 +116,29 @@ gcnClient::~gcnClient()
 
 //************************************************************************
 bool gcnClient::Start(const ClientConfig &config, function<bool(Data & dataMsg)> procFunc)
+{
+	return(startGroup(config, procFunc, nullptr));
+}
+
+//************************************************************************
+// Same as above but the app gets a DataView of each DATA it receives
+bool gcnClient::Start(const ClientConfig &config, function<bool(const DataView & view)> viewFunc)
+{
+	return(startGroup(config, nullptr, viewFunc));
+}
+
+//************************************************************************
+bool gcnClient::startGroup(const ClientConfig &config, function<bool(Data & dataMsg)> procFunc, function<bool(const DataView & view)> viewFunc)
 {
 	// Set the values that are the same across all clients
 	mCurrentLogLevel = config.logLevel;
 	mNodeId = config.nodeId;
 	mPort = config.port;
+	mBatchDelay = config.batchDelay;
+	mBatchCount = config.batchCount;
+	mBatchBytes = config.batchBytes;
+	mOutageTime = config.outageTime;
+	mShmBytes = config.shmBytes;
 	mDataFile = NULL;
 	mDataFilePath = "";
 	
@@ -69,6 +148,7 @@ bool gcnClient::Start(const ClientConfig &config, function<bool(Data & dataMsg)>
 	clientInfo.mSrcttl = config.srcttl;
 	clientInfo.mAnnounceRate = config.announceRate;
 	clientInfo.mMsgHandler = procFunc;
+	clientInfo.mViewHandler = viewFunc;
 	clientInfo.mSendResponse = config.sendResponse;
 	clientInfo.mSendResponseFreq = config.sendRespFreq;
 	clientInfo.mResponseTtl = config.respTtl;
@@ -76,8 +156,18 @@ bool gcnClient::Start(const ClientConfig &config, function<bool(Data & dataMsg)>
 	clientInfo.mResilience = config.resilience;
 	clientInfo.mRegenerateTtl = config.regenerateTtl;
 	clientInfo.mAckProbRelay = config.ackProbRelay;
+	clientInfo.mReliable = config.reliable;
+	clientInfo.mFecK = config.fecK;
+	clientInfo.mFecR = config.fecR;
+	clientInfo.mRlncGen = config.rlncGen;
+	clientInfo.mPriority = config.priority;
 	// init dest to be non-unicast
 	clientInfo.mDest = 0;
+	// no rate limit until the GCN asks for one
+	clientInfo.mRateLimit = 0;
+	clientInfo.mNextSendTime = 0;
+	clientInfo.mPaceTimerSet = false;
+	clientInfo.mPaceTimer.reset(new deadline_timer(*pIoService));
 	// init all stats to 0
 	clientInfo.recvCount = 0;
 	clientInfo.sendCount = 0;
@@ -94,73 +184,72 @@ bool gcnClient::Start(const ClientConfig &config, function<bool(Data & dataMsg)>
 	
 	if(mDataFilePath != "") mDataFile = fopen(mDataFilePath.c_str(),"w+");
 		
-	// open socket to the GCN. retry for 30 seconds before giving up
-	// if socket is not already connected
-	if (!mSocketConnected)
+	// start connecting to the GCN the first time through. We do not wait
+	// for it. Until it connects the advertise and pull below go nowhere
+	// and are sent once it does
+	if (!mStarted)
 	{
-		int timeoutSec = 30;
-		error_code ec;
-		while (timeoutSec)
-		{
-			char buf[64]; sprintf(buf,"%d",mPort);
-			connect(mSocket, mResolver.resolve({DEFAULT_SERVER_HOST, string(buf)}), ec);
-			if (ec)
-			{
-				sleep(1);
-				timeoutSec--;
-				cout << "Not yet connected to server. error code is " << ec << ". " << timeoutSec << " seconds remaining to connect ..." << endl;
-				if (!timeoutSec)
-				{
-					printf("ERROR: Failed to connect to server\n");
-					return(false);
-				}
-			}
-			else
-			{
-				timeoutSec = 0;
-				mSocketConnected = true;
-				printf("SUCCESS: client connected\n");
-			}
-		}
+		mStarted = true;
 		
 		// start the stat timer just once
 		mStatTimer.async_wait(boost::bind(&gcnClient::OnStatTimeout, this));
-
-		// start listening to GCN
-		recvFromGCN();
+		
+		connectToGCN();
 	}
+	
+	registerGroup(iter);
 
-	// Set timer for sending advertise
 	if (iter->second.mType > 0)
 	{
-		// Send advertise to GCN so it knows we have this content
-		sendAdvertise(iter->first, REGISTER);
-		
-		if (iter->second.mAnnounceRate >= 0)
-		{
-			// Don't send data until we have a subscriber
-			iter->second.mHasSubscribers = false;
-		}
-		
 		LOG(LOG_FORCE, "Starting GCN Client Sender with:\n   NodeId: %d\n   Type: %s\n   Log Level: %s\n   Group Id: %d\n   Port: %d\n   Src TTL: %d\n   PUSH Rate: %lf\n   Announce Rate: %lf\n   Send Unicast: %s\n   Regenerate TTL: %s\n\n",
 					mNodeId, AppTypeStr[config.type], LogLevelStr[mCurrentLogLevel], config.gid, mPort, config.srcttl, config.pushRate, config.announceRate, (config.sendResponse ? "True": "False"), (config.regenerateTtl ? "True" : "False"));
 	}
 
 	if ( (iter->second.mType == 0) || (iter->second.mType == 2) )
 	{
-		// We are a listener so send a pull to subscribe
-		sendPull(iter->first);
 		LOG(LOG_FORCE, "Starting GCN Client Listener with:\n   NodeId: %d\n   Type: %s\n   Log Level: %s\n   Group Id: %d\n   Port: %d\n   Send Unicast Response: %s\n   Send Unicast Response Frequency: %d\n   Unicast TTL: %d\n   Unicast Resilience: %s\n",
 					mNodeId, AppTypeStr[config.type], LogLevelStr[mCurrentLogLevel], config.gid, mPort, (config.sendResponse ? "True": "False"), config.sendRespFreq, config.respTtl, UnicastResilience_Name(config.resilience).c_str());
 	}
 
 	return true;
-}  // end gcnClient::Start()
+}  // end gcnClient::startGroup()
+
+
+//************************************************************************
+// function to tell the GCN about a group: an advertise if we send to it
+// and a pull if we listen to it. Done when the group starts and again
+// every time we connect to a GCN
+void gcnClient::registerGroup(ClientIt it)
+{
+	if (it->second.mType > 0)
+	{
+		// Send advertise to GCN so it knows we have this content
+		sendAdvertise(it->first, REGISTER);
+		
+		if (it->second.mAnnounceRate >= 0)
+		{
+			// Don't send data until we have a subscriber
+			it->second.mHasSubscribers = false;
+		}
+	}
+	
+	if ( (it->second.mType == 0) || (it->second.mType == 2) )
+	{
+		// We are a listener so send a pull to subscribe
+		sendPull(it->first);
+	}
+}
 
 
 //************************************************************************
 void gcnClient::Stop()
 {
+	mStopped = true;
+	mReconnectTimer.cancel();
+	
+	// send whatever is waiting in the batch
+	flushBatch();
+	
 	// tell GCN we are gone and stop timers and close sockets
 	for (ClientIt iter = mClientMap.begin(); iter != mClientMap.end(); ++iter)
 	{
@@ -177,6 +266,10 @@ void gcnClient::Stop()
 			sendUnpull(iter->first);
 		}
 		
+		// Anything still waiting to be paced out is dropped
+		iter->second.mPaceTimer->cancel();
+		iter->second.mPaceQueue.clear();
+		
 		printf("\nSTOPPING GCN Client. GID %d Final stats: rcvd>%d sent>%d rerr>%d serr>%d rcvdUni>%d sentUni> %d\n", 
 				iter->first, iter->second.recvCount, iter->second.sendCount, iter->second.rerrCount, iter->second.serrCount, iter->second.recvCountUni, iter->second.sendCountUni);
 	
@@ -195,101 +288,369 @@ void gcnClient::Stop()
 	google::protobuf::ShutdownProtobufLibrary();
 	printf(" ... google buffer shutdown\n");
 	
-	// close socket to GCN
+	// close socket to GCN. DATA still waiting for it is dropped
 	mSocket.close();
+	mSocketConnected = false;
+	mOutageQueue.clear();
+	mOutageBytes = 0;
 	printf(" ... Socket closed\n");
 	
+	// The name is still there if the GCN never answered our offer
+	if (mShm)
+	{
+		mShm->unlink();
+		mShm.reset();
+		mShmActive = false;
+		mShmWrite = false;
+		printf(" ... Shared memory closed\n");
+	}
+	
 	if(mDataFilePath != "") fclose(mDataFile);
 }
 
 //************************************************************************
-// function to send a message to the GCN 
+// function to send a text message to the GCN 
 bool gcnClient::sendMessage(GroupId gid, char* msgBuffer, NodeId dest)
+{
+	return(sendPayload(gid, msgBuffer, strlen(msgBuffer), dest));
+}
+
+//************************************************************************
+// function to send length bytes of content to the GCN. Any bytes will do,
+// NULs included
+bool gcnClient::sendPayload(GroupId gid, const char* payload, size_t length, NodeId dest)
+{
+	return(sendPayload(gid, length, [payload, length](char* pDest) { memcpy(pDest, payload, length); }, dest));
+}
+
+//************************************************************************
+// function to send length bytes of content to the GCN. fill writes the
+// content straight into the buffer (or shared memory ring) that goes to
+// the GCN so the library never copies it
+bool gcnClient::sendPayload(GroupId gid, size_t length, function<void(char* pDest)> fill, NodeId dest)
 {
 	ClientIt it = mClientMap.find(gid);
 	LOG_ASSERT(it != mClientMap.end(), "Could not find GID %d in client map", gid);
 	
-	// Create App message, fill in push and send out socket
-	AppMessage message;
-	auto pData = message.add_data();
-	pData->set_gid(gid);
-	pData->set_data(msgBuffer);
-	
-	// We go ahead and build the message in case we are collecting data
+	// We go ahead and build the header in case we are collecting data
 	// But we don't send it unless we actually have subscribers
 	// Also, we don't want to peg the client send stats if we have none
-	bool hasSubs = it->second.mHasSubscribers;
+	Data header;
+	bool hasSubs = buildHeader(it, header, dest);
+	logProduced(header, length, hasSubs);
+	
+	// Now check for subscribers and don't actually send the message unless we do have them
+	if (!hasSubs)
+		return false;
+	
+	// Send over TCP socket to the GCN
+	// If the GCN asked us to slow down the message may be held and sent later
+	// and then it needs its own copy of the content
+	uint32_t sizeSent = 0;
+	if (it->second.mRateLimit > 0)
+	{
+		AppMessage message;
+		auto pData = message.add_data();
+		*pData = header;
+		string* pContent = pData->mutable_data();
+		pContent->resize(length);
+		if (length)
+			fill(&(*pContent)[0]);
+		if (!pace(gid, message))
+		{
+			it->second.serrCount++;
+			return false;
+		}
+	}
+	else
+	{
+		string sHeader;
+		header.SerializePartialToString(&sHeader);
+		sizeSent = sendDataToGCN(sHeader, &length, 1, [&fill](size_t /*index*/, char* pDest) { fill(pDest); });
+		if (!sizeSent)
+		{
+			it->second.serrCount++;
+			return false;
+		}
+	}
+	
+	// Check log level first because printing to string is expensive
+	// and can affect throughput
+	if (mCurrentLogLevel >= LOG_DEBUG)
+	{ 
+		string sMessage;
+		mPbPrinter.PrintToString(header, &sMessage);
+		LOG(LOG_DEBUG, "Sent Content (%d bytes, %d of content):\n%s", sizeSent, (int)length, sMessage.c_str());
+	}
+
+	if (header.has_uheader())
+		it->second.sendCountUni++;
+	it->second.sendCount++;
+	return true;
+}
+
+//************************************************************************
+// function to send several contents to the same place. They share one
+// header and go in as few AppMessages as they fit in
+int gcnClient::sendPayloads(GroupId gid, const vector<PayloadView> & payloads, NodeId dest)
+{
+	ClientIt it = mClientMap.find(gid);
+	LOG_ASSERT(it != mClientMap.end(), "Could not find GID %d in client map", gid);
+	
+	// While we are paced they go out one at a time anyway
+	if (it->second.mRateLimit > 0)
+	{
+		int sent = 0;
+		for (auto & payload : payloads)
+		{
+			if (sendPayload(gid, payload.data, payload.length, dest))
+				sent++;
+		}
+		return(sent);
+	}
+	
+	Data header;
+	bool hasSubs = buildHeader(it, header, dest);
+	vector<size_t> lengths;
+	lengths.reserve(payloads.size());
+	for (auto & payload : payloads)
+	{
+		logProduced(header, payload.length, hasSubs);
+		lengths.push_back(payload.length);
+	}
+	
+	if (!hasSubs)
+		return(0);
+	
+	string sHeader;
+	header.SerializePartialToString(&sHeader);
+	
+	int sent = 0;
+	size_t first = 0;
+	while (first < payloads.size())
+	{
+		// Take as many as fit in one AppMessage (at least one)
+		size_t count = 0;
+		uint32_t totalSize = mSizeOfSize;
+		while (first + count < payloads.size())
+		{
+			uint32_t fieldSize = dataFieldSize(sHeader.size(), lengths[first + count]);
+			if ( count && (totalSize + fieldSize > MAX_BUFFER_SIZE) )
+			{
+				break;
+			}
+			totalSize += fieldSize;
+			count++;
+		}
+		
+		uint32_t sizeSent = sendDataToGCN(sHeader, &lengths[first], count, 
+			[&payloads, first](size_t index, char* pDest) { memcpy(pDest, payloads[first + index].data, payloads[first + index].length); });
+		if (sizeSent)
+		{
+			sent += count;
+			LOG(LOG_DEBUG, "Sent %d Contents for GID %d (%d bytes)", (int)count, gid, sizeSent);
+		}
+		else
+		{
+			it->second.serrCount += count;
+		}
+		first += count;
+	}
+	
+	if (header.has_uheader())
+		it->second.sendCountUni += sent;
+	it->second.sendCount += sent;
+	return(sent);
+}
+
+//************************************************************************
+// function any thread can call to send content. It is copied into the
+// submit queue and sent by drainSubmitted on the io_service thread
+bool gcnClient::submitPayload(GroupId gid, const char* payload, size_t length, NodeId dest)
+{
+	if (mSubmitDepth.fetch_add(1) >= SUBMIT_MAX_QUEUE)
+	{
+		mSubmitDepth--;
+		mSubmitDrops++;
+		return(false);
+	}
+	
+	SubmitEntry entry;
+	entry.gid = gid;
+	entry.dest = dest;
+	entry.content.assign(payload, length);
+	mSubmitQueue.push(std::move(entry));
+	mSubmitCount++;
+	
+	// Only the first message since the last drain started needs to ask for one
+	if (!mDrainPosted.exchange(true))
+	{
+		pIoService->post(boost::bind(&gcnClient::drainSubmitted, this));
+	}
+	return(true);
+}
+
+//************************************************************************
+// function to send what other threads submitted. Messages in a row for
+// the same place go out together
+void gcnClient::drainSubmitted()
+{
+	// Anything submitted from here on needs another drain. This is done
+	// before popping so a message can not be left behind
+	mDrainPosted.store(false);
+	
+	vector<SubmitEntry> entries;
+	SubmitEntry entry;
+	while ( (entries.size() < SUBMIT_DRAIN_BATCH) && mSubmitQueue.pop(entry) )
+	{
+		entries.push_back(std::move(entry));
+	}
+	mSubmitDepth -= entries.size();
+	
+	vector<PayloadView> payloads;
+	size_t first = 0;
+	while (first < entries.size())
+	{
+		size_t last = first;
+		payloads.clear();
+		while ( (last < entries.size()) && (entries[last].gid == entries[first].gid) && (entries[last].dest == entries[first].dest) )
+		{
+			payloads.push_back(PayloadView{entries[last].content.data(), entries[last].content.size()});
+			last++;
+		}
+		sendPayloads(entries[first].gid, payloads, entries[first].dest);
+		mSubmitBatches++;
+		first = last;
+	}
+	
+	// Leave the rest for another turn so the io_service can do other work
+	if ( (entries.size() == SUBMIT_DRAIN_BATCH) && !mDrainPosted.exchange(true) )
+	{
+		pIoService->post(boost::bind(&gcnClient::drainSubmitted, this));
+	}
+}
+
+//************************************************************************
+// function to fill in everything in a DATA but the content. Returns
+// whether there is anyone to send it to
+bool gcnClient::buildHeader(ClientIt it, Data & header, NodeId dest)
+{
+	header.set_gid(it->first);
 	
 	if (dest)
 	{
 		//This is a unicast packet. Build the header and add to data message
-		auto pHeader = pData->mutable_uheader();
+		auto pHeader = header.mutable_uheader();
 		pHeader->set_unicastdest(dest);
 		pHeader->set_resilience(it->second.mResilience);
 		// If we are not using ADVERTISE/ACK then we need to fill in the src ttl field
 		if (it->second.mAnnounceRate < 0)
-			pData->set_srcttl(it->second.mResponseTtl);
-
-		if (hasSubs)
-			it->second.sendCountUni++;
+			header.set_srcttl(it->second.mResponseTtl);
 	}
 	else if (it->second.mDest)
 	{
 		// I am a GID source and am now sending data as unicast. Build the header and add to data message
-		auto pHeader = pData->mutable_uheader();
+		auto pHeader = header.mutable_uheader();
 		pHeader->set_unicastdest(it->second.mDest);
 		pHeader->set_resilience(it->second.mResilience);
 		// If we are not using ADVERTISE/ACK then we need to fill in the src ttl field
 		if (it->second.mAnnounceRate < 0)
-			pData->set_srcttl(it->second.mResponseTtl);
-		
-		if (hasSubs)
-			it->second.sendCountUni++;
+			header.set_srcttl(it->second.mResponseTtl);
 	}
 	else if (it->second.mAnnounceRate < 0)
 	{
 		// This app is NOT using ADVERTISE/ACK then we need to fill
 		// in the srcttl
-		pData->set_srcttl(it->second.mSrcttl);
+		header.set_srcttl(it->second.mSrcttl);
 		
 		// If we aren't regenerating TTL then we need to fill in that field
 		if (!(it->second.mRegenerateTtl))
-			pData->set_nottlregen(true);
+			header.set_nottlregen(true);
 	}
 	
-	
-	
+	return(it->second.mHasSubscribers);
+}
+
+//************************************************************************
+void gcnClient::logProduced(const Data & header, size_t length, bool hasSubs)
+{
 	if(mDataFile != NULL) //DATAITEM
 	{
 		mDataProdDI++;
 		char buf[256];
 		uint64_t millis = duration_cast<milliseconds>(getTime()).count();
 		int buflen = sprintf(buf,"0,%.0f,ll.gcnClientProdData,node%03d.gcnClient,%.0f,\"{\"\"gid\"\":%d,\"\"size\"\":%d,\"\"ttl\"\":%d,\"\"sent\"\":%d}\"\n",
-			(double)mDataProdDI,mNodeId,(double)millis,pData->gid(),(int)pData->data().size(),pData->srcttl(),hasSubs);
+			(double)mDataProdDI,mNodeId,(double)millis,header.gid(),(int)length,header.srcttl(),hasSubs);
 		fwrite(buf,sizeof(char),buflen,mDataFile);
 		fflush(mDataFile);
 	}
+}
+
+
+//************************************************************************
+// function to send a message at no more than the rate the GCN asked for.
+// Messages sent too soon wait in the pace queue. Returns false if the
+// queue is full.
+bool gcnClient::pace(GroupId gid, AppMessage & message)
+{
+	ClientGroupInfo & info = mClientMap[gid];
+	double now = getTimeSec();
 	
-	// Now check for subscribers and don't actually send the message unless we do have them
-	if (!hasSubs)
-		return false;
+	if ( info.mPaceQueue.empty() && (now >= info.mNextSendTime) )
+	{
+		sendToGCN(message);
+		info.mNextSendTime = now + 1.0 / info.mRateLimit;
+		return true;
+	}
 	
-	// Send over TCP socket to the GCN
-	uint32_t sizeSent = sendToGCN(message);
+	if (info.mPaceQueue.size() >= PACE_MAX_QUEUE)
+	{
+		LOG(LOG_WARN, "Pace queue for GID %d is full (rate %lf). Dropping message", gid, info.mRateLimit);
+		return false;
+	}
+	info.mPaceQueue.push_back(message);
 	
-	// Check log level first because printing to string is expensive
-	// and can affect throughput
-	if (mCurrentLogLevel >= LOG_DEBUG)
-	{ 
-		string sMessage;
-		mPbPrinter.PrintToString(message, &sMessage);
-		LOG(LOG_DEBUG, "Sent Content (%d bytes):\n%s", sizeSent, sMessage.c_str());
+	if (!info.mPaceTimerSet)
+	{
+		info.mPaceTimer->expires_from_now(Microseconds((long)((info.mNextSendTime - now) * 1000000) + 1));
+		info.mPaceTimer->async_wait(boost::bind(&gcnClient::OnPaceTimeout, this, boost::asio::placeholders::error, gid));
+		info.mPaceTimerSet = true;
 	}
-
-	it->second.sendCount++;
 	return true;
 }
 
+//************************************************************************
+void gcnClient::OnPaceTimeout(const error_code & ec, GroupId gid)
+{
+	// whoever canceled the timer also cleared the flag
+	if (ec == operation_aborted)
+	{
+		return;
+	}
+	
+	ClientGroupInfo & info = mClientMap[gid];
+	info.mPaceTimerSet = false;
+	if ( info.mPaceQueue.empty() || (info.mRateLimit <= 0) )
+	{
+		return;
+	}
+	
+	double now = getTimeSec();
+	if (now >= info.mNextSendTime)
+	{
+		sendToGCN(info.mPaceQueue.front());
+		info.mPaceQueue.pop_front();
+		info.mNextSendTime = now + 1.0 / info.mRateLimit;
+	}
+	
+	if (!info.mPaceQueue.empty())
+	{
+		info.mPaceTimer->expires_from_now(Microseconds((long)((info.mNextSendTime - now) * 1000000) + 1));
+		info.mPaceTimer->async_wait(boost::bind(&gcnClient::OnPaceTimeout, this, boost::asio::placeholders::error, gid));
+		info.mPaceTimerSet = true;
+	}
+}
+
 
 //************************************************************************
 // function to send a pull to the GCN to notify it of the groups
@@ -303,6 +664,19 @@ void gcnClient::sendPull(GroupId gid)
 	// set the group id field
 	auto pPull = message.add_pull();
 	pPull->set_gid(gid);
+	
+	// ask the GCN to NACK any DATA it misses for this group
+	ClientIt iter = mClientMap.find(gid);
+	if ( (iter != mClientMap.end()) && iter->second.mReliable )
+	{
+		pPull->set_reliable(true);
+	}
+	
+	// ask the GCN to send the group's DATA with a higher (or lower) priority
+	if ( (iter != mClientMap.end()) && iter->second.mPriority )
+	{
+		pPull->set_priority(iter->second.mPriority);
+	}
 
 	// Send over TCP socket to the GCN
 	uint32_t sizeSent = sendToGCN(message);
@@ -362,6 +736,25 @@ void gcnClient::sendAdvertise(GroupId gid, GCNMessage::AdvertiseType type)
 		if (!(it->second.mRegenerateTtl))
 			pAdvertise->set_nottlregen(true);
 	}
+	
+	// The GCN does the FEC encoding for the group
+	if ( it->second.mFecK && it->second.mFecR )
+	{
+		pAdvertise->set_feck(it->second.mFecK);
+		pAdvertise->set_fecr(it->second.mFecR);
+	}
+	
+	// The GCN does the network coding for the group
+	if (it->second.mRlncGen)
+	{
+		pAdvertise->set_rlncgen(it->second.mRlncGen);
+	}
+	
+	// The GCN sends the group's DATA with this socket priority
+	if (it->second.mPriority)
+	{
+		pAdvertise->set_priority(it->second.mPriority);
+	}
 
 	// Send to the GCN
 	uint32_t sizeSent = sendToGCN(message);
@@ -377,7 +770,8 @@ void gcnClient::sendAdvertise(GroupId gid, GCNMessage::AdvertiseType type)
 void gcnClient::OnRecvMessage(char* buffer, unsigned int len)
 {
 
-	AppMessage message;
+	MessagePool<AppMessage>::Handle pooled(mAppPool);
+	AppMessage & message = *pooled;
 	
 	if(message.ParseFromArray(buffer, len))
 	{
@@ -387,7 +781,7 @@ void gcnClient::OnRecvMessage(char* buffer, unsigned int len)
 		{ 
 			string sMessage;
 			mPbPrinter.PrintToString(message, &sMessage);
-			LOG(LOG_DEBUG, "Received message (%d bytes):\n%s", message.ByteSize(), sMessage.c_str()); 
+			LOG(LOG_DEBUG, "Received message (%zu bytes):\n%s", message.ByteSizeLong(), sMessage.c_str()); 
 		}
 
 		// handle any pulls that are in the message
@@ -410,6 +804,50 @@ void gcnClient::OnRecvMessage(char* buffer, unsigned int len)
 			it->second.mHasSubscribers = false;
 		}
 		
+		// handle the GCN's answer to our offer of shared memory.
+		// Either way nobody else needs the name anymore
+		for ( auto & shmAttach : *message.mutable_shmattach() )
+		{
+			if (!mShm || (shmAttach.name() != mShm->name()))
+			{
+				continue;
+			}
+			mShm->unlink();
+			if (shmAttach.accepted())
+			{
+				mShmActive = true;
+				mShmWrite = true;
+				LOG(LOG_INFO, "Using shared memory with %d byte rings to the GCN", shmAttach.size());
+			}
+			else
+			{
+				LOG(LOG_WARN, "GCN declined shared memory. Using the socket");
+				mShm.reset();
+			}
+		}
+		
+		// handle any rate feedback. The GCN tells us how fast we may send
+		// when it is congested and lifts the limit (rate 0) when it is not
+		for ( auto & rateControl : *message.mutable_ratecontrol() )
+		{
+			ClientIt it = mClientMap.find(rateControl.gid());
+			LOG_ASSERT(it != mClientMap.end(), "Could not find GID %d in client map", rateControl.gid());
+			LOG(LOG_INFO, "Received RATECONTROL for GID %d: rate %lf%s", rateControl.gid(), rateControl.rate(), (rateControl.slowdown() ? " (slow down)" : ""));
+			it->second.mRateLimit = rateControl.rate();
+			
+			// No more limit so send whatever we were holding
+			if ( (it->second.mRateLimit <= 0) && !it->second.mPaceQueue.empty() )
+			{
+				it->second.mPaceTimer->cancel();
+				it->second.mPaceTimerSet = false;
+				while (!it->second.mPaceQueue.empty())
+				{
+					sendToGCN(it->second.mPaceQueue.front());
+					it->second.mPaceQueue.pop_front();
+				}
+			}
+		}
+		
 		// handle any data pushes that we received
 		// These are processed by the function that the application provided.
 		for ( auto & data : *message.mutable_data() )
@@ -429,7 +867,26 @@ void gcnClient::OnRecvMessage(char* buffer, unsigned int len)
 			}
 			
 			// Only increment count if told to do so
-			if (it->second.mMsgHandler(data))
+			bool counted;
+			if (it->second.mViewHandler)
+			{
+				// The content is handed over where protobuf parsed it
+				DataView view;
+				view.gid = data.gid();
+				view.srcNode = data.srcnode();
+				view.sequence = data.sequence();
+				view.ttl = data.ttl();
+				view.distance = data.distance();
+				view.unicast = data.has_uheader();
+				view.payload.data = data.data().data();
+				view.payload.length = data.data().size();
+				counted = it->second.mViewHandler(view);
+			}
+			else
+			{
+				counted = it->second.mMsgHandler(data);
+			}
+			if (counted)
 				it->second.recvCount++;
 			
 			// Is this application using ADVERTISE/ACK? We test that by whether or not
@@ -455,7 +912,7 @@ void gcnClient::OnRecvMessage(char* buffer, unsigned int len)
 				{
 					// I am not a source node so I just send a response every nth packet.
 					// Construct payload
-					Buffer msgBuffer;
+					array<char, MAX_BUFFER_SIZE> msgBuffer;
 					char* tempMsg = msgBuffer.data();
 					sprintf(tempMsg, "Response %d to node %d for GID %d", it->second.recvCount, data.srcnode(), data.gid());
 				
@@ -515,6 +972,25 @@ void gcnClient::OnStatTimeout()
 			it->second.serrCount, it->second.recvCountUni, it->second.sendCountUni);
 	}
 	
+	if (mBatchFlushes)
+	{
+		LOG(LOG_FORCE,"GCN Client batch stats: batches>%u data>%u", mBatchFlushes, mBatchedItems);
+	}
+	
+	if (mSubmitCount)
+	{
+		LOG(LOG_FORCE,"GCN Client submit stats: submitted>%u dropped>%u batches>%u waiting>%u", 
+			mSubmitCount.load(), mSubmitDrops.load(), mSubmitBatches.load(), (unsigned int)mSubmitDepth.load());
+	}
+	
+	if ( !mSocketConnected || mReconnects || mOutageDrops )
+	{
+		LOG(LOG_FORCE,"GCN Client connection stats: connected>%s lost>%u held>%u dropped>%u waiting>%u", 
+			(mSocketConnected ? "True" : "False"), mReconnects, mOutageHeld, mOutageDrops, (unsigned int)mOutageQueue.size());
+	}
+	
+	LOG(LOG_FORCE,"GCN Client buffer stats: %s", BufferPool::instance().statsString().c_str());
+	
 	// reschedule the periodic event
 	if (mStatInterval > 0)
 		{
@@ -524,69 +1000,275 @@ void gcnClient::OnStatTimeout()
 }
 
 //************************************************************************
-void gcnClient::recvFromGCN()
+// function to start connecting to the GCN. OnConnect is called when it
+// has either connected or failed
+void gcnClient::connectToGCN()
+{
+	tcp::endpoint endpoint(boost::asio::ip::address::from_string(DEFAULT_SERVER_HOST), mPort);
+	mSocket.async_connect(endpoint, boost::bind(&gcnClient::OnConnect, this, boost::asio::placeholders::error));
+}
+
+//************************************************************************
+void gcnClient::OnConnect(const error_code & ec)
+{
+	if (mStopped)
+	{
+		return;
+	}
+	
+	// Try again later, waiting twice as long each time up to a limit
+	if (ec)
+	{
+		mSocket.close();
+		LOG(LOG_WARN, "Not yet connected to the GCN (%s). Trying again in %0.1lf seconds", ec.message().c_str(), mReconnectDelay);
+		mReconnectTimer.expires_from_now(Microseconds((long)(mReconnectDelay * 1000000)));
+		mReconnectTimer.async_wait(boost::bind(&gcnClient::OnReconnectTimeout, this, boost::asio::placeholders::error));
+		mReconnectDelay = std::min(mReconnectDelay * 2, RECONNECT_MAX_DELAY);
+		return;
+	}
+	
+	mSocketConnected = true;
+	mReconnectDelay = RECONNECT_MIN_DELAY;
+	printf("SUCCESS: client connected\n");
+	
+	// start listening to GCN
+	mReader.reset();
+	recvFromGCN();
+	
+	// This GCN knows nothing about us yet. Tell it about every group first
+	// so it knows what to do with the DATA that waited for it
+	for (ClientIt it = mClientMap.begin(); it != mClientMap.end(); ++it)
+	{
+		registerGroup(it);
+	}
+	
+	// ask the GCN to use shared memory instead of the socket
+	if (mShmBytes)
+	{
+		offerShm(mShmBytes);
+	}
+	
+	sendHeld();
+}
+
+//************************************************************************
+// function to give up on the GCN we were connected to and start trying
+// to connect to it (or the one that replaces it) again
+void gcnClient::OnDisconnect(const error_code & ec)
 {
-	// Create buffer
-	BufferPtr pBuffer(new Buffer);
+	LOG(LOG_ERROR, "Lost the connection to the GCN (%s). Reconnecting", ec.message().c_str());
+	mSocketConnected = false;
+	mSocket.close();
+	mReconnects++;
+	
+	// The rings went with the GCN. Whatever was in them is lost
+	if (mShm)
+	{
+		mShm->unlink();
+		mShm.reset();
+		mShmActive = false;
+		mShmWrite = false;
+	}
 	
-	// First we read the size of the incoming message, then the message itself into the pBuffer
-	async_read(mSocket, buffer(pBuffer->data(), mSizeOfSize),
-		[this, pBuffer](error_code ec, size_t length)
+	connectToGCN();
+}
+
+//************************************************************************
+void gcnClient::OnReconnectTimeout(const error_code & ec)
+{
+	if ( (ec == operation_aborted) || mStopped )
+	{
+		return;
+	}
+	connectToGCN();
+}
+
+//************************************************************************
+// function to hold DATA until we are connected again. Held DATA that is
+// too old is dropped and so is new DATA if too much is already held
+void gcnClient::holdData(BufferPtr pBuffer, uint32_t totalSize)
+{
+	double now = getTimeSec();
+	expireHeld(now);
+	
+	if ( (mOutageTime <= 0) || (mOutageBytes + totalSize > OUTAGE_MAX_BYTES) )
+	{
+		mOutageDrops++;
+		return;
+	}
+	
+	OutageEntry entry;
+	entry.pBuffer = pBuffer;
+	entry.totalSize = totalSize;
+	entry.time = now;
+	mOutageQueue.push_back(entry);
+	mOutageBytes += totalSize;
+}
+
+//************************************************************************
+// function to drop held DATA older than the outage time
+void gcnClient::expireHeld(double now)
+{
+	while ( !mOutageQueue.empty() && (mOutageQueue.front().time + mOutageTime < now) )
+	{
+		mOutageBytes -= mOutageQueue.front().totalSize;
+		mOutageQueue.pop_front();
+		mOutageDrops++;
+	}
+}
+
+//************************************************************************
+// function to send the DATA held while we were not connected
+void gcnClient::sendHeld()
+{
+	expireHeld(getTimeSec());
+	
+	while (!mOutageQueue.empty())
+	{
+		writeToGCN(mOutageQueue.front().pBuffer, mOutageQueue.front().totalSize, true);
+		mOutageQueue.pop_front();
+		mOutageHeld++;
+	}
+	mOutageBytes = 0;
+}
+
+//************************************************************************
+void gcnClient::recvFromGCN()
+{
+	// Read whatever the GCN has sent and handle every whole message in it
+	mSocket.async_read_some(mReader.space(),
+		[this](error_code ec, size_t length)
 		{
-			if (!ec)
+			if (ec)
 			{
-				//for (unsigned int i = 0; i < length; i++)
-				//{
-				//	printf("0x%x  ", (unsigned char)(pBuffer->data())[i]);
-				//}
-				//printf("\n");
-				
-				// get the size 
-				uint32_t messageSize{};
-				memcpy(&messageSize, pBuffer->data(), length);
-				messageSize = ntohl(messageSize);
-
-				// read the message
-				if ( (messageSize) && (messageSize <= MAX_BUFFER_SIZE - mSizeOfSize) )
+				// We closed the socket ourselves
+				if ( (ec == operation_aborted) || mStopped )
 				{
-					async_read(mSocket, buffer(pBuffer->data() + mSizeOfSize, messageSize),
-						[this, pBuffer](error_code ec, size_t length)
-						{
-							if (!ec)
-							{
-								// call function to process message
-								OnRecvMessage(pBuffer->data() + mSizeOfSize, length);
-								recvFromGCN();
-							}
-							else
-							{
-								LOG(LOG_ERROR, "Stopping GCN Client. async_receive of msg buffer had error %s\n", ec.message().c_str());
-								Stop();
-								exit(1);
-							}
-						});
+					return;
+				}
+				OnDisconnect(ec);
+				return;
+			}
+			mReader.commit(length);
+			
+			char* pMessage;
+			uint32_t messageSize;
+			FrameStatus status;
+			while ( (status = mReader.next(pMessage, messageSize)) != FRAME_NONE )
+			{
+				// A zero length message is the GCN ringing the doorbell
+				// for what it put in the shared memory ring
+				if ( (status == FRAME_OK) && (messageSize == 0) && mShmActive )
+				{
+					recvFromShm();
+					if (mShm->fromGcn().broken())
+					{
+						OnDisconnect(boost::system::errc::make_error_code(boost::system::errc::bad_message));
+						return;
+					}
+				}
+				else if ( (status == FRAME_OK) && messageSize )
+				{
+					// call function to process message
+					OnRecvMessage(pMessage, messageSize);
 				}
 				else
 				{
 					LOG(LOG_ERROR, "recvFromGCN messageSize check failed. messageSize is %d\n", messageSize);
-					recvFromGCN();
 				}
 			}
-			else
-			{
-				LOG(LOG_ERROR, "Stopping GCN Client. async_receive of msg size buffer had error %s\n", ec.message().c_str());
-				Stop();
-				exit(1);
-			}
+			recvFromGCN();
 		});
 }
 
 
+//************************************************************************
+// function to process the messages the GCN put in the shared memory ring.
+// They are parsed where they are and then released
+void gcnClient::recvFromShm()
+{
+	ShmRing & ring = mShm->fromGcn();
+	do
+	{
+		uint32_t length;
+		char* pMessage;
+		while ( (pMessage = ring.peek(length)) != NULL )
+		{
+			OnRecvMessage(pMessage, length);
+			ring.release();
+		}
+	} while (!ring.sleep());
+}
+
+//************************************************************************
+// function to create the shared memory rings and offer them to the GCN.
+// We keep using the socket until the GCN answers
+void gcnClient::offerShm(uint32_t ringBytes)
+{
+	mShm.reset(new ShmChannel);
+	if (!mShm->create(ringBytes))
+	{
+		LOG(LOG_WARN, "Unable to create shared memory. Using the socket");
+		mShm.reset();
+		return;
+	}
+	
+	AppMessage message;
+	auto pShmAttach = message.add_shmattach();
+	pShmAttach->set_name(mShm->name());
+	pShmAttach->set_size(mShm->ringBytes());
+	sendToGCN(message);
+}
+
+//************************************************************************
+// function to send everything from now on over the socket. Once one
+// message has gone that way the GCN could otherwise find later messages
+// in the ring before it has read that one off the socket
+void gcnClient::stopShmWrite()
+{
+	mShmWrite = false;
+	LOG(LOG_WARN, "Shared memory ring to the GCN is full. Using the socket");
+}
+
+//************************************************************************
+// function to tell the GCN there are messages for it in the ring
+void gcnClient::ringDoorbell()
+{
+	// the doorbell is a message of size 0
+	static BufferPtr pDoorbell = []()
+	{
+		BufferPtr pBuffer = newBuffer(sizeof(uint32_t));
+		memset(pBuffer->data(), 0, sizeof(uint32_t));
+		return(pBuffer);
+	}();
+	
+	writeToGCN(pDoorbell, mSizeOfSize, false);
+}
+
 //************************************************************************
 uint32_t gcnClient::sendToGCN(AppMessage & message)
 {
-	uint32_t size = message.ByteSize();
+	flushBatch();
+	
+	uint32_t size = message.ByteSizeLong();
 	uint32_t totalSize = size + mSizeOfSize;
+	
+	// With shared memory the message is serialized straight into the ring.
+	// If the GCN has fallen that far behind it goes on the socket instead
+	if (mShmWrite)
+	{
+		char* pDest = mShm->toGcn().reserve(size);
+		if (pDest)
+		{
+			message.SerializeToArray(pDest, size);
+			if (mShm->toGcn().commit(size))
+			{
+				ringDoorbell();
+			}
+			return(size);
+		}
+		stopShmWrite();
+	}
 
 	// Check the total size can fit in the buffer
 	if ( totalSize > MAX_BUFFER_SIZE )
@@ -596,7 +1278,7 @@ uint32_t gcnClient::sendToGCN(AppMessage & message)
 		}
 	
 	// Buffer to hold the message to send
-	BufferPtr pBuffer(new Buffer);
+	BufferPtr pBuffer = newBuffer(totalSize);
 
 	// Copy the size of the AppMessage first
 	uint32_t htnSize = htonl(size);
@@ -614,17 +1296,231 @@ uint32_t gcnClient::sendToGCN(AppMessage & message)
 	printf("\n");
 #endif
 
-	// Now send the message
-	async_write(mSocket, buffer(*pBuffer, totalSize),
+	writeToGCN(pBuffer, totalSize, (message.data_size() > 0));
+	return(totalSize);
+}
+
+//************************************************************************
+// function to send DATA to the GCN in an AppMessage that is put together
+// here instead of by protobuf. header is the serialized Data without its
+// content and is the same for all count of them. fill writes the content
+// of each one straight into the buffer (or shared memory ring)
+uint32_t gcnClient::sendDataToGCN(const string & header, const size_t* lengths, size_t count, function<void(size_t index, char* pDest)> fill)
+{
+	uint32_t size = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		if (lengths[i] > MAX_BUFFER_SIZE)
+		{
+			LOG(LOG_ERROR, "Content too large (%d bytes)", (int)lengths[i]);
+			return 0;
+		}
+		size += dataFieldSize(header.size(), lengths[i]);
+	}
+	uint32_t totalSize = size + mSizeOfSize;
+	
+	// The shared memory ring batches by itself
+	if (mBatchDelay && !mShmWrite)
+	{
+		return(batchData(header, lengths, count, fill));
+	}
+	flushBatch();
+	
+	// With shared memory the message goes straight into the ring.
+	// If the GCN has fallen that far behind it goes on the socket instead
+	uint8_t* pDest = NULL;
+	if (mShmWrite)
+	{
+		pDest = (uint8_t*)mShm->toGcn().reserve(size);
+		if (!pDest)
+		{
+			stopShmWrite();
+		}
+	}
+	
+	BufferPtr pBuffer;
+	if (!pDest)
+	{
+		// Check the total size can fit in the buffer
+		if ( totalSize > MAX_BUFFER_SIZE )
+		{
+			LOG(LOG_ERROR, "AppMessage too large");
+			return 0;
+		}
+		pBuffer = newBuffer(totalSize);
+		
+		// Copy the size of the AppMessage first
+		uint32_t htnSize = htonl(size);
+		memcpy(pBuffer->data(), &htnSize, mSizeOfSize);
+		pDest = (uint8_t*)pBuffer->data() + mSizeOfSize;
+	}
+	
+	for (size_t i = 0; i < count; i++)
+	{
+		pDest = writeData(pDest, header, lengths[i], i, fill);
+	}
+	
+	if (!pBuffer)
+	{
+		if (mShm->toGcn().commit(size))
+		{
+			ringDoorbell();
+		}
+		return(size);
+	}
+	
+	writeToGCN(pBuffer, totalSize, true);
+	return(totalSize);
+}
+
+//************************************************************************
+// function to add DATA to the batch instead of sending it now. The batch
+// goes out once it has batchCount DATA or batchBytes bytes, or
+// batchDelay microseconds after the first DATA went in
+uint32_t gcnClient::batchData(const string & header, const size_t* lengths, size_t count, function<void(size_t index, char* pDest)> fill)
+{
+	uint32_t added = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		uint32_t fieldSize = dataFieldSize(header.size(), lengths[i]);
+		if (mSizeOfSize + fieldSize > MAX_BUFFER_SIZE)
+		{
+			LOG(LOG_ERROR, "AppMessage too large");
+			return 0;
+		}
+		
+		// Send what we have if this one does not fit
+		if ( mBatch && (mSizeOfSize + mBatchSize + fieldSize > MAX_BUFFER_SIZE) )
+		{
+			flushBatch();
+		}
+		if (!mBatch)
+		{
+			mBatch = newBuffer();
+			mBatchSize = 0;
+			mBatchItems = 0;
+		}
+		
+		writeData((uint8_t*)mBatch->data() + mSizeOfSize + mBatchSize, header, lengths[i], i, fill);
+		mBatchSize += fieldSize;
+		mBatchItems++;
+		added += fieldSize;
+		
+		if ( (mBatchCount && (mBatchItems >= mBatchCount)) || (mBatchBytes && (mBatchSize >= mBatchBytes)) )
+		{
+			flushBatch();
+		}
+		else if (!mBatchTimerSet)
+		{
+			mBatchTimer.expires_from_now(Microseconds(mBatchDelay));
+			mBatchTimer.async_wait(boost::bind(&gcnClient::OnBatchTimeout, this, boost::asio::placeholders::error));
+			mBatchTimerSet = true;
+		}
+	}
+	return(added);
+}
+
+//************************************************************************
+// function to send the batch. Everything else sent to the GCN calls this
+// first so nothing overtakes the DATA in the batch
+void gcnClient::flushBatch()
+{
+	if (!mBatch)
+	{
+		return;
+	}
+	
+	if (mBatchTimerSet)
+	{
+		mBatchTimer.cancel();
+		mBatchTimerSet = false;
+	}
+	
+	uint32_t htnSize = htonl(mBatchSize);
+	memcpy(mBatch->data(), &htnSize, mSizeOfSize);
+	writeToGCN(mBatch, mBatchSize + mSizeOfSize, true);
+	mBatch.reset();
+	
+	mBatchFlushes++;
+	mBatchedItems += mBatchItems;
+}
+
+//************************************************************************
+void gcnClient::OnBatchTimeout(const error_code & ec)
+{
+	if (ec == operation_aborted)
+	{
+		return;
+	}
+	mBatchTimerSet = false;
+	flushBatch();
+}
+
+//************************************************************************
+// function to write a message to the GCN. If we are not connected DATA
+// is held until we are. Anything else is dropped since the pulls and
+// advertises are sent again when we connect
+void gcnClient::writeToGCN(BufferPtr pBuffer, uint32_t totalSize, bool isData)
+{
+	if (!mSocketConnected)
+	{
+		if (isData)
+		{
+			holdData(pBuffer, totalSize);
+		}
+		return;
+	}
+	
+	WriteEntry entry;
+	entry.pBuffer = pBuffer;
+	entry.totalSize = totalSize;
+	mWriteQueue.push_back(entry);
+	
+	if (!mWritesInFlight)
+	{
+		writeQueued();
+	}
+}
+
+//************************************************************************
+// function to write everything queued (up to WRITE_MAX_GATHER messages)
+// with one gather write. The messages stay queued until the write
+// completes so their buffers stay valid
+void gcnClient::writeQueued()
+{
+	array<boost::asio::const_buffer, WRITE_MAX_GATHER> buffers;
+	size_t count = 0;
+	for (auto & entry : mWriteQueue)
+	{
+		if (count == WRITE_MAX_GATHER)
+		{
+			break;
+		}
+		buffers[count++] = buffer(entry.pBuffer->data(), entry.totalSize);
+	}
+	mWritesInFlight = count;
+	
+	// (the rest of buffers are empty and write nothing)
+	async_write(mSocket, buffers,
 		    [this](error_code ec, size_t /*length*/)
 		    {
 			    if (ec)
 				    {
 					    LOG(LOG_ERROR, "Error sending to GCN");
+					    // the connection is gone so nothing queued will be written
+					    mWriteQueue.clear();
+					    mWritesInFlight = 0;
+					    return;
+				    }
+			    
+			    mWriteQueue.erase(mWriteQueue.begin(), mWriteQueue.begin() + mWritesInFlight);
+			    mWritesInFlight = 0;
+			    
+			    if (!mWriteQueue.empty())
+				    {
+					    writeQueued();
 				    }
 		    });
-
-	return(totalSize);
 }
 
 
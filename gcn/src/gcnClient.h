@@ -32,27 +32,51 @@
 #include <boost/date_time/posix_time/posix_time.hpp>
 
 #include "Common.h"
+#include "ShmRing.h"
+#include "MpscQueue.h"
+#include <deque>
 #include <google/protobuf/text_format.h>
+#include <google/protobuf/io/coded_stream.h>
 #include "GCNMessage.pb.h"
 
 using boost::asio::io_service;
 using boost::asio::deadline_timer;
+using std::deque;
+using google::protobuf::io::CodedOutputStream;
 
 // This is the client shared library class.
 //
 // The shared libary provides the following:
 //   - timer event for printing send and receive stats
 //   - thread for receiving messages
-//   - functionality for opening socket to the GCN
+//   - functionality for opening socket to the GCN, and opening it again
+//     (backing off between tries) whenever the GCN goes away. Pulls and
+//     advertises are sent again on each new connection and DATA sent in
+//     between is held for a while
 //   - handling of Advertise and Pull messages
+//   - pacing of content to the rate the GCN asks for when it is congested
+//   - optionally batching content into fewer, larger AppMessages
+//   - optionally exchanging messages with the GCN through shared memory rings
 //   - function to send content that can be called by client application
 //        prototype is: bool sendMessage(GroupId gid, char* msgBuffer, NodeId dest = 0)
 //        dest is an optional argument used to send unicast traffic
+//   - functions to send binary content of a given length without copies
+//        prototypes are: bool sendPayload(GroupId gid, const char* payload, size_t length, NodeId dest = 0)
+//                        bool sendPayload(GroupId gid, size_t length, function<void(char* pDest)> fill, NodeId dest = 0)
+//                        int sendPayloads(GroupId gid, const vector<PayloadView> & payloads, NodeId dest = 0)
+//        the second one lets the app write its content straight into the
+//        buffer (or shared memory ring) that goes to the GCN
+//   - function any thread can call to send content. It is queued and sent
+//     from the thread running the io_service
+//        prototype is: bool submitPayload(GroupId gid, const char* payload, size_t length, NodeId dest = 0)
+//        everything else must be called from the io_service thread
 //
 // The client application that uses the shared library is requred to do the following:
 //   - have a main which reads input line from user and serves as execution context
 //   - provide a function for processing received data messages
-//        prototype is: function<void(Data & dataMsg)>
+//        prototype is: function<bool(Data & dataMsg)>
+//        or, to see the content without protobuf types or copies,
+//        function<bool(const DataView & view)>
 //   - manage the way in which content is sent (e.g., periodically) and
 //     for building the actual content. 
 //   - Uses the function provided by the client shared library to send the content.
@@ -77,6 +101,14 @@ static const string 			DEFAULT_SERVER_HOST{"127.0.0.1"};
 static const unsigned int	DEFAULT_SRCTTL = 2;
 static const double 			DEFAULT_PUSH_RATE = 1.0;
 static const double 			DEFAULT_ANNOUNCE_RATE = 20.0;
+static const size_t			PACE_MAX_QUEUE = 100;   // messages held while pacing before sendMessage fails
+static const size_t			SUBMIT_MAX_QUEUE = 10000;  // messages submitted but not yet sent before submitPayload fails
+static const size_t			SUBMIT_DRAIN_BATCH = 256;  // most submitted messages sent per turn of the io_service
+static const double 			DEFAULT_OUTAGE_TIME = 5.0;
+static const size_t			OUTAGE_MAX_BYTES = 4194304;  // most bytes of DATA held while there is no GCN
+static const double 			RECONNECT_MIN_DELAY = 0.1;   // seconds before the first try to connect again
+static const double 			RECONNECT_MAX_DELAY = 5.0;   // most seconds between tries
+static const size_t			WRITE_MAX_GATHER = 16;       // most messages given to one write to the GCN
 
 // This is the number of characters needed in the message for timestamp.
 // Timestamp is sent as microseconds so we need 16 characters in the string.
@@ -87,6 +119,27 @@ static const double 			DEFAULT_ANNOUNCE_RATE = 20.0;
 
 static const char __attribute__ ((used)) *AppTypeStr[] = { "Listener only", "Sender only", "Listener and Sender"};
 
+// Content handed to or from the library. It does not own the bytes
+struct PayloadView
+{
+	const char*	data;
+	size_t		length;
+};
+
+// What an app that registered a view handler is given for each DATA.
+// The payload points into the received message and is only valid
+// during the call
+struct DataView
+{
+	GroupId		gid;
+	NodeId		srcNode;
+	uint64_t	sequence;
+	uint32_t	ttl;
+	uint32_t	distance;
+	bool		unicast;
+	PayloadView	payload;
+};
+
 // structure to hold config attributes
 struct ClientConfig
 {
@@ -109,6 +162,16 @@ struct ClientConfig
 	NodeId destNodeId;
 	uint32_t ackProbRelay;
 	string dataFile;
+	bool reliable;
+	uint32_t fecK;
+	uint32_t fecR;
+	uint32_t rlncGen;
+	uint32_t priority;
+	uint32_t shmBytes;      // bytes in each shared memory ring (0 = use the socket only)
+	uint32_t batchDelay;    // microseconds content may wait to be batched (0 = no batching)
+	uint32_t batchCount;    // send the batch once it has this many DATA (0 = no limit)
+	uint32_t batchBytes;    // send the batch once it has this many bytes (0 = when it is full)
+	double outageTime;      // seconds DATA is held while there is no GCN (0 = drop it)
 };
 
 struct ClientGroupInfo
@@ -123,8 +186,19 @@ struct ClientGroupInfo
 	UnicastResilience  mResilience;
 	bool mHasSubscribers;
 	bool mRegenerateTtl;
+	bool mReliable;
+	uint32_t mFecK;
+	uint32_t mFecR;
+	uint32_t mRlncGen;
+	uint32_t mPriority;
 	NodeId mDest;
+	double mRateLimit;       // messages per second the GCN asked for (0 = no limit)
+	double mNextSendTime;
+	bool mPaceTimerSet;
+	shared_ptr<deadline_timer> mPaceTimer;
+	deque<AppMessage> mPaceQueue;
 	function<bool(Data & dataMsg)>	mMsgHandler;
+	function<bool(const DataView & view)>	mViewHandler;   // used instead of mMsgHandler when set
 	// Stats
 	unsigned int    recvCount;  // count of DATA messages received; includes ALL message both bcast and unicast
 	unsigned int    sendCount;  // count of DATA messages sent; includes ALL message both bcast and unicast
@@ -134,6 +208,29 @@ struct ClientGroupInfo
 	unsigned int    sendCountUni;  // count of unicast DATA messages sent; this is unicast only and is a subset of sentCount
 };
 
+// DATA waiting for the connection to the GCN to come back
+// A message (or doorbell) waiting to be written to the GCN socket
+struct WriteEntry
+{
+	BufferPtr	pBuffer;
+	uint32_t	totalSize;
+};
+
+struct OutageEntry
+{
+	BufferPtr	pBuffer;
+	uint32_t	totalSize;
+	double		time;
+};
+
+// A message submitted from another thread waiting for the io_service thread
+struct SubmitEntry
+{
+	GroupId		gid;
+	NodeId		dest;
+	string		content;
+};
+
 typedef map<GroupId, ClientGroupInfo> ClientMap;
 typedef pair<GroupId, ClientGroupInfo> ClientPair;
 typedef map<GroupId, ClientGroupInfo>::iterator ClientIt;
@@ -149,21 +246,55 @@ class gcnClient
 		gcnClient(io_service * io_serv);
 		~gcnClient();
 		bool Start(const ClientConfig &config, function<bool(Data & dataMsg)> procFunc);
+		bool Start(const ClientConfig &config, function<bool(const DataView & view)> viewFunc);
 		void Stop();
+		// msgBuffer is text and ends at the first NUL
 		bool sendMessage(GroupId gid, char* msgBuffer, NodeId dest = 0);
+		bool sendPayload(GroupId gid, const char* payload, size_t length, NodeId dest = 0);
+		// fill is called with where the length bytes of content go
+		bool sendPayload(GroupId gid, size_t length, function<void(char* pDest)> fill, NodeId dest = 0);
+		// returns how many of the payloads were sent
+		int sendPayloads(GroupId gid, const vector<PayloadView> & payloads, NodeId dest = 0);
+		// Thread safe. Returns false if too many are waiting
+		bool submitPayload(GroupId gid, const char* payload, size_t length, NodeId dest = 0);
 		
 		google::protobuf::TextFormat::Printer mPbPrinter;
 
 	private:
+		bool startGroup(const ClientConfig &config, function<bool(Data & dataMsg)> procFunc, function<bool(const DataView & view)> viewFunc);
+		bool buildHeader(ClientIt it, Data & header, NodeId dest);
+		void logProduced(const Data & header, size_t length, bool hasSubs);
+		uint32_t sendDataToGCN(const string & header, const size_t* lengths, size_t count, function<void(size_t index, char* pDest)> fill);
+		void drainSubmitted();
 		void OnRecvMessage(char* buffer, unsigned int len);
 		void OnStatTimeout();
 		uint32_t sendToGCN(AppMessage & message);
+		void writeToGCN(BufferPtr pBuffer, uint32_t totalSize, bool isData);
+		void writeQueued();
+		uint32_t batchData(const string & header, const size_t* lengths, size_t count, function<void(size_t index, char* pDest)> fill);
+		void flushBatch();
+		void OnBatchTimeout(const error_code & ec);
+		void connectToGCN();
+		void OnConnect(const error_code & ec);
+		void OnDisconnect(const error_code & ec);
+		void OnReconnectTimeout(const error_code & ec);
+		void registerGroup(ClientIt it);
+		void holdData(BufferPtr pBuffer, uint32_t totalSize);
+		void expireHeld(double now);
+		void sendHeld();
 		void recvFromGCN();
+		void recvFromShm();
+		void offerShm(uint32_t ringBytes);
+		void stopShmWrite();
+		void ringDoorbell();
+		bool pace(GroupId gid, AppMessage & message);
+		void OnPaceTimeout(const error_code & ec, GroupId gid);
 
 		void sendPull(GroupId gid);
 		void sendUnpull(GroupId gid);
 		void sendAdvertise(GroupId gid, GCNMessage::AdvertiseType type);
 
+		io_service* pIoService;
 		NodeId mNodeId;
 		LogLevel mCurrentLogLevel;
 		unsigned int mPort;
@@ -172,9 +303,61 @@ class gcnClient
 		string mDataFilePath;
 		FILE* mDataFile;
 
-		tcp::resolver mResolver;
 		tcp::socket mSocket;
 		bool  mSocketConnected;
+		bool  mStarted;
+		bool  mStopped;
+		FrameReader mReader;
+		
+		// Messages and doorbells are written to the socket in order, with
+		// one write at a time so a doorbell can not land inside a message
+		deque<WriteEntry>  mWriteQueue;
+		size_t  mWritesInFlight;   // entries at the front of mWriteQueue being written now
+		
+		// Messages from the GCN are parsed into these instead of new ones
+		MessagePool<AppMessage> mAppPool;
+		
+		// Trying to connect again after losing the GCN. The delay doubles
+		// with each failed try
+		deadline_timer  mReconnectTimer;
+		double  mReconnectDelay;
+		unsigned int  mReconnects;     // times the connection to the GCN was lost
+		
+		// DATA sent while there was no GCN, oldest first. Anything older
+		// than mOutageTime seconds is dropped
+		double  mOutageTime;
+		deque<OutageEntry>  mOutageQueue;
+		size_t  mOutageBytes;
+		unsigned int  mOutageHeld;     // messages held and sent once connected
+		unsigned int  mOutageDrops;    // messages dropped because they were too old or too many
+		
+		// Shared memory rings to the GCN. Only used once the GCN accepted them
+		uint32_t  mShmBytes;
+		shared_ptr<ShmChannel> mShm;
+		bool  mShmActive;
+		bool  mShmWrite;    // messages to the GCN go in the ring until one does not fit
+		
+		// Messages submitted from other threads. Producers push and
+		// post a drain to the io_service if none is pending
+		MpscQueue<SubmitEntry> mSubmitQueue;
+		atomic<bool>  mDrainPosted;
+		atomic<size_t>  mSubmitDepth;
+		atomic<unsigned int>  mSubmitCount;    // messages submitted
+		atomic<unsigned int>  mSubmitDrops;    // messages refused because too many were waiting
+		atomic<unsigned int>  mSubmitBatches;  // sendPayloads calls made by drains
+
+		// DATA waiting to go to the GCN as one AppMessage. The first
+		// mSizeOfSize bytes of mBatch are left for the size
+		uint32_t  mBatchDelay;
+		uint32_t  mBatchCount;
+		uint32_t  mBatchBytes;
+		BufferPtr  mBatch;
+		uint32_t  mBatchSize;
+		uint32_t  mBatchItems;
+		deadline_timer  mBatchTimer;
+		bool  mBatchTimerSet;
+		unsigned int  mBatchFlushes;   // batches sent
+		unsigned int  mBatchedItems;   // DATA sent in them
 
 		deadline_timer mStatTimer;
 
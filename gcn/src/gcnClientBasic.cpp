@@ -108,6 +108,33 @@ void usage(const string & sAppName)
 	cout<<"                                Default behavior is to regenerate the TTL based on source TTL at a group node"<<endl;
 	cout<<"                                Set by the source node so this value is not relavent for non-source nodes"<<endl;
 	cout<<endl;
+	cout<<"  -n, --reliable                Ask the GCN to recover missing DATA messages with NACKs (listeners only)."<<endl;
+	cout<<"                                Nodes need a retransmission cache (gcn --retxcache) to answer."<<endl;
+	cout<<endl;
+	cout<<"  -K, --feck FEC_K              Number of DATA messages per FEC block (senders only). Used with --fecr."<<endl;
+	cout<<"  -R, --fecr FEC_R              Number of repair DATA messages sent for each FEC block (senders only)."<<endl;
+	cout<<"                                R = 1 sends XOR parity, R > 1 a Reed-Solomon code. K + R must not exceed 256."<<endl;
+	cout<<"                                Default is no FEC."<<endl;
+	cout<<endl;
+	cout<<"  -G, --rlncgen GEN_SIZE        Use random linear network coding with generations of GEN_SIZE DATA messages (senders only)."<<endl;
+	cout<<"                                Relays send new combinations of the DATA they hold. Replaces FEC if both are given."<<endl;
+	cout<<"                                Default is no network coding."<<endl;
+	cout<<endl;
+	cout<<"  -q, --priority PRIORITY       Socket priority (0-7) the GCN uses to send the group's DATA OTA."<<endl;
+	cout<<"                                1-2 = background, 0,3 = best effort, 4-5 = video, 6-7 = voice."<<endl;
+	cout<<"                                Default is 0 (best effort)."<<endl;
+	cout<<endl;
+	cout<<"  -S, --shm BYTES               Exchange messages with the GCN through shared memory rings of BYTES each"<<endl;
+	cout<<"                                instead of the socket, if the GCN accepts. Default is the socket only."<<endl;
+	cout<<endl;
+	cout<<"  -D, --batchdelay USEC         Batch DATA sent to the GCN, holding each for at most USEC microseconds."<<endl;
+	cout<<"  -C, --batchcount COUNT        Send the batch once it has COUNT DATA messages. Default is no limit."<<endl;
+	cout<<"  -B, --batchbytes BYTES        Send the batch once it has BYTES bytes. Default is when it is full."<<endl;
+	cout<<"                                Default is no batching."<<endl;
+	cout<<endl;
+	cout<<"  -O, --outagetime SECONDS      Hold DATA for up to SECONDS while reconnecting to the GCN. 0 drops it."<<endl;
+	cout<<"                                Default is 5 seconds."<<endl;
+	cout<<endl;
 }
 
 
@@ -329,10 +356,20 @@ int main(int argc, char* argv[])
 		{"stopcount",1, nullptr, 'z'},
 		{"stoptime",1, nullptr, 'y'},
 		{"dontregeneratettl",   0, nullptr, 'd'},
+		{"reliable",            0, nullptr, 'n'},
+		{"feck",                1, nullptr, 'K'},
+		{"fecr",                1, nullptr, 'R'},
+		{"rlncgen",             1, nullptr, 'G'},
+		{"priority",            1, nullptr, 'q'},
+		{"shm",                 1, nullptr, 'S'},
+		{"batchdelay",          1, nullptr, 'D'},
+		{"batchcount",          1, nullptr, 'C'},
+		{"batchbytes",          1, nullptr, 'B'},
+		{"outagetime",          1, nullptr, 'O'},
 		{0,         0, nullptr,  0 }
 	};
 
-	string sOptString{"hg:t:l:v:i:p:s:r:b:a:k:u:f:w:x:z:y:d"};
+	string sOptString{"hg:t:l:v:i:p:s:r:b:a:k:u:f:w:x:z:y:dnK:R:G:q:S:D:C:B:O:"};
 
 	int iOption{};
 	int iOptionIndex{};
@@ -358,6 +395,16 @@ int main(int argc, char* argv[])
 	config.resilience = LOW;
 	config.regenerateTtl = true;
 	config.dataFile = "";
+	config.reliable = false;
+	config.fecK = 0;
+	config.fecR = 0;
+	config.rlncGen = 0;
+	config.priority = 0;
+	config.shmBytes = 0;
+	config.batchDelay = 0;
+	config.batchCount = 0;
+	config.batchBytes = 0;
+	config.outageTime = DEFAULT_OUTAGE_TIME;
 
 	while((iOption = getopt_long(argc,argv,sOptString.c_str(), &options[0], &iOptionIndex)) != -1)
 	{
@@ -432,6 +479,36 @@ int main(int argc, char* argv[])
 		case 'd':
 			config.regenerateTtl = false;
 			break;
+		case 'n':
+			config.reliable = true;
+			break;
+		case 'K':
+			config.fecK = atoi(optarg);
+			break;
+		case 'R':
+			config.fecR = atoi(optarg);
+			break;
+		case 'G':
+			config.rlncGen = atoi(optarg);
+			break;
+		case 'q':
+			config.priority = atoi(optarg);
+			break;
+		case 'S':
+			config.shmBytes = atoi(optarg);
+			break;
+		case 'D':
+			config.batchDelay = atoi(optarg);
+			break;
+		case 'C':
+			config.batchCount = atoi(optarg);
+			break;
+		case 'B':
+			config.batchBytes = atoi(optarg);
+			break;
+		case 'O':
+			config.outageTime = atof(optarg);
+			break;
 		default:
 			usage(argv[0]);
 			exit (1); 
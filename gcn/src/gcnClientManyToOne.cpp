@@ -251,6 +251,16 @@ int main(int argc, char* argv[])
 	config.stopCount = 0;
 	config.msgSize = 100;
 	config.resilience = LOW;
+	config.reliable = false;
+	config.fecK = 0;
+	config.fecR = 0;
+	config.rlncGen = 0;
+	config.priority = 0;
+	config.shmBytes = 0;
+	config.batchDelay = 0;
+	config.batchCount = 0;
+	config.batchBytes = 0;
+	config.outageTime = DEFAULT_OUTAGE_TIME;
 
 	while((iOption = getopt_long(argc,argv,sOptString.c_str(), &options[0], &iOptionIndex)) != -1)
 	{
@@ -0,0 +1,111 @@
+/*
+ * Group Centric Networking
+ *
+ * Copyright (C) 2015 Massachusetts Institute of Technology
+ * All rights reserved.
+ *
+ * Authors:
+ *           Patricia Deutsch         <patricia.deutsch@ll.mit.edu>
+ *           Gregory Kuperman         <gkuperman@ll.mit.edu>
+ *           Leonid Veytser           <veytser@ll.mit.edu>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Start/stop test for GcnEngine.
+//
+// Starts an engine listening for apps, connects an app over TCP that
+// neither pulls nor advertises (so the GCN is left waiting on its socket)
+// and attaches an app in this process. Then stops the engine and checks
+// that the io_service runs dry, so an app that embeds the GCN can shut
+// down, and that nothing is left for it to run once the engine is gone.
+// Exits with 1 if the engine does not stop within a few seconds.
+
+#include "GcnEngine.h"
+#include <unistd.h>
+#include <signal.h>
+
+// Gives up if run() has not returned by then
+static const unsigned int TEST_TIMEOUT = 5;
+
+static void OnTimeout(int)
+{
+	const char message[] = "FAILED: the io_service did not run dry after Stop\n";
+	if (write(STDERR_FILENO, message, sizeof(message) - 1) < 0) {}
+	_exit(1);
+}
+
+int main()
+{
+	io_service io;
+
+	// Find a free port for the GCN to listen on
+	unsigned short port;
+	{
+		tcp::acceptor probe(io, tcp::endpoint(tcp::v4(), 0));
+		port = probe.local_endpoint().port();
+	}
+
+	GcnServiceConfig config;
+	initGcnServiceConfig(config);
+	config.nodeId = 1;
+	config.logLevel = LOG_WARN;
+	config.devices.push_back("lo");
+	config.appPort = port;
+
+	bool connected = false;
+	bool stopped = false;
+	{
+		GcnEngine engine(config, &io);
+		engine.Start();
+
+		GcnApp local = engine.attach([](const AppMessage &) {});
+
+		tcp::socket app(io);
+		deadline_timer timer(io);
+		app.async_connect(tcp::endpoint(boost::asio::ip::address_v4::loopback(), port),
+				  [&](const error_code & ec)
+				  {
+					  connected = !ec;
+					  // give the GCN time to accept the app and start reading from it
+					  timer.expires_from_now(Milliseconds(200));
+					  timer.async_wait([&](const error_code &)
+						  {
+							  engine.Stop();
+							  stopped = true;
+						  });
+				  });
+
+		signal(SIGALRM, OnTimeout);
+		alarm(TEST_TIMEOUT);
+		io.run();
+		alarm(0);
+	}
+
+	// The engine is gone. Anything still queued would call into it
+	io.reset();
+	size_t leftover = io.poll();
+
+	printf("connected %s stopped %s leftover handlers %zu\n",
+	       connected ? "yes" : "no", stopped ? "yes" : "no", leftover);
+	if ( !connected || !stopped || leftover )
+	{
+		printf("FAILED\n");
+		return(1);
+	}
+	return(0);
+}
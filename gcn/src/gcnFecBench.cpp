@@ -0,0 +1,253 @@
+/*
+ * Group Centric Networking
+ *
+ * Copyright (C) 2015 Massachusetts Institute of Technology
+ * All rights reserved.
+ *
+ * Authors:
+ *           Patricia Deutsch         <patricia.deutsch@ll.mit.edu>
+ *           Gregory Kuperman         <gkuperman@ll.mit.edu>
+ *           Leonid Veytser           <veytser@ll.mit.edu>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Throughput benchmark for the GF(256) kernels, the FEC code and network
+// coding.
+//
+// For every kernel the CPU supports it times:
+//   - mulAddRegion over a large buffer
+//   - encoding a block of K payloads into R repair payloads
+//   - decoding a block with R source payloads lost (and checks the result)
+//   - a network coded generation of K payloads sent from a source through
+//     a recoding relay to a subscriber, with R packets lost on each hop
+//     (and checks the subscriber decodes all K)
+// Exits with 1 if any check fails.
+// Build with -DBENCHMARKS=ON (and -DRELEASE=ON for meaningful numbers).
+
+#include "GaloisField.h"
+#include "Fec.h"
+#include "NetworkCoding.h"
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <stdlib.h>
+#include <getopt.h>
+
+using namespace std;
+using namespace std::chrono;
+
+static void usage(const char* sAppName)
+{
+	cout<<"usage: "<<sAppName <<" [OPTIONS]"<<endl;
+	cout<<endl;
+	cout<<"options:"<<endl;
+	cout<<"  -h, --help               Print this message and exit."<<endl;
+	cout<<"  -s, --size SIZE          Payload size in bytes. Default is 1400"<<endl;
+	cout<<"  -k, --feck K             Source payloads per block. Default is 16"<<endl;
+	cout<<"  -r, --fecr R             Repair payloads per block. Default is 4"<<endl;
+	cout<<"  -n, --iterations N       Number of blocks to encode and decode. Default is 2000"<<endl;
+	cout<<endl;
+}
+
+// Sends coded packets from one generation to another until the receiver
+// has them all, losing the first "lost". Returns false if it takes more
+// than twice the generation size
+static bool sendGeneration(const RlncGeneration & from, RlncGeneration & to, uint32_t lost)
+{
+	for (uint32_t n = 0; !to.complete(); n++)
+	{
+		string coefficients, payload;
+		if ( (n >= 2 * to.size() + lost) || !from.recode(coefficients, payload) )
+		{
+			return(false);
+		}
+		if (n >= lost)
+		{
+			to.add(coefficients, payload);
+		}
+	}
+	return(true);
+}
+
+static double mbPerSec(size_t bytes, steady_clock::duration elapsed)
+{
+	double sec = duration_cast<duration<double>>(elapsed).count();
+	return( (sec > 0) ? ((double)bytes / sec / 1000000.0) : 0.0 );
+}
+
+int main(int argc, char* argv[])
+{
+	size_t size = 1400;
+	uint32_t k = 16;
+	uint32_t r = 4;
+	uint32_t iterations = 2000;
+	
+	option options[] =
+	{
+		{"help",       0, nullptr, 'h'},
+		{"size",       1, nullptr, 's'},
+		{"feck",       1, nullptr, 'k'},
+		{"fecr",       1, nullptr, 'r'},
+		{"iterations", 1, nullptr, 'n'},
+		{0,            0, nullptr,  0 }
+	};
+	int iOption;
+	while((iOption = getopt_long(argc, argv, "hs:k:r:n:", options, nullptr)) != -1)
+	{
+		switch(iOption)
+		{
+		case 's':
+			size = atoi(optarg);
+			break;
+		case 'k':
+			k = atoi(optarg);
+			break;
+		case 'r':
+			r = atoi(optarg);
+			break;
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if ( (k == 0) || (r == 0) || (r > k) || (k + r > FEC_MAX_SYMBOLS) || (size == 0) || (size > 65535) )
+	{
+		cout << "Invalid parameters. Need 0 < R <= K, K + R <= " << FEC_MAX_SYMBOLS << " and 0 < SIZE < 65536" << endl;
+		return 1;
+	}
+	
+	// random source payloads
+	srand(1);
+	vector<string> payloads(k, string(size, '\0'));
+	vector<string> source(k);
+	for (uint32_t j = 0; j < k; j++)
+	{
+		for (size_t i = 0; i < size; i++)
+		{
+			payloads[j][i] = (char)(rand() & 0xff);
+		}
+		source[j] = Fec::toSymbol(j, payloads[j]);
+	}
+	
+	const size_t regionSize = 1 << 20;
+	vector<uint8_t> src(regionSize), dst(regionSize);
+	for (size_t i = 0; i < regionSize; i++)
+	{
+		src[i] = (uint8_t)(rand() & 0xff);
+	}
+	
+	cout << "Payload " << size << " bytes, K " << k << ", R " << r << ", " << iterations << " blocks" << endl;
+	cout << setw(8) << "kernel" << setw(16) << "mulAdd MB/s" << setw(16) << "encode MB/s" << setw(16) << "decode MB/s" 
+	     << setw(16) << "rlnc MB/s" << endl;
+	bool allOk = true;
+	
+	for (int kernel = GF_KERNEL_SCALAR; kernel < GF_KERNEL_MAX; kernel++)
+	{
+		if (!GaloisField::setKernel((GfKernel)kernel))
+		{
+			cout << setw(8) << GfKernelStr[kernel] << "   not supported by this CPU" << endl;
+			continue;
+		}
+		
+		// region multiply-add
+		uint32_t passes = 200;
+		steady_clock::time_point start = steady_clock::now();
+		for (uint32_t n = 0; n < passes; n++)
+		{
+			GaloisField::mulAddRegion(dst.data(), src.data(), (uint8_t)(n | 2), regionSize);
+		}
+		double mulAddRate = mbPerSec((size_t)passes * regionSize, steady_clock::now() - start);
+		
+		// encode. Rate is source bytes per second
+		vector<string> repair;
+		start = steady_clock::now();
+		for (uint32_t n = 0; n < iterations; n++)
+		{
+			Fec::encode(source, r, repair);
+		}
+		double encodeRate = mbPerSec((size_t)iterations * k * size, steady_clock::now() - start);
+		
+		// decode with the first R source payloads lost
+		bool ok = true;
+		steady_clock::duration decodeTime(0);
+		for (uint32_t n = 0; n < iterations; n++)
+		{
+			map<uint32_t, string> symbols;
+			for (uint32_t j = r; j < k; j++)
+			{
+				symbols[j] = source[j];
+			}
+			for (uint32_t i = 0; i < r; i++)
+			{
+				symbols[k + i] = repair[i];
+			}
+			
+			start = steady_clock::now();
+			ok = ok && Fec::decode(k, r, symbols);
+			decodeTime += steady_clock::now() - start;
+			
+			for (uint32_t j = 0; ok && (j < r); j++)
+			{
+				uint64_t seq;
+				string data;
+				ok = Fec::fromSymbol(symbols[j], seq, data) && (seq == j) && (data == payloads[j]);
+			}
+		}
+		double decodeRate = mbPerSec((size_t)iterations * k * size, decodeTime);
+		
+		// network coding. The source sends its K payloads as is (losing the
+		// first R) and then random combinations until the relay has them all.
+		// The relay only recodes what it has for the subscriber (again losing
+		// the first R). Rate is source bytes per second through both hops
+		bool rlncOk = true;
+		start = steady_clock::now();
+		for (uint32_t n = 0; rlncOk && (n < iterations); n++)
+		{
+			RlncGeneration sourceGen, relayGen, subscriberGen;
+			sourceGen.init(k);
+			relayGen.init(k);
+			subscriberGen.init(k);
+			for (uint32_t j = 0; j < k; j++)
+			{
+				sourceGen.add(RlncGeneration::unitVector(k, j), source[j]);
+				if (j >= r)
+				{
+					relayGen.add(RlncGeneration::unitVector(k, j), source[j]);
+				}
+			}
+			rlncOk = sendGeneration(sourceGen, relayGen, 0) && sendGeneration(relayGen, subscriberGen, r);
+			
+			for (uint32_t j = 0; rlncOk && (j < k); j++)
+			{
+				string symbol, data;
+				uint64_t seq;
+				rlncOk = subscriberGen.getDecoded(j, symbol) && Fec::fromSymbol(symbol, seq, data) && (seq == j) && (data == payloads[j]);
+			}
+		}
+		double rlncRate = mbPerSec((size_t)iterations * k * size, steady_clock::now() - start);
+		
+		cout << setw(8) << GfKernelStr[kernel] << fixed << setprecision(1) << setw(16) << mulAddRate 
+		     << setw(16) << encodeRate << setw(16) << decodeRate << setw(16) << rlncRate 
+		     << (ok ? "" : "   DECODE FAILED") << (rlncOk ? "" : "   RLNC DECODE FAILED") << endl;
+		allOk = allOk && ok && rlncOk;
+	}
+	return(allOk ? 0 : 1);
+}
@@ -29,14 +29,57 @@
 #include "gcnService.h" 
 
 using boost::asio::buffer;
-static uint16_t GcnPort  = 12345;
+
+//************************************************************************
+void initGcnServiceConfig(GcnServiceConfig & config)
+{
+	config.logLevel = DEFAULT_LOG_LEVEL;
+	config.nodeId = 0;
+	config.hashExpire   = DEFAULT_HASHEXPIRE;
+	config.hashInterval = DEFAULT_HASHINTERVAL;
+	config.pullExpire   = DEFAULT_PULLEXPIRE;
+	config.pullInterval = DEFAULT_PULLINTERVAL;
+	config.pathExpire   = DEFAULT_REVPATHEXPIRE;
+	config.pathInterval = DEFAULT_REVPATHINTERVAL;
+	config.mcastEthernetHeader = false;
+	config.alwaysRebroadcast = false;
+	config.dataFile = "";
+	config.localRepair = false;
+	config.repairTtl = DEFAULT_REPAIRTTL;
+	config.repairInterval = DEFAULT_REPAIRINTERVAL;
+	config.neighborExpire = DEFAULT_NEIGHBOREXPIRE;
+	config.retxCacheSize = DEFAULT_RETXCACHESIZE;
+	config.nackTtl = DEFAULT_NACKTTL;
+	config.otaRate = DEFAULT_OTARATE;
+	config.drrQuantum = DEFAULT_DRRQUANTUM;
+	config.dataDeadline = DEFAULT_DATADEADLINE;
+	config.flowCapacity = DEFAULT_FLOWCAPACITY;
+	config.ifMode = IF_MODE_ALL;
+	config.l2Unicast = false;
+	config.aggregateHold = DEFAULT_AGGREGATEHOLD;
+	config.adaptiveCorridor = false;
+	config.autoTtlMargin = DEFAULT_AUTOTTLMARGIN;
+	config.catchupItems = DEFAULT_CATCHUPITEMS;
+	config.catchupWindow = DEFAULT_CATCHUPWINDOW;
+	config.catchupBytes = DEFAULT_CATCHUPBYTES;
+	config.summaryInterval = DEFAULT_SUMMARYINTERVAL;
+	config.sessionQueue.highWater = DEFAULT_SESSIONHIGHWATER;
+	config.sessionQueue.lowWater = DEFAULT_SESSIONLOWWATER;
+	config.sessionQueue.dropPolicy = SESSION_DROP_OLDEST;
+	config.appPort = DEFAULT_APPPORT;
+	config.hugePages = false;
+}
 
 //************************************************************************
 GcnService::GcnService(const GcnServiceConfig &gcnConfig, io_service * io_serv)
 :	pIoService(io_serv),
-	mClientAcceptor(*pIoService, tcp::endpoint(tcp::v4(), GcnPort)),
+	mAppPort(gcnConfig.appPort),
+	mStopped(false),
+	mClientAcceptor(*pIoService),
 	mClientSocket(*pIoService),
+	mSessionQueueConfig(gcnConfig.sessionQueue),
 	mOTASession(gcnConfig.mcastEthernetHeader),
+	mOTAScheduler(*pIoService, mOTASession),
 	mDevices{gcnConfig.devices},
 	mDataFilePath(gcnConfig.dataFile),
 	mNodeId(gcnConfig.nodeId),
@@ -49,10 +92,40 @@ GcnService::GcnService(const GcnServiceConfig &gcnConfig, io_service * io_serv)
 	mRemotePullCleanupInterval(gcnConfig.pullInterval),
 	mAlwaysRebroadcast(gcnConfig.alwaysRebroadcast),
 	mStatInterval(1.0),
+	mLocalRepair(gcnConfig.localRepair),
+	mRepairTtl(gcnConfig.repairTtl),
+	mRepairInterval(gcnConfig.repairInterval),
+	mNeighborExpireTime(gcnConfig.neighborExpire),
+	mRepairSeqNum(0),
+	mRetxCacheSize(gcnConfig.retxCacheSize),
+	mNackTtl(gcnConfig.nackTtl),
+	mNackSeqNum(0),
+	mOtaRate(gcnConfig.otaRate),
+	mDataDeadline(gcnConfig.dataDeadline),
+	mFlowCapacity(gcnConfig.flowCapacity),
+	mIfMode(gcnConfig.ifMode),
+	mL2Unicast(gcnConfig.l2Unicast),
+	mAggregateHold(gcnConfig.aggregateHold),
+	mAdaptiveCorridor(gcnConfig.adaptiveCorridor),
+	mAutoTtlMargin(gcnConfig.autoTtlMargin),
+	mCatchupItems(gcnConfig.catchupItems),
+	mCatchupWindow(gcnConfig.catchupWindow),
+	mCatchupBytes(gcnConfig.catchupBytes),
+	mCatchupSeqNum(0),
+	mSummaryInterval(gcnConfig.summaryInterval),
+	mLastRateCheck(0),
+	mLastRateBytes(0),
 	mHashCleanupTimer(*pIoService, Seconds(1)),
 	mRemotePullCleanupTimer(*pIoService, Seconds(1)),
 	mReversePathCleanupTimer(*pIoService, Seconds(1)),
 	mStatTimer(*pIoService, Seconds(1)),
+	mRepairTimer(*pIoService, Seconds(1)),
+	mRateControlTimer(*pIoService, Milliseconds(RATECONTROL_INTERVAL)),
+	mFeedbackTimer(*pIoService, Milliseconds(UNICAST_FEEDBACK_INTERVAL)),
+	mSummaryTimer(*pIoService, Seconds(1)),
+	mDataTimer(*pIoService),
+	mDataTimerSet(false),
+	mDataTimerMemory(make_shared<HandlerMemory>()),
 	clientCount(0), 
 	recvCountAdv(0),
 	recvCountAck(0), 
@@ -80,6 +153,53 @@ GcnService::GcnService(const GcnServiceConfig &gcnConfig, io_service * io_serv)
 	mRcvAckDI(0),
 	mLocalPullDI(0),
 	mLocalUnpullDI(0),
+	mSentRepairDI(0),
+	mRcvRepairDI(0),
+	repairSentCount(0),
+	repairRcvCount(0),
+	repairRelayCount(0),
+	mSentNackDI(0),
+	mRcvNackDI(0),
+	mSentFeedbackDI(0),
+	nackSentCount(0),
+	nackRcvCount(0),
+	nackSuppressCount(0),
+	retxSentCount(0),
+	retxSuppressCount(0),
+	retxRelayCount(0),
+	retxRecoveredCount(0),
+	fecRepairSentCount(0),
+	fecRecoveredCount(0),
+	fecDecodeFailCount(0),
+	fecFlushCount(0),
+	rlncInnovativeCount(0),
+	rlncDropCount(0),
+	rlncDecodedCount(0),
+	rlncRecodeCount(0),
+	totalBytesRcvd(0),
+	rateSlowdownCount(0),
+	rateRestoreCount(0),
+	ifSelectCount(0),
+	ifStripeCount(0),
+	ifAllCount(0),
+	l2UnicastCount(0),
+	l2FallbackCount(0),
+	aggItemCount(0),
+	aggFrameCount(0),
+	aggReduceCount(0),
+	feedbackSentCount(0),
+	feedbackRcvCount(0),
+	corridorWidenCount(0),
+	corridorNarrowCount(0),
+	catchupLocalCount(0),
+	catchupReqSentCount(0),
+	catchupReqRcvCount(0),
+	catchupSentCount(0),
+	catchupSuppressCount(0),
+	catchupRcvdCount(0),
+	summarySentCount(0),
+	summaryRcvCount(0),
+	summarySuppressCount(0),
 	mSizeOfSize(sizeof(uint32_t))
 {
 	// Verify that the version of the library that we linked against is
@@ -106,7 +226,9 @@ GcnService::GcnService(const GcnServiceConfig &gcnConfig, io_service * io_serv)
 	mOTAReceiveHandler = std::bind(&GcnService::OnNetworkReceive, 
 				       this,
 				       std::placeholders::_1, 
-				       std::placeholders::_2);
+				       std::placeholders::_2,
+				       std::placeholders::_3,
+				       std::placeholders::_4);
 
 	// Initialize the client session handlers
 	mClientReceiveHandler = std::bind(&GcnService::OnClientReceive, 
@@ -118,19 +240,34 @@ GcnService::GcnService(const GcnServiceConfig &gcnConfig, io_service * io_serv)
 	mClientCloseHandler = std::bind(&GcnService::closeClientConnection,
 					this,
 					std::placeholders::_1);
+	
+	// Set up the transmit scheduler. Rate is given in kbit/s
+	mOTAScheduler.configure(mOtaRate * 1000, OTA_BUCKET_SIZE, gcnConfig.drrQuantum, OTA_MAX_QUEUE);
+	
+	// Packet buffers made from here on come from huge pages if asked for
+	if (gcnConfig.hugePages)
+	{
+		BufferPool::instance().useHugePages(true);
+	}
 					
 	// start the stat timer just once
-	mStatTimer.async_wait(boost::bind(&GcnService::OnStatTimeout, this));
+	mStatTimer.async_wait(boost::bind(&GcnService::OnStatTimeout, this, _1));
 
-	LOG(LOG_FORCE, "Creating GCN with:\n  NodeId: %d\n  Log Level: %s\n  Devices: %s\n  Hash Expire Time: %lf\n  Hash Cleanup Interval: %lf\n  Pull Expire Time: %lf\n  Pull Cleanup Interval: %lf\n  Path Expire Time: %lf\n  Path Cleanup Interval: %lf\n  Always Re-Broadcast: %s\n  Port: %d",
+	LOG(LOG_FORCE, "Creating GCN with:\n  NodeId: %d\n  Log Level: %s\n  Devices: %s\n  Hash Expire Time: %lf\n  Hash Cleanup Interval: %lf\n  Pull Expire Time: %lf\n  Pull Cleanup Interval: %lf\n  Path Expire Time: %lf\n  Path Cleanup Interval: %lf\n  Always Re-Broadcast: %s\n  Local Repair: %s (ttl %d)\n  Retransmission Cache Size: %d\n  OTA Rate: %lf kbit/s (DRR quantum %d, DATA deadline %lf ms)\n  Interface Mode: %s\n  Port: %d",
 	            mNodeId, LogLevelStr[mCurrentLogLevel], devlist, mHashExpireTime, mHashCleanupInterval, mRemotePullExpireTime, mRemotePullCleanupInterval,
-	            mReversePathExpireTime, mReversePathCleanupInterval, (mAlwaysRebroadcast ? "True" : "False"), GcnPort);
+	            mReversePathExpireTime, mReversePathCleanupInterval, (mAlwaysRebroadcast ? "True" : "False"), (mLocalRepair ? "True" : "False"), mRepairTtl, mRetxCacheSize, mOtaRate, gcnConfig.drrQuantum, mDataDeadline, IfModeStr[mIfMode], mAppPort);
 	
 }
 
 //************************************************************************
 GcnService::~GcnService()
 {
+	// DATA still waiting to be relayed (if we were not stopped)
+	for (auto & entry : mDataTimerTable)
+	{
+		mDataPool.give(entry.second.pData);
+	}
+	
 	printf("GcnService destructor complete.\n");
 }
 
@@ -148,29 +285,67 @@ void GcnService::Start()
 	// open our OTA session and start reading
 	mOTASession.open(*pIoService, mDevices);
 	mOTASession.read(mOTAReceiveHandler);
+	mAllDevices = mOTASession.getDevices();
 	
-	// begin listening to app client connections
-	acceptClientConnections();
+	// begin listening to app client connections.
+	// Without a port only apps in this process can use us
+	if (mAppPort)
+	{
+		tcp::endpoint endpoint(tcp::v4(), mAppPort);
+		mClientAcceptor.open(endpoint.protocol());
+		mClientAcceptor.set_option(tcp::acceptor::reuse_address(true));
+		mClientAcceptor.bind(endpoint);
+		mClientAcceptor.listen();
+		acceptClientConnections();
+	}
 
 	// Create periodic event to clean the hash of old entries
-	mHashCleanupTimer.async_wait(boost::bind(&GcnService::hashCleanup, this));
+	mHashCleanupTimer.async_wait(boost::bind(&GcnService::hashCleanup, this, _1));
 	
 	// Create periodic event to clean the Remote Pull table of old entries
-	mRemotePullCleanupTimer.async_wait(boost::bind(&GcnService::remotePullCleanup, this));
+	mRemotePullCleanupTimer.async_wait(boost::bind(&GcnService::remotePullCleanup, this, _1));
 	
 	// Create periodic event to clean the Reverse Path Table of old entries
-	mReversePathCleanupTimer.async_wait(boost::bind(&GcnService::reversePathCleanup, this));
+	mReversePathCleanupTimer.async_wait(boost::bind(&GcnService::reversePathCleanup, this, _1));
 
+	// Create periodic event to look for flows that have lost their upstream relay
+	if (mLocalRepair)
+	{
+		mRepairTimer.async_wait(boost::bind(&GcnService::OnRepairTimeout, this, _1));
+	}
+	
+	// Create periodic event to tell source apps to slow down when we are congested
+	if (mFlowCapacity >= 0)
+	{
+		mLastRateCheck = getTimeSec();
+		mRateControlTimer.async_wait(boost::bind(&GcnService::OnRateControlTimeout, this, _1));
+	}
+	
+	// Create periodic event to tell nodes sending us unicast DATA how many got through
+	mFeedbackTimer.async_wait(boost::bind(&GcnService::OnFeedbackTimeout, this, _1));
+	
+	// Create periodic event to tell our neighbors what groups we reach
+	if (mSummaryInterval > 0)
+	{
+		mSummaryTimer.async_wait(boost::bind(&GcnService::OnSummaryTimeout, this, _1));
+	}
 }
 
 
 //************************************************************************
 void GcnService::Stop()
 {
+	// The periodic events check this so they are not scheduled again
+	mStopped = true;
+	
 	LOG(LOG_FORCE,"\nSTOPPING GCN. Final stats\n GCN Client stats: rcvd>%d  sentOTA>%d    \nGCN OTA stats: rcvdAdv>%d rcvdAck>%d rcvdData>%d rcvdUni>%d drop>%d push>%d fwd>%d fwdUni>%d relayDataGroup>%d relayDataNonGroup>%d nonGroupRcvAck>%d nonGroupRcvAdv>%d totalBytesSentCtl>%d totalPacketsSentCtl>%d totalBytesSentData>%d totalPacketsSentData>%d", 
 				clientRcvCount, sentCount, recvCountAdv, recvCountAck, recvCountData, recvCountDataUni, dropCount, pushCount, fwdCount, fwdCountUni, relayDataGroup, relayDataNonGroup, nonGroupRcvAck, nonGroupRcvAdv, totalBytesSentCtl, totalPacketsSentCtl, totalBytesSentData, totalPacketsSentData);
 
 	
+	// stop listening for apps
+	error_code ec;
+	mClientAcceptor.close(ec);
+	
 	// close the socket to the client
 	if (clientCount)
 	{
@@ -189,8 +364,67 @@ void GcnService::Stop()
 	{
 		printf(" ... No active clients\n");
 	}
+	mReliableGroups.clear();
+	
+	// and every other app's socket, so no read is left waiting on an app
+	// that has not pulled or advertised anything
+	for (auto & pSession : mClientSessions)
+	{
+		pSession->close();
+	}
+	mClientSessions.clear();
+	clientCount = 0;
 	
 	// close the socket to the network
+	// (anything still held or queued for it is dropped)
+	for (AggregateIt iter = mAggregateTable.begin(); iter != mAggregateTable.end(); ++iter)
+	{
+		iter->second.pTimer->cancel();
+	}
+	mAggregateTable.clear();
+	for (CatchupTimerIt iter = mCatchupTimerTable.begin(); iter != mCatchupTimerTable.end(); ++iter)
+	{
+		iter->second->cancel();
+	}
+	mCatchupTimerTable.clear();
+	for (CatchupPendingIt iter = mCatchupPendingTable.begin(); iter != mCatchupPendingTable.end(); ++iter)
+	{
+		iter->second.pTimer->cancel();
+	}
+	mCatchupPendingTable.clear();
+	
+	// and anything waiting to be sent or answered
+	for (auto & entry : mAdvTimerTable)
+	{
+		entry.second->cancel();
+	}
+	mAdvTimerTable.clear();
+	for (auto & entry : mAckTimerTable)
+	{
+		entry.second->cancel();
+	}
+	mAckTimerTable.clear();
+	mDataTimer.cancel();
+	mDataTimerSet = false;
+	for (auto & entry : mDataTimerTable)
+	{
+		mDataPool.give(entry.second.pData);
+	}
+	mDataTimerTable.clear();
+	for (auto & entry : mRetxTimerTable)
+	{
+		entry.second->cancel();
+	}
+	mRetxTimerTable.clear();
+	for (auto & entry : mNackTable)
+	{
+		if (entry.second.pTimer)
+		{
+			entry.second.pTimer->cancel();
+		}
+	}
+	mNackTable.clear();
+	mOTAScheduler.stop();
 	mOTASession.close();
 	printf(" ... Raw Socket closed\n");
 	
@@ -202,6 +436,10 @@ void GcnService::Stop()
 			iter2->second.pTimer->cancel();
 			printf(" ... Advertise event canceled for GID %d\n", iter2->first);
 		}
+		if (iter2->second.pFecTimer)
+		{
+			iter2->second.pFecTimer->cancel();
+		}
 		
 		// Now close the session to the client
 		// NOTE that it is possible that we attempt to close the same
@@ -222,13 +460,22 @@ void GcnService::Stop()
 	mRemotePullCleanupTimer.cancel();
 	printf(" ... Remote Pull Table Cleanup event canceled\n");
 	
-	pIoService->stop();
-
-	// Delete all global objects allocated by libprotobuf.
-	google::protobuf::ShutdownProtobufLibrary();
-	printf(" ... google buffer shutdown\n");
+	mRepairTimer.cancel();
+	printf(" ... Repair event canceled\n");
+	
+	mRateControlTimer.cancel();
+	printf(" ... Rate Control event canceled\n");
+	
+	mFeedbackTimer.cancel();
+	printf(" ... Unicast Feedback event canceled\n");
+	
+	mSummaryTimer.cancel();
+	printf(" ... Group Summary event canceled\n");
+	
+	mStatTimer.cancel();
 	
 	if(mDataFile != NULL) fclose(mDataFile);
+	mDataFile = NULL;
 }
 
 //************************************************************************
@@ -249,19 +496,36 @@ void GcnService::acceptClientConnections()
 							     // increment count of connected clients
 							     clientCount++;
 							     // create a new client connection and start reading from it
-							     std::make_shared<ClientSession>(std::move(mClientSocket))->read(mClientReceiveHandler, mClientCloseHandler);
+							     shared_ptr<ClientSession> pSession = std::make_shared<ClientSession>(std::move(mClientSocket), mSessionQueueConfig);
+							     mClientSessions.insert(pSession);
+							     pSession->read(mClientReceiveHandler, mClientCloseHandler);
 						     }
 					     // listen for more connections
-					     acceptClientConnections();
+					     if (!mStopped)
+						     {
+							     acceptClientConnections();
+						     }
 				     });
 }
 
+//************************************************************************
+// function to add an app in this process. What we send it goes to handler
+// and what it sends us is given to processAppMessage
+shared_ptr<ClientSession> GcnService::attachLocalApp(function<void(const AppMessage & message)> handler)
+{
+	clientCount++;
+	shared_ptr<ClientSession> pSession = std::make_shared<ClientSession>(*pIoService, handler);
+	mClientSessions.insert(pSession);
+	return(pSession);
+}
+
 //************************************************************************
 // function to forward a Data message to the subscribing app
 void GcnService::forwardToApp(Data & dataMsg, shared_ptr<ClientSession> pSession)
 {
 	// create app message and fill in with the message passed in
-	AppMessage message;
+	MessagePool<AppMessage>::Handle pooled(mAppPool);
+	AppMessage & message = *pooled;
 	
 	auto pData = message.add_data();
 	pData->CopyFrom(dataMsg);
@@ -273,7 +537,8 @@ void GcnService::forwardToApp(Data & dataMsg, shared_ptr<ClientSession> pSession
 void GcnService::forwardToApp(Pull & pullMsg, shared_ptr<ClientSession> pSession)
 {
 	// create app message and fill in with the message passed in
-	AppMessage message;
+	MessagePool<AppMessage>::Handle pooled(mAppPool);
+	AppMessage & message = *pooled;
 	
 	auto pPull = message.add_pull();
 	pPull->CopyFrom(pullMsg);
@@ -285,7 +550,8 @@ void GcnService::forwardToApp(Pull & pullMsg, shared_ptr<ClientSession> pSession
 void GcnService::forwardToApp(Unpull & unpullMsg, shared_ptr<ClientSession> pSession)
 {
 	// create app message and fill in with the message passed in
-	AppMessage message;
+	MessagePool<AppMessage>::Handle pooled(mAppPool);
+	AppMessage & message = *pooled;
 	
 	auto pUnpull = message.add_unpull();
 	pUnpull->CopyFrom(unpullMsg);
@@ -297,37 +563,126 @@ void GcnService::forwardToApp(Unpull & unpullMsg, shared_ptr<ClientSession> pSes
 void GcnService::forwardToApp(Advertise & advMsg, shared_ptr<ClientSession> pSession)
 {
 	// create app message and fill in with the message passed in
-	AppMessage message;
+	MessagePool<AppMessage>::Handle pooled(mAppPool);
+	AppMessage & message = *pooled;
 	
 	auto pAdvertise = message.add_advertise();
 	pAdvertise->CopyFrom(advMsg);
 	forwardToApp(message, pSession);
 }
 
+//************************************************************************
+// function to forward a RateControl to a source app
+void GcnService::forwardToApp(RateControl & rateMsg, shared_ptr<ClientSession> pSession)
+{
+	// create app message and fill in with the message passed in
+	MessagePool<AppMessage>::Handle pooled(mAppPool);
+	AppMessage & message = *pooled;
+	
+	auto pRateControl = message.add_ratecontrol();
+	pRateControl->CopyFrom(rateMsg);
+	forwardToApp(message, pSession);
+}
+
+//************************************************************************
+// function to forward a Data message to all the local subscribers of
+// its group except pExclude (the app it came from).
+// The AppMessage is built once and serialized once (only if an app on a
+// socket wants it) and shared by every subscriber. Apps in this process
+// share a copy of it that lives until they have all had it. Returns the
+// number of subscribers it went to
+int GcnService::forwardToSubscribers(Data & dataMsg, shared_ptr<ClientSession> pExclude)
+{
+	MessagePool<AppMessage>::Handle pMessage(mAppPool);
+	shared_ptr<AppMessage> pShared;
+	BufferPtr pBuffer;
+	uint32_t totalSize = 0;
+	int count = 0;
+	
+	LocalPullRangeIt rangeIt = mLocalPullTable.equal_range(dataMsg.gid());
+	for (LocalPullIt iter = rangeIt.first; iter != rangeIt.second; ++iter)
+	{
+		if ( pExclude && (pExclude == iter->second) )
+		{
+			continue;
+		}
+		
+		if (!pMessage->data_size())
+		{
+			pMessage->add_data()->CopyFrom(dataMsg);
+		}
+		
+		if (iter->second->isLocal())
+		{
+			if (!pShared)
+			{
+				pShared = std::make_shared<AppMessage>(*pMessage);
+			}
+			iter->second->deliver(pShared);
+			count++;
+			continue;
+		}
+		
+		// serialize when we find the first subscriber to write it to
+		if (!pBuffer)
+		{
+			pBuffer = serializeForApp(*pMessage, totalSize);
+			if (!pBuffer)
+			{
+				return(count);
+			}
+		}
+		iter->second->write(pBuffer, totalSize, true);
+		count++;
+	}
+	return(count);
+}
+
 //************************************************************************
 // function to forward an AppMessage to the subscribing app
 void GcnService::forwardToApp(AppMessage & Msg, shared_ptr<ClientSession> pSession)
+{
+	// An app in this process gets the message itself
+	if (pSession->isLocal())
+	{
+		pSession->deliver(std::make_shared<AppMessage>(Msg));
+		return;
+	}
+	
+	uint32_t totalSize;
+	BufferPtr pBuffer = serializeForApp(Msg, totalSize);
+	if (pBuffer)
+	{
+		// Only DATA may be dropped if the app falls behind
+		pSession->write(pBuffer, totalSize, (Msg.data_size() > 0));
+	}
+}
+
+//************************************************************************
+// function to serialize an AppMessage with its size in front, ready to
+// write to any number of apps. Returns NULL if it is too large
+BufferPtr GcnService::serializeForApp(const AppMessage & Msg, uint32_t & totalSize)
 {
 	// Serialize message for transmission
 	uint32_t size = Msg.ByteSize();
-	uint32_t totalSize = size + mSizeOfSize;
+	totalSize = size + mSizeOfSize;
 
 	// Check the total size can fit in the buffer
 	if ( totalSize > MAX_BUFFER_SIZE )
 		{
 			LOG(LOG_ERROR, "AppMessage too large");
-			return;
+			return(NULL);
 		}
 	
 	// Buffer to hold the message to send
-	BufferPtr pBuffer(new Buffer);
+	BufferPtr pBuffer = newBuffer(totalSize);
 
 	// Copy the size of the AppMessage first
 	uint32_t htnSize = htonl(size);
 	memcpy(pBuffer->data(), &htnSize, mSizeOfSize);
 
-	// Then serialize message
-	Msg.SerializeToArray(pBuffer->data() + mSizeOfSize, Msg.ByteSize());
+	// Then serialize message. ByteSize() above cached the sizes
+	Msg.SerializeWithCachedSizesToArray((uint8_t*)pBuffer->data() + mSizeOfSize);
 	
 	// Check log level first because printing to string is expensive
 	// and can affect throughput
@@ -335,10 +690,9 @@ void GcnService::forwardToApp(AppMessage & Msg, shared_ptr<ClientSession> pSessi
 	{
 		string sMessage;
 		mPbPrinter.PrintToString(Msg, &sMessage);
-		LOG(LOG_DEBUG, "Sent to App (%d bytes):\n%s", Msg.ByteSize(), sMessage.c_str());
+		LOG(LOG_DEBUG, "Sent to App (%d bytes):\n%s", size, sMessage.c_str());
 	}
-	// Send message
-	pSession->write(pBuffer, totalSize);
+	return(pBuffer);
 }
 
 
@@ -347,7 +701,8 @@ void GcnService::forwardToApp(AppMessage & Msg, shared_ptr<ClientSession> pSessi
 void GcnService::forwardToOTA(Data & dataMsg, uint32_t ttl)
 {
 	// Create OTA message to send out raw socket
-	OTAMessage message;
+	MessagePool<OTAMessage>::Handle pooled(mOTAPool);
+	OTAMessage & message = *pooled;
 	
 	// get the "header" part of OTA message and set fields
 	auto header = message.mutable_header();
@@ -360,6 +715,21 @@ void GcnService::forwardToOTA(Data & dataMsg, uint32_t ttl)
 	pData->CopyFrom(dataMsg);
 	pData->set_ttl(ttl - 1); 
 	
+	writeSentDataItem(dataMsg);
+	
+	// Unicast DATA has a single next hop back toward its destination
+	NodeId nextHop = 0;
+	if (mL2Unicast && dataMsg.has_uheader())
+	{
+		nextHop = getUnicastNextHop(dataMsg);
+	}
+	forwardToOTA(pData->gid(), message, nextHop);
+}
+
+//************************************************************************
+// function to write the data collection item for a sent Data
+void GcnService::writeSentDataItem(Data & dataMsg)
+{
 	if(mDataFile != NULL) //DATAITEM
 	{
 		mSentDataDI++;
@@ -370,7 +740,6 @@ void GcnService::forwardToOTA(Data & dataMsg, uint32_t ttl)
 		fwrite(buf,sizeof(char),buflen,mDataFile);
 		fflush(mDataFile);
 	}
-	forwardToOTA(pData->gid(), message);
 }
 
 //************************************************************************
@@ -378,7 +747,8 @@ void GcnService::forwardToOTA(Data & dataMsg, uint32_t ttl)
 void GcnService::forwardToOTA(Advertise & advMsg, uint32_t ttl)
 {
 	// Create OTA message to send out raw socket
-	OTAMessage message;
+	MessagePool<OTAMessage>::Handle pooled(mOTAPool);
+	OTAMessage & message = *pooled;
 	
 	// get the "header" part of OTA message and set fields
 	auto header = message.mutable_header();
@@ -409,7 +779,8 @@ void GcnService::forwardToOTA(Advertise & advMsg, uint32_t ttl)
 void GcnService::forwardToOTA(Ack & ackMsg)
 {
 	// Create OTA message to send out raw socket
-	OTAMessage message;
+	MessagePool<OTAMessage>::Handle pooled(mOTAPool);
+	OTAMessage & message = *pooled;
 	
 	// get the "header" part of OTA message and set fields
 	auto header = message.mutable_header();
@@ -429,13 +800,160 @@ void GcnService::forwardToOTA(Ack & ackMsg)
 		fwrite(buf,sizeof(char),buflen,mDataFile);
 		fflush(mDataFile);
 	}
-	forwardToOTA(pAck->gid(), message);
+	
+	// Only the obligatory relay acts on an ACK unless other nodes are
+	// asked to relay with some probability, then it has to stay broadcast
+	NodeId nextHop = 0;
+	if (mL2Unicast && (ackMsg.probabilityofrelay() == 0))
+	{
+		nextHop = ackMsg.obligatoryrelay();
+	}
+	forwardToOTA(pAck->gid(), message, nextHop);
+}
+
+//************************************************************************
+// function to forward a Repair OTA
+void GcnService::forwardToOTA(Repair & repairMsg, uint32_t ttl)
+{
+	// Create OTA message to send out raw socket
+	MessagePool<OTAMessage>::Handle pooled(mOTAPool);
+	OTAMessage & message = *pooled;
+	
+	// get the "header" part of OTA message and set fields
+	auto header = message.mutable_header();
+	header->set_src(mNodeId);
+	
+	// Add the message passed in to the OTA message
+	// decrement the ttl field based on what user passed in.
+	// We alwyas DECREMENT the TTL when we send
+	auto pRepair = message.add_repair();
+	pRepair->CopyFrom(repairMsg);
+	pRepair->set_ttl(ttl - 1);
+	
+	if(mDataFile != NULL) //DATAITEM
+	{
+		mSentRepairDI++;
+		char buf[256];
+		uint64_t millis = duration_cast<milliseconds>(getTime()).count();
+		int buflen = sprintf(buf,"0,%.0f,ll.gcnSentRepair,node%03d.gcnService,%.0f,\"{\"\"gid\"\":%d,\"\"srcnode\"\":\"\"node%03d\"\",\"\"requester\"\":\"\"node%03d\"\",\"\"ttl\"\":%d}\"\n",
+			(double)mSentRepairDI,mNodeId,(double)millis,repairMsg.gid(),repairMsg.srcnode(),repairMsg.requester(),ttl - 1);
+		fwrite(buf,sizeof(char),buflen,mDataFile);
+		fflush(mDataFile);
+	}
+	forwardToOTA(pRepair->gid(), message);
+}
+
+//************************************************************************
+// function to forward a Nack OTA
+void GcnService::forwardToOTA(Nack & nackMsg, uint32_t ttl)
+{
+	// Create OTA message to send out raw socket
+	MessagePool<OTAMessage>::Handle pooled(mOTAPool);
+	OTAMessage & message = *pooled;
+	
+	// get the "header" part of OTA message and set fields
+	auto header = message.mutable_header();
+	header->set_src(mNodeId);
+	
+	// Add the message passed in to the OTA message
+	// We alwyas DECREMENT the TTL when we send
+	auto pNack = message.add_nack();
+	pNack->CopyFrom(nackMsg);
+	pNack->set_ttl(ttl - 1);
+	
+	if(mDataFile != NULL) //DATAITEM
+	{
+		mSentNackDI++;
+		char buf[256];
+		uint64_t millis = duration_cast<milliseconds>(getTime()).count();
+		int buflen = sprintf(buf,"0,%.0f,ll.gcnSentNack,node%03d.gcnService,%.0f,\"{\"\"gid\"\":%d,\"\"srcnode\"\":\"\"node%03d\"\",\"\"requester\"\":\"\"node%03d\"\",\"\"missing\"\":%d,\"\"ttl\"\":%d}\"\n",
+			(double)mSentNackDI,mNodeId,(double)millis,nackMsg.gid(),nackMsg.srcnode(),nackMsg.requester(),nackMsg.missing_size(),ttl - 1);
+		fwrite(buf,sizeof(char),buflen,mDataFile);
+		fflush(mDataFile);
+	}
+	forwardToOTA(pNack->gid(), message);
+}
+
+
+//************************************************************************
+// function to forward a UnicastFeedback OTA
+void GcnService::forwardToOTA(UnicastFeedback & feedbackMsg, uint32_t ttl)
+{
+	// Create OTA message to send out raw socket
+	MessagePool<OTAMessage>::Handle pooled(mOTAPool);
+	OTAMessage & message = *pooled;
+	
+	// get the "header" part of OTA message and set fields
+	auto header = message.mutable_header();
+	header->set_src(mNodeId);
+	
+	// Add the message passed in to the OTA message
+	// We alwyas DECREMENT the TTL when we send
+	auto pFeedback = message.add_feedback();
+	pFeedback->CopyFrom(feedbackMsg);
+	pFeedback->set_ttl(ttl - 1);
+	
+	if(mDataFile != NULL) //DATAITEM
+	{
+		mSentFeedbackDI++;
+		char buf[256];
+		uint64_t millis = duration_cast<milliseconds>(getTime()).count();
+		int buflen = sprintf(buf,"0,%.0f,ll.gcnSentFeedback,node%03d.gcnService,%.0f,\"{\"\"gid\"\":%d,\"\"srcnode\"\":\"\"node%03d\"\",\"\"requester\"\":\"\"node%03d\"\",\"\"seq\"\":%d,\"\"count\"\":%d,\"\"ttl\"\":%d}\"\n",
+			(double)mSentFeedbackDI,mNodeId,(double)millis,feedbackMsg.gid(),feedbackMsg.srcnode(),feedbackMsg.requester(),feedbackMsg.sequence(),feedbackMsg.count(),ttl - 1);
+		fwrite(buf,sizeof(char),buflen,mDataFile);
+		fflush(mDataFile);
+	}
+	forwardToOTA(pFeedback->gid(), message);
+}
+
+
+//************************************************************************
+// function to forward a Catchup OTA.
+// It is only for our neighbors so there is no ttl
+void GcnService::forwardToOTA(Catchup & catchupMsg)
+{
+	// Create OTA message to send out raw socket
+	MessagePool<OTAMessage>::Handle pooled(mOTAPool);
+	OTAMessage & message = *pooled;
+	
+	// get the "header" part of OTA message and set fields
+	auto header = message.mutable_header();
+	header->set_src(mNodeId);
+	
+	// Add the message passed in to the OTA message
+	auto pCatchup = message.add_catchup();
+	pCatchup->CopyFrom(catchupMsg);
+	
+	forwardToOTA(pCatchup->gid(), message);
+}
+
+
+//************************************************************************
+// function to forward a GroupSummary OTA.
+// It is only for our neighbors so there is no ttl
+void GcnService::forwardToOTA(GroupSummary & summaryMsg)
+{
+	// Create OTA message to send out raw socket
+	MessagePool<OTAMessage>::Handle pooled(mOTAPool);
+	OTAMessage & message = *pooled;
+	
+	// get the "header" part of OTA message and set fields
+	auto header = message.mutable_header();
+	header->set_src(mNodeId);
+	
+	// Add the message passed in to the OTA message
+	auto pSummary = message.add_summary();
+	pSummary->CopyFrom(summaryMsg);
+	
+	forwardToOTA(0, message);
 }
 
 
 //************************************************************************
 // function to forward a Push OTA
-void GcnService::forwardToOTA(GroupId gid, OTAMessage & Msg)
+// If nextHop is set and we know its link layer address the message is
+// sent unicast to it, otherwise it is broadcast
+void GcnService::forwardToOTA(GroupId gid, OTAMessage & Msg, NodeId nextHop)
 {
 	// set flag for data or control
 	bool ctrlPkt = true;
@@ -444,9 +962,6 @@ void GcnService::forwardToOTA(GroupId gid, OTAMessage & Msg)
 		ctrlPkt = false;
 	}
 	
-	// Serialize message for transmission
-	BufferPtr pBuffer(new Buffer);
-
 	// Get length of message (will include potential Ethernet header)
 	size_t length = Msg.ByteSize();
 	
@@ -459,7 +974,12 @@ void GcnService::forwardToOTA(GroupId gid, OTAMessage & Msg)
 			LOG(LOG_ERROR, "Message too large for Ethernet headers");
 			return;
 		}
+	}
 
+	// Serialize message for transmission
+	BufferPtr pBuffer = newBuffer(length);
+	if (USE_ETHERNET_HEADERS)
+	{
 		// Ethernet header will be added to the front of the message later
 		Msg.SerializeToArray(pBuffer->data() + sizeof(struct ether_header), Msg.ByteSize());
 	}
@@ -489,8 +1009,47 @@ void GcnService::forwardToOTA(GroupId gid, OTAMessage & Msg)
 	}
 
 	
-	// send over RAW socket
-	mOTASession.write(gid, pBuffer, length, ctrlPkt);
+	// Control rides the voice access category, DATA uses the group's priority
+	int priority = OTA_PRIORITY_CTRL;
+	if (!ctrlPkt)
+	{
+		GroupPriorityIt prioIt = mGroupPriorityTable.find(gid);
+		priority = (prioIt != mGroupPriorityTable.end()) ? prioIt->second : OTA_PRIORITY_DEFAULT;
+	}
+	
+	// send over RAW socket through the scheduler.
+	// DATA that can not go out before their deadline are dropped
+	double deadline = 0;
+	if ( !ctrlPkt && (mDataDeadline > 0) )
+	{
+		deadline = getTimeSec() + mDataDeadline / 1000;
+	}
+	// Control goes out every device, DATA may only need some of them
+	DeviceSet devices;
+	if ( !ctrlPkt && (mIfMode != IF_MODE_ALL) && (mAllDevices.size() > 1) )
+	{
+		devices = selectDevices(gid, Msg);
+	}
+	
+	// A directed message only goes out the device its next hop is on
+	unsigned char destHwAddress[ETH_ALEN];
+	const unsigned char* pDestHwAddress = NULL;
+	if (nextHop && (nextHop != mNodeId))
+	{
+		int device;
+		if (getNextHopAddress(nextHop, device, destHwAddress))
+		{
+			devices.clear();
+			devices.insert(device);
+			pDestHwAddress = destHwAddress;
+			l2UnicastCount++;
+		}
+		else
+		{
+			l2FallbackCount++;
+		}
+	}
+	mOTAScheduler.enqueue(gid, pBuffer, length, ctrlPkt, priority, devices, deadline, pDestHwAddress);
 
 }
 
@@ -512,7 +1071,14 @@ void GcnService::closeClientConnection(shared_ptr<ClientSession> pSession)
 	{
 		if (iter->second == pSession)
 		{
+			GroupId gid = iter->first;
 			iter = mLocalPullTable.erase(iter);
+			
+			// No one left here to ask for missing DATA for
+			if (mLocalPullTable.count(gid) == 0)
+			{
+				mReliableGroups.erase(gid);
+			}
 		}
 		else
 		{
@@ -533,6 +1099,9 @@ void GcnService::closeClientConnection(shared_ptr<ClientSession> pSession)
 			{
 				iter2->second.pTimer->cancel();
 			}
+			// the last DATA the app sent still get their repair DATA
+			fecFlush(iter2->second);
+			
 			// erase entry
 			iter2 = mAnnounceTable.erase(iter2);
 		}
@@ -542,11 +1111,21 @@ void GcnService::closeClientConnection(shared_ptr<ClientSession> pSession)
 		}
 	}
 	
+	// remove this client session from any catch-up it was waiting on
+	for (CatchupPendingIt iter3 = mCatchupPendingTable.begin(); iter3 != mCatchupPendingTable.end(); ++iter3)
+	{
+		vector<shared_ptr<ClientSession> > & sessions = iter3->second.sessions;
+		sessions.erase(std::remove(sessions.begin(), sessions.end(), pSession), sessions.end());
+	}
+	
 	// Now close the session
 	pSession->close();
 	
-	// decrement client count
-	clientCount--;
+	// decrement client count (unless Stop already forgot the session)
+	if (mClientSessions.erase(pSession))
+	{
+		clientCount--;
+	}
 }
 
 //************************************************************************
@@ -554,7 +1133,6 @@ void GcnService::closeClientConnection(shared_ptr<ClientSession> pSession)
 bool GcnService::addToHash(Data & dataMsg, HashValue & hashValue)
 {
 	uint32_t ttl;
-	string data;
 	
 	// We want all the fields of the message in the hash EXCEPT the ttl 
 	// and distance because values can change so just set to 0 so all 
@@ -564,7 +1142,8 @@ bool GcnService::addToHash(Data & dataMsg, HashValue & hashValue)
 	
 	// copy the Data passed in to a new message so we can set the ttl
 	// of that new message to 0 then serialize it to a string for hashing
-	Data message;
+	MessagePool<Data>::Handle pooled(mDataPool);
+	Data & message = *pooled;
 	message.CopyFrom(dataMsg);
 	// save off the ttl
 	ttl = message.ttl();
@@ -572,6 +1151,7 @@ bool GcnService::addToHash(Data & dataMsg, HashValue & hashValue)
 	// Set ttl and distance to 0 to exclude from hash
 	message.set_ttl(0); 
 	message.set_distance(0);
+	message.clear_catchupfor();
 	
 	// if this has a unicast header, exclude relay distance, obligatory relay and prob of relay
 	if(message.has_uheader())
@@ -581,8 +1161,8 @@ bool GcnService::addToHash(Data & dataMsg, HashValue & hashValue)
 	}
 	
 	// Now serialize to a string for the hash and add it
-	message.SerializeToString(&data);
-	return(addToHash(data, hashValue, ttl));
+	message.SerializeToString(&mHashScratch);
+	return(addToHash(mHashScratch, hashValue, ttl));
 }
 
 //************************************************************************
@@ -590,7 +1170,6 @@ bool GcnService::addToHash(Data & dataMsg, HashValue & hashValue)
 bool GcnService::addToHash(Advertise & advMsg, HashValue & hashValue)
 {
 	uint32_t ttl;
-	string data;
 	
 	// We want all the fields of the message in the hash EXCEPT the ttl 
 	// and distance because values can change so just set to 0 so all 
@@ -610,36 +1189,87 @@ bool GcnService::addToHash(Advertise & advMsg, HashValue & hashValue)
 	message.set_distance(0);
 	
 	// Now serialize to a string for the hash and add it to hash
-	message.SerializeToString(&data);
-	return(addToHash(data, hashValue, ttl));
+	message.SerializeToString(&mHashScratch);
+	return(addToHash(mHashScratch, hashValue, ttl));
 }
 
 //************************************************************************
-// function sets the hash value using the reference passed in
-// If it was already in the hash, returns false
-// If NEW then it returns true
-bool GcnService::addToHash(string data, HashValue & hashValue, uint32_t ttl)
+// function serializes a Repair message to a string for the hash
+bool GcnService::addToHash(Repair & repairMsg, HashValue & hashValue)
 {
-	// Get hash value
-	hashValue = make_hash(data);
+	uint32_t ttl;
 	
-	// Now look to see if this is already in the hash
-	HashIt iter = mHashTable.find(hashValue);
-	if (iter != mHashTable.end())
-	{
-		// if already in the hash then return the hash value
-		LOG(LOG_DEBUG, "Received packet already seen with hash value %d", hashValue);
-		return(false);
-	}
-	else
-	{
-		// We do NOT have an entry for this hashValue.
-		// Add an entry to the HashMap
-		mHashTable.insert(HashPair(hashValue, ttl));
-		
-		// Add an entry to the HashTimeMap
-		TimeDuration currDur = getTime();
-		double currTime = (double) duration_cast<seconds>(currDur).count();
+	// Same as for the Advertise, the ttl changes as the message
+	// is forwarded so it is excluded from the hash
+	Repair message;
+	message.CopyFrom(repairMsg);
+	ttl = message.ttl();
+	message.set_ttl(0);
+	
+	// Now serialize to a string for the hash and add it to hash
+	message.SerializeToString(&mHashScratch);
+	return(addToHash(mHashScratch, hashValue, ttl));
+}
+
+//************************************************************************
+// function serializes a Nack message to a string for the hash
+bool GcnService::addToHash(Nack & nackMsg, HashValue & hashValue)
+{
+	uint32_t ttl;
+	
+	// Same as for the Repair, the ttl changes as the message
+	// is forwarded so it is excluded from the hash
+	Nack message;
+	message.CopyFrom(nackMsg);
+	ttl = message.ttl();
+	message.set_ttl(0);
+	
+	// Now serialize to a string for the hash and add it to hash
+	message.SerializeToString(&mHashScratch);
+	return(addToHash(mHashScratch, hashValue, ttl));
+}
+
+//************************************************************************
+bool GcnService::addToHash(UnicastFeedback & feedbackMsg, HashValue & hashValue)
+{
+	uint32_t ttl;
+	
+	// Same as for the NACK, the ttl is excluded from the hash
+	UnicastFeedback message;
+	message.CopyFrom(feedbackMsg);
+	ttl = message.ttl();
+	message.set_ttl(0);
+	
+	message.SerializeToString(&mHashScratch);
+	return(addToHash(mHashScratch, hashValue, ttl));
+}
+
+//************************************************************************
+// function sets the hash value using the reference passed in
+// If it was already in the hash, returns false
+// If NEW then it returns true
+bool GcnService::addToHash(const string & data, HashValue & hashValue, uint32_t ttl)
+{
+	// Get hash value
+	hashValue = make_hash(data);
+	
+	// Now look to see if this is already in the hash
+	HashIt iter = mHashTable.find(hashValue);
+	if (iter != mHashTable.end())
+	{
+		// if already in the hash then return the hash value
+		LOG(LOG_DEBUG, "Received packet already seen with hash value %d", hashValue);
+		return(false);
+	}
+	else
+	{
+		// We do NOT have an entry for this hashValue.
+		// Add an entry to the HashMap
+		mHashTable.insert(HashPair(hashValue, ttl));
+		
+		// Add an entry to the HashTimeMap
+		TimeDuration currDur = getTime();
+		double currTime = (double) duration_cast<seconds>(currDur).count();
 		mHashTimeTable.insert(HashTimePair(currTime, hashValue));
 		
 		LOG(LOG_DEBUG, "Received packet NOT seen with hash value %d. Add to map with TTL %d.", hashValue, ttl);
@@ -781,8 +1411,14 @@ bool GcnService::coinFlip(uint32_t prob)
 
 //************************************************************************
 // Function called by periodic event to clean hash 
-void GcnService::hashCleanup()
+void GcnService::hashCleanup(const error_code & ec)
 {
+	// Cancelled by Stop, or the timer went with us. Touch nothing
+	if ( (ec == operation_aborted) || mStopped )
+	{
+		return;
+	}
+	
 	HashTimeIt timerIter;
 	HashIt     hashIter;
 	int count = 0;
@@ -822,15 +1458,21 @@ void GcnService::hashCleanup()
 	if (mHashCleanupInterval > 0)
 	{
 		mHashCleanupTimer.expires_at(mHashCleanupTimer.expires_at() + Milliseconds(mHashCleanupInterval));
-		mHashCleanupTimer.async_wait(boost::bind(&GcnService::hashCleanup, this));
+		mHashCleanupTimer.async_wait(boost::bind(&GcnService::hashCleanup, this, _1));
 	}
 }
 
 
 //************************************************************************
 // Function called by periodic event to clean reverse path table
-void GcnService::reversePathCleanup()
+void GcnService::reversePathCleanup(const error_code & ec)
 {
+	// Cancelled by Stop, or the timer went with us. Touch nothing
+	if ( (ec == operation_aborted) || mStopped )
+	{
+		return;
+	}
+	
 	ReservePathIt pathIter;
 	int count = 0;
 
@@ -862,15 +1504,21 @@ void GcnService::reversePathCleanup()
 	if (mReversePathCleanupInterval > 0)
 	{
 		mReversePathCleanupTimer.expires_at(mReversePathCleanupTimer.expires_at() + Milliseconds(mReversePathCleanupInterval));
-		mReversePathCleanupTimer.async_wait(boost::bind(&GcnService::reversePathCleanup, this));
+		mReversePathCleanupTimer.async_wait(boost::bind(&GcnService::reversePathCleanup, this, _1));
 	}
 }
 
 
 //************************************************************************
 // Function called by periodic event to clean remote pull table
-void GcnService::remotePullCleanup()
+void GcnService::remotePullCleanup(const error_code & ec)
 {
+	// Cancelled by Stop, or the timer went with us. Touch nothing
+	if ( (ec == operation_aborted) || mStopped )
+	{
+		return;
+	}
+	
 	RemotePullIt pullIter;
 	int count = 0;
 
@@ -929,13 +1577,19 @@ void GcnService::remotePullCleanup()
 	if (mRemotePullCleanupInterval > 0)
 		{
 			mRemotePullCleanupTimer.expires_at(mRemotePullCleanupTimer.expires_at() + Milliseconds(mRemotePullCleanupInterval));
-			mRemotePullCleanupTimer.async_wait(boost::bind(&GcnService::remotePullCleanup, this));
+			mRemotePullCleanupTimer.async_wait(boost::bind(&GcnService::remotePullCleanup, this, _1));
 		}
 }
 
 //************************************************************************
-void GcnService::OnStatTimeout()
+void GcnService::OnStatTimeout(const error_code & ec)
 {
+	// Cancelled by Stop, or the timer went with us. Touch nothing
+	if ( (ec == operation_aborted) || mStopped )
+	{
+		return;
+	}
+	
 	// Print all the groups for which this node is a relay
 	char buffer [500];
 	sprintf(buffer, "GCN Relay Node for Groups:");
@@ -948,6 +1602,90 @@ void GcnService::OnStatTimeout()
 	LOG(LOG_FORCE,"GCN Client stats: rcvd>%d  sentOTA>%d   GCN OTA stats: rcvdAdv>%d rcvdAck>%d rcvdData>%d rcvdUni>%d drop>%d push>%d fwd>%d fwdUni>%d relayDataGroup>%d relayDataNonGroup>%d nonGroupRcvAck>%d nonGroupRcvAdv>%d totalBytesSentCtl>%d totalPacketsSentCtl>%d totalBytesSentData>%d totalPacketsSentData>%d %s", 
 				clientRcvCount, sentCount, recvCountAdv, recvCountAck, recvCountData, recvCountDataUni, dropCount, pushCount, fwdCount, fwdCountUni, relayDataGroup, relayDataNonGroup, nonGroupRcvAck, nonGroupRcvAdv, totalBytesSentCtl, totalPacketsSentCtl, totalBytesSentData, totalPacketsSentData, buffer);
 
+	if (mLocalRepair)
+	{
+		LOG(LOG_FORCE,"GCN Repair stats: sent>%d rcvd>%d relay>%d flows>%d neighbors>%d", 
+					repairSentCount, repairRcvCount, repairRelayCount, mFlowTable.size(), mNeighborTable.size());
+	}
+	
+	if ( mRetxCacheSize || !mReliableGroups.empty() )
+	{
+		LOG(LOG_FORCE,"GCN Reliable stats: nackSent>%d nackRcvd>%d nackSuppress>%d retxSent>%d retxSuppress>%d retxRelay>%d recovered>%d cachedFlows>%d", 
+					nackSentCount, nackRcvCount, nackSuppressCount, retxSentCount, retxSuppressCount, retxRelayCount, retxRecoveredCount, mRetxCacheTable.size());
+	}
+	
+	if ( fecRepairSentCount || !mFecDecodeTable.empty() )
+	{
+		LOG(LOG_FORCE,"GCN FEC stats: repairSent>%d recovered>%d decodeFail>%d flushed>%d", 
+					fecRepairSentCount, fecRecoveredCount, fecDecodeFailCount, fecFlushCount);
+	}
+	
+	// (without pacing only once frames have had to wait)
+	const OTAClassStats & ctrl = mOTAScheduler.getStats(OTA_CLASS_CTRL);
+	const OTAClassStats & data = mOTAScheduler.getStats(OTA_CLASS_DATA);
+	if ( (mOtaRate > 0) || (ctrl.maxDepth > 1) || (data.maxDepth > 1) )
+	{
+		LOG(LOG_FORCE,"GCN Scheduler stats: ctrlDepth>%d ctrlMaxDepth>%d ctrlSent>%d ctrlDropDeadline>%d ctrlDropOverflow>%d dataDepth>%d dataMaxDepth>%d dataSent>%d dataDropDeadline>%d dataDropOverflow>%d activeGroups>%d", 
+					(int)ctrl.depth, (int)ctrl.maxDepth, ctrl.sent, ctrl.dropDeadline, ctrl.dropOverflow,
+					(int)data.depth, (int)data.maxDepth, data.sent, data.dropDeadline, data.dropOverflow, (int)mOTAScheduler.activeGroups());
+	}
+	
+	if (mIfMode != IF_MODE_ALL)
+	{
+		LOG(LOG_FORCE,"GCN Interface stats: devices>%d selected>%d striped>%d all>%d", 
+					(int)mAllDevices.size(), ifSelectCount, ifStripeCount, ifAllCount);
+	}
+	
+	if ( mAdaptiveCorridor || feedbackSentCount )
+	{
+		LOG(LOG_FORCE,"GCN Corridor stats: feedbackSent>%d feedbackRcvd>%d widen>%d narrow>%d corridors>%d", 
+					feedbackSentCount, feedbackRcvCount, corridorWidenCount, corridorNarrowCount, (int)mCorridorTable.size());
+	}
+	
+	for (auto & pSession : mClientSessions)
+	{
+		const SessionStats & stats = pSession->getStats();
+		LOG(LOG_FORCE,"GCN Session stats: port %d: depth>%d maxDepth>%d bytes>%d maxBytes>%d writes>%d sent>%d dropped>%d reads>%d rcvd>%d", 
+					pSession->port(), (int)stats.depth, (int)stats.maxDepth, stats.bytes, stats.maxBytes, stats.writes, stats.sent, stats.dropped, 
+					stats.reads, stats.received);
+	}
+	
+	if (mSummaryInterval > 0)
+	{
+		LOG(LOG_FORCE,"GCN Summary stats: sent>%d rcvd>%d suppressed>%d neighbors>%d", 
+					summarySentCount, summaryRcvCount, summarySuppressCount, (int)mSummaryTable.size());
+	}
+	
+	if (mCatchupItems)
+	{
+		LOG(LOG_FORCE,"GCN Catchup stats: local>%d reqSent>%d reqRcvd>%d sent>%d suppress>%d rcvd>%d groups>%d", 
+					catchupLocalCount, catchupReqSentCount, catchupReqRcvCount, catchupSentCount, catchupSuppressCount, catchupRcvdCount, (int)mCatchupCacheTable.size());
+	}
+	
+	if (mAggregateHold > 0)
+	{
+		LOG(LOG_FORCE,"GCN Aggregation stats: items>%d frames>%d reduced>%d", aggItemCount, aggFrameCount, aggReduceCount);
+	}
+	
+	if (mL2Unicast)
+	{
+		LOG(LOG_FORCE,"GCN Unicast stats: directed>%d fallback>%d", l2UnicastCount, l2FallbackCount);
+	}
+	
+	if (mFlowCapacity >= 0)
+	{
+		LOG(LOG_FORCE,"GCN Rate Control stats: slowdown>%d restore>%d totalBytesRcvd>%d", 
+					rateSlowdownCount, rateRestoreCount, totalBytesRcvd);
+	}
+	
+	if ( !mRlncTable.empty() )
+	{
+		LOG(LOG_FORCE,"GCN RLNC stats: innovative>%d notInnovative>%d decoded>%d recoded>%d", 
+					rlncInnovativeCount, rlncDropCount, rlncDecodedCount, rlncRecodeCount);
+	}
+	
+	LOG(LOG_FORCE,"GCN Buffer stats: %s", BufferPool::instance().statsString().c_str());
+	
 	// Reset flags for relay nodes
 	relayDataGroup = 0;
 	relayDataNonGroup = 0;
@@ -956,7 +1694,7 @@ void GcnService::OnStatTimeout()
 	if (mStatInterval > 0)
 		{
 			mStatTimer.expires_at(mStatTimer.expires_at() + Seconds(mStatInterval));
-			mStatTimer.async_wait(boost::bind(&GcnService::OnStatTimeout, this));
+			mStatTimer.async_wait(boost::bind(&GcnService::OnStatTimeout, this, _1));
 		}
 }
 
@@ -964,25 +1702,55 @@ void GcnService::OnStatTimeout()
 //************************************************************************
 void GcnService::OnAnnounceTimeout(const error_code & ec, shared_ptr<void> arg)
 {
-	if(ec)
+	if ( ec || mStopped )
 	{
 		return;
 	}
 	
 	shared_ptr<AnnounceIt> pIter = static_pointer_cast<AnnounceIt>(arg);
+	sendAdvertise(*pIter);
+
+	// reschedule the periodic event
+	if ((*pIter)->second.interval > 0)
+	{
+		(*pIter)->second.pTimer->expires_at((*pIter)->second.pTimer->expires_at() + Seconds((*pIter)->second.interval));
+		(*pIter)->second.pTimer->async_wait(boost::bind(&GcnService::OnAnnounceTimeout, this, _1, pIter));
+	}
+}
 
+//************************************************************************
+// function to send the periodic ADVERTISE of a group we source
+void GcnService::sendAdvertise(AnnounceIt iter)
+{
 	// Create message, fill in announce and send out socket
 	Advertise message;
 	HashValue tempHash;
+	
+	// The ttl may come from how far the group members are instead of the app
+	uint32_t srcTtl = iter->second.srcTtl;
+	if (mAutoTtlMargin >= 0)
+	{
+		srcTtl = getAutoTtl(iter->second, iter->first, srcTtl, 
+		                    (iter->second.seqNum + 1) % AUTOTTL_PROBE_EVERY == 0);
+	}
 
-	message.set_gid((*pIter)->first);
-	message.set_srcttl((*pIter)->second.srcTtl);
+	// With group summaries on, a periodic ADVERTISE is only sent if a
+	// neighbor's summary says the group is within reach
+	if ( (mSummaryInterval > 0) && (iter->second.interval > 0) && !isGroupNearby(iter->first, srcTtl) )
+	{
+		summarySuppressCount++;
+		LOG(LOG_DEBUG, "No neighbor reaches GID %d. Not sending ADVERTISE\n", iter->first);
+		return;
+	}
+	
+	message.set_gid(iter->first);
+	message.set_srcttl(srcTtl);
 	message.set_srcnode(mNodeId);
-	message.set_ttl((*pIter)->second.srcTtl);
-	message.set_probrelay((*pIter)->second.probRelay);
+	message.set_ttl(srcTtl);
+	message.set_probrelay(iter->second.probRelay);
 	message.set_distance(0);
-	message.set_sequence(++((*pIter)->second.seqNum));
-	if ((*pIter)->second.noTtlRegen)
+	message.set_sequence(++(iter->second.seqNum));
+	if (iter->second.noTtlRegen)
 	{
 		message.set_nottlregen(true);
 	}
@@ -991,24 +1759,17 @@ void GcnService::OnAnnounceTimeout(const error_code & ec, shared_ptr<void> arg)
 	addToHash(message, tempHash);
 
 	// Add to distance table
-	updateDistanceTable((*pIter)->first, mNodeId, tempHash, 0, mNodeId, true, true);
+	updateDistanceTable(iter->first, mNodeId, tempHash, 0, mNodeId, true, true);
 	
-	LOG(LOG_DEBUG, "Sending ADVERTISE for GID %d\n", (*pIter)->first);
-	forwardToOTA(message, (*pIter)->second.srcTtl);
-
-	// reschedule the periodic event
-	if ((*pIter)->second.interval > 0)
-	{
-		(*pIter)->second.pTimer->expires_at((*pIter)->second.pTimer->expires_at() + Seconds((*pIter)->second.interval));
-		(*pIter)->second.pTimer->async_wait(boost::bind(&GcnService::OnAnnounceTimeout, this, _1, pIter));
-	}
+	LOG(LOG_DEBUG, "Sending ADVERTISE for GID %d\n", iter->first);
+	forwardToOTA(message, srcTtl);
 }
 
 //************************************************************************
 // Function to handle processing when ACK timer expires
 void GcnService::OnAckTimeout(const error_code & ec, Ack & ackMsg)
 {
-	if(ec)
+	if ( ec || mStopped )
 	{
 		return;
 	}
@@ -1046,6 +1807,21 @@ void GcnService::OnAckTimeout(const error_code & ec, Ack & ackMsg)
 		LOG(LOG_DEBUG, "Sending ACK for GID %d  GID src %d. prob of relay is %d\n", it->first.gid, it->first.gidSrc, probRelay);
 	}
 
+	// Tell the source how far the group reaches through us
+	uint32_t extent = getMemberExtent(it->first);
+	if (mLocalPullTable.count(ackMsg.gid()))
+	{
+		DistanceIt distIt = mDistanceTable.find(it->first);
+		if ( (distIt != mDistanceTable.end()) && (distIt->second.distance > extent) )
+		{
+			extent = distIt->second.distance;
+		}
+	}
+	if (extent)
+	{
+		ackMsg.set_memberdistance(extent);
+	}
+
 	// Send message
 	forwardToOTA(ackMsg);
 
@@ -1085,7 +1861,7 @@ void GcnService::setAckTimer(Ack & ackMsg)
 // Function to handle processing when ADVERTISE timer expires
 void GcnService::OnAdvTimeout(const error_code & ec, Advertise & advertiseMsg, uint32_t ttl)
 {
-	if(ec)
+	if ( ec || mStopped )
 	{
 		return;
 	}
@@ -1140,25 +1916,51 @@ void GcnService::setAdvTimer(Advertise & advertiseMsg, uint32_t ttl)
 
 
 //************************************************************************
-// Function to handle processing when DATA timer expires
-void GcnService::OnDataTimeout(const error_code & ec, Data & dataMsg, uint32_t ttl, HashValue hashVal)
+// Function to handle processing when DATA timer expires.
+// Sends every DATA that is due and sets the timer for the next one
+void GcnService::OnDataTimeout(const error_code & ec)
 {
-	if(ec)
+	if ( (ec == operation_aborted) || mStopped )
 	{
 		return;
 	}
+	mDataTimerSet = false;
 	
-	// Get iter to item in the timer table
-	auto it = mDataTimerTable.find(hashVal);
-	LOG_ASSERT(it != mDataTimerTable.end(), "Hit Data timeout but had no entry in timer table");
-	
-	LOG(LOG_DEBUG, "Data timer exired for GID %d  GID src %d  hash value %u.", dataMsg.gid(), dataMsg.srcnode(), hashVal);
-	
-	// Send message
-	forwardToOTA(dataMsg, ttl);
+	double currTime = getTimeSec();
+	double nextDue = 0;
+	for (auto it = mDataTimerTable.begin(); it != mDataTimerTable.end();)
+	{
+		if (it->second.due > currTime)
+		{
+			if ( !nextDue || (it->second.due < nextDue) )
+			{
+				nextDue = it->second.due;
+			}
+			++it;
+			continue;
+		}
+		
+		// delete the entry from the timer table before sending
+		DataRelay relay = it->second;
+		LOG(LOG_DEBUG, "Data timer exired for GID %d  GID src %d  hash value %u.", relay.pData->gid(), relay.pData->srcnode(), it->first);
+		it = mDataTimerTable.erase(it);
+		
+		// Send message. Relayed unicast DATA may be held to go out with others
+		if ( (mAggregateHold > 0) && relay.pData->has_uheader() )
+		{
+			aggregateData(*relay.pData, relay.ttl);
+		}
+		else
+		{
+			forwardToOTA(*relay.pData, relay.ttl);
+		}
+		mDataPool.give(relay.pData);
+	}
 	
-	// delete the timer from the timer table
-	mDataTimerTable.erase(it);
+	if (nextDue)
+	{
+		scheduleDataTimer(nextDue);
+	}
 }
 
 //************************************************************************
@@ -1168,1139 +1970,3455 @@ void GcnService::setDataTimer(Data & dataMsg, uint32_t ttl, HashValue hashVal)
 	// Set timer for timer to occur
 	// Time is random between 0.0 and 10.0 microseconds)
 	double tempTime = double(rand() % 10);
-	DataTimer tempTimer(new deadline_timer(*pIoService, Microseconds(tempTime)));
-
-	tempTimer->async_wait(boost::bind(&GcnService::OnDataTimeout, this, _1, dataMsg, ttl, hashVal));
-
-	// Before we insert this into the table, see if we have one already
-	// If we do, delete the existing one and use the new one.
+	
+	// If we have one for this DATA already, it is replaced by this one.
 	// How can this happen you ask? Well, it is possile that we get Data
 	// as a non-group node with a ttl of say 1. Then we get another one with a 
 	// ttl of 2. In that case, because the ttl is higher than our max ttl for the
 	// advertise then we will set a timer for the second one and that can happen
 	// quickly before the timer expired. We only want to send the data with the highest ttl.
-	// If we don't delete the first one then when we do the insert, the new one is not
-	// inserted because we have one already. The new timer then gets automatically cancelled
-	// when we exit this function and boom! we send the lower ttl data instead
-	// of the higher ttl data. So ... see if we have one and delete it first!
 	auto it = mDataTimerTable.find(hashVal);
-	if (it != mDataTimerTable.end())
+	if (it == mDataTimerTable.end())
 	{
-		// delete the timer from the timer table
-		mDataTimerTable.erase(it);
+		DataRelay relay;
+		relay.pData = mDataPool.take();
+		it = mDataTimerTable.insert(DataTimerPair(hashVal, relay)).first;
 	}
-	mDataTimerTable.insert(DataTimerPair(hashVal, tempTimer));
+	it->second.pData->CopyFrom(dataMsg);
+	it->second.ttl = ttl;
+	it->second.due = getTimeSec() + tempTime / 1000000;
+	scheduleDataTimer(it->second.due);
+	
 	LOG(LOG_DEBUG, "Set Data timer for GID %d  GID src %d  hash value %u. Timer hits in %.0lf usec", 
 		      dataMsg.gid(), dataMsg.srcnode(), hashVal, tempTime);
 
 }
 
 //************************************************************************
-// function to process messages received over the air
-void GcnService::OnNetworkReceive(char* buffer, int len)
+// function to set the DATA timer for due if it is not set already.
+// DATA due before the timer fires wait for it (at most the 10 usec of
+// the random wait) rather than have the timer set again
+void GcnService::scheduleDataTimer(double due)
+{
+	if (mDataTimerSet)
+	{
+		return;
+	}
+	double wait = due - getTimeSec();
+	mDataTimer.expires_from_now(Microseconds((wait > 0) ? (long)(wait * 1000000) : 0));
+	mDataTimer.async_wait(makeAllocHandler(mDataTimerMemory, boost::bind(&GcnService::OnDataTimeout, this, _1)));
+	mDataTimerSet = true;
+}
+
+//************************************************************************
+// function to track the DATA received for a flow at a group node.
+// A gap in the sequence numbers means a packet was lost upstream so we
+// ask our neighbors to repair the tree
+void GcnService::updateFlowMonitor(Data & dataMsg)
 {
+	GIDKey key(dataMsg.gid(), dataMsg.srcnode());
+	uint64_t seq = dataMsg.sequence();
+	double currTime = getTimeSec();
 	
-	// Suppress protobuf deserialization errors
-	google::protobuf::LogSilencer logSilencer; 
+	FlowIt iter = mFlowTable.find(key);
+	if (iter == mFlowTable.end())
+	{
+		FlowInfo info;
+		info.lastSeq = seq;
+		info.lastTime = currTime;
+		info.avgInterval = 0.0;
+		info.lastRepairTime = 0.0;
+		info.repairCount = 0;
+		mFlowTable.insert(FlowPair(key, info));
+		return;
+	}
+	
+	// DATA can arrive out of order over different relays.
+	// Only a newer sequence number moves the flow forward
+	if (seq <= iter->second.lastSeq)
+	{
+		return;
+	}
+	
+	// Keep a moving average of the inter-arrival time per packet. This is
+	// the expected source rate used to detect that the flow went silent
+	double interval = (currTime - iter->second.lastTime) / (double)(seq - iter->second.lastSeq);
+	if (iter->second.avgInterval > 0.0)
+	{
+		iter->second.avgInterval = (0.875 * iter->second.avgInterval) + (0.125 * interval);
+	}
+	else
+	{
+		iter->second.avgInterval = interval;
+	}
+	
+	bool gap = (seq > iter->second.lastSeq + 1);
+	iter->second.lastSeq = seq;
+	iter->second.lastTime = currTime;
+	iter->second.repairCount = 0;
+	
+	if (gap)
+	{
+		sendRepair(key, "sequence gap");
+	}
+}
 
-#if 0
-	LOG(LOG_DEBUG, "Received message of len = %d", len);
-	for (int i = 0; i < len; i++)
+//************************************************************************
+// function to send a Repair message for a flow.
+// Repairs are rate limited per flow
+void GcnService::sendRepair(const GIDKey & key, const char* reason)
+{
+	double currTime = getTimeSec();
+	
+	FlowIt iter = mFlowTable.find(key);
+	if (iter != mFlowTable.end())
 	{
-		printf("0x%x  ", (unsigned char)buffer[i]);
+		if ( (currTime - iter->second.lastRepairTime) < REPAIR_HOLDDOWN )
+		{
+			LOG(LOG_DEBUG, "Detected %s for gid %d gid src %d but sent REPAIR recently. NOT sending", reason, key.gid, key.gidSrc);
+			return;
+		}
+		iter->second.lastRepairTime = currTime;
+		iter->second.repairCount++;
 	}
-	printf("\n");
-#endif
-	// Parse OTA message
-	OTAMessage message;
-	if(message.ParseFromArray(buffer, len))
+	
+	Repair message;
+	message.set_gid(key.gid);
+	message.set_srcnode(key.gidSrc);
+	message.set_requester(mNodeId);
+	message.set_sequence(++mRepairSeqNum);
+	message.set_ttl(mRepairTtl);
+	
+	// Add to hash so we ignore the request if a neighbor forwards it back to us
+	HashValue tempHash;
+	addToHash(message, tempHash);
+	
+	LOG(LOG_INFO, "Detected %s for gid %d gid src %d. Sending REPAIR with ttl %d", reason, key.gid, key.gidSrc, mRepairTtl);
+	forwardToOTA(message, mRepairTtl);
+	repairSentCount++;
+}
+
+//************************************************************************
+// function to see if we have heard from a neighbor recently
+bool GcnService::isNeighborAlive(NodeId nodeId, double expireTime)
+{
+	NeighborIt iter = mNeighborTable.find(nodeId);
+	if (iter == mNeighborTable.end())
 	{
-		// Check log level first because printing to string is expensive
-		// and can affect throughput
-		if (mCurrentLogLevel >= LOG_DEBUG)
-		{ 
-			string sMessage;
-			mPbPrinter.PrintToString(message, &sMessage);
-			LOG(LOG_DEBUG, "Received OTA (%d bytes):\n %s", len, sMessage.c_str());
+		return(false);
+	}
+	return( (getTimeSec() - iter->second.lastHeard) <= expireTime );
+}
+
+//************************************************************************
+// Function called by periodic event to look for flows at group nodes that
+// have lost their upstream relay
+void GcnService::OnRepairTimeout(const error_code & ec)
+{
+	// Cancelled by Stop, or the timer went with us. Touch nothing
+	if ( (ec == operation_aborted) || mStopped )
+	{
+		return;
+	}
+	
+	double currTime = getTimeSec();
+	
+	for (FlowIt iter = mFlowTable.begin(); iter != mFlowTable.end(); )
+	{
+		// Stop watching flows for groups that no longer have local subscribers
+		if (mLocalPullTable.count(iter->first.gid) == 0)
+		{
+			iter = mFlowTable.erase(iter);
+			continue;
 		}
 		
-		if (message.header().src() != mNodeId)
+		// We need at least one inter-arrival sample to know the expected rate.
+		// Give up after a few attempts so that a source that simply stopped
+		// sending does not make us send REPAIR forever
+		if ( (iter->second.avgInterval > 0.0) && (iter->second.repairCount < MAX_REPAIR_ATTEMPTS) )
 		{
-			// handle any Ack messages
-			for ( auto & ack : *message.mutable_ack() ) 
+			double silence = currTime - iter->second.lastTime;
+			bool flowSilent = (silence > (REPAIR_SILENCE_FACTOR * iter->second.avgInterval));
+			
+			// Has the next hop on our reverse path gone away? Relays are only heard when
+			// they send so allow for at least two packet intervals of silence
+			bool upstreamLost = false;
+			ReservePathIt revIt = mReversePathTable.find(iter->first);
+			if ( (revIt != mReversePathTable.end()) && (revIt->second.srcNode != iter->first.gidSrc) )
 			{
-				processNetworkAck(ack, message.header().src());
+				double expire = std::max(mNeighborExpireTime, 2.0 * iter->second.avgInterval);
+				upstreamLost = !isNeighborAlive(revIt->second.srcNode, expire);
 			}
 			
-			// handle any Advertise messages
-			for ( auto & advertise : *message.mutable_advertise() ) 
+			if (flowSilent)
 			{
-				processNetworkAdvertise(advertise, message.header().src());
+				sendRepair(iter->first, "silent flow");
 			}
-			
-			// handle any data pushes
-			for ( auto & data : *message.mutable_data() )// process data message
+			else if (upstreamLost)
 			{
-				processNetworkData(data, message.header().src());
+				sendRepair(iter->first, "neighbor timeout");
 			}
-			
-		}
-		else
-		{
-			LOG(LOG_DEBUG, "Received OTA message with my source id (%d). Ignoring", message.header().src());
-			dropCount++;
 		}
+		++iter;
 	}
-	else
-	{
-		//LOG(LOG_DEBUG, "Unable to deserialize message");
+	
+	// reschedule the periodic event
+	if (mRepairInterval > 0)
+	{
+		mRepairTimer.expires_at(mRepairTimer.expires_at() + Milliseconds(mRepairInterval));
+		mRepairTimer.async_wait(boost::bind(&GcnService::OnRepairTimeout, this, _1));
 	}
-
-} 
+}
 
 //************************************************************************
-// function to pre process Data messages received from the network and the client
-// This handles the hash, distance table and local delivery
-bool GcnService::preProcessData(Data & dataMsg, HashValue & hashValue, NodeId msgOtaSrc, shared_ptr<ClientSession> pSession)
+// function to add a DATA message to the retransmission cache for its flow.
+// Each flow has a fixed size ring so the newest DATA overwrites the oldest
+void GcnService::addToRetxCache(Data & dataMsg)
 {
-	// get hash Value. 
-	// This sets hashValue and returns true if it is NOT already in the hash, 
-	bool newToHash = addToHash(dataMsg, hashValue);
+	if ( !(dataMsg.has_sequence()) )
+	{
+		return;
+	}
 	
-	// get get fields from message
-	GroupId gid = dataMsg.gid();
-	NodeId gidsrc = dataMsg.srcnode();
-	uint32_t distance = dataMsg.distance();
+	GIDKey key(dataMsg.gid(), dataMsg.srcnode());
+	RetxCacheIt iter = mRetxCacheTable.find(key);
+	if (iter == mRetxCacheTable.end())
+	{
+		iter = mRetxCacheTable.insert(RetxCachePair(key, RetxRing(mRetxCacheSize))).first;
+	}
 	
-	// First handle distance and packet count
-	updateDistanceTable(gid, gidsrc, hashValue, distance, msgOtaSrc, newToHash, false);
+	RetxEntry & entry = iter->second[dataMsg.sequence() % mRetxCacheSize];
+	entry.seq = dataMsg.sequence();
+	entry.valid = true;
+	dataMsg.SerializeToString(&entry.data);
+}
+
+//************************************************************************
+// function to track the sequence numbers received for a flow of a reliable
+// group and to schedule a NACK for the ones that are missing
+void GcnService::updateNackState(Data & dataMsg)
+{
+	GIDKey key(dataMsg.gid(), dataMsg.srcnode());
+	uint64_t seq = dataMsg.sequence();
 	
-	// Next handle local delivery
-	// Check the "have we seen it" hash and only process if we have not seen this packet yet.
-	if (newToHash)
+	NackIt iter = mNackTable.find(key);
+	if (iter == mNackTable.end())
 	{
-		if (dataMsg.has_uheader())
+		// First DATA we see for this flow. Nothing before it can be recovered
+		NackInfo info;
+		info.lastSeq = seq;
+		info.pTimer.reset(new deadline_timer(*pIoService));
+		info.timerSet = false;
+		mNackTable.insert(NackPair(key, info));
+		return;
+	}
+	
+	if (seq <= iter->second.lastSeq)
+	{
+		// Late or retransmitted DATA. See if it is one we were missing
+		if (iter->second.missing.erase(seq))
 		{
-			recvCountDataUni++;
-			// only process if I am the destination
-			if (dataMsg.uheader().unicastdest() == mNodeId)
-			{
-				// Check announce map - deliver to source client
-				AnnounceIt appIt = mAnnounceTable.find(gid);
-				if (appIt != mAnnounceTable.end())
-				{
-					forwardToApp(dataMsg, appIt->second.pSession);
-					LOG(LOG_DEBUG, "Source Node: Received unicast DATA message we have not already seen. Forwarding to App");
-					pushCount++;
-				}
-				// Also check local pull table - deliver to ALL subscribing clients
-				if (mLocalPullTable.count(gid))
-				{
-					// We have local subscribers!
-					// get all the local subscribers and send them the data
-					LocalPullRangeIt rangeIt = mLocalPullTable.equal_range(gid);
-					for (LocalPullIt iter = rangeIt.first; iter != rangeIt.second; ++iter)
-					{
-						// send over the socket specified by iter->second
-						forwardToApp(dataMsg, iter->second);
-						LOG(LOG_DEBUG, "Group Node: Received unicast DATA message we have not already seen. Forwarding to App");
-						pushCount++;
-					}
-				}
-			}
+			retxRecoveredCount++;
+			LOG(LOG_DEBUG, "Recovered missing DATA seq %lu for gid %d gid src %d", (unsigned long)seq, key.gid, key.gidSrc);
 		}
-		else
+		if ( iter->second.missing.empty() && iter->second.timerSet )
 		{
-			recvCountData++;
-			// Do we have any local subscribers?
-			if (mLocalPullTable.count(gid))
-			{
-				// We have local subscribers!
-				// get all the local subscribers and send them the data
-				LocalPullRangeIt rangeIt = mLocalPullTable.equal_range(gid);
-				for (LocalPullIt iter = rangeIt.first; iter != rangeIt.second; ++iter)
-				{
-					// Only send to this socket if it is NOT the same socket
-					// on which we received data. pSession could be NULL if this
-					// data packet arrived over the air. If it arrived from a client
-					// then pSession is not null and we compare it to the subscriber
-					// socket. So send to the subscriber if we have no pSession (i.e., it
-					// arrived OTA or pSession does not match
-					if ( !pSession || (pSession != iter->second) )
-					{
-						// send over the socket specified by iter->second
-						forwardToApp(dataMsg, iter->second);
-						pushCount++;
-					}
-				}
-			}
+			iter->second.pTimer->cancel();
+			iter->second.timerSet = false;
 		}
+		return;
+	}
+	
+	// Everything between the last sequence number and this one is missing.
+	// Only keep track of the most recent ones
+	uint64_t first = iter->second.lastSeq + 1;
+	if (seq - first > NACK_MAX_MISSING)
+	{
+		first = seq - NACK_MAX_MISSING;
+	}
+	for (uint64_t missingSeq = first; missingSeq < seq; missingSeq++)
+	{
+		iter->second.missing.insert(pair<uint64_t, uint32_t>(missingSeq, 0));
+	}
+	while (iter->second.missing.size() > NACK_MAX_MISSING)
+	{
+		iter->second.missing.erase(iter->second.missing.begin());
+	}
+	iter->second.lastSeq = seq;
+	
+	if ( !(iter->second.missing.empty()) && !(iter->second.timerSet) )
+	{
+		setNackTimer(iter, (rand() % NACK_MAX_DELAY) + 1);
 	}
-	return(newToHash);
 }
 
 //************************************************************************
-// function to process Data messages received from the network
-void GcnService::processNetworkData(Data & dataMsg, NodeId msgOtaSrc)
+// function to set the timer for sending a NACK for a flow
+void GcnService::setNackTimer(NackIt iter, int delay)
 {
-	uint32_t myDistance = 0;
-	DistanceIt distIter;
+	iter->second.pTimer->expires_from_now(Milliseconds(delay));
+	iter->second.pTimer->async_wait(boost::bind(&GcnService::OnNackTimeout, this, _1, iter->first));
+	iter->second.timerSet = true;
+	LOG(LOG_DEBUG, "Set Nack timer for GID %d  GID src %d. Timer hits in %d msec", iter->first.gid, iter->first.gidSrc, delay);
+}
+
+//************************************************************************
+// Function to handle processing when NACK timer expires
+void GcnService::OnNackTimeout(const error_code & ec, GIDKey key)
+{
+	if ( ec || mStopped )
+	{
+		return;
+	}
 	
-	// Go ahead and increment the distance field so that it
-	// is already set if the advertise message gets forwarded
-	// Also need to update the distance so we store the correct
-	// value in our distance table
-	// NOTE: Do this before storing local value below
-	dataMsg.set_distance(dataMsg.distance() + 1);
+	NackIt iter = mNackTable.find(key);
+	if (iter == mNackTable.end())
+	{
+		return;
+	}
+	iter->second.timerSet = false;
 	
-	// pre process the DATA message. This handles the hash, distance table and local delivery
-	HashValue hashValue;
-	bool newToHash = preProcessData(dataMsg, hashValue, msgOtaSrc);
+	// Stop tracking flows for groups that no longer have local subscribers
+	if (mLocalPullTable.count(key.gid) == 0)
+	{
+		mNackTable.erase(iter);
+		return;
+	}
 	
-	// get get fields from message
-	GroupId gid = dataMsg.gid();
-	NodeId gidsrc = dataMsg.srcnode();
-	uint32_t ttl = dataMsg.ttl();
+	Nack message;
+	message.set_gid(key.gid);
+	message.set_srcnode(key.gidSrc);
+	message.set_requester(mNodeId);
+	message.set_sequence(++mNackSeqNum);
+	message.set_ttl(mNackTtl);
+	message.set_srcttl(mNackTtl);
 	
-	// Set values used for if statements. Whether or not we are a group node
-	// and whether or not this is using ADVERTISE/ACK
-	// For the purposes of forwarding a DATA message, we are a group node
-	// if we have a subscriber OR are a producer of data for the group 
-	// (i.e., we are a group "participant"). Note however that if we are the source
-	// of the DATA that it will NOT be newToHash and we will therefore ignore it
-	// ***** TO DO *****
-	// How do we know that this is a DATA for app with advertise/ack or not?
-	// we are currently using src ttl to detect this. ADVERTISE/ACK application
-	// DATA message do not have src ttl 
-	// ****************
-	bool groupNode = ( (mLocalPullTable.count(gid) > 0) || (mAnnounceTable.count(gid) > 0) );
-	bool usingAck = !(dataMsg.has_srcttl());
+	for (auto missIt = iter->second.missing.begin(); missIt != iter->second.missing.end(); )
+	{
+		if (missIt->second >= NACK_MAX_TRIES)
+		{
+			LOG(LOG_INFO, "Giving up on DATA seq %lu for gid %d gid src %d", (unsigned long)missIt->first, key.gid, key.gidSrc);
+			missIt = iter->second.missing.erase(missIt);
+			continue;
+		}
+		message.add_missing(missIt->first);
+		missIt->second++;
+		++missIt;
+	}
 	
-	if(mDataFile != NULL) //DATAITEM
+	if (message.missing_size() == 0)
 	{
-		mRcvDataDI++;
-		char buf[256];
-		uint64_t millis = duration_cast<milliseconds>(getTime()).count();
-		int buflen = sprintf(buf,"0,%.0f,ll.gcnRcvData,node%03d.gcnService,%.0f,\"{\"\"rcvfrom\"\":\"\"node%03d\"\",\"\"gid\"\":%d,\"\"size\"\":%d,\"\"seq\"\":%.0f,\"\"srcttl\"\":%d,\"\"orgsrc\"\":\"\"node%03d\"\",\"\"ttl\"\":%d,\"\"dist\"\":%d,\"\"newhash\"\":%d}\"\n",
-			(double)mRcvDataDI,mNodeId,(double)millis,msgOtaSrc,gid,(int)dataMsg.data().size(),(double)dataMsg.sequence(),dataMsg.srcttl(),gidsrc,ttl,dataMsg.distance()-1,newToHash);
-		fwrite(buf,sizeof(char),buflen,mDataFile);
-		fflush(mDataFile);
+		return;
 	}
 	
-	// Now handle forwarding
-	if ( dataMsg.has_uheader() )
+	// Add to hash so we ignore the request if a neighbor forwards it back to us
+	HashValue tempHash;
+	addToHash(message, tempHash);
+	
+	LOG(LOG_INFO, "Sending NACK for %d DATA messages for gid %d gid src %d", message.missing_size(), key.gid, key.gidSrc);
+	forwardToOTA(message, mNackTtl);
+	nackSentCount++;
+	
+	// Ask again later for anything that is still missing
+	setNackTimer(iter, NACK_HOLDDOWN + (rand() % NACK_MAX_DELAY));
+}
+
+//************************************************************************
+// function to set a timer for retransmitting a cached DATA message
+// to answer nackMsg
+void GcnService::setRetxTimer(const DataKey & key, uint32_t ttl, const Nack & nackMsg)
+{
+	// Only one retransmission outstanding for each DATA
+	if (mRetxTimerTable.count(key))
 	{
-		// This is unicast message
-		if ( (newToHash) && (dataMsg.uheader().unicastdest() != mNodeId) )
+		return;
+	}
+	
+	// Time is random between 1 and RETX_MAX_DELAY milliseconds
+	int tempTime = (rand() % RETX_MAX_DELAY) + 1;
+	RetxTimer tempTimer(new deadline_timer(*pIoService, Milliseconds(tempTime)));
+	tempTimer->async_wait(boost::bind(&GcnService::OnRetxTimeout, this, _1, key, ttl, nackMsg.requester(), nackMsg.sequence()));
+	
+	mRetxTimerTable.insert(RetxTimerPair(key, tempTimer));
+	LOG(LOG_DEBUG, "Set Retransmit timer for GID %d  GID src %d  Seq %lu. Timer hits in %d msec", 
+		key.gid, key.gidSrc, (unsigned long)key.seq, tempTime);
+}
+
+//************************************************************************
+// Function to handle processing when the retransmit timer expires
+void GcnService::OnRetxTimeout(const error_code & ec, DataKey key, uint32_t ttl, NodeId requester, uint32_t nackSeq)
+{
+	if ( ec || mStopped )
+	{
+		return;
+	}
+	
+	// The timer is removed from the table if another node answered first
+	auto it = mRetxTimerTable.find(key);
+	if (it == mRetxTimerTable.end())
+	{
+		return;
+	}
+	
+	// Make sure the DATA has not been overwritten in the ring since the NACK
+	RetxCacheIt cacheIt = mRetxCacheTable.find(GIDKey(key.gid, key.gidSrc));
+	if (cacheIt != mRetxCacheTable.end())
+	{
+		RetxEntry & entry = cacheIt->second[key.seq % mRetxCacheSize];
+		MessagePool<Data>::Handle pooled(mDataPool);
+		Data & dataMsg = *pooled;
+		if ( entry.valid && (entry.seq == key.seq) && dataMsg.ParseFromString(entry.data) )
 		{
-			// I haven't seen this packet and I'm not destination
-			// Compare relay distance to distance I have for this gid source
-			uint32_t relayDistance = dataMsg.uheader().relaydistance();
+			// Say which NACK this answers so the relays on the way pass it on
+			auto pRetx = dataMsg.mutable_retx();
+			pRetx->set_requester(requester);
+			pRetx->set_nacksequence(nackSeq);
 			
-			distIter = mDistanceTable.find(GIDKey(gid, dataMsg.uheader().unicastdest()));
-			if (distIter != mDistanceTable.end())
-			{
-				myDistance = distIter->second.distance;
-			}
-			if ( (myDistance) && (myDistance <= relayDistance) )
-			{
-				if ( usingAck && ((groupNode && mAlwaysRebroadcast) || (mRemotePullTable.count(gid)))) // I am a relay for the corresponding one-to-many flow
-				{
-					auto uheader = dataMsg.mutable_uheader();
-					uheader->set_relaydistance(myDistance - 1);
-					
-					LOG(LOG_DEBUG, "Received unicast DATA message with relayDistance %d. My Distance is %d to Node %d. Forwarding OTA",
-									relayDistance, myDistance, dataMsg.uheader().unicastdest());
-					setDataTimer(dataMsg, 1, hashValue);
-					fwdCountUni++;
-				}
-				else if (!usingAck) 
-				{
-					if ( (ttl) && (!groupNode || dataMsg.has_nottlregen()) )
-					{
-						// TTL is NOT 0 and we are either a non-group node OR a group node that is NOT regenerating TTL
-						// so we can forward the packet.
-						auto uheader = dataMsg.mutable_uheader();
-						uheader->set_relaydistance(myDistance - 1);
-					
-						LOG(LOG_DEBUG, "Received unicast DATA message with relayDistance %d. My Distance is %d to Node %d. Forwarding OTA",
-										relayDistance, myDistance, dataMsg.uheader().unicastdest());
-						setDataTimer(dataMsg, ttl, hashValue);
-						fwdCountUni++;
-					}
-					else if (groupNode)
-					{
-						auto uheader = dataMsg.mutable_uheader();
-						uheader->set_relaydistance(myDistance - 1);
-					
-						LOG(LOG_DEBUG, "Received unicast DATA message with relayDistance %d. My Distance is %d to Node %d. Forwarding OTA",
-										relayDistance, myDistance, dataMsg.uheader().unicastdest());
-						setDataTimer(dataMsg,  dataMsg.srcttl(), hashValue);
-						fwdCountUni++;
-					}
-					else
-					{
-						LOG(LOG_DEBUG, "Received unicast DATA message with relayDistance %d. My Distance is %d to Node %d, with %d TTL. NOT Forwarding OTA",
-								relayDistance, myDistance, dataMsg.uheader().unicastdest(),ttl);
-					}
-				} 
-				else
-				{
-					LOG(LOG_DEBUG, "Received unicast DATA message with relayDistance %d. My Distance is %d to Node %d, with %d pull table entries. NOT Forwarding OTA",
-								relayDistance, myDistance, dataMsg.uheader().unicastdest(),mRemotePullTable.count(gid));
-				}
-			}
-			else
-			{
-				LOG(LOG_DEBUG, "Received unicast DATA message with relayDistance %d. My Distance is %d to Node %d. NOT Forwarding OTA",
-								relayDistance, myDistance, dataMsg.uheader().unicastdest());
-			}
+			// Add to hash so we ignore it if a relay sends it back to us
+			HashValue tempHash;
+			addToHash(dataMsg, tempHash);
+			
+			LOG(LOG_DEBUG, "Retransmitting DATA seq %lu for gid %d gid src %d to requester %d", (unsigned long)key.seq, key.gid, key.gidSrc, requester);
+			forwardToOTA(dataMsg, ttl);
+			retxSentCount++;
 		}
 	}
-	else if (dataMsg.srcnode() != mNodeId)
+	
+	// delete the timer from the timer table
+	mRetxTimerTable.erase(it);
+}
+
+//************************************************************************
+// function to pass on a retransmitted DATA toward the node whose NACK it
+// answers. The retx header is part of the hash, so each answer is relayed
+// once whether or not the DATA itself was seen here before
+void GcnService::relayRetransmission(Data & dataMsg)
+{
+	HashValue retxHash;
+	if ( !addToHash(dataMsg, retxHash) )
 	{
-		if (usingAck)
-		{
-			// This app is using ADVERTISE/ACK
-			if ( (newToHash) && ( (groupNode && mAlwaysRebroadcast) || (mRemotePullTable.count(gid)) ) )
-			{
-				// We have not seen this packet and we have a downstream subscriber OR
-				// we are a group node and are configured to always rebroadcast
-				// so we need to forward this OTA
-				// Use TTL of 1 so when it is sent, the actual sent TTL will be 0
-				// (NOTE: ttl gets decremented before sending)
-				setDataTimer(dataMsg, 1, hashValue);
-				fwdCount++;
-				// Mark flag for statistics
-				if (groupNode)
-					relayDataGroup=1;
-				else
-					relayDataNonGroup=1;
-			}
-		}
-		else
-		{
-			// This is NOT using ADVERTISE/ACK 
-			uint32_t srcTtl = dataMsg.srcttl();
-			if (groupNode)
+		return;
+	}
+	
+	// (NOTE: ttl gets decremented before sending)
+	if ( (dataMsg.retx().requester() != mNodeId) && dataMsg.ttl() )
+	{
+		LOG(LOG_DEBUG, "Relaying retransmitted DATA seq %lu for gid %d gid src %d to requester %d", 
+			(unsigned long)dataMsg.sequence(), dataMsg.gid(), dataMsg.srcnode(), dataMsg.retx().requester());
+		setDataTimer(dataMsg, dataMsg.ttl(), retxHash);
+		retxRelayCount++;
+	}
+}
+
+//************************************************************************
+// function to send a non-unicast DATA from a local source OTA
+void GcnService::sendSourceData(Data & dataMsg, bool advertiseOverride)
+{
+	if (dataMsg.has_srcttl())
+	{
+		// we aren't using ADVERTISE/ACK so use the src ttl in push
+		forwardToOTA(dataMsg, dataMsg.srcttl());
+	}
+	else if ( (mRemotePullTable.count(dataMsg.gid()) != 0) || advertiseOverride )
+	{
+		// We are using ADVERTISE/ACK and we have either:
+		// a) set up the path with ADVERTISE/ACK which we know because we
+		//    have a remote pull entry
+		// OR
+		// b) we are overriding ADVERTISE in which case we will never have an 
+		//    entry in remote pull table but the app will only send if we
+		//    heard another group node's advertisement
+		// In either case we want to forward out the ota link.
+		// We use TTL of 1 so when it is sent, the actual sent TTL will be 0
+		// (NOTE: ttl gets decremented before sending)
+		// PUSH is always sent with TTL = 0
+		// WHY do we check for an entry in remote pull table when we re using Advertise?
+		// Well, it is possible that we have a subscriber on this node.
+		// In that case, as soon as the GID is advertised, we send a PULL
+		// to the source client to tell it we have a subscriber (the local subscriber)
+		// We may not yet have any remote subscribers to we must have at least one
+		// before we start sending the data over the air.
+		// This allows a GID source to send the data to a subscriber that is local
+		// but still have to send out advertise and get an ack before sending OTA.
+		forwardToOTA(dataMsg, 1);
+	}
+}
+
+//************************************************************************
+// function to add a source DATA to the current FEC block of a group.
+// Sets the FEC header of the DATA and, when the block is complete, 
+// returns the repair DATA for the block
+void GcnService::fecEncode(AnnounceInfo & info, Data & dataMsg, vector<Data> & repairMsgs)
+{
+	auto pFec = dataMsg.mutable_fec();
+	pFec->set_blockid(info.fecBlockId);
+	pFec->set_index(info.fecSymbols.size());
+	pFec->set_k(info.fecK);
+	pFec->set_r(info.fecR);
+	
+	// Repair DATA go as far as the source DATA of their block
+	info.fecHeader.Clear();
+	info.fecHeader.set_gid(dataMsg.gid());
+	if (dataMsg.has_srcttl())
+	{
+		info.fecHeader.set_srcttl(dataMsg.srcttl());
+	}
+	if (dataMsg.has_nottlregen())
+	{
+		info.fecHeader.set_nottlregen(dataMsg.nottlregen());
+	}
+	
+	info.fecSymbols.push_back(Fec::toSymbol(dataMsg.sequence(), dataMsg.data()));
+	info.fecLastTime = getTimeSec();
+	if (info.fecSymbols.size() < info.fecK)
+	{
+		// If the app stops sending mid block the repair DATA go out anyway.
+		// The timer is set once per block and set again when it fires if
+		// DATA came in since
+		if (info.fecSymbols.size() == 1)
+		{
+			if (!info.pFecTimer)
 			{
-				if (newToHash)
+				info.pFecTimer.reset(new deadline_timer(*pIoService));
+			}
+			info.pFecTimer->expires_from_now(Milliseconds(FEC_FLUSH_TIME));
+			info.pFecTimer->async_wait(boost::bind(&GcnService::OnFecFlushTimeout, this, _1, dataMsg.gid(), info.fecBlockId));
+		}
+		return;
+	}
+	
+	fecEndBlock(info, repairMsgs);
+}
+
+//************************************************************************
+// function to make the repair DATA for the source DATA in the current FEC
+// block of a group and start the next block. A block ended early by the
+// flush timer is coded with K set to the source DATA it holds. Subscribers
+// take the K of the repair DATA over the K of the source DATA.
+void GcnService::fecEndBlock(AnnounceInfo & info, vector<Data> & repairMsgs)
+{
+	if (info.pFecTimer)
+	{
+		info.pFecTimer->cancel();
+	}
+	
+	uint32_t k = info.fecSymbols.size();
+	vector<string> repair;
+	if (Fec::encode(info.fecSymbols, info.fecR, repair))
+	{
+		for (uint32_t i = 0; i < repair.size(); i++)
+		{
+			// Repair DATA have no sequence number. They are not part of
+			// the flow as far as NACKs and the flow monitor are concerned
+			Data message;
+			message.CopyFrom(info.fecHeader);
+			message.set_srcnode(mNodeId);
+			message.set_distance(0);
+			message.set_data(repair[i]);
+			
+			auto pRepairFec = message.mutable_fec();
+			pRepairFec->set_blockid(info.fecBlockId);
+			pRepairFec->set_index(k + i);
+			pRepairFec->set_k(k);
+			pRepairFec->set_r(info.fecR);
+			repairMsgs.push_back(message);
+		}
+	}
+	LOG(LOG_DEBUG, "FEC block %d complete for gid %d with %d DATA. Sending %d repair DATA", info.fecBlockId, info.fecHeader.gid(), k, (int)repairMsgs.size());
+	
+	info.fecSymbols.clear();
+	info.fecBlockId++;
+}
+
+//************************************************************************
+// Function to handle processing when a FEC block has waited too long for
+// the rest of its source DATA
+void GcnService::OnFecFlushTimeout(const error_code & ec, GroupId gid, uint32_t blockId)
+{
+	if ( (ec == operation_aborted) || mStopped )
+	{
+		return;
+	}
+	
+	// The block may have been completed (or the group gone) since
+	AnnounceIt anncIt = mAnnounceTable.find(gid);
+	if ( (anncIt == mAnnounceTable.end()) || (anncIt->second.fecBlockId != blockId) || anncIt->second.fecSymbols.empty() )
+	{
+		return;
+	}
+	
+	// Still getting DATA. Wait until FEC_FLUSH_TIME after the last one
+	AnnounceInfo & info = anncIt->second;
+	double idle = getTimeSec() - info.fecLastTime;
+	if (idle * 1000 < FEC_FLUSH_TIME)
+	{
+		info.pFecTimer->expires_from_now(Milliseconds(FEC_FLUSH_TIME - (int)(idle * 1000)));
+		info.pFecTimer->async_wait(boost::bind(&GcnService::OnFecFlushTimeout, this, _1, gid, blockId));
+		return;
+	}
+	
+	fecFlush(info);
+}
+
+//************************************************************************
+// function to end a partly filled FEC block of a group now and send its
+// repair DATA
+void GcnService::fecFlush(AnnounceInfo & info)
+{
+	if (info.fecSymbols.empty())
+	{
+		return;
+	}
+	
+	vector<Data> fecRepair;
+	fecEndBlock(info, fecRepair);
+	fecFlushCount++;
+	
+	bool advertiseOverride = !(info.interval > 0);
+	for (auto & repair : fecRepair)
+	{
+		HashValue repairHash;
+		addToHash(repair, repairHash);
+		sendSourceData(repair, advertiseOverride);
+		fecRepairSentCount++;
+	}
+}
+
+//************************************************************************
+// function to pass a FEC DATA received OTA to the decoder for its block.
+// Any source DATA recovered are delivered to the local subscribers here.
+// Returns true if the DATA passed in should be delivered to the subscribers
+bool GcnService::fecDecode(Data & dataMsg)
+{
+	const FecHeader & fec = dataMsg.fec();
+	uint32_t k = fec.k();
+	uint32_t r = fec.r();
+	uint32_t index = fec.index();
+	bool isSource = (index < k);
+	
+	if ( (k == 0) || (k + r > FEC_MAX_SYMBOLS) || (index >= k + r) )
+	{
+		LOG(LOG_WARN, "Received DATA with bad FEC header (k %d r %d index %d) for gid %d", k, r, index, dataMsg.gid());
+		return(isSource);
+	}
+	
+	// get the block, create it if this is the first DATA of the block
+	// and only keep the most recent blocks
+	FecBlockMap & blocks = mFecDecodeTable[GIDKey(dataMsg.gid(), dataMsg.srcnode())];
+	auto blockIt = blocks.find(fec.blockid());
+	if (blockIt == blocks.end())
+	{
+		FecBlockInfo info;
+		info.k = k;
+		info.r = r;
+		info.decoded = false;
+		blockIt = blocks.insert(pair<uint32_t, FecBlockInfo>(fec.blockid(), info)).first;
+		
+		while ( (blocks.size() > FEC_MAX_BLOCKS) && (blocks.begin() != blockIt) )
+		{
+			if ( !(blocks.begin()->second.decoded) )
+			{
+				fecDecodeFailCount++;
+			}
+			blocks.erase(blocks.begin());
+		}
+	}
+	FecBlockInfo & block = blockIt->second;
+	
+	// The source ended the block early (see fecEndBlock). Its repair DATA
+	// carry the number of source DATA it really holds
+	if ( !isSource && (k < block.k) && !block.decoded )
+	{
+		block.k = k;
+	}
+	
+	if (isSource)
+	{
+		if (block.delivered.count(index))
+		{
+			// We recovered this one already
+			return(false);
+		}
+		block.delivered.insert(index);
+	}
+	
+	if (block.decoded)
+	{
+		return(isSource);
+	}
+	
+	if (block.delivered.size() == block.k)
+	{
+		// Nothing is missing so there is nothing to decode
+		block.decoded = true;
+		block.symbols.clear();
+		return(isSource);
+	}
+	
+	if (isSource)
+	{
+		block.symbols[index] = Fec::toSymbol(dataMsg.sequence(), dataMsg.data());
+	}
+	else
+	{
+		block.symbols[index] = dataMsg.data();
+	}
+	
+	if (block.symbols.size() < block.k)
+	{
+		return(isSource);
+	}
+	
+	// We have K symbols. Recover the missing source DATA and deliver them
+	if (Fec::decode(block.k, block.r, block.symbols))
+	{
+		for (uint32_t j = 0; j < block.k; j++)
+		{
+			uint64_t seq;
+			Data recovered;
+			if ( block.delivered.count(j) || !Fec::fromSymbol(block.symbols[j], seq, *recovered.mutable_data()) )
+			{
+				continue;
+			}
+			recovered.set_gid(dataMsg.gid());
+			recovered.set_srcnode(dataMsg.srcnode());
+			recovered.set_sequence(seq);
+			recovered.mutable_fec()->CopyFrom(fec);
+			recovered.mutable_fec()->set_index(j);
+			block.delivered.insert(j);
+			fecRecoveredCount++;
+			
+			pushCount += forwardToSubscribers(recovered);
+			LOG(LOG_DEBUG, "Recovered DATA seq %lu of FEC block %d for gid %d gid src %d", (unsigned long)seq, fec.blockid(), dataMsg.gid(), dataMsg.srcnode());
+		}
+	}
+	else
+	{
+		fecDecodeFailCount++;
+	}
+	block.decoded = true;
+	block.symbols.clear();
+	
+	return(isSource);
+}
+
+//************************************************************************
+// function to pick the devices a DATA goes out on when we have more than one.
+// The downstream neighbors of the group are the nodes in the Remote Pull table.
+// For each of them we know the devices we have heard it on recently.
+//   select: the device we hear each downstream neighbor best on (most messages)
+//   stripe: one of the devices that reaches every downstream neighbor, round robin.
+//           Falls back to select if no device reaches them all.
+// An empty set (all devices) is returned if we don't know where the
+// downstream neighbors are, or the DATA is not going down the group tree.
+DeviceSet GcnService::selectDevices(GroupId gid, OTAMessage & Msg)
+{
+	DeviceSet devices;
+	
+	// Unicast DATA go back up the tree
+	if ( Msg.data_size() && Msg.data(0).has_uheader() )
+	{
+		ifAllCount++;
+		return devices;
+	}
+	
+	RemotePullRangeIt rangeIt = mRemotePullTable.equal_range(gid);
+	if (rangeIt.first == rangeIt.second)
+	{
+		ifAllCount++;
+		return devices;
+	}
+	
+	double currTime = getTimeSec();
+	DeviceSet common = mAllDevices;
+	for (RemotePullIt iter = rangeIt.first; iter != rangeIt.second; ++iter)
+	{
+		NeighborIt nbrIt = mNeighborTable.find(iter->second.nodeId);
+		if (nbrIt == mNeighborTable.end())
+		{
+			ifAllCount++;
+			return DeviceSet();
+		}
+		
+		// devices this neighbor has been heard on recently and the best of them
+		DeviceSet heard;
+		int best = -1;
+		uint32_t bestCount = 0;
+		for (auto devIt = nbrIt->second.devices.begin(); devIt != nbrIt->second.devices.end(); ++devIt)
+		{
+			if ( (currTime - devIt->second.lastHeard) > mNeighborExpireTime )
+			{
+				continue;
+			}
+			heard.insert(devIt->first);
+			if (devIt->second.rxCount > bestCount)
+			{
+				best = devIt->first;
+				bestCount = devIt->second.rxCount;
+			}
+		}
+		if (best < 0)
+		{
+			ifAllCount++;
+			return DeviceSet();
+		}
+		devices.insert(best);
+		
+		DeviceSet both;
+		for (auto devIt = common.begin(); devIt != common.end(); ++devIt)
+		{
+			if (heard.count(*devIt))
+			{
+				both.insert(*devIt);
+			}
+		}
+		common.swap(both);
+	}
+	
+	if ( (mIfMode == IF_MODE_STRIPE) && !common.empty() )
+	{
+		uint32_t stripe = mStripeTable[gid]++;
+		auto devIt = common.begin();
+		std::advance(devIt, stripe % common.size());
+		devices.clear();
+		devices.insert(*devIt);
+		ifStripeCount++;
+	}
+	else
+	{
+		ifSelectCount++;
+	}
+	return devices;
+}
+
+//************************************************************************
+// function to find the link layer address of a neighbor to unicast to.
+// Picks the device we hear it best on among those where its address is
+// known and has not changed recently. Returns false if there is none.
+bool GcnService::getNextHopAddress(NodeId nodeId, int & device, unsigned char* hwAddress)
+{
+	NeighborIt nbrIt = mNeighborTable.find(nodeId);
+	if (nbrIt == mNeighborTable.end())
+	{
+		return(false);
+	}
+	
+	double currTime = getTimeSec();
+	const NeighborDeviceInfo* pBest = NULL;
+	for (auto devIt = nbrIt->second.devices.begin(); devIt != nbrIt->second.devices.end(); ++devIt)
+	{
+		const NeighborDeviceInfo & devInfo = devIt->second;
+		if ( !devInfo.hwKnown || ((currTime - devInfo.lastHeard) > mNeighborExpireTime) )
+		{
+			continue;
+		}
+		if ( devInfo.hwChangeTime && ((currTime - devInfo.hwChangeTime) <= mNeighborExpireTime) )
+		{
+			continue;
+		}
+		if ( (pBest == NULL) || (devInfo.rxCount > pBest->rxCount) )
+		{
+			pBest = &devInfo;
+			device = devIt->first;
+		}
+	}
+	if (pBest == NULL)
+	{
+		return(false);
+	}
+	memcpy(hwAddress, pBest->hwAddress, ETH_ALEN);
+	return(true);
+}
+
+//************************************************************************
+// function to find the next hop for unicast DATA. That is the destination
+// itself if it is a neighbor, otherwise the neighbor we heard the
+// destination's DATA from. Returns 0 if there is no next hop to use.
+NodeId GcnService::getUnicastNextHop(Data & dataMsg)
+{
+	NodeId dest = dataMsg.uheader().unicastdest();
+	if (isNeighborAlive(dest, mNeighborExpireTime))
+	{
+		return(dest);
+	}
+	
+	ReservePathIt revIt = mReversePathTable.find(GIDKey(dataMsg.gid(), dest));
+	if ( (revIt != mReversePathTable.end()) && isNeighborAlive(revIt->second.srcNode, mNeighborExpireTime) )
+	{
+		return(revIt->second.srcNode);
+	}
+	return(0);
+}
+
+//************************************************************************
+// function to hold a relayed unicast DATA so it can be sent with other
+// DATA going to the same destination. What is held goes out when the
+// hold time is up or when the next DATA would not fit with it.
+void GcnService::aggregateData(Data & dataMsg, uint32_t ttl)
+{
+	GIDKey key(dataMsg.gid(), dataMsg.uheader().unicastdest());
+	int size = dataMsg.ByteSize() + AGGREGATE_ITEM_OVERHEAD;
+	
+	AggregateIt iter = mAggregateTable.find(key);
+	if ( (iter != mAggregateTable.end()) && ((iter->second.bytes + size) > AGGREGATE_MAX_BYTES) )
+	{
+		flushAggregate(iter);
+		iter = mAggregateTable.end();
+	}
+	
+	if (iter == mAggregateTable.end())
+	{
+		AggregateInfo info;
+		info.bytes = 0;
+		info.pTimer.reset(new deadline_timer(*pIoService, Microseconds((long)(mAggregateHold * 1000))));
+		info.pTimer->async_wait(boost::bind(&GcnService::OnAggregateTimeout, this, _1, key, info.pTimer));
+		iter = mAggregateTable.insert(AggregatePair(key, info)).first;
+	}
+	
+	iter->second.items.push_back(pair<Data, uint32_t>(dataMsg, ttl));
+	iter->second.bytes += size;
+	aggItemCount++;
+}
+
+//************************************************************************
+void GcnService::OnAggregateTimeout(const error_code & ec, GIDKey key, shared_ptr<deadline_timer> pTimer)
+{
+	if ( ec || mStopped )
+	{
+		return;
+	}
+	
+	// The entry may have been sent already and a new one started since
+	AggregateIt iter = mAggregateTable.find(key);
+	if ( (iter != mAggregateTable.end()) && (iter->second.pTimer == pTimer) )
+	{
+		flushAggregate(iter);
+	}
+}
+
+//************************************************************************
+// function to send the unicast DATA held for a destination in one OTA
+// message. If the app gave us a reducer for the group the payloads are
+// combined into a single DATA first.
+void GcnService::flushAggregate(AggregateIt iter)
+{
+	GroupId gid = iter->first.gid;
+	AggregateItems & items = iter->second.items;
+	iter->second.pTimer->cancel();
+	
+	auto reducerIt = mReducerTable.find(gid);
+	if ( (items.size() > 1) && (reducerIt != mReducerTable.end()) )
+	{
+		string payload;
+		if (reducerIt->second(gid, items, payload))
+		{
+			// The combined DATA goes as far as the farthest one would have
+			pair<Data, uint32_t> reduced = items.back();
+			for (auto & item : items)
+			{
+				if (item.second > reduced.second)
 				{
-					// We are a group node and haven't seen this packet
-					if (!(dataMsg.has_nottlregen()))
-					{
-						// Message does not have nottlregen field so we ARE regenerating TTL
-						// For this case: Reset ttl field to src ttl field value
-						//  (NOTE: ttl gets decremented before sending)
-						setDataTimer(dataMsg, srcTtl, hashValue);
-						fwdCount++;
-						relayDataGroup=1;
-						LOG(LOG_DEBUG, "Group Node: Received DATA message we have not already seen. Forwarding OTA with regenerated TTL (ttl=%d)", srcTtl);
-					}
-					else if (ttl)
-					{
-						// Not regenerating TTL so just use the non-zero ttl value.
-						setDataTimer(dataMsg, ttl, hashValue);
-						fwdCount++;
-						relayDataGroup=1;
-						LOG(LOG_DEBUG, "Group Node: Received DATA message we have not already seen. Forwarding OTA w/o regenerating TTL (ttl=%d)", ttl);
-					}
+					reduced.second = item.second;
 				}
 			}
-			else if (ttl)
+			reduced.first.set_data(payload);
+			items.assign(1, reduced);
+			aggReduceCount++;
+		}
+	}
+	
+	OTAMessage message;
+	auto header = message.mutable_header();
+	header->set_src(mNodeId);
+	for (auto & item : items)
+	{
+		auto pData = message.add_data();
+		pData->CopyFrom(item.first);
+		pData->set_ttl(item.second - 1);
+		writeSentDataItem(item.first);
+	}
+	
+	NodeId nextHop = 0;
+	if (mL2Unicast)
+	{
+		nextHop = getUnicastNextHop(items.front().first);
+	}
+	LOG(LOG_DEBUG, "Sending %d held unicast DATA for GID %d to Node %d", (int)items.size(), gid, iter->first.gidSrc);
+	mAggregateTable.erase(iter);
+	aggFrameCount++;
+	
+	forwardToOTA(gid, message, nextHop);
+}
+
+//************************************************************************
+// function to set the reducer used to combine a group's held unicast DATA.
+// An empty reducer removes it.
+void GcnService::setDataReducer(GroupId gid, DataReducer reducer)
+{
+	if (reducer)
+	{
+		mReducerTable[gid] = reducer;
+	}
+	else
+	{
+		mReducerTable.erase(gid);
+	}
+}
+
+//************************************************************************
+// function to set the socket priority used for a group's DATA.
+// Returns the priority that will be used.
+int GcnService::setGroupPriority(GroupId gid, uint32_t priority)
+{
+	if (priority > (uint32_t)OTA_PRIORITY_MAX)
+	{
+		LOG(LOG_WARN, "Priority %d for group %d is too high. Using %d", priority, gid, OTA_PRIORITY_MAX);
+		priority = OTA_PRIORITY_MAX;
+	}
+	
+	GroupPriorityIt prioIt = mGroupPriorityTable.find(gid);
+	if ( (prioIt == mGroupPriorityTable.end()) || (prioIt->second != (int)priority) )
+	{
+		LOG(LOG_DEBUG, "DATA for group %d now sent with priority %d", gid, priority);
+		mGroupPriorityTable[gid] = priority;
+	}
+	return(priority);
+}
+
+//************************************************************************
+// function to turn a source DATA of a coded group into a coded DATA.
+// The source sends its DATA systematically (one unit coefficient) so
+// subscribers that get them all never need to solve anything. Relays
+// do the mixing.
+void GcnService::rlncEncode(AnnounceInfo & info, Data & dataMsg)
+{
+	auto pCoded = dataMsg.mutable_coded();
+	pCoded->set_generation(info.rlncGenId);
+	pCoded->set_gensize(info.rlncGenSize);
+	pCoded->set_coefficients(RlncGeneration::unitVector(info.rlncGenSize, info.rlncCount));
+	
+	// The sequence number goes in the symbol. Coded DATA have no sequence
+	// number of their own since a combination has no single one
+	dataMsg.set_data(Fec::toSymbol(dataMsg.sequence(), dataMsg.data()));
+	dataMsg.clear_sequence();
+	
+	info.rlncCount++;
+	if (info.rlncCount >= info.rlncGenSize)
+	{
+		info.rlncCount = 0;
+		info.rlncGenId++;
+	}
+}
+
+//************************************************************************
+// function to add a coded DATA to its generation. This is the rank check
+// used instead of the hash for coded DATA. Returns true if it is innovative.
+// Source DATA decoded because of it are delivered to the local subscribers here.
+bool GcnService::addToGeneration(Data & dataMsg, HashValue & hashValue, shared_ptr<ClientSession> pSession)
+{
+	GroupId gid = dataMsg.gid();
+	const CodedHeader & coded = dataMsg.coded();
+	
+	// Still need a hash value for the distance table and the data timers.
+	// It is NOT added to the hash table.
+	{
+		MessagePool<Data>::Handle pooled(mDataPool);
+		Data & message = *pooled;
+		message.CopyFrom(dataMsg);
+		message.set_ttl(0);
+		message.set_distance(0);
+		message.SerializeToString(&mHashScratch);
+		hashValue = make_hash(mHashScratch);
+	}
+	
+	if ( (coded.gensize() == 0) || (coded.gensize() > RLNC_MAX_GENSIZE) || (coded.coefficients().size() != coded.gensize()) )
+	{
+		LOG(LOG_WARN, "Received coded DATA with bad header (gensize %d, %d coefficients) for gid %d", coded.gensize(), (int)coded.coefficients().size(), gid);
+		return(false);
+	}
+	
+	// get the generation, create it if this is the first DATA of the generation
+	// and only keep the most recent generations
+	RlncGenMap & gens = mRlncTable[GIDKey(gid, dataMsg.srcnode())];
+	auto genIt = gens.find(coded.generation());
+	if (genIt == gens.end())
+	{
+		genIt = gens.insert(pair<uint32_t, RlncGenInfo>(coded.generation(), RlncGenInfo())).first;
+		genIt->second.gen.init(coded.gensize());
+		while ( (gens.size() > RLNC_MAX_GENERATIONS) && (gens.begin() != genIt) )
+		{
+			gens.erase(gens.begin());
+		}
+	}
+	RlncGenInfo & info = genIt->second;
+	
+	if (!info.gen.add(coded.coefficients(), dataMsg.data()))
+	{
+		rlncDropCount++;
+		LOG(LOG_DEBUG, "Received coded DATA for gid %d gid src %d generation %d that is not innovative (rank %d)", gid, dataMsg.srcnode(), coded.generation(), info.gen.rank());
+		return(false);
+	}
+	rlncInnovativeCount++;
+	
+	// Deliver whatever is now decoded
+	if (mLocalPullTable.count(gid))
+	{
+		for (uint32_t index = 0; index < info.gen.size(); index++)
+		{
+			string symbol;
+			uint64_t seq;
+			Data decoded;
+			if ( info.delivered.count(index) || !info.gen.getDecoded(index, symbol) || !Fec::fromSymbol(symbol, seq, *decoded.mutable_data()) )
+			{
+				continue;
+			}
+			decoded.set_gid(gid);
+			decoded.set_srcnode(dataMsg.srcnode());
+			decoded.set_sequence(seq);
+			info.delivered.insert(index);
+			rlncDecodedCount++;
+			
+			// Don't send back to the source app
+			pushCount += forwardToSubscribers(decoded, pSession);
+		}
+	}
+	return(true);
+}
+
+//************************************************************************
+// function to replace a coded DATA we are about to forward with a random
+// combination of all the coded DATA we have for its generation
+void GcnService::recodeData(Data & dataMsg)
+{
+	RlncIt flowIt = mRlncTable.find(GIDKey(dataMsg.gid(), dataMsg.srcnode()));
+	if (flowIt == mRlncTable.end())
+	{
+		return;
+	}
+	auto genIt = flowIt->second.find(dataMsg.coded().generation());
+	
+	// Nothing to mix if this is all we have
+	if ( (genIt == flowIt->second.end()) || (genIt->second.gen.rank() < 2) )
+	{
+		return;
+	}
+	
+	string coefficients;
+	string payload;
+	if (genIt->second.gen.recode(coefficients, payload))
+	{
+		dataMsg.mutable_coded()->set_coefficients(coefficients);
+		dataMsg.set_data(payload);
+		rlncRecodeCount++;
+	}
+}
+
+//************************************************************************
+// Periodic function to give source apps rate feedback.
+// We are congested if the OTA transmit queue is deep, an app has sent
+// more than we have read from its socket or the channel (everything we
+// sent and heard) is busy. When congested every source app is told to
+// halve the rate it is sending at. Once the congestion clears the rate
+// is raised a bit each check until it is well above what the app sends
+// and then the limit is lifted.
+void GcnService::OnRateControlTimeout(const error_code & ec)
+{
+	// Cancelled by Stop, or the timer went with us. Touch nothing
+	if ( (ec == operation_aborted) || mStopped )
+	{
+		return;
+	}
+	
+	double now = getTimeSec();
+	double elapsed = now - mLastRateCheck;
+	mLastRateCheck = now;
+	
+	unsigned int bytes = totalBytesSentCtl + totalBytesSentData + totalBytesRcvd;
+	double busyRatio = 0;
+	if ( (mFlowCapacity > 0) && (elapsed > 0) )
+	{
+		busyRatio = ((bytes - mLastRateBytes) * 8) / (elapsed * mFlowCapacity * 1000);
+	}
+	mLastRateBytes = bytes;
+	size_t queueDepth = mOTAScheduler.getStats(OTA_CLASS_DATA).depth;
+	
+	for (AnnounceIt iter = mAnnounceTable.begin(); iter != mAnnounceTable.end(); ++iter)
+	{
+		AnnounceInfo & info = iter->second;
+		double observed = (elapsed > 0) ? info.appDataCount / elapsed : 0;
+		info.appDataCount = 0;
+		
+		size_t backlog = info.pSession->backlog();
+		bool congested = (queueDepth > RATECONTROL_QUEUE_DEPTH) || (backlog > RATECONTROL_BACKLOG) || (busyRatio > RATECONTROL_BUSY_RATIO);
+		
+		double rate = info.rateLimit;
+		if (congested)
+		{
+			// Nothing to slow down if the app is not sending
+			if (observed == 0)
+			{
+				continue;
+			}
+			double base = ( (info.rateLimit > 0) && (info.rateLimit < observed) ) ? info.rateLimit : observed;
+			rate = base * RATECONTROL_DECREASE;
+			if (rate < RATECONTROL_MIN_RATE)
+			{
+				rate = RATECONTROL_MIN_RATE;
+			}
+		}
+		else if (info.rateLimit > 0)
+		{
+			rate = info.rateLimit * RATECONTROL_INCREASE;
+			
+			// The app is sending well below the limit so it no longer needs one
+			if (rate > 2 * observed)
+			{
+				rate = 0;
+			}
+		}
+		
+		if (rate == info.rateLimit)
+		{
+			continue;
+		}
+		
+		LOG(LOG_INFO, "Rate control for gid %d: rate %lf -> %lf (observed %lf, queue %d, backlog %d, busy %lf)", 
+			iter->first, info.rateLimit, rate, observed, (int)queueDepth, (int)backlog, busyRatio);
+		
+		RateControl rateMsg;
+		rateMsg.set_gid(iter->first);
+		rateMsg.set_rate(rate);
+		rateMsg.set_slowdown(congested);
+		forwardToApp(rateMsg, info.pSession);
+		info.rateLimit = rate;
+		
+		if (congested)
+		{
+			rateSlowdownCount++;
+		}
+		else
+		{
+			rateRestoreCount++;
+		}
+	}
+	
+	// reschedule the periodic event
+	mRateControlTimer.expires_at(mRateControlTimer.expires_at() + Milliseconds(RATECONTROL_INTERVAL));
+	mRateControlTimer.async_wait(boost::bind(&GcnService::OnRateControlTimeout, this, _1));
+}
+
+//************************************************************************
+// function to process messages received over the air
+void GcnService::OnNetworkReceive(char* buffer, int len, int device, const unsigned char* srcHwAddress)
+{
+	
+	// Suppress protobuf deserialization errors
+	google::protobuf::LogSilencer logSilencer; 
+
+#if 0
+	LOG(LOG_DEBUG, "Received message of len = %d", len);
+	for (int i = 0; i < len; i++)
+	{
+		printf("0x%x  ", (unsigned char)buffer[i]);
+	}
+	printf("\n");
+#endif
+	totalBytesRcvd += len;
+	
+	// Parse OTA message
+	MessagePool<OTAMessage>::Handle pooled(mOTAPool);
+	OTAMessage & message = *pooled;
+	if(message.ParseFromArray(buffer, len))
+	{
+		// Check log level first because printing to string is expensive
+		// and can affect throughput
+		if (mCurrentLogLevel >= LOG_DEBUG)
+		{ 
+			string sMessage;
+			mPbPrinter.PrintToString(message, &sMessage);
+			LOG(LOG_DEBUG, "Received OTA (%d bytes):\n %s", len, sMessage.c_str());
+		}
+		
+		if (message.header().src() != mNodeId)
+		{
+			// refresh the neighbor entry for the node that sent this message
+			// and what we hear from it on the device this arrived on
+			double currTime = getTimeSec();
+			NeighborIt nbrIt = mNeighborTable.find(message.header().src());
+			if (nbrIt == mNeighborTable.end())
+			{
+				nbrIt = mNeighborTable.insert(NeighborPair(message.header().src(), NeighborInfo())).first;
+			}
+			nbrIt->second.lastHeard = currTime;
+			NeighborDeviceInfo & devInfo = nbrIt->second.devices[device];
+			devInfo.lastHeard = currTime;
+			devInfo.rxCount++;
+			
+			// learn the link layer address it sends from on this device.
+			// A node id that shows up from a different address is not
+			// trusted as a unicast next hop until the change settles
+			if (srcHwAddress)
+			{
+				if ( devInfo.hwKnown && memcmp(devInfo.hwAddress, srcHwAddress, ETH_ALEN) )
+				{
+					LOG(LOG_INFO, "Neighbor %d changed link layer address on device %d", message.header().src(), device);
+					devInfo.hwChangeTime = currTime;
+				}
+				memcpy(devInfo.hwAddress, srcHwAddress, ETH_ALEN);
+				devInfo.hwKnown = true;
+			}
+			
+			// handle any Ack messages
+			for ( auto & ack : *message.mutable_ack() ) 
+			{
+				processNetworkAck(ack, message.header().src());
+			}
+			
+			// handle any Advertise messages
+			for ( auto & advertise : *message.mutable_advertise() ) 
+			{
+				processNetworkAdvertise(advertise, message.header().src());
+			}
+			
+			// handle any data pushes
+			for ( auto & data : *message.mutable_data() )// process data message
+			{
+				processNetworkData(data, message.header().src());
+			}
+			
+			// handle any Repair messages
+			for ( auto & repair : *message.mutable_repair() )
+			{
+				processNetworkRepair(repair, message.header().src());
+			}
+			
+			// handle any Nack messages
+			for ( auto & nack : *message.mutable_nack() )
+			{
+				processNetworkNack(nack, message.header().src());
+			}
+			
+			// handle any UnicastFeedback messages
+			for ( auto & feedback : *message.mutable_feedback() )
+			{
+				processNetworkFeedback(feedback, message.header().src());
+			}
+			
+			// handle any Catchup messages
+			for ( auto & catchup : *message.mutable_catchup() )
+			{
+				processNetworkCatchup(catchup, message.header().src());
+			}
+			
+			// handle any GroupSummary messages
+			for ( auto & summary : *message.mutable_summary() )
+			{
+				processNetworkSummary(summary, message.header().src());
+			}
+			
+		}
+		else
+		{
+			LOG(LOG_DEBUG, "Received OTA message with my source id (%d). Ignoring", message.header().src());
+			dropCount++;
+		}
+	}
+	else
+	{
+		//LOG(LOG_DEBUG, "Unable to deserialize message");
+	}
+
+} 
+
+//************************************************************************
+// function to pre process Data messages received from the network and the client
+// This handles the hash, distance table and local delivery
+bool GcnService::preProcessData(Data & dataMsg, HashValue & hashValue, NodeId msgOtaSrc, shared_ptr<ClientSession> pSession)
+{
+	// get hash Value. 
+	// This sets hashValue and returns true if it is NOT already in the hash, 
+	// For coded DATA the check is whether it is innovative (increases the
+	// rank of its generation) instead
+	bool newToHash;
+	if (dataMsg.has_coded())
+	{
+		newToHash = addToGeneration(dataMsg, hashValue, pSession);
+	}
+	else
+	{
+		newToHash = addToHash(dataMsg, hashValue);
+	}
+	
+	// get get fields from message
+	GroupId gid = dataMsg.gid();
+	NodeId gidsrc = dataMsg.srcnode();
+	uint32_t distance = dataMsg.distance();
+	
+	// First handle distance and packet count
+	updateDistanceTable(gid, gidsrc, hashValue, distance, msgOtaSrc, newToHash, false);
+	
+	// Next handle local delivery
+	// Check the "have we seen it" hash and only process if we have not seen this packet yet.
+	if (newToHash)
+	{
+		if (dataMsg.has_uheader())
+		{
+			recvCountDataUni++;
+			// only process if I am the destination
+			if (dataMsg.uheader().unicastdest() == mNodeId)
+			{
+				// Senders adapting their corridor number their unicast DATA
+				if (dataMsg.uheader().has_sequence())
+				{
+					updateUnicastRx(dataMsg);
+				}
+				
+				// The sender is a member this far from us
+				recordMemberDistance(GIDKey(gid, mNodeId), gidsrc, distance);
+				
+				// Check announce map - deliver to source client
+				AnnounceIt appIt = mAnnounceTable.find(gid);
+				if (appIt != mAnnounceTable.end())
+				{
+					forwardToApp(dataMsg, appIt->second.pSession);
+					LOG(LOG_DEBUG, "Source Node: Received unicast DATA message we have not already seen. Forwarding to App");
+					pushCount++;
+				}
+				// Also check local pull table - deliver to ALL subscribing clients
+				if (mLocalPullTable.count(gid))
+				{
+					// We have local subscribers!
+					pushCount += forwardToSubscribers(dataMsg);
+					LOG(LOG_DEBUG, "Group Node: Received unicast DATA message we have not already seen. Forwarding to App");
+				}
+			}
+		}
+		else
+		{
+			recvCountData++;
+			
+			// Keep the group's recent DATA for subscribers that join late
+			if (mCatchupItems)
+			{
+				addToCatchupCache(dataMsg);
+			}
+			
+			// Do we have any local subscribers?
+			// (coded DATA are delivered as they are decoded in addToGeneration)
+			if ( mLocalPullTable.count(gid) && !(dataMsg.has_coded()) )
+			{
+				// FEC DATA that arrived over the air go through the decoder first.
+				// Repair DATA and source DATA we already recovered are not delivered
+				bool deliver = true;
+				if ( dataMsg.has_fec() && !pSession )
+				{
+					deliver = fecDecode(dataMsg);
+				}
+				
+				// We have local subscribers!
+				// Only send to the subscribers that are NOT the same socket
+				// on which we received data. pSession could be NULL if this
+				// data packet arrived over the air. If it arrived from a client
+				// then pSession is not null and that subscriber is skipped
+				if (deliver)
+				{
+					pushCount += forwardToSubscribers(dataMsg, pSession);
+				}
+			}
+		}
+	}
+	return(newToHash);
+}
+
+//************************************************************************
+// function to process Data messages received from the network
+void GcnService::processNetworkData(Data & dataMsg, NodeId msgOtaSrc)
+{
+	uint32_t myDistance = 0;
+	DistanceIt distIter;
+	
+	// Go ahead and increment the distance field so that it
+	// is already set if the advertise message gets forwarded
+	// Also need to update the distance so we store the correct
+	// value in our distance table
+	// NOTE: Do this before storing local value below
+	dataMsg.set_distance(dataMsg.distance() + 1);
+	
+	// Cached DATA a neighbor sent to answer a Catchup say who asked.
+	// That is only of use here, not to the apps or our own cache
+	bool catchupAnswer = dataMsg.has_catchupfor();
+	NodeId catchupFor = dataMsg.catchupfor();
+	dataMsg.clear_catchupfor();
+	
+	// Retransmitted DATA answering a NACK are passed on toward the requester
+	// (relays that had the DATA already would drop them as duplicates).
+	// Past that they are handled like any other DATA
+	if (dataMsg.has_retx())
+	{
+		relayRetransmission(dataMsg);
+		dataMsg.clear_retx();
+	}
+	
+	// pre process the DATA message. This handles the hash, distance table and local delivery
+	HashValue hashValue;
+	bool newToHash = preProcessData(dataMsg, hashValue, msgOtaSrc);
+	
+	// New local subscribers may still need DATA we have already seen
+	if ( !(mCatchupPendingTable.empty()) || !(mCatchupTimerTable.empty()) )
+	{
+		deliverCatchup(dataMsg, hashValue, newToHash, catchupAnswer, catchupFor);
+	}
+	
+	// Innovative coded DATA are forwarded as a new combination of
+	// everything we have for the generation instead of as a copy
+	if ( newToHash && dataMsg.has_coded() )
+	{
+		recodeData(dataMsg);
+	}
+	
+	// get get fields from message
+	GroupId gid = dataMsg.gid();
+	NodeId gidsrc = dataMsg.srcnode();
+	uint32_t ttl = dataMsg.ttl();
+	
+	// Set values used for if statements. Whether or not we are a group node
+	// and whether or not this is using ADVERTISE/ACK
+	// For the purposes of forwarding a DATA message, we are a group node
+	// if we have a subscriber OR are a producer of data for the group 
+	// (i.e., we are a group "participant"). Note however that if we are the source
+	// of the DATA that it will NOT be newToHash and we will therefore ignore it
+	// ***** TO DO *****
+	// How do we know that this is a DATA for app with advertise/ack or not?
+	// we are currently using src ttl to detect this. ADVERTISE/ACK application
+	// DATA message do not have src ttl 
+	// ****************
+	bool groupNode = ( (mLocalPullTable.count(gid) > 0) || (mAnnounceTable.count(gid) > 0) );
+	bool usingAck = !(dataMsg.has_srcttl());
+	
+	// Group nodes with local subscribers watch the flow for signs that the
+	// upstream relay has been lost
+	if ( mLocalRepair && newToHash && usingAck && !(dataMsg.has_uheader()) && dataMsg.has_sequence() && (gidsrc != mNodeId) && (mLocalPullTable.count(gid) > 0) )
+	{
+		updateFlowMonitor(dataMsg);
+	}
+	
+	// (FEC repair DATA have no sequence number and are not part of the flow here)
+	if ( !(dataMsg.has_uheader()) && dataMsg.has_sequence() && (gidsrc != mNodeId) )
+	{
+		// If we were going to answer a NACK for this DATA, someone else beat us to it
+		if ( !(mRetxTimerTable.empty()) )
+		{
+			auto retxIt = mRetxTimerTable.find(DataKey(gid, gidsrc, dataMsg.sequence()));
+			if (retxIt != mRetxTimerTable.end())
+			{
+				retxIt->second->cancel();
+				mRetxTimerTable.erase(retxIt);
+				retxSuppressCount++;
+			}
+		}
+		
+		if (newToHash)
+		{
+			// Keep a copy so we can answer NACKs from our neighbors
+			if (mRetxCacheSize)
+			{
+				addToRetxCache(dataMsg);
+			}
+			
+			// Subscribers of reliable groups look for missing DATA
+			if ( mReliableGroups.count(gid) && mLocalPullTable.count(gid) )
+			{
+				updateNackState(dataMsg);
+			}
+		}
+	}
+	
+	if(mDataFile != NULL) //DATAITEM
+	{
+		mRcvDataDI++;
+		char buf[256];
+		uint64_t millis = duration_cast<milliseconds>(getTime()).count();
+		int buflen = sprintf(buf,"0,%.0f,ll.gcnRcvData,node%03d.gcnService,%.0f,\"{\"\"rcvfrom\"\":\"\"node%03d\"\",\"\"gid\"\":%d,\"\"size\"\":%d,\"\"seq\"\":%.0f,\"\"srcttl\"\":%d,\"\"orgsrc\"\":\"\"node%03d\"\",\"\"ttl\"\":%d,\"\"dist\"\":%d,\"\"newhash\"\":%d}\"\n",
+			(double)mRcvDataDI,mNodeId,(double)millis,msgOtaSrc,gid,(int)dataMsg.data().size(),(double)dataMsg.sequence(),dataMsg.srcttl(),gidsrc,ttl,dataMsg.distance()-1,newToHash);
+		fwrite(buf,sizeof(char),buflen,mDataFile);
+		fflush(mDataFile);
+	}
+	
+	// Now handle forwarding
+	if ( dataMsg.has_uheader() )
+	{
+		// This is unicast message
+		if ( (newToHash) && (dataMsg.uheader().unicastdest() != mNodeId) )
+		{
+			// I haven't seen this packet and I'm not destination
+			// Compare relay distance to distance I have for this gid source
+			uint32_t relayDistance = dataMsg.uheader().relaydistance();
+			
+			distIter = mDistanceTable.find(GIDKey(gid, dataMsg.uheader().unicastdest()));
+			if (distIter != mDistanceTable.end())
+			{
+				myDistance = distIter->second.distance;
+			}
+			if ( (myDistance) && (myDistance <= relayDistance) )
+			{
+				if ( usingAck && ((groupNode && mAlwaysRebroadcast) || (mRemotePullTable.count(gid)))) // I am a relay for the corresponding one-to-many flow
+				{
+					auto uheader = dataMsg.mutable_uheader();
+					uheader->set_relaydistance(myDistance - 1);
+					
+					LOG(LOG_DEBUG, "Received unicast DATA message with relayDistance %d. My Distance is %d to Node %d. Forwarding OTA",
+									relayDistance, myDistance, dataMsg.uheader().unicastdest());
+					setDataTimer(dataMsg, 1, hashValue);
+					fwdCountUni++;
+				}
+				else if (!usingAck) 
+				{
+					if ( (ttl) && (!groupNode || dataMsg.has_nottlregen()) )
+					{
+						// TTL is NOT 0 and we are either a non-group node OR a group node that is NOT regenerating TTL
+						// so we can forward the packet.
+						auto uheader = dataMsg.mutable_uheader();
+						uheader->set_relaydistance(myDistance - 1);
+					
+						LOG(LOG_DEBUG, "Received unicast DATA message with relayDistance %d. My Distance is %d to Node %d. Forwarding OTA",
+										relayDistance, myDistance, dataMsg.uheader().unicastdest());
+						setDataTimer(dataMsg, ttl, hashValue);
+						fwdCountUni++;
+					}
+					else if (groupNode)
+					{
+						auto uheader = dataMsg.mutable_uheader();
+						uheader->set_relaydistance(myDistance - 1);
+					
+						LOG(LOG_DEBUG, "Received unicast DATA message with relayDistance %d. My Distance is %d to Node %d. Forwarding OTA",
+										relayDistance, myDistance, dataMsg.uheader().unicastdest());
+						setDataTimer(dataMsg,  dataMsg.srcttl(), hashValue);
+						fwdCountUni++;
+					}
+					else
+					{
+						LOG(LOG_DEBUG, "Received unicast DATA message with relayDistance %d. My Distance is %d to Node %d, with %d TTL. NOT Forwarding OTA",
+								relayDistance, myDistance, dataMsg.uheader().unicastdest(),ttl);
+					}
+				} 
+				else
+				{
+					LOG(LOG_DEBUG, "Received unicast DATA message with relayDistance %d. My Distance is %d to Node %d, with %d pull table entries. NOT Forwarding OTA",
+								relayDistance, myDistance, dataMsg.uheader().unicastdest(),mRemotePullTable.count(gid));
+				}
+			}
+			else
+			{
+				LOG(LOG_DEBUG, "Received unicast DATA message with relayDistance %d. My Distance is %d to Node %d. NOT Forwarding OTA",
+								relayDistance, myDistance, dataMsg.uheader().unicastdest());
+			}
+		}
+	}
+	else if (dataMsg.srcnode() != mNodeId)
+	{
+		if (usingAck)
+		{
+			// This app is using ADVERTISE/ACK
+			if ( (newToHash) && ( (groupNode && mAlwaysRebroadcast) || (mRemotePullTable.count(gid)) ) )
+			{
+				// We have not seen this packet and we have a downstream subscriber OR
+				// we are a group node and are configured to always rebroadcast
+				// so we need to forward this OTA
+				// Use TTL of 1 so when it is sent, the actual sent TTL will be 0
+				// (NOTE: ttl gets decremented before sending)
+				setDataTimer(dataMsg, 1, hashValue);
+				fwdCount++;
+				// Mark flag for statistics
+				if (groupNode)
+					relayDataGroup=1;
+				else
+					relayDataNonGroup=1;
+			}
+		}
+		else
+		{
+			// This is NOT using ADVERTISE/ACK 
+			uint32_t srcTtl = dataMsg.srcttl();
+			if (groupNode)
+			{
+				if (newToHash)
+				{
+					// We are a group node and haven't seen this packet
+					if (!(dataMsg.has_nottlregen()))
+					{
+						// Message does not have nottlregen field so we ARE regenerating TTL
+						// For this case: Reset ttl field to src ttl field value
+						//  (NOTE: ttl gets decremented before sending)
+						setDataTimer(dataMsg, srcTtl, hashValue);
+						fwdCount++;
+						relayDataGroup=1;
+						LOG(LOG_DEBUG, "Group Node: Received DATA message we have not already seen. Forwarding OTA with regenerated TTL (ttl=%d)", srcTtl);
+					}
+					else if (ttl)
+					{
+						// Not regenerating TTL so just use the non-zero ttl value.
+						setDataTimer(dataMsg, ttl, hashValue);
+						fwdCount++;
+						relayDataGroup=1;
+						LOG(LOG_DEBUG, "Group Node: Received DATA message we have not already seen. Forwarding OTA w/o regenerating TTL (ttl=%d)", ttl);
+					}
+				}
+			}
+			else if (ttl)
+			{
+				// We are NOT a group node and TTL is not zero
+				if (newToHash)
+				{
+					// We have NOT seen this packet yet so just send back out the raw socket
+					// (NOTE: ttl gets decremented before sending)
+					setDataTimer(dataMsg, ttl, hashValue);
+					fwdCount++;
+					relayDataNonGroup=1;
+					LOG(LOG_DEBUG, "Non-Group Node: Received DATA message we have not already seen. Forwarding OTA");
+				}
+				else if ( !(dataMsg.has_coded()) )
+				{
+					// we have seen this message
+					// (coded DATA that were not innovative are never in the hash so they are just dropped)
+					uint32_t maxTTL = getMaxTTLfromHash(hashValue);
+					if (dataMsg.ttl() > maxTTL)
+					{
+						// Save off this new (higher TTL) as the max TTL
+						changeMaxTTL(hashValue, ttl);
+						
+						// Construct message to send back out the raw socket
+						// (NOTE: ttl gets decremented before sending)
+						// Make sure we reset the distance before we send this out
+						distIter = mDistanceTable.find(GIDKey(gid, gidsrc));
+						LOG_ASSERT(distIter != mDistanceTable.end(), "Received message we have already seen but had no distance entry");
+						dataMsg.set_distance(distIter->second.distance);
+						
+						// now send ota
+						setDataTimer(dataMsg, ttl, hashValue);
+						fwdCount++;
+						relayDataNonGroup=1;
+						LOG(LOG_DEBUG, "Non-Group Node: Received DATA message we have already seen. This msg has higher TTL. Forwarding OTA");
+					}
+				}
+			}
+		}
+	}
+}
+
+
+//************************************************************************
+// function to process Announce messages received from the network
+void GcnService::processNetworkAdvertise(Advertise & advertiseMsg, NodeId msgOtaSrc)
+{
+	// Go ahead and increment the distance field so that it
+	// is already set if the advertise message gets forwarded
+	// Also need to update the distance so we store the correct
+	// value in our distance table
+	// NOTE: Do this before storing local value below
+	advertiseMsg.set_distance(advertiseMsg.distance() + 1);
+	
+	// get hash Value. 
+	// This sets hashValue and returns true if it is NOT already in the hash, 
+	HashValue hashValue;
+	bool newToHash = addToHash(advertiseMsg, hashValue);
+	
+	// get get fields from message
+	GroupId gid = 	advertiseMsg.gid();
+	uint32_t srcTtl = advertiseMsg.srcttl();
+	NodeId gidsrc = advertiseMsg.srcnode();
+	uint32_t ttl = 	advertiseMsg.ttl();
+	uint32_t seq = 	advertiseMsg.sequence();
+	uint32_t distance = 	advertiseMsg.distance();
+	uint32_t probRelay = 	advertiseMsg.probrelay();
+	
+	// For the purposes of forwarding an ADVERTISE message, we are a group node
+	// if we have a subscriber OR are a producer of data for the group 
+	// (i.e., we are a group "participant"). Note however that if we are the source
+	// of the ADVERTISE that it will NOT be newToHash and we will therefore ignore it
+	bool groupNode = ( (mLocalPullTable.count(gid) > 0) || (mAnnounceTable.count(gid) > 0) );
+	
+	// Learn the priority the source wants for the group's DATA so we use it when we relay
+	if ( newToHash && advertiseMsg.has_priority() )
+	{
+		setGroupPriority(gid, advertiseMsg.priority());
+	}
+	
+	// Add advertisement to the set of adv seen below.
+	// We use AdvSeen in the decision on forwarding an ACK.
+	// It gets added ONLY for the cases which would cause
+	// us to actually forward the Advertise (non group nodes
+	// do not do that if ttl is 0 so we don't want to add this
+	// item to the map in that case)
+	// TO DO. IMPORTANT!!! For now there is NO cleanup of this
+	// set!! That means that we track every unique advertisement
+	// we have ever received (Unique means gid, gid src, seq #).
+	// Since we are not running long simulations or scenarios 
+	// for now this works BUT we need to implement a method
+	// for cleaning out old entries. (Greg and I discussed this
+	// but did not come to a final design)
+
+	// Mark flag for statistics if I am not a group node
+	if (!groupNode)
+	{
+		nonGroupRcvAdv=1;
+		if (ttl)
+			mAdvSeenSet.insert(AdvKey(gid,gidsrc,seq));
+	}
+	else
+	{
+		mAdvSeenSet.insert(AdvKey(gid,gidsrc,seq));
+	}
+	
+	// First handle distance and packet count
+	updateDistanceTable(gid, gidsrc, hashValue, distance, msgOtaSrc, newToHash, true);
+	
+	if (newToHash)
+	{
+		// we have NOT seen it so add/update entry in Reverse Path map
+		recvCountAdv++;
+		
+		// get time stamp
+		TimeDuration currDur = getTime();
+		
+		// Add this to the reverse path map
+		// We use the first ADVERTISE received for a sequence # as the reverse path
+		ReservePathIt iter = mReversePathTable.find(GIDKey(gid, gidsrc));
+		if (iter != mReversePathTable.end())
+		{
+			// already have a reverse path entry in the table for this gid + gid src
+			// update entry if the sequence number is newer than what we have already
+			if (seq > iter->second.seqNum)
+			{
+				iter->second.srcNode = msgOtaSrc;
+				iter->second.seqNum = seq;
+				iter->second.timestamp = duration_cast<seconds>(currDur).count();
+				iter->second.probRelay = probRelay;
+			}
+		}
+		else
+		{
+			// add new entry
+			RevPathInfo  mInfo;
+			mInfo.srcNode = msgOtaSrc;
+			mInfo.seqNum = seq;
+			// convert timestamp to seconds
+			mInfo.timestamp = duration_cast<seconds>(currDur).count();
+			mInfo.probRelay = probRelay;
+
+			// add to reverse path table
+			mReversePathTable.insert(ReservePathPair(GIDKey(gid, gidsrc),mInfo));
+		}
+	}
+
+	
+	// Are we a group node?
+	if (groupNode)
+	{
+		// We are a group node ... but have we seen this before?
+		if (newToHash)
+		{
+			// Handle forwarding of ADVERTISE
+			if (!(advertiseMsg.has_nottlregen()))
+			{
+				// Message does not have nottlregen field so we ARE regenerating TTL
+				// For this case: Reset ttl field to src ttl field value
+				//  (NOTE: ttl gets decremented before sending)
+				setAdvTimer(advertiseMsg, srcTtl);
+				fwdCount++;
+				LOG(LOG_DEBUG, "Group Node: Received ADVERTISE message we have not already seen. Forwarding OTA with regenerated TTL (ttl=%d)", srcTtl);
+			}
+			else if (ttl)
+			{
+				// Not regenerating TTL so just use the non-zero ttl value.
+				setAdvTimer(advertiseMsg, ttl);
+				fwdCount++;
+				LOG(LOG_DEBUG, "Group Node: Received ADVERTISE message we have not already seen. Forwarding OTA w/o regenerating TTL (ttl=%d)", ttl);
+			}
+			
+			// Send an Ack message back to the msg src (not GID source)
+			Ack ackMsg;
+			// set the group id, gid src and sequence # fields of the ack
+			ackMsg.set_gid(gid);
+			ackMsg.set_srcnode(gidsrc);
+			ackMsg.set_sequence(seq);
+			ackMsg.set_obligatoryrelay(msgOtaSrc);
+			
+			// Set timer for sending the ACK messge. 
+			setAckTimer(ackMsg);
+			
+			// If we are overriding advertisements then we use the receipt of an 
+			// advertisement for our group id as indication that we can start
+			// sending data. Normally the signal to start sending is based
+			// on receipt of an ACK to our advertise but we aren't sending them
+			// so we use this as the signal that the path is set up
+			// TO DO: use of advertise override is a temporary way of forcing
+			// nodes that are for the same group to have only one node set up
+			// the group tree and the other source re-use it.
+			AnnounceIt anncIt = mAnnounceTable.find(gid);
+			if ( (anncIt != mAnnounceTable.end())  && (anncIt->second.interval == 0 ) )
+			{
+					// Only send PULL to app if we haven't sent one already
+					if (!(anncIt->second.pullSentToApp) )
+					{
+						Pull pullMsg;
+						pullMsg.set_gid(gid);
+						forwardToApp(pullMsg, anncIt->second.pSession);
+						// Set flag that we have sent pull to app
+						anncIt->second.pullSentToApp = true;
+					}
+			}
+		}
+	}
+	else
+	{
+		// we have no local apps that want this data 
+		// Handle for Max TTL and just process for forwarding
+		// if TTL is not 0
+		if (ttl)
+		{
+			if (newToHash)
+			{
+				// We have NOT seen this packet yet so just send back out the raw socket
+				// (NOTE: ttl gets decremented before sending)
+				setAdvTimer(advertiseMsg, ttl);
+				fwdCount++;
+				LOG(LOG_DEBUG, "Non-Group Node: Received Announce message we have not already seen. Forwarding OTA");
+			}
+			else
+			{
+				// we have seen this message
+				uint32_t maxTTL = getMaxTTLfromHash(hashValue);
+				if (ttl > maxTTL)
+				{
+					// Save off this new (higher TTL) as the max TTL
+					changeMaxTTL(hashValue, ttl);
+					
+					// Construct message to send back out the raw socket
+					// (NOTE: ttl gets decremented before sending)
+					// Make sure we reset the distance before we send this out
+					DistanceIt distIter = mDistanceTable.find(GIDKey(gid, gidsrc));
+					LOG_ASSERT(distIter != mDistanceTable.end(), "Received message we have already seen but had no distance entry");
+					advertiseMsg.set_distance(distIter->second.distance);
+					
+					// NOTE: If we get here and we already have a timer for the previous lower ttl advertisement
+					// that previous timer will be canceled and previous adv will not be sent. Just this new one will be sent!
+					setAdvTimer(advertiseMsg, ttl);
+					fwdCount++;
+					LOG(LOG_DEBUG, "Non-Group Node: Received Announce message we have already seen. This msg has higher TTL. Forwarding OTA");
+				}
+				else
+				{
+					dropCount++;
+					LOG(LOG_DEBUG, "Non-Group Node: Received Announce message we have already seen with higher TTL. Ignoring");
+				}
+			}
+		}
+		else
+		{
+			dropCount++;
+			LOG(LOG_DEBUG, "Non-Group Node: Received Announce message with TTL 0. Ignoring");
+		}
+	}
+	if(mDataFile != NULL) //DATAITEM
+	{
+		mRcvAdvDI++;
+		char buf[256];
+		uint64_t millis = duration_cast<milliseconds>(getTime()).count();
+		int buflen = sprintf(buf,"0,%.0f,ll.gcnRcvAdv,node%03d.gcnService,%.0f,\"{\"\"rcvfrom\"\":\"\"node%03d\"\",\"\"gid\"\":%d,\"\"seq\"\":%.0f,\"\"orgsrc\"\":\"\"node%03d\"\",\"\"srcttl\"\":%d,\"\"ttl\"\":%d,\"\"dist\"\":%d,\"\"newhash\"\":%d,\"\"grpnode\"\":%d}\"\n",
+			(double)mRcvAdvDI,mNodeId,(double)millis,msgOtaSrc,gid,(double)seq,gidsrc,srcTtl,ttl,distance,newToHash,groupNode);
+		fwrite(buf,sizeof(char),buflen,mDataFile);
+		fflush(mDataFile);
+	}
+}
+
+
+
+//************************************************************************
+// function to process Pull messages received from the network
+void GcnService::processNetworkAck(Ack& ackMsg, NodeId msgOtaSrc)
+{
+	AnnounceIt anncIt;
+	ReservePathIt revIt;
+	
+	recvCountAck++;
+	
+	// difference between msgOtaSrc and gidSrc is that msgOtaSrc is the node from
+	// which this Ack was received and gidSrc is the source node of the
+	// GID content
+	
+	// get fields from message
+	GroupId gid = ackMsg.gid();
+	uint32_t seq = ackMsg.sequence();
+	NodeId gidsrc = ackMsg.srcnode();
+	NodeId obligRelay = ackMsg.obligatoryrelay();
+	uint32_t probRelay = ackMsg.probabilityofrelay();
+	
+	// Only ACKs sent to us say how far the group reaches through msgOtaSrc.
+	// An ACK we overhear went to some other relay and would make the
+	// extent we report upstream cover members that are not behind us
+	if ( ackMsg.has_memberdistance() && ((obligRelay == mNodeId) || (gidsrc == mNodeId)) )
+	{
+		recordMemberDistance(GIDKey(gid, gidsrc), msgOtaSrc, ackMsg.memberdistance());
+	}
+	
+	// For the purposes of forwarding an ADVERTISE message, we are a group node
+	// if we have a subscriber OR are a producer of data for the group 
+	// (i.e., we are a group "participant"). Note however that if we are the source
+	// that it will NOT be newToHash and we will therefore ignore it
+	bool groupNode = ( (mLocalPullTable.count(gid) > 0) || (mAnnounceTable.count(gid) > 0) );
+	
+	// Mark flag for statistics if I am not a group node
+	if (!groupNode)
+		nonGroupRcvAck = 1;
+	
+	// init a flag as to whether or not we put an entry in the Remote Pull Table.
+	// We only do this if we actually send an ACK. It gets complicated below so
+	// it is easier to just use a flag and add the entry at the end if needed.
+	bool addRemotePull = false;
+	
+	// Set flag as to whether or not we have seen an advertisement
+	// for this ack. We need to know if we have an Advertisement if
+	// we are not obligatory relay so just figure that out here 
+	// and set flag
+	bool seenAdv = false;
+	auto advIt = mAdvSeenSet.find(AdvKey(gid,gidsrc,seq));
+	if (advIt != mAdvSeenSet.end())
+	{
+		seenAdv = true;
+	}
+	
+	// Set flag as to whether or not we have already flipped a coin for this ACK.
+	// This is based on sequence number, i.e., we can flip a coin
+	// for each sequence number
+	bool coinFlipped = true;
+	auto coinIt = mCoinFlipTable.find(GIDKey(gid, gidsrc));
+	if ( (coinIt == mCoinFlipTable.end()) || (seq > coinIt->second) )
+	{
+		// either we have no entry for this gid,gidsrc and have never flipped
+		// a coin for the gid,gidsrc OR we have an entry but this is a
+		// new sequence number. For either case we act as though we have never
+		// flipped the coin
+		coinFlipped = false;
+	}
+	
+	// Set flag as to whether or not we have already forwarded an ACK.
+	// This is based on sequence number, i.e., we can send an ACK
+	// for each sequence number
+	bool ackSent = true;
+	auto ackSentIt = mAckSentTable.find(GIDKey(gid, gidsrc));
+	if ( (ackSentIt == mAckSentTable.end()) || (seq > ackSentIt->second) )
+	{
+		// either we have no entry for this gid,gidsrc and have never sent
+		// an ack for the gid,gidsrc OR we have an entry but this is a
+		// new sequence number. For either case we are eligible to send an ACK
+		ackSent = false;
+	}
+	
+	// Handle ACK processing
+	// 1. First see if we are the GID source. 
+	// If so then find the app that announced this content and send the pull
+	// so it knows there is a subscriber and can now send the content.
+	// We can't just look to see if we have this GID in our Announce Table
+	// because there can be multiple sources for a GID. That means we could
+	// have an entry in the Announce Table for this GID but we are not the source
+	// node that this ack is intended for. So first, check the GID source in the ack.
+	// If we match then we are source
+	if (gidsrc == mNodeId)
+	{
+		anncIt = mAnnounceTable.find(gid);
+		if (anncIt != mAnnounceTable.end())
+		{
+			// Set flag so we add a remote pull entry
+			addRemotePull = true;
+			
+			// Only send PULL to app if we haven't sent one already
+			if (!(anncIt->second.pullSentToApp) )
+			{
+				Pull pullMsg;
+				pullMsg.set_gid(gid);
+				forwardToApp(pullMsg, anncIt->second.pSession);
+				// Set flag that we have sent pull to app
+				anncIt->second.pullSentToApp = true;
+			}
+		}
+	}
+	// 2. See if we are the obligatory relay and forward ACK if we are
+	else if (obligRelay == mNodeId)
+	{
+		// Get reverse path
+		// Because we are obligatory relay we expect to have an entry!
+		revIt = mReversePathTable.find(GIDKey(gid, gidsrc));
+		LOG_ASSERT(revIt != mReversePathTable.end(), "Obligatory relay node received ACK but had no reverse path for GID %d GID src\n", gid, gidsrc);
+		
+		// We are a relay node since we were selected as obligatory relay. That means we have to send an ACK
+		// to tell the source node that there is a subscriber upstream from us. HOWEVER, if we are a group
+		// node then we already sent an ACK when we received the advertise message. We don't need to
+		// send another one. It is also possible that we already sent an ack for this seq # as a non-group node
+		// which can happen if we received an ack and were oblig relay or won the coin toss
+		if ( (!groupNode) && (!ackSent) )
+		{
+			LOG(LOG_DEBUG, "Received ACK. We are obligatory relay for gid %d gid src %d seq %d. Forwarding ACK.", gid, gidsrc, seq);
+			// Forward ACK to our next hop on reverse path
+			ackMsg.set_obligatoryrelay(revIt->second.srcNode);
+			// Set timer for sending the ACK messge. 
+			setAckTimer(ackMsg);
+			
+			// We have just sent ack for this gid, gidsrc, seq # so we must add an entry to the map
+			if (ackSentIt == mAckSentTable.end())
+			{
+				mAckSentTable.insert(SequencePair(GIDKey(gid, gidsrc), seq));
+			}
+			else if (seq > ackSentIt->second)
+			{
+				ackSentIt->second = seq;
+			}
+		}
+		else if (groupNode)
+			LOG(LOG_DEBUG, "Received ACK. We are obligatory relay for gid %d gid src %d seq %d. Group node so NOT Forwarding ACK.", gid, gidsrc, seq);
+		else
+			LOG(LOG_DEBUG, "Received ACK. We are obligatory relay for gid %d gid src %d seq %d. Already sent ack. NOT Forwarding ACK.", gid, gidsrc, seq);
+		
+		// Set flag so we add a remote pull entry -- this is how we say "I am a relay node"
+		addRemotePull = true;
+	}
+	// 3. See if we should still forward this ACK based on coinflip
+	// We have to have actually seen an advertisement for this seq #,
+	// not have already done the coin flip in order to flip the coin
+	else if ( (seenAdv) && (!coinFlipped) && (probRelay) && coinFlip(probRelay))
+	{
+		// Yeah! We won the coin flip! We get to be a relay.
+		// first get entry in reverse path so we know who to send back to.
+		// If we don't have an entry, that is a problem! seenAdv is true so
+		// we had to have seen an Adv 
+		revIt = mReversePathTable.find(GIDKey(gid, gidsrc));
+		LOG_ASSERT(revIt != mReversePathTable.end(), "We are not obligatory relay node received ACK but had no reverse path for GID %d GID src\n", gid, gidsrc);
+		
+		// We are a relay node since we won the coin toss. just like above,
+		// no need to send ack if we are a group node
+		if (!groupNode && !ackSent)
+		{
+			LOG(LOG_DEBUG, "Received ACK. We are not obligatory relay. Won coin toss for gid %d gid src %d seq %d. Forwarding ACK.", gid, gidsrc, seq);
+			// Forward ACK to our next hop on reverse path
+			ackMsg.set_obligatoryrelay(revIt->second.srcNode);
+			// Set timer for sending the ACK messge. 
+			setAckTimer(ackMsg);
+			
+			// We have just sent ack for this gid, gidsrc, seq # so we must add an entry to the map
+			if (ackSentIt == mAckSentTable.end())
+			{
+				mAckSentTable.insert(SequencePair(GIDKey(gid, gidsrc), seq));
+			}
+			else if (seq > ackSentIt->second)
+			{
+				ackSentIt->second = seq;
+			}
+		}
+		else if (groupNode)
+			LOG(LOG_DEBUG, "Received ACK. We are not obligatory relay. Won coin toss for gid %d gid src %d seq %d but we are Group node. NOT Forwarding ACK.", gid, gidsrc, seq);
+		else
+			LOG(LOG_DEBUG, "Received ACK. We are not obligatory relay but already sent ack for gid %d gid src %d seq %d. NOT Forwarding ACK.", gid, gidsrc, seq);
+
+		// Set flag so we add a remote pull entry -- this is how we say "I am a relay node"
+		addRemotePull = true;
+		
+		// We have just done a coin flip for this gid, gidsrc, seq # so we must add an entry to the map
+		if (coinIt == mCoinFlipTable.end())
+		{
+			mCoinFlipTable.insert(SequencePair(GIDKey(gid, gidsrc), seq));
+		}
+		else if (seq > coinIt->second)
+		{
+			coinIt->second = seq;
+		}
+	}
+	else
+	{
+		if (!seenAdv)
+			LOG(LOG_DEBUG, "Received ACK. We are not obligatory relay but have not seen advertise for gid %d gid src %d seq %d. NOT Forwarding ACK.", gid, gidsrc, seq);
+		else if (coinFlipped)
+			LOG(LOG_DEBUG, "Received ACK. We are not obligatory relay but already did coin toss for gid %d gid src %d seq %d. NOT Forwarding ACK.", probRelay, gid, gidsrc, seq);
+		else
+		{
+			LOG(LOG_DEBUG, "Received ACK. We are not obligatory relay and lost coin toss with prob of %d for gid %d gid src %d seq %d. NOT Forwarding ACK.", probRelay, gid, gidsrc, seq);
+			
+			// We have just done a coin flip for this gid, gidsrc, seq # so we must add an entry to the map
+			if (coinIt == mCoinFlipTable.end())
+			{
+				mCoinFlipTable.insert(SequencePair(GIDKey(gid, gidsrc), seq));
+			}
+			else if (seq > coinIt->second)
+			{
+				coinIt->second = seq;
+			}
+		}
+	}
+
+	
+	// Finally, add entry to remote pull table if flag was set
+	if (addRemotePull)
+	{
+		addToRemotePull(gid, msgOtaSrc);
+	}
+	
+	if(mDataFile != NULL) //DATAITEM
+	{
+		mRcvAckDI++;
+		char buf[256];
+		uint64_t millis = duration_cast<milliseconds>(getTime()).count();
+		int buflen = sprintf(buf,"0,%.0f,ll.gcnRcvAck,node%03d.gcnService,%.0f,\"{\"\"rcvfrom\"\":\"\"node%03d\"\",\"\"gid\"\":%d,\"\"seq\"\":%.0f,\"\"orgsrc\"\":\"\"node%03d\"\",\"\"grpnode\"\":%d,\"\"obligrelay\"\":%d,\"\"probrelay\"\":%d,\"\"addremotepull\"\":%d,\"\"seenadv\"\":%d,\"\"coinflipped\"\":%d,\"\"acksent\"\":%d}\"\n",
+			(double)mRcvAckDI,mNodeId,(double)millis,msgOtaSrc,gid,(double)seq,gidsrc,groupNode,obligRelay,probRelay,addRemotePull,seenAdv,coinFlipped,ackSent);
+		fwrite(buf,sizeof(char),buflen,mDataFile);
+		fflush(mDataFile);
+	}
+}
+
+//************************************************************************
+// function to add (or refresh) an entry in the remote pull table.
+// An entry in the remote pull table is how we say "I am a relay node"
+void GcnService::addToRemotePull(GroupId gid, NodeId nodeId)
+{
+	RemotePullIt pullIt;
+	
+	TimeDuration currDur = getTime();
+	int currTime = duration_cast<seconds>(currDur).count();
+	
+	// Add this entry to our Remote pull map if not already in the map
+	// get all the entries that have this gid and see if we find the node id
+	RemotePullRangeIt rangeIt = mRemotePullTable.equal_range(gid);
+	for (pullIt = rangeIt.first; pullIt != rangeIt.second; ++pullIt)
+	{
+		// Did the mapped value match the src?
+		if (pullIt->second.nodeId == nodeId)
+		{
+			// reset time stamp
+			pullIt->second.timestamp = currTime;
+			LOG(LOG_DEBUG, "Found gid %d msgOtaSrc %d in remote Pull table", gid, nodeId);
+			break;
+		}
+	}
+	// Did we find an entry?
+	if (pullIt == rangeIt.second)
+	{
+		// did not find an entry so add it
+		RemotePullInfo info;
+		info.nodeId = nodeId;
+		// set the timestamp 
+		info.timestamp = currTime;
+		
+		mRemotePullTable.insert(RemotePullPair(gid, info));
+		LOG(LOG_DEBUG, "Added gid %d msgOtaSrc %d to remote Pull table", gid, nodeId);
+	}
+}
+
+//************************************************************************
+// function to process Repair messages received from the network
+void GcnService::processNetworkRepair(Repair & repairMsg, NodeId msgOtaSrc)
+{
+	repairRcvCount++;
+	
+	// get hash Value. 
+	// This sets hashValue and returns true if it is NOT already in the hash, 
+	HashValue hashValue;
+	bool newToHash = addToHash(repairMsg, hashValue);
+	
+	// get fields from message
+	GroupId gid = repairMsg.gid();
+	NodeId gidsrc = repairMsg.srcnode();
+	uint32_t ttl = repairMsg.ttl();
+	bool groupNode = ( (mLocalPullTable.count(gid) > 0) || (mAnnounceTable.count(gid) > 0) );
+	bool becomeRelay = false;
+	bool downstream = false;
+	
+	if (!newToHash)
+	{
+		dropCount++;
+		LOG(LOG_DEBUG, "Received REPAIR for gid %d gid src %d from requester %d we have already seen. Ignoring", gid, gidsrc, repairMsg.requester());
+	}
+	else if (gidsrc == mNodeId)
+	{
+		// We are the GID source and the requester is one of our neighbors.
+		// Just make sure we keep sending the data over the air
+		if (mAnnounceTable.count(gid))
+		{
+			becomeRelay = true;
+		}
+	}
+	else
+	{
+		// We can only help if we have a reverse path toward the GID source and our
+		// own next hop on that path is still around. Otherwise we could be asked to
+		// repair a tree through the very relay that was lost.
+		ReservePathIt revIt = mReversePathTable.find(GIDKey(gid, gidsrc));
+		
+		// If our next hop is the requester (or the node passing the request on)
+		// we are downstream of the break. Pulling from it would make a loop
+		downstream = ( (revIt != mReversePathTable.end()) && 
+		               ( (revIt->second.srcNode == msgOtaSrc) || (revIt->second.srcNode == repairMsg.requester()) ) );
+		if (downstream)
+		{
+			dropCount++;
+			LOG(LOG_DEBUG, "Received REPAIR for gid %d gid src %d from requester %d which is our upstream. Ignoring", gid, gidsrc, repairMsg.requester());
+		}
+		else if ( (revIt != mReversePathTable.end()) && isNeighborAlive(revIt->second.srcNode, mNeighborExpireTime) )
+		{
+			becomeRelay = true;
+			
+			// Group nodes already sent an ACK when they received the ADVERTISE so
+			// the path upstream of them is set up. Otherwise send an ACK to our next
+			// hop on the reverse path so that it relays for us too (unless we already
+			// sent an ACK for this sequence number)
+			auto ackSentIt = mAckSentTable.find(GIDKey(gid, gidsrc));
+			if ( !groupNode && ( (ackSentIt == mAckSentTable.end()) || (revIt->second.seqNum > ackSentIt->second) ) )
 			{
-				// We are NOT a group node and TTL is not zero
-				if (newToHash)
+				Ack ackMsg;
+				ackMsg.set_gid(gid);
+				ackMsg.set_srcnode(gidsrc);
+				ackMsg.set_sequence(revIt->second.seqNum);
+				ackMsg.set_obligatoryrelay(revIt->second.srcNode);
+				setAckTimer(ackMsg);
+				
+				if (ackSentIt == mAckSentTable.end())
 				{
-					// We have NOT seen this packet yet so just send back out the raw socket
-					// (NOTE: ttl gets decremented before sending)
-					setDataTimer(dataMsg, ttl, hashValue);
-					fwdCount++;
-					relayDataNonGroup=1;
-					LOG(LOG_DEBUG, "Non-Group Node: Received DATA message we have not already seen. Forwarding OTA");
+					mAckSentTable.insert(SequencePair(GIDKey(gid, gidsrc), revIt->second.seqNum));
 				}
 				else
 				{
-					// we have seen this message
-					uint32_t maxTTL = getMaxTTLfromHash(hashValue);
-					if (dataMsg.ttl() > maxTTL)
-					{
-						// Save off this new (higher TTL) as the max TTL
-						changeMaxTTL(hashValue, ttl);
-						
-						// Construct message to send back out the raw socket
-						// (NOTE: ttl gets decremented before sending)
-						// Make sure we reset the distance before we send this out
-						distIter = mDistanceTable.find(GIDKey(gid, gidsrc));
-						LOG_ASSERT(distIter != mDistanceTable.end(), "Received message we have already seen but had no distance entry");
-						dataMsg.set_distance(distIter->second.distance);
-						
-						// now send ota
-						setDataTimer(dataMsg, ttl, hashValue);
-						fwdCount++;
-						relayDataNonGroup=1;
-						LOG(LOG_DEBUG, "Non-Group Node: Received DATA message we have already seen. This msg has higher TTL. Forwarding OTA");
-					}
+					ackSentIt->second = revIt->second.seqNum;
 				}
 			}
 		}
 	}
+	
+	if (becomeRelay)
+	{
+		// Add the node we heard the REPAIR from to the remote pull table so that
+		// we start relaying DATA for this group right away
+		addToRemotePull(gid, msgOtaSrc);
+		repairRelayCount++;
+		LOG(LOG_INFO, "Received REPAIR for gid %d gid src %d from requester %d. Now a relay for node %d", gid, gidsrc, repairMsg.requester(), msgOtaSrc);
+	}
+	else if (newToHash && ttl && !downstream)
+	{
+		// We can't repair the tree ourselves so pass the request on.
+		// We also relay DATA for the node we heard the request from so that
+		// the repair has a path back to the requester if one of our neighbors
+		// picks it up.
+		// (NOTE: ttl gets decremented before sending)
+		addToRemotePull(gid, msgOtaSrc);
+		forwardToOTA(repairMsg, ttl);
+		fwdCount++;
+		LOG(LOG_DEBUG, "Received REPAIR for gid %d gid src %d from requester %d with no reverse path. Forwarding OTA", gid, gidsrc, repairMsg.requester());
+	}
+	
+	if(mDataFile != NULL) //DATAITEM
+	{
+		mRcvRepairDI++;
+		char buf[256];
+		uint64_t millis = duration_cast<milliseconds>(getTime()).count();
+		int buflen = sprintf(buf,"0,%.0f,ll.gcnRcvRepair,node%03d.gcnService,%.0f,\"{\"\"rcvfrom\"\":\"\"node%03d\"\",\"\"gid\"\":%d,\"\"orgsrc\"\":\"\"node%03d\"\",\"\"requester\"\":\"\"node%03d\"\",\"\"ttl\"\":%d,\"\"newhash\"\":%d,\"\"relay\"\":%d}\"\n",
+			(double)mRcvRepairDI,mNodeId,(double)millis,msgOtaSrc,gid,gidsrc,repairMsg.requester(),ttl,newToHash,becomeRelay);
+		fwrite(buf,sizeof(char),buflen,mDataFile);
+		fflush(mDataFile);
+	}
 }
 
-
 //************************************************************************
-// function to process Announce messages received from the network
-void GcnService::processNetworkAdvertise(Advertise & advertiseMsg, NodeId msgOtaSrc)
+// function to process Nack messages received from the network
+void GcnService::processNetworkNack(Nack & nackMsg, NodeId msgOtaSrc)
 {
-	// Go ahead and increment the distance field so that it
-	// is already set if the advertise message gets forwarded
-	// Also need to update the distance so we store the correct
-	// value in our distance table
-	// NOTE: Do this before storing local value below
-	advertiseMsg.set_distance(advertiseMsg.distance() + 1);
+	nackRcvCount++;
 	
 	// get hash Value. 
 	// This sets hashValue and returns true if it is NOT already in the hash, 
 	HashValue hashValue;
-	bool newToHash = addToHash(advertiseMsg, hashValue);
+	if (!addToHash(nackMsg, hashValue))
+	{
+		dropCount++;
+		LOG(LOG_DEBUG, "Received NACK for gid %d gid src %d from requester %d we have already seen. Ignoring", nackMsg.gid(), nackMsg.srcnode(), nackMsg.requester());
+		return;
+	}
 	
-	// get get fields from message
-	GroupId gid = 	advertiseMsg.gid();
-	uint32_t srcTtl = advertiseMsg.srcttl();
-	NodeId gidsrc = advertiseMsg.srcnode();
-	uint32_t ttl = 	advertiseMsg.ttl();
-	uint32_t seq = 	advertiseMsg.sequence();
-	uint32_t distance = 	advertiseMsg.distance();
-	uint32_t probRelay = 	advertiseMsg.probrelay();
+	// get fields from message
+	GIDKey key(nackMsg.gid(), nackMsg.srcnode());
+	uint32_t ttl = nackMsg.ttl();
+	set<uint64_t> requested(nackMsg.missing().begin(), nackMsg.missing().end());
 	
-	// For the purposes of forwarding an ADVERTISE message, we are a group node
-	// if we have a subscriber OR are a producer of data for the group 
-	// (i.e., we are a group "participant"). Note however that if we are the source
-	// of the ADVERTISE that it will NOT be newToHash and we will therefore ignore it
-	bool groupNode = ( (mLocalPullTable.count(gid) > 0) || (mAnnounceTable.count(gid) > 0) );
+	// If we are waiting to send a NACK for the same DATA, the neighbor already
+	// asked for us. Hold ours back and let the retransmission get here first
+	NackIt nackIt = mNackTable.find(key);
+	if ( (nackIt != mNackTable.end()) && nackIt->second.timerSet && !(nackIt->second.missing.empty()) )
+	{
+		bool covered = true;
+		for (auto & missing : nackIt->second.missing)
+		{
+			if (requested.count(missing.first) == 0)
+			{
+				covered = false;
+				break;
+			}
+		}
+		if (covered)
+		{
+			setNackTimer(nackIt, NACK_HOLDDOWN + (rand() % NACK_MAX_DELAY));
+			nackSuppressCount++;
+		}
+	}
 	
-	// Add advertisement to the set of adv seen below.
-	// We use AdvSeen in the decision on forwarding an ACK.
-	// It gets added ONLY for the cases which would cause
-	// us to actually forward the Advertise (non group nodes
-	// do not do that if ttl is 0 so we don't want to add this
-	// item to the map in that case)
-	// TO DO. IMPORTANT!!! For now there is NO cleanup of this
-	// set!! That means that we track every unique advertisement
-	// we have ever received (Unique means gid, gid src, seq #).
-	// Since we are not running long simulations or scenarios 
-	// for now this works BUT we need to implement a method
-	// for cleaning out old entries. (Greg and I discussed this
-	// but did not come to a final design)
+	// Answer from our cache. The retransmission needs to travel
+	// as far as the NACK did to get back to the requester
+	uint32_t found = 0;
+	uint32_t retxTtl = (nackMsg.srcttl() > ttl) ? (nackMsg.srcttl() - ttl) : 1;
+	RetxCacheIt cacheIt = mRetxCacheTable.find(key);
+	if ( mRetxCacheSize && (cacheIt != mRetxCacheTable.end()) )
+	{
+		for (auto seq : requested)
+		{
+			RetxEntry & entry = cacheIt->second[seq % mRetxCacheSize];
+			if ( entry.valid && (entry.seq == seq) )
+			{
+				setRetxTimer(DataKey(key.gid, key.gidSrc, seq), retxTtl, nackMsg);
+				found++;
+			}
+		}
+	}
+	
+	if (found)
+	{
+		LOG(LOG_DEBUG, "Received NACK for gid %d gid src %d from requester %d. Have %d of %d DATA in cache", key.gid, key.gidSrc, nackMsg.requester(), found, (int)requested.size());
+	}
+	else if (ttl)
+	{
+		// We can't help so pass the request on
+		// (NOTE: ttl gets decremented before sending)
+		forwardToOTA(nackMsg, ttl);
+		fwdCount++;
+		LOG(LOG_DEBUG, "Received NACK for gid %d gid src %d from requester %d with nothing in cache. Forwarding OTA", key.gid, key.gidSrc, nackMsg.requester());
+	}
+	
+	if(mDataFile != NULL) //DATAITEM
+	{
+		mRcvNackDI++;
+		char buf[256];
+		uint64_t millis = duration_cast<milliseconds>(getTime()).count();
+		int buflen = sprintf(buf,"0,%.0f,ll.gcnRcvNack,node%03d.gcnService,%.0f,\"{\"\"rcvfrom\"\":\"\"node%03d\"\",\"\"gid\"\":%d,\"\"orgsrc\"\":\"\"node%03d\"\",\"\"requester\"\":\"\"node%03d\"\",\"\"missing\"\":%d,\"\"found\"\":%d,\"\"ttl\"\":%d}\"\n",
+			(double)mRcvNackDI,mNodeId,(double)millis,msgOtaSrc,key.gid,key.gidSrc,nackMsg.requester(),(int)requested.size(),found,ttl);
+		fwrite(buf,sizeof(char),buflen,mDataFile);
+		fflush(mDataFile);
+	}
+}
 
-	// Mark flag for statistics if I am not a group node
-	if (!groupNode)
+//************************************************************************
+// function to process UnicastFeedback messages received from the network.
+// The node that sent the unicast DATA adapts its corridor. Other nodes
+// pass the feedback on if they are closer to that node than the ttl left.
+void GcnService::processNetworkFeedback(UnicastFeedback & feedbackMsg, NodeId msgOtaSrc)
+{
+	HashValue hashValue;
+	if (!addToHash(feedbackMsg, hashValue))
+	{
+		dropCount++;
+		return;
+	}
+	
+	GroupId gid = feedbackMsg.gid();
+	if (feedbackMsg.requester() != mNodeId)
+	{
+		uint32_t ttl = feedbackMsg.ttl();
+		DistanceIt distIt = mDistanceTable.find(GIDKey(gid, feedbackMsg.requester()));
+		if ( ttl && (distIt != mDistanceTable.end()) && (distIt->second.distance <= ttl) )
+		{
+			// (NOTE: ttl gets decremented before sending)
+			forwardToOTA(feedbackMsg, ttl);
+			fwdCount++;
+		}
+		return;
+	}
+	
+	feedbackRcvCount++;
+	CorridorIt iter = mCorridorTable.find(GIDKey(gid, feedbackMsg.srcnode()));
+	if ( (iter == mCorridorTable.end()) || (feedbackMsg.sequence() <= iter->second.ackedSeq) )
+	{
+		return;
+	}
+	
+	// How many of the unicast DATA sent since the last feedback got through
+	CorridorInfo & info = iter->second;
+	uint32_t sent = feedbackMsg.sequence() - info.ackedSeq;
+	uint32_t rcvd = (feedbackMsg.count() >= info.ackedCount) ? (feedbackMsg.count() - info.ackedCount) : feedbackMsg.count();
+	double ratio = std::min(1.0, (double)rcvd / sent);
+	
+	if ( (ratio < CORRIDOR_WIDEN_RATIO) && (info.width < CORRIDOR_MAX_WIDTH) )
+	{
+		info.width++;
+		corridorWidenCount++;
+		LOG(LOG_DEBUG, "Widened unicast corridor for GID %d to Node %d to %d (%.2f delivered)", gid, feedbackMsg.srcnode(), info.width, ratio);
+	}
+	else if ( (ratio >= CORRIDOR_NARROW_RATIO) && (info.width > CORRIDOR_MIN_WIDTH) )
+	{
+		info.width--;
+		corridorNarrowCount++;
+		LOG(LOG_DEBUG, "Narrowed unicast corridor for GID %d to Node %d to %d (%.2f delivered)", gid, feedbackMsg.srcnode(), info.width, ratio);
+	}
+	info.ackedSeq = feedbackMsg.sequence();
+	info.ackedCount = feedbackMsg.count();
+	info.lastFeedback = getTimeSec();
+}
+
+//************************************************************************
+// function to number a unicast DATA we are sending and get the width of
+// the corridor to its destination. A new corridor starts from the
+// resilience the app asked for. If the destination has gone quiet the
+// corridor is widened since the feedback is being lost too.
+int GcnService::getCorridorWidth(Data & dataMsg, GCNMessage::UnicastResilience resil)
+{
+	GIDKey key(dataMsg.gid(), dataMsg.uheader().unicastdest());
+	double currTime = getTimeSec();
+	
+	CorridorIt iter = mCorridorTable.find(key);
+	if (iter == mCorridorTable.end())
+	{
+		CorridorInfo info;
+		info.width = std::min(CORRIDOR_MIN_WIDTH + (int)resil, CORRIDOR_MAX_WIDTH);
+		info.sentSeq = 0;
+		info.ackedSeq = 0;
+		info.ackedCount = 0;
+		info.lastFeedback = currTime;
+		info.lastSent = currTime;
+		iter = mCorridorTable.insert(CorridorPair(key, info)).first;
+	}
+	
+	CorridorInfo & info = iter->second;
+	if ( (info.sentSeq > info.ackedSeq) && ((currTime - info.lastFeedback) * 1000 > CORRIDOR_FEEDBACK_TIMEOUT * UNICAST_FEEDBACK_INTERVAL) )
+	{
+		if (info.width < CORRIDOR_MAX_WIDTH)
+		{
+			info.width++;
+			corridorWidenCount++;
+			LOG(LOG_DEBUG, "No feedback from Node %d for GID %d. Widened unicast corridor to %d", key.gidSrc, key.gid, info.width);
+		}
+		info.lastFeedback = currTime;
+	}
+	
+	info.sentSeq++;
+	info.lastSent = currTime;
+	dataMsg.mutable_uheader()->set_sequence(info.sentSeq);
+	return(info.width);
+}
+
+//************************************************************************
+// function to count a numbered unicast DATA we are the destination for
+void GcnService::updateUnicastRx(Data & dataMsg)
+{
+	GIDKey key(dataMsg.gid(), dataMsg.srcnode());
+	UnicastRxInfo & info = mUnicastRxTable[key];
+	if (dataMsg.uheader().sequence() > info.highestSeq)
+	{
+		info.highestSeq = dataMsg.uheader().sequence();
+	}
+	info.count++;
+	info.changed = true;
+	info.lastRcvd = getTimeSec();
+}
+
+//************************************************************************
+// Periodic function to send UnicastFeedback to each node we received
+// numbered unicast DATA from since the last time
+void GcnService::OnFeedbackTimeout(const error_code & ec)
+{
+	// Cancelled by Stop, or the timer went with us. Touch nothing
+	if ( (ec == operation_aborted) || mStopped )
+	{
+		return;
+	}
+	
+	double currTime = getTimeSec();
+	for (UnicastRxIt iter = mUnicastRxTable.begin(); iter != mUnicastRxTable.end(); )
+	{
+		// Forget senders we have not heard from in a while
+		if ( (currTime - iter->second.lastRcvd) > mReversePathExpireTime )
+		{
+			iter = mUnicastRxTable.erase(iter);
+			continue;
+		}
+		
+		if (iter->second.changed)
+		{
+			UnicastFeedback feedbackMsg;
+			feedbackMsg.set_gid(iter->first.gid);
+			feedbackMsg.set_srcnode(mNodeId);
+			feedbackMsg.set_requester(iter->first.gidSrc);
+			feedbackMsg.set_sequence(iter->second.highestSeq);
+			feedbackMsg.set_count(iter->second.count);
+			
+			// The feedback goes as far as the unicast DATA came, plus one hop of slack
+			uint32_t ttl = mRepairTtl + 1;
+			DistanceIt distIt = mDistanceTable.find(iter->first);
+			if (distIt != mDistanceTable.end())
+			{
+				ttl = distIt->second.distance + 2;
+			}
+			feedbackMsg.set_ttl(ttl);
+			
+			HashValue hashValue;
+			addToHash(feedbackMsg, hashValue);
+			forwardToOTA(feedbackMsg, ttl);
+			feedbackSentCount++;
+			iter->second.changed = false;
+		}
+		++iter;
+	}
+	
+	// Forget corridors to destinations we have stopped sending to
+	for (CorridorIt iter = mCorridorTable.begin(); iter != mCorridorTable.end(); )
+	{
+		if ( (currTime - iter->second.lastSent) > mReversePathExpireTime )
+		{
+			iter = mCorridorTable.erase(iter);
+			continue;
+		}
+		++iter;
+	}
+	
+	mFeedbackTimer.expires_at(mFeedbackTimer.expires_at() + Milliseconds(UNICAST_FEEDBACK_INTERVAL));
+	mFeedbackTimer.async_wait(boost::bind(&GcnService::OnFeedbackTimeout, this, _1));
+}
+
+//************************************************************************
+// function to remember how far from the source the group reaches
+// through a node
+void GcnService::recordMemberDistance(const GIDKey & key, NodeId reporter, uint32_t distance)
+{
+	MemberDistInfo & info = mMemberExtentTable[key][reporter];
+	info.distance = distance;
+	info.lastHeard = getTimeSec();
+}
+
+//************************************************************************
+// function to get the distance from the source of the farthest group
+// member we know of for a flow. Nodes that have not reported for as
+// long as a remote pull lives are forgotten. Returns 0 if there are none.
+uint32_t GcnService::getMemberExtent(const GIDKey & key)
+{
+	MemberExtentIt iter = mMemberExtentTable.find(key);
+	if (iter == mMemberExtentTable.end())
+	{
+		return(0);
+	}
+	
+	double currTime = getTimeSec();
+	uint32_t extent = 0;
+	for (auto nodeIt = iter->second.begin(); nodeIt != iter->second.end(); )
+	{
+		if ( (currTime - nodeIt->second.lastHeard) > mRemotePullExpireTime )
+		{
+			nodeIt = iter->second.erase(nodeIt);
+			continue;
+		}
+		extent = std::max(extent, nodeIt->second.distance);
+		++nodeIt;
+	}
+	
+	if (iter->second.empty())
 	{
-		nonGroupRcvAdv=1;
-		if (ttl)
-			mAdvSeenSet.insert(AdvKey(gid,gidsrc,seq));
+		mMemberExtentTable.erase(iter);
 	}
-	else
+	return(extent);
+}
+
+//************************************************************************
+// function to pick the source ttl for a group from how far away its
+// members are. Until we hear from a member, and on probes, the app's
+// ttl is used as well so members farther out can still find the group.
+uint32_t GcnService::getAutoTtl(AnnounceInfo & info, GroupId gid, uint32_t appTtl, bool probe)
+{
+	uint32_t extent = getMemberExtent(GIDKey(gid, mNodeId));
+	if (extent == 0)
 	{
-		mAdvSeenSet.insert(AdvKey(gid,gidsrc,seq));
+		return(appTtl);
 	}
 	
-	// First handle distance and packet count
-	updateDistanceTable(gid, gidsrc, hashValue, distance, msgOtaSrc, newToHash, true);
+	uint32_t ttl = std::min(extent + (uint32_t)mAutoTtlMargin, AUTOTTL_MAX_TTL);
+	if (ttl == 0)
+	{
+		ttl = 1;
+	}
+	if (ttl != info.autoTtl)
+	{
+		LOG(LOG_INFO, "Source ttl for GID %d is now %d (farthest member %d hops)", gid, ttl, extent);
+		info.autoTtl = ttl;
+	}
 	
-	if (newToHash)
+	if (probe)
 	{
-		// we have NOT seen it so add/update entry in Reverse Path map
-		recvCountAdv++;
-		
-		// get time stamp
-		TimeDuration currDur = getTime();
-		
-		// Add this to the reverse path map
-		// We use the first ADVERTISE received for a sequence # as the reverse path
-		ReservePathIt iter = mReversePathTable.find(GIDKey(gid, gidsrc));
-		if (iter != mReversePathTable.end())
-		{
-			// already have a reverse path entry in the table for this gid + gid src
-			// update entry if the sequence number is newer than what we have already
-			if (seq > iter->second.seqNum)
-			{
-				iter->second.srcNode = msgOtaSrc;
-				iter->second.seqNum = seq;
-				iter->second.timestamp = duration_cast<seconds>(currDur).count();
-				iter->second.probRelay = probRelay;
-			}
-		}
-		else
-		{
-			// add new entry
-			RevPathInfo  mInfo;
-			mInfo.srcNode = msgOtaSrc;
-			mInfo.seqNum = seq;
-			// convert timestamp to seconds
-			mInfo.timestamp = duration_cast<seconds>(currDur).count();
-			mInfo.probRelay = probRelay;
+		return(std::max(ttl, appTtl));
+	}
+	return(ttl);
+}
 
-			// add to reverse path table
-			mReversePathTable.insert(ReservePathPair(GIDKey(gid, gidsrc),mInfo));
-		}
+//************************************************************************
+// function to add a DATA to its group's catch-up cache. Only group nodes
+// and relays keep one and only DATA a subscriber can use as is
+// (not coded DATA or FEC repair DATA)
+void GcnService::addToCatchupCache(Data & dataMsg)
+{
+	GroupId gid = dataMsg.gid();
+	if ( dataMsg.has_coded() || (dataMsg.has_fec() && (dataMsg.fec().index() >= dataMsg.fec().k())) )
+	{
+		return;
 	}
+	if ( !(mLocalPullTable.count(gid) || mAnnounceTable.count(gid) || mRemotePullTable.count(gid)) )
+	{
+		return;
+	}
+	
+	CatchupCacheIt iter = mCatchupCacheTable.find(gid);
+	if (iter == mCatchupCacheTable.end())
+	{
+		shared_ptr<DataCache> pCache(new DataCache(mCatchupBytes, mCatchupItems, mCatchupWindow));
+		iter = mCatchupCacheTable.insert(make_pair(gid, pCache)).first;
+	}
+	
+	// the cache copies the record so the scratch string (and the memory
+	// it has grown to) is reused for the next DATA
+	dataMsg.SerializeToString(&mCatchupRecord);
+	iter->second->add(mCatchupRecord, getTimeSec());
+}
 
+//************************************************************************
+// function to give a new local subscriber the group's recent DATA.
+// If we have none cached we ask our neighbors for theirs.
+void GcnService::primeSubscriber(GroupId gid, shared_ptr<ClientSession> pSession)
+{
+	vector<string> records;
+	CatchupCacheIt iter = mCatchupCacheTable.find(gid);
+	if (iter != mCatchupCacheTable.end())
+	{
+		iter->second->get(records, getTimeSec());
+	}
 	
-	// Are we a group node?
-	if (groupNode)
+	if (!records.empty())
 	{
-		// We are a group node ... but have we seen this before?
-		if (newToHash)
+		for (auto & record : records)
 		{
-			// Handle forwarding of ADVERTISE
-			if (!(advertiseMsg.has_nottlregen()))
-			{
-				// Message does not have nottlregen field so we ARE regenerating TTL
-				// For this case: Reset ttl field to src ttl field value
-				//  (NOTE: ttl gets decremented before sending)
-				setAdvTimer(advertiseMsg, srcTtl);
-				fwdCount++;
-				LOG(LOG_DEBUG, "Group Node: Received ADVERTISE message we have not already seen. Forwarding OTA with regenerated TTL (ttl=%d)", srcTtl);
-			}
-			else if (ttl)
-			{
-				// Not regenerating TTL so just use the non-zero ttl value.
-				setAdvTimer(advertiseMsg, ttl);
-				fwdCount++;
-				LOG(LOG_DEBUG, "Group Node: Received ADVERTISE message we have not already seen. Forwarding OTA w/o regenerating TTL (ttl=%d)", ttl);
-			}
-			
-			// Send an Ack message back to the msg src (not GID source)
-			Ack ackMsg;
-			// set the group id, gid src and sequence # fields of the ack
-			ackMsg.set_gid(gid);
-			ackMsg.set_srcnode(gidsrc);
-			ackMsg.set_sequence(seq);
-			ackMsg.set_obligatoryrelay(msgOtaSrc);
-			
-			// Set timer for sending the ACK messge. 
-			setAckTimer(ackMsg);
-			
-			// If we are overriding advertisements then we use the receipt of an 
-			// advertisement for our group id as indication that we can start
-			// sending data. Normally the signal to start sending is based
-			// on receipt of an ACK to our advertise but we aren't sending them
-			// so we use this as the signal that the path is set up
-			// TO DO: use of advertise override is a temporary way of forcing
-			// nodes that are for the same group to have only one node set up
-			// the group tree and the other source re-use it.
-			AnnounceIt anncIt = mAnnounceTable.find(gid);
-			if ( (anncIt != mAnnounceTable.end())  && (anncIt->second.interval == 0 ) )
+			MessagePool<Data>::Handle pooled(mDataPool);
+			Data & dataMsg = *pooled;
+			if (dataMsg.ParseFromString(record))
 			{
-					// Only send PULL to app if we haven't sent one already
-					if (!(anncIt->second.pullSentToApp) )
-					{
-						Pull pullMsg;
-						pullMsg.set_gid(gid);
-						forwardToApp(pullMsg, anncIt->second.pSession);
-						// Set flag that we have sent pull to app
-						anncIt->second.pullSentToApp = true;
-					}
+				forwardToApp(dataMsg, pSession);
+				catchupLocalCount++;
 			}
 		}
+		LOG(LOG_DEBUG, "Gave new subscriber for GID %d %d cached DATA", gid, (int)records.size());
+		return;
 	}
-	else
+	
+	CatchupPendingInfo & pending = mCatchupPendingTable[gid];
+	pending.sessions.push_back(pSession);
+	pending.expire = getTimeSec() + CATCHUP_WAIT / 1000.0;
+	if (!pending.pTimer)
 	{
-		// we have no local apps that want this data 
-		// Handle for Max TTL and just process for forwarding
-		// if TTL is not 0
-		if (ttl)
+		pending.pTimer.reset(new deadline_timer(*pIoService, Milliseconds(CATCHUP_WAIT)));
+		pending.pTimer->async_wait(boost::bind(&GcnService::OnCatchupPendingTimeout, this, _1, gid));
+	}
+	
+	Catchup catchupMsg;
+	catchupMsg.set_gid(gid);
+	catchupMsg.set_requester(mNodeId);
+	catchupMsg.set_sequence(++mCatchupSeqNum);
+	forwardToOTA(catchupMsg);
+	catchupReqSentCount++;
+	LOG(LOG_DEBUG, "Nothing cached for GID %d. Asking neighbors to catch up new subscriber", gid);
+}
+
+//************************************************************************
+// function to handle DATA received while catch-up is going on.
+// New local subscribers get the DATA we had already seen (the others got
+// those long ago) and a neighbor answering the same Catchup we were
+// going to answer means our own answer is not needed.
+void GcnService::deliverCatchup(Data & dataMsg, HashValue hashValue, bool newToHash, bool catchupAnswer, NodeId catchupFor)
+{
+	GroupId gid = dataMsg.gid();
+	
+	CatchupPendingIt pendIt = mCatchupPendingTable.find(gid);
+	if (pendIt != mCatchupPendingTable.end())
+	{
+		if (pendIt->second.sessions.empty())
 		{
-			if (newToHash)
-			{
-				// We have NOT seen this packet yet so just send back out the raw socket
-				// (NOTE: ttl gets decremented before sending)
-				setAdvTimer(advertiseMsg, ttl);
-				fwdCount++;
-				LOG(LOG_DEBUG, "Non-Group Node: Received Announce message we have not already seen. Forwarding OTA");
-			}
-			else
+			pendIt->second.pTimer->cancel();
+			mCatchupPendingTable.erase(pendIt);
+		}
+		else if ( pendIt->second.delivered.insert(hashValue).second && !newToHash && !(dataMsg.has_uheader()) &&
+		          !(dataMsg.has_coded()) && !(dataMsg.has_fec() && (dataMsg.fec().index() >= dataMsg.fec().k())) )
+		{
+			for (auto & pSession : pendIt->second.sessions)
 			{
-				// we have seen this message
-				uint32_t maxTTL = getMaxTTLfromHash(hashValue);
-				if (ttl > maxTTL)
-				{
-					// Save off this new (higher TTL) as the max TTL
-					changeMaxTTL(hashValue, ttl);
-					
-					// Construct message to send back out the raw socket
-					// (NOTE: ttl gets decremented before sending)
-					// Make sure we reset the distance before we send this out
-					DistanceIt distIter = mDistanceTable.find(GIDKey(gid, gidsrc));
-					LOG_ASSERT(distIter != mDistanceTable.end(), "Received message we have already seen but had no distance entry");
-					advertiseMsg.set_distance(distIter->second.distance);
-					
-					// NOTE: If we get here and we already have a timer for the previous lower ttl advertisement
-					// that previous timer will be canceled and previous adv will not be sent. Just this new one will be sent!
-					setAdvTimer(advertiseMsg, ttl);
-					fwdCount++;
-					LOG(LOG_DEBUG, "Non-Group Node: Received Announce message we have already seen. This msg has higher TTL. Forwarding OTA");
-				}
-				else
-				{
-					dropCount++;
-					LOG(LOG_DEBUG, "Non-Group Node: Received Announce message we have already seen with higher TTL. Ignoring");
-				}
+				forwardToApp(dataMsg, pSession);
+				catchupRcvdCount++;
 			}
 		}
-		else
+	}
+	
+	if (catchupAnswer)
+	{
+		CatchupTimerIt iter = mCatchupTimerTable.find(GIDKey(gid, catchupFor));
+		if (iter != mCatchupTimerTable.end())
 		{
-			dropCount++;
-			LOG(LOG_DEBUG, "Non-Group Node: Received Announce message with TTL 0. Ignoring");
+			iter->second->cancel();
+			mCatchupTimerTable.erase(iter);
+			catchupSuppressCount++;
 		}
 	}
-	if(mDataFile != NULL) //DATAITEM
+}
+
+//************************************************************************
+// function to forget the new local subscribers of a group once they
+// have waited CATCHUP_WAIT for DATA from a neighbor's cache. A subscriber
+// that came later gets the rest of its own wait.
+void GcnService::OnCatchupPendingTimeout(const error_code & ec, GroupId gid)
+{
+	if ( (ec == operation_aborted) || mStopped )
 	{
-		mRcvAdvDI++;
-		char buf[256];
-		uint64_t millis = duration_cast<milliseconds>(getTime()).count();
-		int buflen = sprintf(buf,"0,%.0f,ll.gcnRcvAdv,node%03d.gcnService,%.0f,\"{\"\"rcvfrom\"\":\"\"node%03d\"\",\"\"gid\"\":%d,\"\"seq\"\":%.0f,\"\"orgsrc\"\":\"\"node%03d\"\",\"\"srcttl\"\":%d,\"\"ttl\"\":%d,\"\"dist\"\":%d,\"\"newhash\"\":%d,\"\"grpnode\"\":%d}\"\n",
-			(double)mRcvAdvDI,mNodeId,(double)millis,msgOtaSrc,gid,(double)seq,gidsrc,srcTtl,ttl,distance,newToHash,groupNode);
-		fwrite(buf,sizeof(char),buflen,mDataFile);
-		fflush(mDataFile);
+		return;
+	}
+	
+	CatchupPendingIt pendIt = mCatchupPendingTable.find(gid);
+	if (pendIt == mCatchupPendingTable.end())
+	{
+		return;
+	}
+	
+	double remaining = pendIt->second.expire - getTimeSec();
+	if (remaining * 1000 >= 1)
+	{
+		pendIt->second.pTimer->expires_from_now(Milliseconds((int)(remaining * 1000)));
+		pendIt->second.pTimer->async_wait(boost::bind(&GcnService::OnCatchupPendingTimeout, this, _1, gid));
+		return;
+	}
+	mCatchupPendingTable.erase(pendIt);
+}
+
+//************************************************************************
+// function to process Catchup messages received from the network.
+// If we have DATA cached for the group we answer after a random delay
+// so the neighbors that also have it do not all answer at once.
+void GcnService::processNetworkCatchup(Catchup & catchupMsg, NodeId msgOtaSrc)
+{
+	catchupReqRcvCount++;
+	
+	CatchupCacheIt iter = mCatchupCacheTable.find(catchupMsg.gid());
+	if ( (iter == mCatchupCacheTable.end()) || (iter->second->size() == 0) )
+	{
+		return;
+	}
+	
+	GIDKey key(catchupMsg.gid(), catchupMsg.requester());
+	if (mCatchupTimerTable.count(key))
+	{
+		return;
 	}
+	
+	shared_ptr<deadline_timer> pTimer(new deadline_timer(*pIoService, Milliseconds(rand() % CATCHUP_MAX_DELAY)));
+	pTimer->async_wait(boost::bind(&GcnService::OnCatchupTimeout, this, _1, key));
+	mCatchupTimerTable.insert(make_pair(key, pTimer));
 }
 
+//************************************************************************
+void GcnService::OnCatchupTimeout(const error_code & ec, GIDKey key)
+{
+	if ( ec || mStopped )
+	{
+		return;
+	}
+	mCatchupTimerTable.erase(key);
+	
+	vector<string> records;
+	CatchupCacheIt iter = mCatchupCacheTable.find(key.gid);
+	if (iter != mCatchupCacheTable.end())
+	{
+		iter->second->get(records, getTimeSec());
+	}
+	
+	// Send them one hop only, like a retransmission, marked with who
+	// they are for so the other neighbors holding them stay quiet
+	for (auto & record : records)
+	{
+		MessagePool<Data>::Handle pooled(mDataPool);
+		Data & dataMsg = *pooled;
+		if (dataMsg.ParseFromString(record))
+		{
+			dataMsg.set_catchupfor(key.gidSrc);
+			forwardToOTA(dataMsg, 1);
+			catchupSentCount++;
+		}
+	}
+	LOG(LOG_DEBUG, "Sent %d cached DATA for GID %d to catch up Node %d", (int)records.size(), key.gid, key.gidSrc);
+}
 
+//************************************************************************
+// function to process GroupSummary messages received from the network.
+// We keep what the neighbor reaches until it stops beaconing
+void GcnService::processNetworkSummary(GroupSummary & summaryMsg, NodeId msgOtaSrc)
+{
+	summaryRcvCount++;
+	
+	SummaryInfo info;
+	for (int i = 0; (i < summaryMsg.level_size()) && (i < (int)SUMMARY_DEPTH); i++)
+	{
+		BloomFilter filter(SUMMARY_FILTER_BITS, SUMMARY_HASHES);
+		if (!filter.load(summaryMsg.level(i), summaryMsg.hashes()))
+		{
+			LOG(LOG_WARN, "Dropping GroupSummary from Node %d with bad filter size", summaryMsg.srcnode());
+			return;
+		}
+		info.levels.push_back(filter);
+	}
+	info.lastHeard = getTimeSec();
+	mSummaryTable[summaryMsg.srcnode()] = info;
+}
 
 //************************************************************************
-// function to process Pull messages received from the network
-void GcnService::processNetworkAck(Ack& ackMsg, NodeId msgOtaSrc)
+// function to see if anyone within hops of us may care about a group.
+// Returns true unless the summaries of all our neighbors rule it out
+bool GcnService::isGroupNearby(GroupId gid, uint32_t hops)
 {
-	RemotePullIt pullIt;
-	AnnounceIt anncIt;
-	ReservePathIt revIt;
+	// The summaries do not reach that far so we can not tell
+	if ( (hops == 0) || (hops > SUMMARY_DEPTH) )
+	{
+		return(true);
+	}
 	
-	recvCountAck++;
+	double currTime = getTimeSec();
+	double expireTime = SUMMARY_EXPIRE * mSummaryInterval;
+	for (NeighborIt nbrIt = mNeighborTable.begin(); nbrIt != mNeighborTable.end(); nbrIt++)
+	{
+		if ( (currTime - nbrIt->second.lastHeard) > mNeighborExpireTime )
+		{
+			continue;
+		}
+		
+		// A neighbor we have no current summary for could reach anything
+		SummaryIt sumIt = mSummaryTable.find(nbrIt->first);
+		if ( (sumIt == mSummaryTable.end()) || ((currTime - sumIt->second.lastHeard) > expireTime) )
+		{
+			return(true);
+		}
+		
+		// A node hops away from us is hops - 1 away from one of our neighbors
+		for (uint32_t i = 0; (i < hops) && (i < sumIt->second.levels.size()); i++)
+		{
+			if (sumIt->second.levels[i].contains(gid))
+			{
+				return(true);
+			}
+		}
+	}
+	return(false);
+}
+
+//************************************************************************
+// Function called by periodic event to send our GroupSummary beacon
+// and the periodic ADVERTISEs that are due.
+// Level 0 is the groups we subscribe to, level i is what our neighbors
+// reach in i - 1 hops. The groups we only source are left out: they
+// would come back to us in our neighbors' level 1 and make every group
+// we source look nearby. A source needs to know about subscribers anyway.
+void GcnService::OnSummaryTimeout(const error_code & ec)
+{
+	// Cancelled by Stop, or the timer went with us. Touch nothing
+	if ( (ec == operation_aborted) || mStopped )
+	{
+		return;
+	}
 	
-	TimeDuration currDur = getTime();
-	int currTime = duration_cast<seconds>(currDur).count();
+	double currTime = getTimeSec();
+	double expireTime = SUMMARY_EXPIRE * mSummaryInterval;
 	
-	// difference between msgOtaSrc and gidSrc is that msgOtaSrc is the node from
-	// which this Ack was received and gidSrc is the source node of the
-	// GID content
+	vector<BloomFilter> levels(SUMMARY_DEPTH, BloomFilter(SUMMARY_FILTER_BITS, SUMMARY_HASHES));
+	for (auto & pull : mLocalPullTable)
+	{
+		levels[0].insert(pull.first);
+	}
 	
-	// get fields from message
-	GroupId gid = ackMsg.gid();
-	uint32_t seq = ackMsg.sequence();
-	NodeId gidsrc = ackMsg.srcnode();
-	NodeId obligRelay = ackMsg.obligatoryrelay();
-	uint32_t probRelay = ackMsg.probabilityofrelay();
+	for (SummaryIt iter = mSummaryTable.begin(); iter != mSummaryTable.end(); )
+	{
+		// Forget neighbors that stopped beaconing
+		if ( (currTime - iter->second.lastHeard) > expireTime )
+		{
+			iter = mSummaryTable.erase(iter);
+			continue;
+		}
+		for (uint32_t i = 1; (i < SUMMARY_DEPTH) && (i <= iter->second.levels.size()); i++)
+		{
+			levels[i].merge(iter->second.levels[i - 1]);
+		}
+		iter++;
+	}
 	
-	// For the purposes of forwarding an ADVERTISE message, we are a group node
-	// if we have a subscriber OR are a producer of data for the group 
-	// (i.e., we are a group "participant"). Note however that if we are the source
-	// that it will NOT be newToHash and we will therefore ignore it
-	bool groupNode = ( (mLocalPullTable.count(gid) > 0) || (mAnnounceTable.count(gid) > 0) );
+	GroupSummary summaryMsg;
+	summaryMsg.set_srcnode(mNodeId);
+	summaryMsg.set_hashes(SUMMARY_HASHES);
+	for (auto & level : levels)
+	{
+		summaryMsg.add_level(level.bits());
+	}
+	forwardToOTA(summaryMsg);
+	summarySentCount++;
 	
-	// Mark flag for statistics if I am not a group node
-	if (!groupNode)
-		nonGroupRcvAck = 1;
+	// The groups we source have no timer of their own while summaries
+	// are on. Their ADVERTISEs go out with the beacon once due
+	for (AnnounceIt iter = mAnnounceTable.begin(); iter != mAnnounceTable.end(); ++iter)
+	{
+		if ( (iter->second.interval > 0) && (currTime >= iter->second.nextAdvertise) )
+		{
+			sendAdvertise(iter);
+			iter->second.nextAdvertise += iter->second.interval;
+			if (iter->second.nextAdvertise <= currTime)
+			{
+				iter->second.nextAdvertise = currTime + iter->second.interval;
+			}
+		}
+	}
 	
-	// init a flag as to whether or not we put an entry in the Remote Pull Table.
-	// We only do this if we actually send an ACK. It gets complicated below so
-	// it is easier to just use a flag and add the entry at the end if needed.
-	bool addRemotePull = false;
+	// reschedule the periodic event
+	mSummaryTimer.expires_at(mSummaryTimer.expires_at() + Milliseconds((long)(mSummaryInterval * 1000)));
+	mSummaryTimer.async_wait(boost::bind(&GcnService::OnSummaryTimeout, this, _1));
+}
+
+//************************************************************************
+// function to process messages received from client
+void GcnService::OnClientReceive(shared_ptr<ClientSession> pSession, char* buffer, int len)
+{
+	// Parse App message
+	MessagePool<AppMessage>::Handle pooled(mAppPool);
+	AppMessage & message = *pooled;
 	
-	// Set flag as to whether or not we have seen an advertisement
-	// for this ack. We need to know if we have an Advertisement if
-	// we are not obligatory relay so just figure that out here 
-	// and set flag
-	bool seenAdv = false;
-	auto advIt = mAdvSeenSet.find(AdvKey(gid,gidsrc,seq));
-	if (advIt != mAdvSeenSet.end())
+	if(message.ParseFromArray(buffer, len))
 	{
-		seenAdv = true;
+		processAppMessage(pSession, message);
 	}
-	
-	// Set flag as to whether or not we have already flipped a coin for this ACK.
-	// This is based on sequence number, i.e., we can flip a coin
-	// for each sequence number
-	bool coinFlipped = true;
-	auto coinIt = mCoinFlipTable.find(GIDKey(gid, gidsrc));
-	if ( (coinIt == mCoinFlipTable.end()) || (seq > coinIt->second) )
+	else
 	{
-		// either we have no entry for this gid,gidsrc and have never flipped
-		// a coin for the gid,gidsrc OR we have an entry but this is a
-		// new sequence number. For either case we act as though we have never
-		// flipped the coin
-		coinFlipped = false;
+		//LOG(LOG_DEBUG, "Unable to deserialize message");
 	}
+}
+
+//************************************************************************
+// function to handle an AppMessage from an app, whether it came on the
+// app's socket, its shared memory ring or from an app in this process
+void GcnService::processAppMessage(shared_ptr<ClientSession> pSession, AppMessage & message)
+{
+	clientRcvCount++;
+	AnnounceIt iter2;
+	shared_ptr<AnnounceIt> pIter;
 	
-	// Set flag as to whether or not we have already forwarded an ACK.
-	// This is based on sequence number, i.e., we can send an ACK
-	// for each sequence number
-	bool ackSent = true;
-	auto ackSentIt = mAckSentTable.find(GIDKey(gid, gidsrc));
-	if ( (ackSentIt == mAckSentTable.end()) || (seq > ackSentIt->second) )
+	// Check log level first because printing to string is expensive
+	// and a batch from the app can hold many DATA
+	if (mCurrentLogLevel >= LOG_DEBUG)
 	{
-		// either we have no entry for this gid,gidsrc and have never sent
-		// an ack for the gid,gidsrc OR we have an entry but this is a
-		// new sequence number. For either case we are eligible to send an ACK
-		ackSent = false;
+		string sMessage;
+		mPbPrinter.PrintToString(message, &sMessage);
+		LOG(LOG_DEBUG, "Received Message:\n%s", sMessage.c_str());
 	}
 	
-	// Handle ACK processing
-	// 1. First see if we are the GID source. 
-	// If so then find the app that announced this content and send the pull
-	// so it knows there is a subscriber and can now send the content.
-	// We can't just look to see if we have this GID in our Announce Table
-	// because there can be multiple sources for a GID. That means we could
-	// have an entry in the Announce Table for this GID but we are not the source
-	// node that this ack is intended for. So first, check the GID source in the ack.
-	// If we match then we are source
-	if (gidsrc == mNodeId)
+	// handle any pulls that are in the message
+	for ( auto & pull : *message.mutable_pull() )
 	{
-		anncIt = mAnnounceTable.find(gid);
-		if (anncIt != mAnnounceTable.end())
+		// Add this entry to our local pull map
+		mLocalPullTable.insert(LocalPullPair(pull.gid(), pSession));
+		LOG(LOG_DEBUG, "Added gid %d to local Pull table", pull.gid());
+		
+		// The subscriber wants us to ask for any DATA we miss
+		if (pull.reliable())
 		{
-			// Set flag so we add a remote pull entry
-			addRemotePull = true;
-			
-			// Only send PULL to app if we haven't sent one already
-			if (!(anncIt->second.pullSentToApp) )
+			mReliableGroups.insert(pull.gid());
+		}
+		
+		// The subscriber wants the group's DATA sent with this priority
+		if (pull.has_priority())
+		{
+			setGroupPriority(pull.gid(), pull.priority());
+		}
+		
+		// Give the subscriber the group's recent DATA
+		if (mCatchupItems)
+		{
+			primeSubscriber(pull.gid(), pSession);
+		}
+		
+		// PREVIOUSLY: we would check to see if we have a local
+		// source for the gid and if we do but have not sent
+		// a PULL to that source, then we would send one here
+		// because we now have a local subscriber to the group.
+		
+		// NOW: We do NOT send a PULL to the local client based
+		// on having a local subscriber. 
+		// For group tree (i.e., we are using Advertise/Ack) the
+		// source client does not send data until is knows there
+		// is a remote subscriber. That is, it must receive an
+		// Ack over the air. The local subscriber is NOT enough
+		// to start sending. This means we could have a local subscriber
+		// but the source will NOT send it any data until it knows of
+		// a remote subscriber.
+		if(mDataFile != NULL) //DATAITEM
+		{
+			mLocalPullDI++;
+			char buf[256];
+			uint64_t millis = duration_cast<milliseconds>(getTime()).count();
+			int buflen = sprintf(buf,"0,%.0f,ll.gcnLocalPull,node%03d.gcnService,%.0f,\"{\"\"gid\"\":%d}\"\n",
+				(double)mLocalPullDI,mNodeId,(double)millis,pull.gid());
+			fwrite(buf,sizeof(char),buflen,mDataFile);
+			fflush(mDataFile);
+		}
+	}
+
+	// handle any unpulls that are in the mesage
+	for ( auto & unpull : *message.mutable_unpull() )
+	{
+		// find and remove this entry from our local pull map
+		LocalPullRangeIt rangeIt = mLocalPullTable.equal_range(unpull.gid());
+		// loop over all entries that have this group id and find the entry
+		// for this socket
+		for (LocalPullIt iter = rangeIt.first; iter != rangeIt.second; ++iter)
+		{
+			if (iter->second == pSession)
 			{
-				Pull pullMsg;
-				pullMsg.set_gid(gid);
-				forwardToApp(pullMsg, anncIt->second.pSession);
-				// Set flag that we have sent pull to app
-				anncIt->second.pullSentToApp = true;
+				mLocalPullTable.erase(iter);
+				
+				// No one left here to ask for missing DATA for
+				if (mLocalPullTable.count(unpull.gid()) == 0)
+				{
+					mReliableGroups.erase(unpull.gid());
+				}
+				if(mDataFile != NULL) //DATAITEM
+				{
+					mLocalUnpullDI++;
+					char buf[256];
+					uint64_t millis = duration_cast<milliseconds>(getTime()).count();
+					int buflen = sprintf(buf,"0,%.0f,ll.gcnLocalUnpull,node%03d.gcnService,%.0f,\"{\"\"gid\"\":%d}\"\n",
+						(double)mLocalUnpullDI,mNodeId,(double)millis,unpull.gid());
+					fwrite(buf,sizeof(char),buflen,mDataFile);
+					fflush(mDataFile);
+				}
+				break;
 			}
 		}
 	}
-	// 2. See if we are the obligatory relay and forward ACK if we are
-	else if (obligRelay == mNodeId)
+
+	// handle any data pushes
+	for ( auto & data : *message.mutable_data() )
 	{
-		// Get reverse path
-		// Because we are obligatory relay we expect to have an entry!
-		revIt = mReversePathTable.find(GIDKey(gid, gidsrc));
-		LOG_ASSERT(revIt != mReversePathTable.end(), "Obligatory relay node received ACK but had no reverse path for GID %d GID src\n", gid, gidsrc);
+		// add the distance and src node fields
+		// IMPORTANT: The src node must be added BEFORE adding this
+		// to the hash so that when our neighbor send it OTA and we
+		// receive it, we get a hash match
+		data.set_distance(0);
+		data.set_srcnode(mNodeId);
+		GroupId gid = data.gid();
+		// Unicast DATA are numbered on their own so they leave no gaps in
+		// the multicast sequence subscribers look for missing DATA in
+		if (data.has_uheader())
+		{
+			data.set_sequence(++mUnicastSeqNumByGID[gid]);
+		}
+		else
+		{
+			data.set_sequence(++mSeqNumByGID[gid]);
+		}
 		
-		// We are a relay node since we were selected as obligatory relay. That means we have to send an ACK
-		// to tell the source node that there is a subscriber upstream from us. HOWEVER, if we are a group
-		// node then we already sent an ACK when we received the advertise message. We don't need to
-		// send another one. It is also possible that we already sent an ack for this seq # as a non-group node
-		// which can happen if we received an ack and were oblig relay or won the coin toss
-		if ( (!groupNode) && (!ackSent) )
+		// Only multicast DATA use the announce table. Look it up once
+		AnnounceIt anncIt = mAnnounceTable.end();
+		if ( !(data.has_uheader()) )
 		{
-			LOG(LOG_DEBUG, "Received ACK. We are obligatory relay for gid %d gid src %d seq %d. Forwarding ACK.", gid, gidsrc, seq);
-			// Forward ACK to our next hop on reverse path
-			ackMsg.set_obligatoryrelay(revIt->second.srcNode);
-			// Set timer for sending the ACK messge. 
-			setAckTimer(ackMsg);
-			
-			// We have just sent ack for this gid, gidsrc, seq # so we must add an entry to the map
-			if (ackSentIt == mAckSentTable.end())
-			{
-				mAckSentTable.insert(SequencePair(GIDKey(gid, gidsrc), seq));
-			}
-			else if (seq > ackSentIt->second)
+			anncIt = mAnnounceTable.find(gid);
+		}
+		
+		// Unicast DATA get their own sequence (before the hash) so the
+		// destination can tell us how many got through. Only the ones that
+		// will go OTA below are numbered, otherwise the destination would
+		// count the rest as lost
+		int corridorWidth = 0;
+		if ( mAdaptiveCorridor && data.has_uheader() )
+		{
+			DistanceIt destIt = mDistanceTable.find(GIDKey(data.gid(), data.uheader().unicastdest()));
+			if ( (destIt != mDistanceTable.end()) && (destIt->second.distance > 0) )
 			{
-				ackSentIt->second = seq;
+				corridorWidth = getCorridorWidth(data, data.uheader().resilience());
 			}
 		}
-		else if (groupNode)
-			LOG(LOG_DEBUG, "Received ACK. We are obligatory relay for gid %d gid src %d seq %d. Group node so NOT Forwarding ACK.", gid, gidsrc, seq);
-		else
-			LOG(LOG_DEBUG, "Received ACK. We are obligatory relay for gid %d gid src %d seq %d. Already sent ack. NOT Forwarding ACK.", gid, gidsrc, seq);
 		
-		// Set flag so we add a remote pull entry -- this is how we say "I am a relay node"
-		addRemotePull = true;
-	}
-	// 3. See if we should still forward this ACK based on coinflip
-	// We have to have actually seen an advertisement for this seq #,
-	// not have already done the coin flip in order to flip the coin
-	else if ( (seenAdv) && (!coinFlipped) && (probRelay) && coinFlip(probRelay))
-	{
-		// Yeah! We won the coin flip! We get to be a relay.
-		// first get entry in reverse path so we know who to send back to.
-		// If we don't have an entry, that is a problem! seenAdv is true so
-		// we had to have seen an Adv 
-		revIt = mReversePathTable.find(GIDKey(gid, gidsrc));
-		LOG_ASSERT(revIt != mReversePathTable.end(), "We are not obligatory relay node received ACK but had no reverse path for GID %d GID src\n", gid, gidsrc);
+		// DATA flooded with a source ttl only need to reach the group members
+		if ( (mAutoTtlMargin >= 0) && data.has_srcttl() && (anncIt != mAnnounceTable.end()) )
+		{
+			data.set_srcttl(getAutoTtl(anncIt->second, gid, data.srcttl(), (data.sequence() % AUTOTTL_PROBE_EVERY) == 0));
+		}
 		
-		// We are a relay node since we won the coin toss. just like above,
-		// no need to send ack if we are a group node
-		if (!groupNode && !ackSent)
+		// Groups using FEC get the FEC header added here (before the hash)
+		// and repair DATA are made when a block is complete
+		vector<Data> fecRepair;
+		if (anncIt != mAnnounceTable.end())
 		{
-			LOG(LOG_DEBUG, "Received ACK. We are not obligatory relay. Won coin toss for gid %d gid src %d seq %d. Forwarding ACK.", gid, gidsrc, seq);
-			// Forward ACK to our next hop on reverse path
-			ackMsg.set_obligatoryrelay(revIt->second.srcNode);
-			// Set timer for sending the ACK messge. 
-			setAckTimer(ackMsg);
-			
-			// We have just sent ack for this gid, gidsrc, seq # so we must add an entry to the map
-			if (ackSentIt == mAckSentTable.end())
+			anncIt->second.appDataCount++;
+			if (anncIt->second.rlncGenSize)
 			{
-				mAckSentTable.insert(SequencePair(GIDKey(gid, gidsrc), seq));
+				// Network coding replaces FEC if the app asked for both
+				rlncEncode(anncIt->second, data);
 			}
-			else if (seq > ackSentIt->second)
+			else if (anncIt->second.fecK)
 			{
-				ackSentIt->second = seq;
+				fecEncode(anncIt->second, data, fecRepair);
 			}
 		}
-		else if (groupNode)
-			LOG(LOG_DEBUG, "Received ACK. We are not obligatory relay. Won coin toss for gid %d gid src %d seq %d but we are Group node. NOT Forwarding ACK.", gid, gidsrc, seq);
-		else
-			LOG(LOG_DEBUG, "Received ACK. We are not obligatory relay but already sent ack for gid %d gid src %d seq %d. NOT Forwarding ACK.", gid, gidsrc, seq);
-
-		// Set flag so we add a remote pull entry -- this is how we say "I am a relay node"
-		addRemotePull = true;
 		
-		// We have just done a coin flip for this gid, gidsrc, seq # so we must add an entry to the map
-		if (coinIt == mCoinFlipTable.end())
+		// pre process the DATA message. This handles the hash, distance table and local delivery
+		HashValue tempHash;
+		preProcessData(data, tempHash, mNodeId, pSession);
+		
+		// Keep a copy so we can answer NACKs from our neighbors
+		if ( mRetxCacheSize && !(data.has_uheader()) )
 		{
-			mCoinFlipTable.insert(SequencePair(GIDKey(gid, gidsrc), seq));
+			addToRetxCache(data);
 		}
-		else if (seq > coinIt->second)
+		
+		// set flag for advertise override. Here we assume we are overriding
+		// then look for interval > 0 and reset it.
+		// Only do this if this is not unicast. Unicast may not have an entry
+		// in the announce table if the node is a GID destination that wants to
+		// send unicast responses to source. Also, advertiseOverride is not used
+		// for unicast so it doesn't even matter what the value is.
+		bool advertiseOverride = true;
+		if ( !(data.has_uheader()) )
 		{
-			coinIt->second = seq;
+			LOG_ASSERT(anncIt != mAnnounceTable.end(), "Could not find GID %d in announce table", data.gid());
+			if ( anncIt->second.interval > 0 )
+			{
+				advertiseOverride = false;
+			}
 		}
-	}
-	else
-	{
-		if (!seenAdv)
-			LOG(LOG_DEBUG, "Received ACK. We are not obligatory relay but have not seen advertise for gid %d gid src %d seq %d. NOT Forwarding ACK.", gid, gidsrc, seq);
-		else if (coinFlipped)
-			LOG(LOG_DEBUG, "Received ACK. We are not obligatory relay but already did coin toss for gid %d gid src %d seq %d. NOT Forwarding ACK.", probRelay, gid, gidsrc, seq);
-		else
+		
+		
+		// ***** TO DO *****
+		// 1. How do we know how to set the initial relay distance in the packet?
+		//    Currently using the distance to the source node (unicast dest) from the distance table
+		//    but in the future we will want to use some other value for robustness
+		//    such as distance to source + N
+		// 2. How do we know that this is a DATA for app with advertise/ack or not?
+		//    Currently using src ttl to detect this. ADVERTISE/ACK application
+		//    DATA message do not have src ttl
+		// ****************
+		if (data.has_uheader())
 		{
-			LOG(LOG_DEBUG, "Received ACK. We are not obligatory relay and lost coin toss with prob of %d for gid %d gid src %d seq %d. NOT Forwarding ACK.", probRelay, gid, gidsrc, seq);
-			
-			// We have just done a coin flip for this gid, gidsrc, seq # so we must add an entry to the map
-			if (coinIt == mCoinFlipTable.end())
+			DistanceIt iter3 = mDistanceTable.find(GIDKey(data.gid(), data.uheader().unicastdest()));
+			if (iter3 == mDistanceTable.end())
 			{
-				mCoinFlipTable.insert(SequencePair(GIDKey(gid, gidsrc), seq));
+				LOG(LOG_WARN,"Received unicast message but had no distance entry");
+				continue;
 			}
-			else if (seq > coinIt->second)
+
+			auto pHeader = data.mutable_uheader();
+			GCNMessage::UnicastResilience  resil = data.uheader().resilience();
+			
+			// ***** TO DO *****
+			// What are we going to actually do with resilience?
+			// For now just use distance - 1, distance or distance + 1
+			// Note that this could be done in one line:  pHeader->set_relaydistance(iter3->second.distance + resil)
+			// But keeping the switch statement for now in case we change how this is set.
+			// ****************
+			if (iter3->second.distance > 0)
 			{
-				coinIt->second = seq;
-			}
-		}
-	}
+				int tempRelayDist=0;
+				switch(resil)
+				{
+					case 0:
+						tempRelayDist = iter3->second.distance-1;
+						break;
+					case 1:
+						tempRelayDist = iter3->second.distance;
+						break;
+					case 2:
+						tempRelayDist = iter3->second.distance + 1;
+						break;
+					default:
+						tempRelayDist = iter3->second.distance - 1;
+						break;
+				}
+				if (mAdaptiveCorridor)
+				{
+					tempRelayDist = std::max(0, (int)iter3->second.distance + corridorWidth);
+				}
+				pHeader->set_relaydistance(tempRelayDist);
+				
+				// clear the resilience field so it is not sent OTA
+				pHeader->clear_resilience();
 
-	
-	// Finally, add entry to remote pull table if flag was set
-	if (addRemotePull)
-	{
-		// Add this entry to our Remote pull map if not already in the map
-		// get all the entries that have this gid and see if we find the node id
-		RemotePullRangeIt rangeIt = mRemotePullTable.equal_range(gid);
-		for (pullIt = rangeIt.first; pullIt != rangeIt.second; ++pullIt)
-		{
-			// Did the mapped value match the src?
-			if (pullIt->second.nodeId == msgOtaSrc)
+				LOG(LOG_DEBUG, "Forwarded Unicast Data message OTA for destination GID %d node %d distance %d Relay distance %d", data.gid(), data.uheader().unicastdest(), iter3->second.distance, tempRelayDist);
+				if (data.has_srcttl())
+					forwardToOTA(data,data.srcttl());
+				else
+					forwardToOTA(data, 1);
+			} else
 			{
-				// reset time stamp
-				pullIt->second.timestamp = currTime;
-				LOG(LOG_DEBUG, "Found gid %d msgOtaSrc %d in remote Pull table", gid, msgOtaSrc);
-				break;
+				LOG(LOG_DEBUG, "*Not* Forwarding Unicast Data message for destination GID %d node %d Relay distance %d", data.gid(), data.uheader().unicastdest(), iter3->second.distance);
 			}
 		}
-		// Did we find an entry?
-		if (pullIt == rangeIt.second)
+		else
 		{
-			// did not find an entry so add it
-			RemotePullInfo info;
-			info.nodeId = msgOtaSrc;
-			// set the timestamp 
-			info.timestamp = currTime;
+			sendSourceData(data, advertiseOverride);
 			
-			mRemotePullTable.insert(RemotePullPair(gid, info));
-			LOG(LOG_DEBUG, "Added gid %d msgOtaSrc %d to remote Pull table", gid, msgOtaSrc);
+			// Repair DATA go out the same way as the source DATA.
+			// Add them to the hash so we ignore them when a neighbor forwards them
+			for (auto & repair : fecRepair)
+			{
+				HashValue repairHash;
+				addToHash(repair, repairHash);
+				sendSourceData(repair, advertiseOverride);
+				fecRepairSentCount++;
+			}
 		}
+		sentCount++;
 	}
 	
-	if(mDataFile != NULL) //DATAITEM
+	// handle any offer of shared memory rings from the app.
+	// The answer goes on the socket and only what we send after it
+	// goes in the ring
+	for ( auto & shmAttach : *message.mutable_shmattach() )
 	{
-		mRcvAckDI++;
-		char buf[256];
-		uint64_t millis = duration_cast<milliseconds>(getTime()).count();
-		int buflen = sprintf(buf,"0,%.0f,ll.gcnRcvAck,node%03d.gcnService,%.0f,\"{\"\"rcvfrom\"\":\"\"node%03d\"\",\"\"gid\"\":%d,\"\"seq\"\":%.0f,\"\"orgsrc\"\":\"\"node%03d\"\",\"\"grpnode\"\":%d,\"\"obligrelay\"\":%d,\"\"probrelay\"\":%d,\"\"addremotepull\"\":%d,\"\"seenadv\"\":%d,\"\"coinflipped\"\":%d,\"\"acksent\"\":%d}\"\n",
-			(double)mRcvAckDI,mNodeId,(double)millis,msgOtaSrc,gid,(double)seq,gidsrc,groupNode,obligRelay,probRelay,addRemotePull,seenAdv,coinFlipped,ackSent);
-		fwrite(buf,sizeof(char),buflen,mDataFile);
-		fflush(mDataFile);
+		shared_ptr<ShmChannel> pShm(new ShmChannel);
+		bool accepted = pShm->open(shmAttach.name(), shmAttach.size());
+		LOG(LOG_INFO, "%s shared memory %s with %d byte rings", (accepted ? "Using" : "Unable to use"), shmAttach.name().c_str(), shmAttach.size());
+		
+		AppMessage reply;
+		auto pReply = reply.add_shmattach();
+		pReply->set_name(shmAttach.name());
+		pReply->set_size(shmAttach.size());
+		pReply->set_accepted(accepted);
+		forwardToApp(reply, pSession);
+		
+		if (accepted)
+		{
+			pSession->attachShm(pShm);
+		}
 	}
-}
-
-//************************************************************************
-// function to process messages received from client
-void GcnService::OnClientReceive(shared_ptr<ClientSession> pSession, char* buffer, int len)
-{
-	clientRcvCount++;
-	AnnounceIt iter2;
-	shared_ptr<AnnounceIt> pIter;
-	
-
-	// Parse App message
-	AppMessage message;
 	
-	if(message.ParseFromArray(buffer, len))
+	// handle any advertise messages
+	for ( auto & advertise : *message.mutable_advertise() )
 	{
-		string sMessage;
-		mPbPrinter.PrintToString(message, &sMessage);
-		LOG(LOG_DEBUG, "Received Message:\n%s", sMessage.c_str());
-		
-		// handle any pulls that are in the message
-		for ( auto & pull : *message.mutable_pull() )
+		// get fields from message
+		GroupId gid = advertise.gid();
+		uint32_t srcTtl = advertise.srcttl();
+		uint32_t advType = advertise.type();
+		int32_t interval = -1;
+		uint32_t probRelay = 0;
+		uint32_t fecK = 0;
+		uint32_t fecR = 0;
+		uint32_t rlncGenSize = 0;
+		// If the advertise has an interval then we need to get that plus the prob relay values
+		if (advertise.has_interval())
 		{
-			// Add this entry to our local pull map
-			mLocalPullTable.insert(LocalPullPair(pull.gid(), pSession));
-			LOG(LOG_DEBUG, "Added gid %d to local Pull table", pull.gid());
-			
-			// PREVIOUSLY: we would check to see if we have a local
-			// source for the gid and if we do but have not sent
-			// a PULL to that source, then we would send one here
-			// because we now have a local subscriber to the group.
-			
-			// NOW: We do NOT send a PULL to the local client based
-			// on having a local subscriber. 
-			// For group tree (i.e., we are using Advertise/Ack) the
-			// source client does not send data until is knows there
-			// is a remote subscriber. That is, it must receive an
-			// Ack over the air. The local subscriber is NOT enough
-			// to start sending. This means we could have a local subscriber
-			// but the source will NOT send it any data until it knows of
-			// a remote subscriber.
-			if(mDataFile != NULL) //DATAITEM
-			{
-				mLocalPullDI++;
-				char buf[256];
-				uint64_t millis = duration_cast<milliseconds>(getTime()).count();
-				int buflen = sprintf(buf,"0,%.0f,ll.gcnLocalPull,node%03d.gcnService,%.0f,\"{\"\"gid\"\":%d}\"\n",
-					(double)mLocalPullDI,mNodeId,(double)millis,pull.gid());
-				fwrite(buf,sizeof(char),buflen,mDataFile);
-				fflush(mDataFile);
-			}
-		}
-
-		// handle any unpulls that are in the mesage
-		for ( auto & unpull : *message.mutable_unpull() )
-		{
-			// find and remove this entry from our local pull map
-			LocalPullRangeIt rangeIt = mLocalPullTable.equal_range(unpull.gid());
-			// loop over all entries that have this group id and find the entry
-			// for this socket
-			for (LocalPullIt iter = rangeIt.first; iter != rangeIt.second; ++iter)
-			{
-				if (iter->second == pSession)
-				{
-					mLocalPullTable.erase(iter);
-					if(mDataFile != NULL) //DATAITEM
-					{
-						mLocalUnpullDI++;
-						char buf[256];
-						uint64_t millis = duration_cast<milliseconds>(getTime()).count();
-						int buflen = sprintf(buf,"0,%.0f,ll.gcnLocalUnpull,node%03d.gcnService,%.0f,\"{\"\"gid\"\":%d}\"\n",
-							(double)mLocalUnpullDI,mNodeId,(double)millis,unpull.gid());
-						fwrite(buf,sizeof(char),buflen,mDataFile);
-						fflush(mDataFile);
-					}
-					break;
-				}
-			}
+			interval = advertise.interval();
+			probRelay = advertise.probrelay();
 		}
-
-		// handle any data pushes
-		for ( auto & data : *message.mutable_data() )
+		// Does the app want FEC for this group?
+		if ( advertise.feck() && advertise.fecr() )
 		{
-			// add the distance and src node fields
-			// IMPORTANT: The src node must be added BEFORE adding this
-			// to the hash so that when our neighbor send it OTA and we
-			// receive it, we get a hash match
-			data.set_distance(0);
-			data.set_srcnode(mNodeId);
-			GroupId gid = data.gid();
-			if(mSeqNumByGID.find(gid) == mSeqNumByGID.end())
+			if (advertise.feck() + advertise.fecr() <= FEC_MAX_SYMBOLS)
 			{
-				mSeqNumByGID[gid] = 0;
-			}
-			mSeqNumByGID[gid]++;
-			data.set_sequence(mSeqNumByGID[gid]);
-			
-			// pre process the DATA message. This handles the hash, distance table and local delivery
-			HashValue tempHash;
-			preProcessData(data, tempHash, mNodeId, pSession);
-			
-			// set flag for advertise override. Here we assume we are overriding
-			// then look for interval > 0 and reset it.
-			// Only do this if this is not unicast. Unicast may not have an entry
-			// in the announce table if the node is a GID destination that wants to
-			// send unicast responses to source. Also, advertiseOverride is not used
-			// for unicast so it doesn't even matter what the value is.
-			bool advertiseOverride = true;
-			if ( !(data.has_uheader()) )
-			{
-				AnnounceIt anncIt = mAnnounceTable.find(data.gid());
-				LOG_ASSERT(anncIt != mAnnounceTable.end(), "Could not find GID %d in announce table", data.gid());
-				if ( anncIt->second.interval > 0 )
-				{
-					advertiseOverride = false;
-				}
+				fecK = advertise.feck();
+				fecR = advertise.fecr();
 			}
-			
-			
-			// ***** TO DO *****
-			// 1. How do we know how to set the initial relay distance in the packet?
-			//    Currently using the distance to the source node (unicast dest) from the distance table
-			//    but in the future we will want to use some other value for robustness
-			//    such as distance to source + N
-			// 2. How do we know that this is a DATA for app with advertise/ack or not?
-			//    Currently using src ttl to detect this. ADVERTISE/ACK application
-			//    DATA message do not have src ttl
-			// ****************
-			if (data.has_uheader())
+			else
 			{
-				DistanceIt iter3 = mDistanceTable.find(GIDKey(data.gid(), data.uheader().unicastdest()));
-				if (iter3 == mDistanceTable.end())
-				{
-					LOG(LOG_WARN,"Received unicast message but had no distance entry");
-					continue;
-				}
-
-				auto pHeader = data.mutable_uheader();
-				GCNMessage::UnicastResilience  resil = data.uheader().resilience();
-				
-				// ***** TO DO *****
-				// What are we going to actually do with resilience?
-				// For now just use distance - 1, distance or distance + 1
-				// Note that this could be done in one line:  pHeader->set_relaydistance(iter3->second.distance + resil)
-				// But keeping the switch statement for now in case we change how this is set.
-				// ****************
-				if (iter3->second.distance > 0)
-				{
-					int tempRelayDist=0;
-					switch(resil)
-					{
-						case 0:
-							tempRelayDist = iter3->second.distance-1;
-							break;
-						case 1:
-							tempRelayDist = iter3->second.distance;
-							break;
-						case 2:
-							tempRelayDist = iter3->second.distance + 1;
-							break;
-						default:
-							tempRelayDist = iter3->second.distance - 1;
-							break;
-					}
-					pHeader->set_relaydistance(tempRelayDist);
-					
-					// clear the resilience field so it is not sent OTA
-					pHeader->clear_resilience();
-
-					LOG(LOG_DEBUG, "Forwarded Unicast Data message OTA for destination GID %d node %d distance %d Relay distance %d", data.gid(), data.uheader().unicastdest(), iter3->second.distance, tempRelayDist);
-					if (data.has_srcttl())
-						forwardToOTA(data,data.srcttl());
-					else
-						forwardToOTA(data, 1);
-				} else
-				{
-					LOG(LOG_DEBUG, "*Not* Forwarding Unicast Data message for destination GID %d node %d Relay distance %d", data.gid(), data.uheader().unicastdest(), iter3->second.distance);
-				}
+				LOG(LOG_WARN, "Received ADVERTISE for group %d with FEC k %d r %d. k + r must not exceed %d. NOT using FEC", gid, advertise.feck(), advertise.fecr(), FEC_MAX_SYMBOLS);
 			}
-			else if (data.has_srcttl())
+		}
+		// Does the app want network coding for this group?
+		if (advertise.rlncgen())
+		{
+			if (advertise.rlncgen() <= RLNC_MAX_GENSIZE)
 			{
-				// we aren't using ADVERTISE/ACK so use the src ttl in push
-				forwardToOTA(data, data.srcttl());
+				rlncGenSize = advertise.rlncgen();
 			}
-			else if ( (mRemotePullTable.count(data.gid()) != 0) || advertiseOverride )
+			else
 			{
-				// We are using ADVERTISE/ACK and we have either:
-				// a) set up the path with ADVERTISE/ACK which we know because we
-				//    have a remote pull entry
-				// OR
-				// b) we are overriding ADVERTISE in which case we will never have an 
-				//    entry in remote pull table but the app will only send if we
-				//    heard another group node's advertisement
-				// In either case we want to forward out the ota link.
-				// We use TTL of 1 so when it is sent, the actual sent TTL will be 0
-				// (NOTE: ttl gets decremented before sending)
-				// PUSH is always sent with TTL = 0
-				// WHY do we check for an entry in remote pull table when we re using Advertise?
-				// Well, it is possible that we have a subscriber on this node.
-				// In that case, as soon as the GID is advertised, we send a PULL
-				// to the source client to tell it we have a subscriber (the local subscriber)
-				// We may not yet have any remote subscribers to we must have at least one
-				// before we start sending the data over the air.
-				// This allows a GID source to send the data to a subscriber that is local
-				// but still have to send out advertise and get an ack before sending OTA.
-				forwardToOTA(data, 1);
-			}
-			sentCount++;
+				LOG(LOG_WARN, "Received ADVERTISE for group %d with generation size %d. Must not exceed %d. NOT using network coding", gid, advertise.rlncgen(), RLNC_MAX_GENSIZE);
+			}
+		}
+		
+		// Does the app want a priority for the group's DATA?
+		int priority = OTA_PRIORITY_DEFAULT;
+		if (advertise.has_priority())
+		{
+			priority = setGroupPriority(gid, advertise.priority());
 		}
 		
-		// handle any advertise messages
-		for ( auto & advertise : *message.mutable_advertise() )
+		LOG(LOG_DEBUG, "Received ADVERTISE for group %d of type %d.", gid, advType);
+	
+		// get iter to any current entry we might have in announce map
+		iter2 = mAnnounceTable.find(gid);
+		
+		if (advType == DEREGISTER)
 		{
-			// get fields from message
-			GroupId gid = advertise.gid();
-			uint32_t srcTtl = advertise.srcttl();
-			uint32_t advType = advertise.type();
-			int32_t interval = -1;
-			uint32_t probRelay = 0;
-			// If the advertise has an interval then we need to get that plus the prob relay values
-			if (advertise.has_interval())
+			LOG_ASSERT(iter2 != mAnnounceTable.end(), "Received an DE-REGISTER ADVERTISE message for GID %d but had no entry in Announce Table", gid);
+		
+			if ( iter2->second.interval > 0 )
 			{
-				interval = advertise.interval();
-				probRelay = advertise.probrelay();
+				iter2->second.pTimer->cancel();
 			}
+			// the last DATA the app sent still get their repair DATA
+			fecFlush(iter2->second);
 			
-			LOG(LOG_DEBUG, "Received ADVERTISE for group %d of type %d.", gid, advType);
-		
-			// get iter to any current entry we might have in announce map
-			iter2 = mAnnounceTable.find(gid);
-			
-			if (advType == DEREGISTER)
+			// This app has stopped being a source for the GID so delete it from
+			// the Announce table
+			mAnnounceTable.erase(iter2);
+		}
+		else
+		{
+			if (iter2 == mAnnounceTable.end())
 			{
-				LOG_ASSERT(iter2 != mAnnounceTable.end(), "Received an DE-REGISTER ADVERTISE message for GID %d but had no entry in Announce Table", gid);
-			
-				if ( iter2->second.interval > 0 )
-				{
-					iter2->second.pTimer->cancel();
-				}
+				// this is a new group. Add this to our announce map
+				AnnounceInfo info;
+				info.pSession = pSession;
+				info.interval = interval;
+				info.probRelay = probRelay;
+				info.srcTtl = srcTtl;
+				info.seqNum = 0;
+				info.pullSentToApp = false;
+				info.noTtlRegen = false;
+				info.fecK = fecK;
+				info.fecR = fecR;
+				info.fecBlockId = 0;
+				info.fecLastTime = 0;
+				info.rlncGenSize = rlncGenSize;
+				info.rlncGenId = 0;
+				info.rlncCount = 0;
+				info.appDataCount = 0;
+				info.rateLimit = 0;
+				info.priority = priority;
+				info.autoTtl = 0;
+				info.nextAdvertise = 0;
 				
-				// This app has stopped being a source for the GID so delete it from
-				// the Announce table
-				mAnnounceTable.erase(iter2);
-			}
-			else
-			{
-				if (iter2 == mAnnounceTable.end())
+				// Set up the return value from insert (which is a pair with iter and a bool)
+				std::pair<AnnounceIt,bool> ret = mAnnounceTable.insert(AnnouncePair(gid, info));
+				LOG(LOG_DEBUG, "Added gid %d to local Announce table with interval %d", gid, interval);
+				
+				if (interval > 0)
 				{
-					// this is a new group. Add this to our announce map
-					AnnounceInfo info;
-					info.pSession = pSession;
-					info.interval = interval;
-					info.probRelay = probRelay;
-					info.srcTtl = srcTtl;
-					info.seqNum = 0;
-					info.pullSentToApp = false;
-					info.noTtlRegen = false;
+					LOG_ASSERT(interval < mRemotePullExpireTime, "Received ANNOUNCE for group %d but the interval (%d) is higher than the Remote Pull Expire Time (%lf)", gid, interval, mRemotePullExpireTime);
 					
-					// Set up the return value from insert (which is a pair with iter and a bool)
-					std::pair<AnnounceIt,bool> ret = mAnnounceTable.insert(AnnouncePair(gid, info));
-					LOG(LOG_DEBUG, "Added gid %d to local Announce table with interval %d", gid, interval);
+					// Is this app regenerating TTL or not?
+					if (advertise.has_nottlregen())
+					{
+						ret.first->second.noTtlRegen = true;
+						LOG(LOG_DEBUG, "gid %d is not regenerating TTL", gid);
+					}
 					
-					if (interval > 0)
+					// Start periodic event to send announcements. first one sent 10 sec from now.
+					// With group summaries on they go out with the summary beacon instead
+					if (mSummaryInterval > 0)
+					{
+						ret.first->second.nextAdvertise = getTimeSec() + 10.0;
+					}
+					else
 					{
-						LOG_ASSERT(interval < mRemotePullExpireTime, "Received ANNOUNCE for group %d but the interval (%d) is higher than the Remote Pull Expire Time (%lf)", gid, interval, mRemotePullExpireTime);
-						
-						// Is this app regenerating TTL or not?
-						if (advertise.has_nottlregen())
-						{
-							ret.first->second.noTtlRegen = true;
-							LOG(LOG_DEBUG, "gid %d is not regenerating TTL", gid);
-						}
-						
-						// Start periodic event to send announcements. first one sent 10 sec from now.
 						// (yes this next line looks weird with the first->second! But "ret->first" is
 						//  an AnnounceIt and we need to get to the mapped value which is "->second")
 						ret.first->second.pTimer.reset(new deadline_timer(*pIoService, Seconds(10.0)));
@@ -2309,167 +5427,356 @@ void GcnService::OnClientReceive(shared_ptr<ClientSession> pSession, char* buffe
 						pIter = make_shared<AnnounceIt> (ret.first);
 						// The handler takes an iterator to the entry in the announce table
 						ret.first->second.pTimer->async_wait(boost::bind(&GcnService::OnAnnounceTimeout, this, _1, pIter));
-						
-						// PREVIOUSLY: we would check to see if we have a local
-						// subscriber for the gid and if we do but have not sent
-						// a PULL to that source, then we would send one here
-						// because we have a local subscriber to the group.
-						
-						// NOW: We do NOT send a PULL to the local client based
-						// on having a local subscriber. 
-						// For group tree (i.e., we are using Advertise/Ack) the
-						// source client does not send data until is knows there
-						// is a remote subscriber. That is, it must receive an
-						// Ack over the air. The local subscriber is NOT enough
-						// to start sending. This means we could have a local subscriber
-						// but the source will NOT send it any data until it knows of
-						// a remote subscriber.
 					}
+					
+					// PREVIOUSLY: we would check to see if we have a local
+					// subscriber for the gid and if we do but have not sent
+					// a PULL to that source, then we would send one here
+					// because we have a local subscriber to the group.
+					
+					// NOW: We do NOT send a PULL to the local client based
+					// on having a local subscriber. 
+					// For group tree (i.e., we are using Advertise/Ack) the
+					// source client does not send data until is knows there
+					// is a remote subscriber. That is, it must receive an
+					// Ack over the air. The local subscriber is NOT enough
+					// to start sending. This means we could have a local subscriber
+					// but the source will NOT send it any data until it knows of
+					// a remote subscriber.
 				}
-				else
+			}
+			else
+			{
+				// We already have an entry for this group. This would then be an update to
+				// the announcement interval or src ttl or ttl regeneration or prob relay
+				if (iter2->second.interval != interval)
 				{
-					// We already have an entry for this group. This would then be an update to
-					// the announcement interval or src ttl or ttl regeneration or prob relay
-					if (iter2->second.interval != interval)
+					// If current interval is > 0 cancel the existing timer
+					// but only if we actually set the timer. If we are set
+					// to override advertisements then there is nothing to cancel
+					if ( iter2->second.pTimer )
 					{
-						// If current interval is > 0 cancel the existing timer
-						// but only if we actually set the timer. If we are set
-						// to override advertisements then there is nothing to cancel
-						if ( iter2->second.interval > 0 )
-						{
-							
-							iter2->second.pTimer->cancel();
-							iter2->second.pTimer.reset();
-						} 
 						
-						// If new interval is > 0 set the timer
-						if ( interval > 0 )
+						iter2->second.pTimer->cancel();
+						iter2->second.pTimer.reset();
+					} 
+					
+					// If new interval is > 0 set the timer
+					if ( interval > 0 )
+					{
+						// start periodic event to send announcements. first one sent 1.0 sec from now.
+						// The handler takes an iterator to the entry in the announce table
+						if (mSummaryInterval > 0)
+						{
+							iter2->second.nextAdvertise = getTimeSec() + 1.0;
+						}
+						else
 						{
-							// start periodic event to send announcements. first one sent 1.0 sec from now.
-							// The handler takes an iterator to the entry in the announce table
 							iter2->second.pTimer.reset(new deadline_timer(*pIoService, Seconds(1.0)));
 							pIter = make_shared<AnnounceIt> (iter2);
 							iter2->second.pTimer->async_wait(boost::bind(&GcnService::OnAnnounceTimeout, this, _1, pIter));
 						}
-						
-						iter2->second.interval = interval;
-						LOG(LOG_DEBUG, "Interval for gid %d changed to %lf", gid, iter2->second.interval);
-					}
-					
-					if (iter2->second.srcTtl != advertise.srcttl())
-					{
-						iter2->second.srcTtl = advertise.srcttl();
-						LOG(LOG_DEBUG, "Src TTL for gid %d changed to %d", gid, iter2->second.srcTtl);
-					}
-					
-					if (iter2->second.probRelay != advertise.probrelay())
-					{
-						iter2->second.probRelay = advertise.probrelay();
-						LOG(LOG_DEBUG, "Prob of Relay for gid %d changed to %d", gid, iter2->second.probRelay);
 					}
 					
-					// Is this app regenerating TTL or not?
-					if (advertise.has_nottlregen())
-					{
-						iter2->second.noTtlRegen = true;
-					}
-					else
-					{
-						iter2->second.noTtlRegen = false;
-					}
+					iter2->second.interval = interval;
+					LOG(LOG_DEBUG, "Interval for gid %d changed to %lf", gid, iter2->second.interval);
+				}
+				
+				if (iter2->second.srcTtl != advertise.srcttl())
+				{
+					iter2->second.srcTtl = advertise.srcttl();
+					LOG(LOG_DEBUG, "Src TTL for gid %d changed to %d", gid, iter2->second.srcTtl);
+				}
+				
+				if (iter2->second.probRelay != advertise.probrelay())
+				{
+					iter2->second.probRelay = advertise.probrelay();
+					LOG(LOG_DEBUG, "Prob of Relay for gid %d changed to %d", gid, iter2->second.probRelay);
+				}
+				
+				// Is this app regenerating TTL or not?
+				if (advertise.has_nottlregen())
+				{
+					iter2->second.noTtlRegen = true;
+				}
+				else
+				{
+					iter2->second.noTtlRegen = false;
+				}
+				
+				// A change to the FEC parameters starts a new block
+				if ( (iter2->second.fecK != fecK) || (iter2->second.fecR != fecR) )
+				{
+					iter2->second.fecK = fecK;
+					iter2->second.fecR = fecR;
+					iter2->second.fecSymbols.clear();
+					iter2->second.fecBlockId++;
+					LOG(LOG_DEBUG, "FEC for gid %d changed to k %d r %d", gid, fecK, fecR);
+				}
+				
+				// A change to the generation size starts a new generation
+				if (iter2->second.rlncGenSize != rlncGenSize)
+				{
+					iter2->second.rlncGenSize = rlncGenSize;
+					iter2->second.rlncCount = 0;
+					iter2->second.rlncGenId++;
+					LOG(LOG_DEBUG, "Network coding generation size for gid %d changed to %d", gid, rlncGenSize);
 				}
+				iter2->second.priority = priority;
 			}
 		}
 	}
-	else
-	{
-		//LOG(LOG_DEBUG, "Unable to deserialize message");
-	}
 }
 
 void ClientSession::read(function<void(shared_ptr<ClientSession>, char* buffer, int length)> & receiveHandler,
 			 function<void(shared_ptr<ClientSession>)> & closeHandler)
 {
-	// Create buffer
-	BufferPtr pBuffer(new Buffer);
-	
-	// First we read the size of the incoming message, then the message itself into the pBuffer
+	// Read whatever the app has sent and handle every whole message in it
 	auto self(shared_from_this());
-	async_read(mSocket, buffer(pBuffer->data(), mSizeOfSize),
-		[this, self, pBuffer, &receiveHandler, &closeHandler](error_code ec, size_t length)
+	mSocket.async_read_some(mReader.space(),
+		[this, self, &receiveHandler, &closeHandler](error_code ec, size_t length)
 		{
-			if (!ec)
+			// closed by the GCN (it may be stopping), nothing more to do
+			if (ec == operation_aborted)
+			{
+				return;
+			}
+			if (ec)
+			{
+				printf("ClientSession::read error: %s\n",ec.message().c_str());
+				closeHandler(self);
+				return;
+			}
+			mReader.commit(length);
+			mStats.reads = mReader.reads();
+			
+			char* pMessage;
+			uint32_t messageSize;
+			FrameStatus status;
+			while ( (status = mReader.next(pMessage, messageSize)) != FRAME_NONE )
 			{
-				// get the size 
-				/*
-				printf("Read message size\n");
-				for (unsigned int i = 0; i < length; i++)
+				// A zero length message is the app ringing the doorbell
+				// for what it put in the shared memory ring
+				if ( (status == FRAME_OK) && (messageSize == 0) && mShm )
 				{
-					printf("0x%x  ", (unsigned char)(pBuffer->data())[i]);
+					readShm(receiveHandler);
+					if (mShm->toGcn().broken())
+					{
+						printf("ClientSession::read bad message in the shared memory ring. Closing\n");
+						closeHandler(self);
+						return;
+					}
 				}
-				printf("\n");
-				*/
-				
-				uint32_t messageSize{};
-				memcpy(&messageSize, pBuffer->data(), length);
-				messageSize = ntohl(messageSize);
-				//printf ("message size is %d\n", messageSize);
-
-				// read the message
-				if ( (messageSize) && (messageSize <= MAX_BUFFER_SIZE - mSizeOfSize) )
+				else if ( (status == FRAME_OK) && messageSize )
 				{
-					auto self(shared_from_this());
-					async_read(mSocket, buffer(pBuffer->data() + mSizeOfSize, messageSize),
-						[this, self, pBuffer, &receiveHandler, &closeHandler](error_code ec, size_t length)
-						{
-							if (!ec)
-							{
-								/*
-								printf("Read message\n");
-								for (unsigned int i = 0; i < length; i++)
-								{
-									printf("0x%x  ", (unsigned char)(pBuffer->data())[i]);
-								}
-								printf("\n");
-								*/
-								
-								receiveHandler(self, pBuffer->data() + mSizeOfSize, length);
-								read(receiveHandler, closeHandler);
-							}
-							else
-							{
-								printf("ClientSession::read error: %s\n", ec.message().c_str());
-								closeHandler(self);
-							}
-						});
+					mStats.received++;
+					receiveHandler(self, pMessage, messageSize);
 				}
 				else
 				{
 					printf("ClientSession::read messageSize check failed. messageSize is %u\n", messageSize);
-					read(receiveHandler, closeHandler);
 				}
 			}
-			else
+			read(receiveHandler, closeHandler);
+		});
+}
+
+//************************************************************************
+// function to hand the app's messages in the shared memory ring to the
+// receive handler. They are parsed where they are and then released
+void ClientSession::readShm(function<void(shared_ptr<ClientSession>, char* buffer, int length)> & receiveHandler)
+{
+	auto self(shared_from_this());
+	ShmRing & ring = mShm->toGcn();
+	do
+	{
+		uint32_t length;
+		char* pMessage;
+		while ( (pMessage = ring.peek(length)) != NULL )
+		{
+			receiveHandler(self, pMessage, length);
+			ring.release();
+		}
+	} while (!ring.sleep());
+}
+
+//************************************************************************
+// function to tell the app there are messages for it in the ring
+void ClientSession::ringDoorbell()
+{
+	// the doorbell is a message of size 0
+	static BufferPtr pDoorbell = []()
+	{
+		BufferPtr pBuffer = newBuffer(sizeof(uint32_t));
+		memset(pBuffer->data(), 0, sizeof(uint32_t));
+		return(pBuffer);
+	}();
+	
+	enqueue(pDoorbell, mSizeOfSize, false);
+}
+
+//************************************************************************
+// function to hand a message to an app in this process. The handler runs
+// from the io_service, as a socket read would, so the app is free to call
+// back into the GCN
+void ClientSession::deliver(shared_ptr<AppMessage> pMsg)
+{
+	auto self(shared_from_this());
+	mStats.sent++;
+	mLocalIo->post([self, pMsg]()
+		{
+			if (self->mLocalHandler)
 			{
-				printf("ClientSession::read error: %s\n",ec.message().c_str());
-				closeHandler(self);
+				self->mLocalHandler(*pMsg);
 			}
 		});
 }
 
-void ClientSession::write(BufferPtr pBuffer, int length)
+//************************************************************************
+void ClientSession::write(BufferPtr pBuffer, int length, bool isData)
+{
+	// Once the app took our shared memory the message goes in the ring.
+	// If the app has fallen that far behind (or the message is too big for
+	// the ring) it goes on the socket instead, and so does everything after
+	// it. The app could otherwise find later messages in the ring before
+	// it has read this one off the socket
+	if (mShmWrite)
+	{
+		bool doorbell = false;
+		if (mShm->fromGcn().write(pBuffer->data() + mSizeOfSize, length - mSizeOfSize, doorbell))
+		{
+			if (doorbell)
+			{
+				ringDoorbell();
+			}
+			return;
+		}
+		mShmWrite = false;
+		printf("ClientSession::write shared memory ring to app on port %d is full. Using the socket\n", mPort);
+	}
+	enqueue(pBuffer, length, isData);
+}
+
+//************************************************************************
+// function to add a message to the write queue and start writing if
+// we are not already
+void ClientSession::enqueue(BufferPtr pBuffer, int length, bool isData)
+{
+	if ( isData && !admit(length) )
+	{
+		mStats.dropped++;
+		return;
+	}
+	
+	OutFrame frame;
+	frame.pBuffer = pBuffer;
+	frame.length = length;
+	frame.isData = isData;
+	mOutQueue.push_back(frame);
+	
+	mStats.depth = mOutQueue.size();
+	mStats.bytes += length;
+	mStats.maxDepth = std::max(mStats.maxDepth, mStats.depth);
+	mStats.maxBytes = std::max(mStats.maxBytes, mStats.bytes);
+	
+	if (!mInFlight)
+	{
+		writeQueued();
+	}
+}
+
+//************************************************************************
+// function to see if there is room for length more bytes of DATA.
+// Above the high water mark we either drop the oldest DATA that are not
+// being written until we are under the low water mark, or drop new DATA
+// until the queue has drained that far. Returns false if this DATA
+// has to be dropped
+bool ClientSession::admit(int length)
+{
+	if (mDropping)
+	{
+		if (mStats.bytes + length > mQueueConfig.lowWater)
+		{
+			return(false);
+		}
+		mDropping = false;
+	}
+	
+	if (mStats.bytes + length <= mQueueConfig.highWater)
+	{
+		return(true);
+	}
+	
+	if (mQueueConfig.dropPolicy == SESSION_DROP_NEWEST)
+	{
+		mDropping = true;
+		return(false);
+	}
+	
+	for (auto iter = mOutQueue.begin() + mInFlight; (iter != mOutQueue.end()) && (mStats.bytes + length > mQueueConfig.lowWater); )
+	{
+		if (iter->isData)
+		{
+			mStats.bytes -= iter->length;
+			mStats.dropped++;
+			iter = mOutQueue.erase(iter);
+		}
+		else
+		{
+			++iter;
+		}
+	}
+	mStats.depth = mOutQueue.size();
+	return(mStats.bytes + length <= mQueueConfig.highWater);
+}
+
+//************************************************************************
+// function to write everything queued (up to SESSION_MAX_GATHER
+// messages) with one gather write. The messages stay queued until the
+// write completes so their buffers stay valid
+void ClientSession::writeQueued()
 {
+	array<boost::asio::const_buffer, SESSION_MAX_GATHER> buffers;
+	size_t count = 0;
+	for (auto & frame : mOutQueue)
+	{
+		if (count == SESSION_MAX_GATHER)
+		{
+			break;
+		}
+		buffers[count++] = buffer(frame.pBuffer->data(), frame.length);
+	}
+	mInFlight = count;
+	mStats.writes++;
 	
+	// (the rest of buffers are empty and write nothing)
 	auto self(shared_from_this());
-	async_write(mSocket, buffer(pBuffer->data(), length),
-		    [this, self, pBuffer](error_code ec, size_t length)
+	async_write(mSocket, buffers,
+		    [this, self](error_code ec, size_t length)
 		    {
 			    if (ec)
 				    {
 					    fprintf(stderr, ">>>>> ClientSession Write error: %s\n", ec.message().c_str());
+					    // the app is gone so nothing queued will be written
+					    mOutQueue.clear();
+					    mInFlight = 0;
+					    mStats.depth = 0;
+					    mStats.bytes = 0;
+					    return;
+				    }
+			    
+			    for (size_t i = 0; i < mInFlight; i++)
+				    {
+					    mStats.bytes -= mOutQueue.front().length;
+					    mOutQueue.pop_front();
+				    }
+			    mStats.sent += mInFlight;
+			    mStats.depth = mOutQueue.size();
+			    mInFlight = 0;
+			    
+			    if (!mOutQueue.empty())
+				    {
+					    writeQueued();
 				    }
 		    });
 }
-
-
-
@@ -31,6 +31,12 @@
 
 
 #include "Common.h"
+#include "Fec.h"
+#include "NetworkCoding.h"
+#include "OTAScheduler.h"
+#include "DataCache.h"
+#include "BloomFilter.h"
+#include "ShmRing.h"
 #include <google/protobuf/text_format.h>
 #include "GCNMessage.pb.h"
 
@@ -49,9 +55,116 @@ static const double DEFAULT_PULLEXPIRE = 3600.0; // Set these very high for now
 static const double DEFAULT_PULLINTERVAL = 5000.0;
 static const double DEFAULT_REVPATHEXPIRE = 3600.0;  // Set these very high for now so that nothing expires
 static const double DEFAULT_REVPATHINTERVAL = 10000.0;
+static const uint32_t DEFAULT_REPAIRTTL = 1;
+static const double DEFAULT_REPAIRINTERVAL = 250.0;
+static const double DEFAULT_NEIGHBOREXPIRE = 3.0;
+
+// Local repair constants
+static const double REPAIR_HOLDDOWN = 1.0;         // min seconds between REPAIR messages for a flow
+static const double REPAIR_SILENCE_FACTOR = 3.0;   // flow is silent after this many expected packet intervals
+static const uint32_t MAX_REPAIR_ATTEMPTS = 3;     // REPAIR messages sent for a flow before waiting for DATA again
+
+// Reliable delivery (NACK) constants
+static const uint32_t DEFAULT_RETXCACHESIZE = 0;   // DATA cached per flow. 0 = no retransmission cache
+static const uint32_t DEFAULT_NACKTTL = 1;
+static const int NACK_MAX_DELAY = 20;              // max random wait in ms before sending a NACK
+static const int NACK_HOLDDOWN = 100;              // min ms between NACK messages for a flow
+static const uint32_t NACK_MAX_TRIES = 3;          // NACK messages sent for a sequence number before giving up on it
+static const size_t NACK_MAX_MISSING = 64;         // max missing sequence numbers tracked (and sent) per flow
+static const int RETX_MAX_DELAY = 10;              // max random wait in ms before answering a NACK
+
+// FEC constants
+static const size_t FEC_MAX_BLOCKS = 8;            // blocks per flow a subscriber keeps for decoding
+static const int FEC_FLUSH_TIME = 200;             // ms without DATA before the repair DATA of a partly filled block are sent
+
+// OTA transmit scheduler constants
+static const double DEFAULT_OTARATE = 0.0;         // pacing rate in kbit/s. 0 = no pacing (frames go out as fast as the device takes them)
+static const uint32_t DEFAULT_DRRQUANTUM = 1500;   // bytes each group with queued DATA may send per round
+static const double DEFAULT_DATADEADLINE = 500.0;  // ms a DATA frame may wait in the queue before it is dropped. 0 = no deadline
+static const uint32_t OTA_BUCKET_SIZE = 16384;     // token bucket depth in bytes
+static const size_t OTA_MAX_QUEUE = 1000;          // max frames queued for control and for each group
+
+// Rate control (source app flow control) constants
+static const double DEFAULT_FLOWCAPACITY = -1.0;     // nominal channel rate in kbit/s. < 0 = no rate feedback to source apps
+static const int RATECONTROL_INTERVAL = 500;         // ms between congestion checks
+static const size_t RATECONTROL_QUEUE_DEPTH = 100;   // OTA DATA frames queued before the channel is congested
+static const size_t RATECONTROL_BACKLOG = 32768;     // bytes waiting on a source app socket before it is congested
+static const double RATECONTROL_BUSY_RATIO = 0.7;    // fraction of the channel capacity in use before it is congested
+static const double RATECONTROL_DECREASE = 0.5;      // rate multiplier when congested
+static const double RATECONTROL_INCREASE = 1.25;     // rate multiplier when not congested
+static const double RATECONTROL_MIN_RATE = 1.0;      // never ask for fewer DATA per second than this
+
+// Network coding constants
+static const uint32_t RLNC_MAX_GENSIZE = 64;       // max source DATA per generation (each coded DATA carries one coefficient per source DATA)
+static const size_t RLNC_MAX_GENERATIONS = 4;      // generations per flow a node keeps for rank checks and recoding
+
+// Unicast DATA aggregation constants
+static const double DEFAULT_AGGREGATEHOLD = 0.0;   // ms a relay holds unicast DATA to send with others to the same destination. 0 = no aggregation
+static const int AGGREGATE_MAX_BYTES = 1400;       // max bytes of DATA held for one OTA message (fits an Ethernet frame)
+static const int AGGREGATE_ITEM_OVERHEAD = 4;      // bytes to encode a DATA inside the OTA message
+
+// Adaptive unicast corridor constants
+static const int UNICAST_FEEDBACK_INTERVAL = 1000; // ms between feedback messages from a unicast destination
+static const int CORRIDOR_MIN_WIDTH = -1;          // relay distance offset from the sender's distance to the destination
+static const int CORRIDOR_MAX_WIDTH = 3;
+static const double CORRIDOR_WIDEN_RATIO = 0.9;    // widen when less than this fraction of the unicast DATA got through
+static const double CORRIDOR_NARROW_RATIO = 0.99;  // narrow when at least this fraction got through
+static const int CORRIDOR_FEEDBACK_TIMEOUT = 3;    // feedback intervals without feedback before widening
+
+// Auto TTL constants
+static const int DEFAULT_AUTOTTLMARGIN = -1;       // hops added to the farthest group member for the source ttl. < 0 = use the app's ttl
+static const uint32_t AUTOTTL_MAX_TTL = 16;        // never advertise a larger ttl than this
+static const uint32_t AUTOTTL_PROBE_EVERY = 10;    // every Nth ADVERTISE or DATA goes at least as far as the app's ttl to find new members
+
+// Late joiner catch-up constants
+static const uint32_t DEFAULT_CATCHUPITEMS = 0;       // recent DATA cached per group for new subscribers. 0 = no cache
+static const double DEFAULT_CATCHUPWINDOW = 0.0;      // seconds a cached DATA stays useful. 0 = no time limit
+static const uint32_t DEFAULT_CATCHUPBYTES = 65536;   // arena size per group in bytes
+static const int CATCHUP_MAX_DELAY = 50;              // max random ms a neighbor waits before answering a Catchup
+static const int CATCHUP_WAIT = 1000;                 // ms a new subscriber is given DATA we have already seen
+
+// Group summary constants
+static const double DEFAULT_SUMMARYINTERVAL = 0.0;   // seconds between group summary beacons. 0 = no beacons
+static const uint32_t SUMMARY_FILTER_BITS = 2048;    // bits in each Bloom filter of a beacon
+static const uint32_t SUMMARY_HASHES = 3;            // bits set per group id
+static const uint32_t SUMMARY_DEPTH = 3;             // hops the groups in a beacon reach
+static const int SUMMARY_EXPIRE = 3;                 // beacon intervals a neighbor's summary stays valid
+
+// App session write queue constants
+static const unsigned int DEFAULT_APPPORT = 12345;   // port apps connect to
+static const uint32_t DEFAULT_SESSIONHIGHWATER = 1048576; // bytes queued to an app before its DATA are dropped
+static const uint32_t DEFAULT_SESSIONLOWWATER = 524288;   // bytes queued to an app once we stop dropping
+static const size_t SESSION_MAX_GATHER = 64;              // max messages given to one write to an app
 
 
 // structure to hold config attributes
+// How DATA are sent when there is more than one OTA device
+enum IfMode
+{
+	IF_MODE_ALL = 0,   // every DATA on every device
+	IF_MODE_SELECT,    // each DATA on the device(s) its downstream neighbors are heard on
+	IF_MODE_STRIPE,    // each DATA on one device, round robin over the devices that reach all downstream neighbors
+	IF_MODE_MAX
+};
+static const char __attribute__ ((used)) *IfModeStr[] = { "all", "select", "stripe" };
+
+// Which DATA are dropped when an app does not keep up with what we send it.
+// Control messages are never dropped
+enum SessionDropPolicy
+{
+	SESSION_DROP_OLDEST = 0,   // the oldest queued DATA, to make room for the new one
+	SESSION_DROP_NEWEST,       // the new DATA, until the queue drains to the low water mark
+	SESSION_DROP_MAX
+};
+static const char __attribute__ ((used)) *SessionDropPolicyStr[] = { "oldest", "newest" };
+
+struct SessionQueueConfig
+{
+	uint32_t			highWater;
+	uint32_t			lowWater;
+	SessionDropPolicy	dropPolicy;
+};
+
 struct GcnServiceConfig
 {
 	LogLevel logLevel;
@@ -67,8 +180,33 @@ struct GcnServiceConfig
 	bool alwaysRebroadcast;
 	uint32_t ackProbRelay;
 	string dataFile;
+	bool localRepair;
+	uint32_t repairTtl;
+	double repairInterval;
+	double neighborExpire;
+	uint32_t retxCacheSize;
+	uint32_t nackTtl;
+	double otaRate;
+	uint32_t drrQuantum;
+	double dataDeadline;
+	double flowCapacity;
+	IfMode ifMode;
+	bool l2Unicast;
+	double aggregateHold;
+	bool adaptiveCorridor;
+	int autoTtlMargin;
+	uint32_t catchupItems;
+	double catchupWindow;
+	uint32_t catchupBytes;
+	double summaryInterval;
+	SessionQueueConfig sessionQueue;
+	unsigned int appPort;      // 0 = no socket, only apps in the same process (GcnEngine)
+	bool hugePages;            // back the packet buffer pool with huge pages
 };
 
+// fills in every attribute with its default (node id 0, no devices)
+void initGcnServiceConfig(GcnServiceConfig & config);
+
 class ClientSession;
 
 // Typdefs for the LOCAL Pull maps; this relates gid to socket
@@ -154,17 +292,20 @@ typedef pair<GIDKey, AdvTimer> AdvTimerPair;
 
 // typedefs for Data Timer Map
 // Key: hash value
-// Mapped value: shared pointer to a deadline timer
+// Mapped value: the DATA to relay, its ttl and when it is due
 // When a node needs to forward a data msg, it waits for a small period
-// of time before doing so. The deadline timer is stored in the map. 
-// We keep the map of deadline timers so that once created, it
-// has a reference and this is not destroyed. When destroyed the timer is
-// cancelled so if we didn't keep the timer, it would get canceled immediately.
-// Also, cant just have a private because we could have more than one advertise
-// outstanding at any given time
-typedef shared_ptr<deadline_timer> DataTimer;
-typedef map<HashValue, DataTimer> DataTimerMap;
-typedef pair<HashValue, DataTimer> DataTimerPair;
+// of time before doing so. The DATA waiting are kept in the map until
+// they are due and one timer (mDataTimer) sends them.
+// Every relayed DATA adds an entry, so the message comes from mDataPool
+// and the map nodes are kept for reuse
+struct DataRelay
+{
+	Data*		pData;   // from mDataPool, given back once sent
+	uint32_t	ttl;
+	double		due;     // time (from getTimeSec) to send it
+};
+typedef map<HashValue, DataRelay, less<HashValue>, NodeAllocator<pair<const HashValue, DataRelay>>> DataTimerMap;
+typedef pair<HashValue, DataRelay> DataTimerPair;
 
 // typedefs for Distance Map
 // Key: group id and GID source node
@@ -187,6 +328,235 @@ typedef pair<GIDKey, DistanceInfo> DistancePair;
 typedef map<GIDKey, DistanceInfo>::iterator DistanceIt;
 
 
+// typedefs for Flow Monitor Map
+// Key: group id and GID source node
+// Mapped value: flow info
+// Group nodes track the sequence number and arrival time of the DATA they
+// receive from each GID source. A gap in the sequence numbers or a silence
+// much longer than the average inter-arrival time means that an upstream
+// relay has most likely been lost and the tree needs a local repair.
+struct FlowInfo
+{
+	uint64_t	lastSeq;
+	double		lastTime;
+	double		avgInterval;
+	double		lastRepairTime;
+	uint32_t	repairCount;
+};
+typedef map<GIDKey, FlowInfo> FlowMap;
+typedef pair<GIDKey, FlowInfo> FlowPair;
+typedef map<GIDKey, FlowInfo>::iterator FlowIt;
+
+// typedefs for Neighbor Map
+// Key: node id of the neighbor
+// Mapped value: neighbor info
+// Every OTA message we receive refreshes the entry for the node that sent it.
+// Used to detect that the next hop on a reverse path has gone away.
+// For each neighbor we also keep what we hear from it on each of our devices
+// and its link layer address there (learned from the frames it sends)
+struct NeighborDeviceInfo
+{
+	double		lastHeard;
+	uint32_t	rxCount;
+	bool		hwKnown;
+	double		hwChangeTime;   // last time the address changed. Not used for a while after
+	unsigned char	hwAddress[ETH_ALEN];
+};
+struct NeighborInfo
+{
+	double		lastHeard;
+	map<int, NeighborDeviceInfo>	devices;
+};
+typedef map<NodeId, NeighborInfo> NeighborMap;
+typedef pair<NodeId, NeighborInfo> NeighborPair;
+typedef map<NodeId, NeighborInfo>::iterator NeighborIt;
+
+
+// typedefs for Retransmission Cache Map
+// Key: group id and GID source node
+// Mapped value: ring of the most recent DATA messages
+// Sources and every node that receives DATA keep the last N messages of
+// each flow so that they can answer a NACK from a nearby subscriber.
+// The ring slot is sequence % N so a lookup is a single index. The slot
+// also holds the sequence number since it can be overwritten by a newer DATA.
+struct RetxEntry
+{
+	uint64_t	seq;
+	bool		valid;
+	string		data;   // serialized DATA message
+};
+typedef vector<RetxEntry> RetxRing;
+typedef map<GIDKey, RetxRing> RetxCacheMap;
+typedef pair<GIDKey, RetxRing> RetxCachePair;
+typedef map<GIDKey, RetxRing>::iterator RetxCacheIt;
+
+// typedefs for Nack Map
+// Key: group id and GID source node
+// Mapped value: nack info
+// Subscribers of reliable groups track the highest sequence number received
+// from each GID source and the sequence numbers still missing (mapped to the
+// number of NACKs sent for it). A NACK is sent after a small random wait
+// so that a NACK overheard from a neighbor for the same DATA can suppress ours.
+struct NackInfo
+{
+	uint64_t	lastSeq;
+	map<uint64_t, uint32_t>		missing;
+	shared_ptr<deadline_timer>	pTimer;
+	bool		timerSet;
+};
+typedef map<GIDKey, NackInfo> NackMap;
+typedef pair<GIDKey, NackInfo> NackPair;
+typedef map<GIDKey, NackInfo>::iterator NackIt;
+
+// typedefs for FEC Decode Map
+// Key: group id and GID source node
+// Mapped value: map of block id to block info
+// Subscribers keep the symbols received for the most recent FEC blocks of
+// each flow. Once K symbols of a block are in, any missing source DATA is
+// recovered and delivered to the app. Source DATA already delivered are
+// tracked so the original and the recovered copy are not both delivered.
+struct FecBlockInfo
+{
+	uint32_t					k;
+	uint32_t					r;
+	map<uint32_t, string>	symbols;
+	set<uint32_t>			delivered;
+	bool						decoded;
+};
+typedef map<uint32_t, FecBlockInfo> FecBlockMap;
+typedef map<GIDKey, FecBlockMap> FecDecodeMap;
+typedef pair<GIDKey, FecBlockMap> FecDecodePair;
+typedef map<GIDKey, FecBlockMap>::iterator FecDecodeIt;
+
+// typedefs for Group Priority Map
+// Key: group id
+// Mapped value: socket priority (SO_PRIORITY) used to send the group's DATA OTA
+// Set by local apps in their ADVERTISE or PULL and learned from the
+// ADVERTISE of remote sources so relays use the same priority
+typedef map<GroupId, int> GroupPriorityMap;
+typedef map<GroupId, int>::iterator GroupPriorityIt;
+
+// typedefs for Aggregate Map
+// Key: group id and unicast destination
+// Mapped value: unicast DATA held by this relay and the ttl each is sent with
+// Relays hold unicast DATA going to the same destination for a short time
+// and send them together in one OTA message, so the nodes near a
+// many-to-one destination carry fewer frames
+typedef vector<pair<Data, uint32_t> > AggregateItems;
+struct AggregateInfo
+{
+	AggregateItems		items;
+	int					bytes;
+	shared_ptr<deadline_timer>	pTimer;
+};
+typedef map<GIDKey, AggregateInfo> AggregateMap;
+typedef pair<GIDKey, AggregateInfo> AggregatePair;
+typedef map<GIDKey, AggregateInfo>::iterator AggregateIt;
+
+// typedefs for Corridor Map
+// Key: group id and unicast destination
+// Mapped value: relay corridor used for our unicast DATA to the destination
+// The width is added to our distance to the destination to get the relay
+// distance. It starts from the resilience the app asked for and then
+// follows the feedback from the destination.
+struct CorridorInfo
+{
+	int			width;
+	uint32_t	sentSeq;       // last unicast sequence sent
+	uint32_t	ackedSeq;      // sequence and count from the last feedback
+	uint32_t	ackedCount;
+	double		lastFeedback;
+	double		lastSent;
+};
+typedef map<GIDKey, CorridorInfo> CorridorMap;
+typedef pair<GIDKey, CorridorInfo> CorridorPair;
+typedef map<GIDKey, CorridorInfo>::iterator CorridorIt;
+
+// typedefs for Unicast Receive Map
+// Key: group id and the node sending us unicast DATA
+// Mapped value: what we received, reported back in UnicastFeedback
+struct UnicastRxInfo
+{
+	uint32_t	highestSeq;
+	uint32_t	count;
+	bool		changed;       // received something since the last feedback
+	double		lastRcvd;
+};
+typedef map<GIDKey, UnicastRxInfo> UnicastRxMap;
+typedef map<GIDKey, UnicastRxInfo>::iterator UnicastRxIt;
+
+// typedefs for Member Extent Map
+// Key: group id and GID source node
+// Mapped value: for each node that told us, the distance from the source
+// of the farthest group member through it. Learned from the ACKs of a
+// flow, and at the source also from the unicast DATA of its members.
+struct MemberDistInfo
+{
+	uint32_t	distance;
+	double		lastHeard;
+};
+typedef map<NodeId, MemberDistInfo> MemberDistMap;
+typedef map<GIDKey, MemberDistMap> MemberExtentMap;
+typedef map<GIDKey, MemberDistMap>::iterator MemberExtentIt;
+
+// typedefs for Catchup Cache Map
+// Key: group id
+// Mapped value: the group's most recent DATA (serialized) in a per group arena
+// Kept by group nodes and relays to prime subscribers that join late
+typedef map<GroupId, shared_ptr<DataCache> > CatchupCacheMap;
+typedef map<GroupId, shared_ptr<DataCache> >::iterator CatchupCacheIt;
+
+// typedefs for Catchup Pending Map
+// Key: group id
+// Mapped value: new local subscribers waiting on DATA from a neighbor's cache.
+// Until the wait is over they are also given DATA we had already seen.
+struct CatchupPendingInfo
+{
+	vector<shared_ptr<ClientSession> >	sessions;
+	double					expire;
+	set<HashValue>			delivered;
+	shared_ptr<deadline_timer>	pTimer;      // forgets the entry once the wait is over
+};
+typedef map<GroupId, CatchupPendingInfo> CatchupPendingMap;
+typedef map<GroupId, CatchupPendingInfo>::iterator CatchupPendingIt;
+
+// typedefs for Catchup Timer Map
+// Key: group id and the node that asked for catch-up
+// Mapped value: timer to send it our cached DATA
+typedef map<GIDKey, shared_ptr<deadline_timer> > CatchupTimerMap;
+typedef map<GIDKey, shared_ptr<deadline_timer> >::iterator CatchupTimerIt;
+
+// typedefs for Summary Map
+// Key: neighbor node id
+// Mapped value: the groups the neighbor reaches, from its last beacon.
+// levels[i] is the groups it reaches in i hops
+struct SummaryInfo
+{
+	vector<BloomFilter>	levels;
+	double				lastHeard;
+};
+typedef map<NodeId, SummaryInfo> SummaryMap;
+typedef map<NodeId, SummaryInfo>::iterator SummaryIt;
+
+// Combines the payloads of the unicast DATA held for a group into one
+// payload. Returns false if the DATA should be sent as they are.
+typedef function<bool(GroupId gid, const AggregateItems & items, string & payload)> DataReducer;
+
+// typedefs for Coded Generation Map
+// Key: group id and GID source node
+// Mapped value: map of generation id to generation info
+// Every node that receives coded DATA keeps the most recent generations of
+// each flow. Subscribers also track which source DATA have been delivered.
+struct RlncGenInfo
+{
+	RlncGeneration		gen;
+	set<uint32_t>		delivered;
+};
+typedef map<uint32_t, RlncGenInfo> RlncGenMap;
+typedef map<GIDKey, RlncGenMap> RlncMap;
+typedef pair<GIDKey, RlncGenMap> RlncPair;
+typedef map<GIDKey, RlncGenMap>::iterator RlncIt;
+
 // Typdefs for the Announc map; this relates gid to AnnounceInfo
 // This is a map because there can only be one provider of gid content
 // Key: group id
@@ -201,6 +571,21 @@ struct AnnounceInfo
 	uint32_t						seqNum;
 	bool								pullSentToApp;
 	bool								noTtlRegen;
+	uint32_t						fecK;          // FEC source DATA per block (0 = no FEC)
+	uint32_t						fecR;          // FEC repair DATA per block
+	uint32_t						fecBlockId;
+	vector<string>				fecSymbols;    // symbols of the block being filled
+	Data								fecHeader;     // gid, srcttl and nottlregen for the repair DATA of a flushed block
+	shared_ptr<deadline_timer>	pFecTimer;     // flushes a partly filled block
+	double							fecLastTime;   // when the last source DATA was added to the block
+	uint32_t						rlncGenSize;   // network coding generation size (0 = no coding)
+	uint32_t						rlncGenId;
+	uint32_t						rlncCount;     // source DATA sent in the current generation
+	uint32_t						appDataCount;  // DATA received from the app since the last rate control check
+	double							rateLimit;     // rate the app was last told to use (0 = no limit)
+	int								priority;      // socket priority for the group's DATA
+	uint32_t						autoTtl;       // source ttl last picked from the group extent (0 = none yet)
+	double							nextAdvertise; // when the next periodic ADVERTISE is due with group summaries on
 };
 typedef map<GroupId, AnnounceInfo>  AnnounceMap;
 typedef pair<GroupId, AnnounceInfo> AnnouncePair;
@@ -212,10 +597,11 @@ typedef map<GroupId, AnnounceInfo>::iterator  AnnounceIt;
 // mapped value is the max ttl which is used by non-Group nodes (i.e., nodes with no subscribers to the group)
 // This map is used to store the hash values so we can search to see if we have seen a packet or not
 // and also to get the maxTTL of packets we have seen.
-// using an unordered_map because it is more efficient for finds than a map
-typedef unordered_map<HashValue, uint32_t>  HashMap;
+// using an unordered_map because it is more efficient for finds than a map.
+// Every new packet adds an entry so the nodes are kept for reuse
+typedef unordered_map<HashValue, uint32_t, hash<HashValue>, equal_to<HashValue>, NodeAllocator<pair<const HashValue, uint32_t>>>  HashMap;
 typedef pair<HashValue, uint32_t> HashPair;
-typedef unordered_map<HashValue, uint32_t>::iterator  HashIt;
+typedef HashMap::iterator  HashIt;
 
 // Map 2:
 // key is the time at which the hash value was inserted into the HashMap
@@ -224,9 +610,9 @@ typedef unordered_map<HashValue, uint32_t>::iterator  HashIt;
 // after some period of time. This map is scanned for old records and then the mapped value
 // is used to access the hash value in the HashMap to delete it from there.
 // using a map so we can order by increasing time stamp
-typedef multimap<double, HashValue> HashTimeMap;
+typedef multimap<double, HashValue, less<double>, NodeAllocator<pair<const double, HashValue>>> HashTimeMap;
 typedef pair<double, HashValue> HashTimePair;
-typedef multimap<double, HashValue>::iterator HashTimeIt;
+typedef HashTimeMap::iterator HashTimeIt;
 
 // Key used for the set that holds advertisements
 // that the node has seen
@@ -261,24 +647,145 @@ class AdvKey {
 
 
 
+// Key used for the retransmission timer map. Identifies one DATA
+// message of a flow
+class DataKey {
+  public:
+	GroupId	gid;
+	NodeId	gidSrc;
+	uint64_t	seq;
+    
+	DataKey(GroupId k1, NodeId k2, uint64_t k3)
+		: gid(k1), gidSrc(k2), seq(k3) {}  
+
+	bool operator<(const DataKey &right) const 
+	{
+		if ( gid == right.gid ) 
+		{
+			if ( gidSrc == right.gidSrc ) 
+			{
+				return seq < right.seq;
+			}
+			else 
+			{
+				return gidSrc < right.gidSrc;
+			}
+		}
+		else 
+		{
+			return gid < right.gid;
+		}
+	}    
+};
+
+// typedefs for Retransmit Timer Map
+// Key: data key
+// Mapped value: shared pointer to a deadline timer
+// A node answering a NACK waits a small random period before sending the
+// cached DATA. If it hears the same DATA from another node first, the timer is
+// cancelled so that only the first (closest) cache answers.
+typedef shared_ptr<deadline_timer> RetxTimer;
+typedef map<DataKey, RetxTimer> RetxTimerMap;
+typedef pair<DataKey, RetxTimer> RetxTimerPair;
+
+
+// Write queue counters of an app session
+struct SessionStats
+{
+	size_t			depth;        // messages queued now
+	size_t			maxDepth;     // most messages ever queued
+	uint32_t		bytes;        // bytes queued now
+	uint32_t		maxBytes;     // most bytes ever queued
+	unsigned int	writes;       // writes to the socket
+	unsigned int	sent;         // messages written
+	unsigned int	dropped;      // DATA dropped because the app fell behind
+	unsigned int	reads;        // reads from the socket
+	unsigned int	received;     // messages read from the socket
+};
+
 class ClientSession
 : public std::enable_shared_from_this<ClientSession>
 {
  public:
- ClientSession(tcp::socket socket)
-	 : mSocket(std::move(socket)), mSizeOfSize(sizeof(uint32_t))
-		{}
+ ClientSession(tcp::socket socket, const SessionQueueConfig & queueConfig)
+	 : mSocket(std::move(socket)), mSizeOfSize(sizeof(uint32_t)), mShmWrite(false), mQueueConfig(queueConfig), mInFlight(0), mDropping(false), mLocalIo(NULL)
+		{
+			memset(&mStats, 0, sizeof(mStats));
+			error_code ec;
+			mPort = mSocket.remote_endpoint(ec).port();
+		}
+ 
+ // An app in the same process. Messages for it are handed to localHandler
+ // instead of being written to a socket
+ ClientSession(io_service & io, function<void(const AppMessage & message)> localHandler)
+	 : mSocket(io), mSizeOfSize(sizeof(uint32_t)), mShmWrite(false), mPort(0), mQueueConfig(), mInFlight(0), mDropping(false), 
+	   mLocalIo(&io), mLocalHandler(localHandler)
+		{
+			memset(&mStats, 0, sizeof(mStats));
+		}
 	
 	void read(function<void(shared_ptr<ClientSession>, char* buffer, int length)> & receiveHandler,
 		  function<void(shared_ptr<ClientSession>)> & closeHandler);
-	void write(BufferPtr pBuffer, int length);
+	
+	// Messages are queued and written in order. DATA (isData) may be
+	// dropped if the app is not reading them fast enough
+	void write(BufferPtr pBuffer, int length, bool isData = false);
+	
+	// Only for an app in the same process. The handler is called from the
+	// io_service, never from inside the GCN's own processing
+	bool isLocal() const { return mLocalIo != NULL; }
+	void deliver(shared_ptr<AppMessage> pMsg);
+	
+	// the app's port identifies the session in the logs
+	unsigned short port() const { return mPort; }
+	const SessionStats & getStats() const { return mStats; }
+	
+	// Use the shared memory rings the app offered from now on
+	void attachShm(shared_ptr<ShmChannel> pShm)
+	{
+		mShm = pShm;
+		mShmWrite = true;
+	}
+	size_t backlog()
+	{
+		// bytes the app has sent that we have not read yet
+		error_code ec;
+		return mSocket.available(ec) + (mShm ? mShm->toGcn().used() : 0);
+	}
 	void close()
 	{
 		mSocket.close();
+		mLocalHandler = nullptr;
 	}
  private:
+	struct OutFrame
+	{
+		BufferPtr	pBuffer;
+		int			length;
+		bool		isData;
+	};
+	
+	void readShm(function<void(shared_ptr<ClientSession>, char* buffer, int length)> & receiveHandler);
+	void ringDoorbell();
+	void enqueue(BufferPtr pBuffer, int length, bool isData);
+	bool admit(int length);
+	void writeQueued();
+	
 	tcp::socket mSocket;
 	size_t mSizeOfSize;
+	FrameReader mReader;
+	shared_ptr<ShmChannel> mShm;
+	bool mShmWrite;       // messages for the app go in the ring until one does not fit
+	unsigned short mPort;
+	
+	SessionQueueConfig mQueueConfig;
+	deque<OutFrame> mOutQueue;
+	size_t mInFlight;     // messages at the front of mOutQueue being written now
+	bool mDropping;       // dropping new DATA until under the low water mark
+	SessionStats mStats;
+	
+	io_service* mLocalIo;
+	function<void(const AppMessage & message)> mLocalHandler;
 };
 
 
@@ -291,10 +798,11 @@ class GcnService
 		void Stop();
 		void Run();
 
-		void hashCleanup();
-		void reversePathCleanup();
-		void remotePullCleanup();
+		void hashCleanup(const error_code & ec);
+		void reversePathCleanup(const error_code & ec);
+		void remotePullCleanup(const error_code & ec);
 		void OnAnnounceTimeout(const error_code & ec, shared_ptr<void> arg);
+		void sendAdvertise(AnnounceIt iter);
 		
 		void acceptClientConnections();
 		
@@ -305,25 +813,42 @@ class GcnService
 		bool preProcessData(Data & dataMsg, HashValue & hashValue, NodeId msgOtaSrc, shared_ptr<ClientSession> pSession = nullptr);
 		
 		// message receive functions which must be implemented
-		void OnNetworkReceive(char* buffer, int len);
+		void OnNetworkReceive(char* buffer, int len, int device, const unsigned char* srcHwAddress);
 		void OnClientReceive(shared_ptr<ClientSession> pSession, char* buffer, int len);
+		void processAppMessage(shared_ptr<ClientSession> pSession, AppMessage & message);
+		
+		// apps in the same process
+		shared_ptr<ClientSession> attachLocalApp(function<void(const AppMessage & message)> handler);
 		
 		// message processing functions
 		void processNetworkData(Data & dataMsg, NodeId msgOtaSrc);
 		void processNetworkAdvertise(Advertise & advertiseMsg, NodeId msgOtaSrc);
 		void processNetworkAck(Ack& ackMsg, NodeId msgOtaSrc);
+		void processNetworkRepair(Repair & repairMsg, NodeId msgOtaSrc);
+		void processNetworkNack(Nack & nackMsg, NodeId msgOtaSrc);
+		void processNetworkFeedback(UnicastFeedback & feedbackMsg, NodeId msgOtaSrc);
+		void processNetworkCatchup(Catchup & catchupMsg, NodeId msgOtaSrc);
+		void processNetworkSummary(GroupSummary & summaryMsg, NodeId msgOtaSrc);
 		 
 		// message forwarding
 		void forwardToApp(Data & dataMsg,     shared_ptr<ClientSession> pSession);
 		void forwardToApp(Pull & pullMsg,     shared_ptr<ClientSession> pSession);
 		void forwardToApp(Unpull & unpullMsg, shared_ptr<ClientSession> pSession);
 		void forwardToApp(Advertise & advMsg, shared_ptr<ClientSession> pSession);
+		void forwardToApp(RateControl & rateMsg, shared_ptr<ClientSession> pSession);
 		void forwardToApp(AppMessage & Msg,   shared_ptr<ClientSession> pSession);
+		int forwardToSubscribers(Data & dataMsg, shared_ptr<ClientSession> pExclude = nullptr);
+		BufferPtr serializeForApp(const AppMessage & Msg, uint32_t & totalSize);
 		
 		void forwardToOTA(Data & dataMsg,     uint32_t ttl);
 		void forwardToOTA(Advertise & advMsg, uint32_t ttl);
 		void forwardToOTA(Ack & ackMsg);
-		void forwardToOTA(GroupId gid, OTAMessage & Msg);
+		void forwardToOTA(Repair & repairMsg, uint32_t ttl);
+		void forwardToOTA(Nack & nackMsg, uint32_t ttl);
+		void forwardToOTA(UnicastFeedback & feedbackMsg, uint32_t ttl);
+		void forwardToOTA(Catchup & catchupMsg);
+		void forwardToOTA(GroupSummary & summaryMsg);
+		void forwardToOTA(GroupId gid, OTAMessage & Msg, NodeId nextHop = 0);
 		
 		// Functions for ACK timers
 		void setAckTimer(Ack & ackMsg);
@@ -335,26 +860,102 @@ class GcnService
 		
 		// Functions for Data timers
 		void setDataTimer(Data & dataMsg, uint32_t ttl, HashValue hashVal);
-		void OnDataTimeout(const error_code & ec, Data & dataMsg, uint32_t ttl, HashValue hashVal);
+		void scheduleDataTimer(double due);
+		void OnDataTimeout(const error_code & ec);
 		
 		// Hash items
 		bool addToHash(Data & dataMsg, HashValue & hashValue);
 		bool addToHash(Advertise & advMsg, HashValue & hashValue);
-		bool addToHash(string data, HashValue & hashValue, uint32_t ttl);
+		bool addToHash(Repair & repairMsg, HashValue & hashValue);
+		bool addToHash(Nack & nackMsg, HashValue & hashValue);
+		bool addToHash(UnicastFeedback & feedbackMsg, HashValue & hashValue);
+		bool addToHash(const string & data, HashValue & hashValue, uint32_t ttl);
 		uint32_t getMaxTTLfromHash(HashValue hashValue);
 		void changeMaxTTL(HashValue hashValue, uint32_t ttl);
 		void updateDistanceTable(GroupId gid, NodeId gidsrc, HashValue hashValue, uint32_t distance, NodeId otaSrc, bool newToHash, bool AdvMsg);
 		
 		void closeClientConnection(shared_ptr<ClientSession> pSession);
 		
+		// Local tree repair
+		void updateFlowMonitor(Data & dataMsg);
+		void sendRepair(const GIDKey & key, const char* reason);
+		void OnRepairTimeout(const error_code & ec);
+		bool isNeighborAlive(NodeId nodeId, double expireTime);
+		void addToRemotePull(GroupId gid, NodeId nodeId);
+		
+		// Reliable delivery
+		void addToRetxCache(Data & dataMsg);
+		void updateNackState(Data & dataMsg);
+		void setNackTimer(NackIt iter, int delay);
+		void OnNackTimeout(const error_code & ec, GIDKey key);
+		void setRetxTimer(const DataKey & key, uint32_t ttl, const Nack & nackMsg);
+		void OnRetxTimeout(const error_code & ec, DataKey key, uint32_t ttl, NodeId requester, uint32_t nackSeq);
+		void relayRetransmission(Data & dataMsg);
+		
+		// Forward error correction
+		void sendSourceData(Data & dataMsg, bool advertiseOverride);
+		void fecEncode(AnnounceInfo & info, Data & dataMsg, vector<Data> & repairMsgs);
+		void fecEndBlock(AnnounceInfo & info, vector<Data> & repairMsgs);
+		void OnFecFlushTimeout(const error_code & ec, GroupId gid, uint32_t blockId);
+		void fecFlush(AnnounceInfo & info);
+		bool fecDecode(Data & dataMsg);
+		
+		// OTA device selection for a group's DATA
+		DeviceSet selectDevices(GroupId gid, OTAMessage & Msg);
+		
+		// Link layer unicast to a single next hop
+		bool getNextHopAddress(NodeId nodeId, int & device, unsigned char* hwAddress);
+		NodeId getUnicastNextHop(Data & dataMsg);
+		
+		// Unicast DATA aggregation at relays
+		void aggregateData(Data & dataMsg, uint32_t ttl);
+		void OnAggregateTimeout(const error_code & ec, GIDKey key, shared_ptr<deadline_timer> pTimer);
+		void flushAggregate(AggregateIt iter);
+		void setDataReducer(GroupId gid, DataReducer reducer);
+		void writeSentDataItem(Data & dataMsg);
+		
+		// Adaptive unicast corridor
+		int getCorridorWidth(Data & dataMsg, GCNMessage::UnicastResilience resil);
+		void updateUnicastRx(Data & dataMsg);
+		void OnFeedbackTimeout(const error_code & ec);
+		
+		// Source ttl from the group extent
+		void recordMemberDistance(const GIDKey & key, NodeId reporter, uint32_t distance);
+		uint32_t getMemberExtent(const GIDKey & key);
+		uint32_t getAutoTtl(AnnounceInfo & info, GroupId gid, uint32_t appTtl, bool probe);
+		
+		// Late joiner catch-up
+		void addToCatchupCache(Data & dataMsg);
+		void primeSubscriber(GroupId gid, shared_ptr<ClientSession> pSession);
+		void deliverCatchup(Data & dataMsg, HashValue hashValue, bool newToHash, bool catchupAnswer, NodeId catchupFor);
+		void OnCatchupTimeout(const error_code & ec, GIDKey key);
+		void OnCatchupPendingTimeout(const error_code & ec, GroupId gid);
+		
+		// Group summary beacons
+		void OnSummaryTimeout(const error_code & ec);
+		bool isGroupNearby(GroupId gid, uint32_t hops);
+		
+		// Socket priority for a group's DATA
+		int setGroupPriority(GroupId gid, uint32_t priority);
+		
+		// Network coding
+		void rlncEncode(AnnounceInfo & info, Data & dataMsg);
+		bool addToGeneration(Data & dataMsg, HashValue & hashValue, shared_ptr<ClientSession> pSession);
+		void recodeData(Data & dataMsg);
+		
 
 		//io_service mIoService;
 		io_service* pIoService;
 
+		unsigned int mAppPort;
+		bool mStopped;
 		tcp::acceptor mClientAcceptor;
 		tcp::socket mClientSocket;
+		SessionQueueConfig mSessionQueueConfig;
+		set<shared_ptr<ClientSession>> mClientSessions;  // every connected app
 		
 		OTASession mOTASession;
+		OTAScheduler mOTAScheduler;
 
 		vector<string> 	mDevices;
 		 
@@ -378,10 +979,39 @@ class GcnService
 		
 		set<AdvKey>		mAdvSeenSet;
 		
+		FlowMap			mFlowTable;
+		NeighborMap		mNeighborTable;
+		
+		RetxCacheMap	mRetxCacheTable;
+		RetxTimerMap	mRetxTimerTable;
+		NackMap			mNackTable;
+		set<GroupId>	mReliableGroups;
+		FecDecodeMap	mFecDecodeTable;
+		RlncMap			mRlncTable;
+		GroupPriorityMap	mGroupPriorityTable;
+		map<GroupId, uint32_t>	mStripeTable;    // next stripe for each group
+		AggregateMap		mAggregateTable;
+		map<GroupId, DataReducer>	mReducerTable;
+		CorridorMap			mCorridorTable;
+		UnicastRxMap		mUnicastRxTable;
+		MemberExtentMap	mMemberExtentTable;
+		CatchupCacheMap	mCatchupCacheTable;
+		string			mCatchupRecord;       // scratch for serializing a DATA into the cache
+		CatchupPendingMap	mCatchupPendingTable;
+		CatchupTimerMap	mCatchupTimerTable;
+		SummaryMap		mSummaryTable;
+		
 		// hash tables
 		hash<string>	make_hash;
 		HashMap			mHashTable;
 		HashTimeMap		mHashTimeTable;
+		string			mHashScratch;     // what is hashed is serialized here
+		
+		// Messages used again for every packet instead of being made
+		// (and their contents allocated) on the stack each time
+		MessagePool<OTAMessage>	mOTAPool;
+		MessagePool<AppMessage>	mAppPool;
+		MessagePool<Data>		mDataPool;
 		
 		
 		NodeId		mNodeId;
@@ -394,13 +1024,45 @@ class GcnService
 		double		mRemotePullCleanupInterval;
 		bool			mAlwaysRebroadcast;
 		double		mStatInterval;
+		bool			mLocalRepair;
+		uint32_t		mRepairTtl;
+		double		mRepairInterval;
+		double		mNeighborExpireTime;
+		uint32_t		mRepairSeqNum;
+		uint32_t		mRetxCacheSize;
+		uint32_t		mNackTtl;
+		uint32_t		mNackSeqNum;
+		double		mOtaRate;
+		double		mDataDeadline;
+		double		mFlowCapacity;
+		IfMode		mIfMode;
+		DeviceSet		mAllDevices;
+		bool			mL2Unicast;
+		double		mAggregateHold;
+		bool			mAdaptiveCorridor;
+		int			mAutoTtlMargin;
+		uint32_t		mCatchupItems;
+		double		mCatchupWindow;
+		uint32_t		mCatchupBytes;
+		uint32_t		mCatchupSeqNum;
+		double		mSummaryInterval;
+		double		mLastRateCheck;
+		unsigned int	mLastRateBytes;
 
 		deadline_timer mHashCleanupTimer;
 		deadline_timer mRemotePullCleanupTimer;
 		deadline_timer mReversePathCleanupTimer;
 		deadline_timer mStatTimer;
+		deadline_timer mRepairTimer;
+		deadline_timer mRateControlTimer;
+		deadline_timer mFeedbackTimer;
+		deadline_timer mSummaryTimer;
+		deadline_timer mDataTimer;
+		bool           mDataTimerSet;
+		shared_ptr<HandlerMemory> mDataTimerMemory;
 		
-		void OnStatTimeout();
+		void OnStatTimeout(const error_code & ec);
+		void OnRateControlTimeout(const error_code & ec);
 
 		int	clientCount;
 		
@@ -431,11 +1093,59 @@ class GcnService
 		uint64_t		mRcvAckDI;		// number of received message ack items made so far
 		uint64_t		mLocalPullDI;		// number of local pull items made so far
 		uint64_t		mLocalUnpullDI;		// number of local unpull items made so far
-		map<unsigned int,unsigned long>	mSeqNumByGID;
+		uint64_t		mSentRepairDI;		// number of sent message repair items made so far
+		uint64_t		mRcvRepairDI;		// number of received message repair items made so far
+		unsigned int		repairSentCount;		// number of REPAIR messages originated by this node
+		unsigned int		repairRcvCount;		// number of REPAIR messages received OTA
+		unsigned int		repairRelayCount;		// number of times this node became a relay because of a REPAIR
+		uint64_t		mSentNackDI;		// number of sent message nack items made so far
+		uint64_t		mRcvNackDI;		// number of received message nack items made so far
+		uint64_t		mSentFeedbackDI;		// number of sent message unicast feedback items made so far
+		unsigned int		nackSentCount;		// number of NACK messages originated by this node
+		unsigned int		nackRcvCount;		// number of NACK messages received OTA
+		unsigned int		nackSuppressCount;		// number of NACK messages delayed because a neighbor asked first
+		unsigned int		retxSentCount;		// number of cached DATA messages retransmitted
+		unsigned int		retxSuppressCount;		// number of retransmissions cancelled because another node answered first
+		unsigned int		retxRelayCount;		// number of retransmissions from other nodes passed on toward the requester
+		unsigned int		retxRecoveredCount;		// number of missing DATA messages recovered by this node
+		unsigned int		fecRepairSentCount;		// number of FEC repair DATA messages sent by this source
+		unsigned int		fecRecoveredCount;		// number of source DATA messages recovered by FEC decoding
+		unsigned int		fecDecodeFailCount;		// number of FEC blocks that could not be decoded
+		unsigned int		fecFlushCount;		// number of partly filled FEC blocks ended by the flush timer
+		unsigned int		rlncInnovativeCount;		// number of coded DATA messages that increased the rank of their generation
+		unsigned int		rlncDropCount;		// number of coded DATA messages dropped because they were not innovative
+		unsigned int		rlncDecodedCount;		// number of source DATA messages decoded and delivered
+		unsigned int		rlncRecodeCount;		// number of coded DATA messages recoded before forwarding
+		unsigned int		totalBytesRcvd;		// number of bytes received OTA
+		unsigned int		rateSlowdownCount;		// number of RateControl messages that lowered an app rate
+		unsigned int		rateRestoreCount;		// number of RateControl messages that raised or lifted an app rate
+		unsigned int		ifSelectCount;		// number of DATA messages sent on selected devices only
+		unsigned int		ifStripeCount;		// number of DATA messages striped on one device
+		unsigned int		ifAllCount;		// number of DATA messages sent on all devices because downstream neighbors were unknown
+		unsigned int		l2UnicastCount;		// number of messages sent as link layer unicast to their next hop
+		unsigned int		l2FallbackCount;		// number of messages broadcast because their next hop address was unknown or ambiguous
+		unsigned int		aggItemCount;		// number of unicast DATA held for aggregation
+		unsigned int		aggFrameCount;		// number of OTA messages the held unicast DATA were sent in
+		unsigned int		aggReduceCount;		// number of times a reducer combined held unicast DATA into one
+		unsigned int		feedbackSentCount;		// number of UnicastFeedback messages originated by this node
+		unsigned int		feedbackRcvCount;		// number of UnicastFeedback messages received for our unicast DATA
+		unsigned int		corridorWidenCount;		// number of times a unicast corridor was widened
+		unsigned int		corridorNarrowCount;		// number of times a unicast corridor was narrowed
+		unsigned int		catchupLocalCount;		// number of cached DATA given to new local subscribers
+		unsigned int		catchupReqSentCount;		// number of Catchup messages sent for new local subscribers
+		unsigned int		catchupReqRcvCount;		// number of Catchup messages received OTA
+		unsigned int		catchupSentCount;		// number of cached DATA sent to neighbors that asked
+		unsigned int		catchupSuppressCount;		// number of Catchup answers cancelled because a neighbor answered first
+		unsigned int		catchupRcvdCount;		// number of DATA already seen given to new local subscribers
+		unsigned int		summarySentCount;		// number of group summary beacons sent
+		unsigned int		summaryRcvCount;		// number of group summary beacons received OTA
+		unsigned int		summarySuppressCount;		// number of ADVERTISEs not sent because no neighbor summary had the group
+		map<unsigned int,unsigned long>	mSeqNumByGID;        // multicast DATA (what NACKs look for gaps in)
+		map<unsigned int,unsigned long>	mUnicastSeqNumByGID; // unicast DATA
 		
 		size_t mSizeOfSize;
 
-		function<void(char* buffer, int length)> mOTAReceiveHandler;
+		function<void(char* buffer, int length, int device, const unsigned char* srcHwAddress)> mOTAReceiveHandler;
 		function<void(shared_ptr<ClientSession>, char* buffer, int length)> mClientReceiveHandler;
 		function<void(shared_ptr<ClientSession>)> mClientCloseHandler;
 }; // end class
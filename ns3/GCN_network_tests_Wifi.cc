@@ -288,6 +288,7 @@ main (int argc, char *argv[])
 	// These values apply if using netpatterns
 	uint32_t srcttl = 3;
 	uint32_t robustMode = 0;
+	uint32_t localRepair = 0;
 	uint32_t probrelay = 0;
 	int32_t advtime = 20;  // -1 = no advertise; 0 = use advertise but override; >0 send ADVERTISE over the air
 	uint32_t regenttl = 1; // 1= regen TTL at group nodes 0 = don't regen. Use 0 if simulating classic flood.
@@ -325,6 +326,7 @@ main (int argc, char *argv[])
 	cmd.AddValue ("error", "Error rate if CONSTANT error model is used", errorRate);
 	cmd.AddValue ("srcttl", "Source TTL", srcttl);
 	cmd.AddValue ("robust", "Enable robust mode. Set to 1 to enable.", robustMode);
+	cmd.AddValue ("repair", "Enable local tree repair. Set to 1 to enable.", localRepair);
 	cmd.AddValue ("probrelay", "Probability of Relay to use for ACKs", probrelay);
 	cmd.AddValue ("advtime", "Interval for ADVERTISE messages", advtime);
 	cmd.AddValue ("regenttl", "Don't regenerate TTL at group nodes", regenttl);
@@ -353,7 +355,7 @@ main (int argc, char *argv[])
 	if (errorModel.compare("CONSTANT") ==0)
 	{
 		std::cout << "Running scenario for " << simtime << " seconds with " <<nNodes << " nodes\n     SrcTTL: " << srcttl << "\n     p_g: " << p_g << "\n     Tx Range: " << txRange << "\n     Error Model: CONSTANT\n     Error Rate: " << errorRate 
-	          << "\n     Robust Mode: " << (robustMode ? "Yes" : "No") << "\n     ADVERTISE Interval: " << advtime << "\n     Prob of Relay: " << probrelay << "\n     Regenerate TTL: " << (regenttl ? "Yes" : "No") 
+	          << "\n     Robust Mode: " << (robustMode ? "Yes" : "No") << "\n     Local Repair: " << (localRepair ? "Yes" : "No") << "\n     ADVERTISE Interval: " << advtime << "\n     Prob of Relay: " << probrelay << "\n     Regenerate TTL: " << (regenttl ? "Yes" : "No") 
 	          << "\n     Group Nodes are Senders: " << (allSenders ? "Yes" : "No")
 	          << "\n     Many To One: " << manyToOne 
 	          << "\n     Unicast Resilience: " << uniResil
@@ -363,7 +365,7 @@ main (int argc, char *argv[])
 	else
 	{
 		std::cout << "Running scenario for " << simtime << " seconds with " <<nNodes << " nodes\n     SrcTTL: " << srcttl << "\n     p_g: " << p_g << "\n     Tx Range: " << txRange << "\n     Error Model:  " << errorModel 
-	          << "\n     Robust Mode: " << (robustMode ? "Yes" : "No") << "\n     ADVERTISE Interval: " << advtime << "\n     Prob of Relay: " << probrelay << "\n     Regenerate TTL: " << (regenttl ? "Yes" : "No") 
+	          << "\n     Robust Mode: " << (robustMode ? "Yes" : "No") << "\n     Local Repair: " << (localRepair ? "Yes" : "No") << "\n     ADVERTISE Interval: " << advtime << "\n     Prob of Relay: " << probrelay << "\n     Regenerate TTL: " << (regenttl ? "Yes" : "No") 
 	          << "\n     Group Nodes are Senders: " << (allSenders ? "Yes" : "No")
 	          << "\n     Many To One: " << manyToOne 
 	          << "\n     Unicast Resilience: " << uniResil
@@ -829,6 +831,10 @@ main (int argc, char *argv[])
 				dce.AddArgument("-b");  // Turn ON robust mode so we always re-broadcast w/ack DATA
 												//  packets even if we have no downstream subscriber
 			}
+			if (localRepair)
+			{
+				dce.AddArgument("-R");  // Turn ON local tree repair at group nodes
+			}
 			apps = dce.Install (NpNodes.Get (id));
 			apps.Start (ns3::Seconds (1.0));
 			